@@ -11,11 +11,56 @@ Project#1:	CLP & DDL
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <search.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Map the MSVC CRT names used in this file to their POSIX equivalents.
+#define stricmp strcasecmp
+#define _stati64 stat
+#define _fstati64 fstat
+#define _fseeki64 fseeko
+#define _ftelli64 ftello
+#define _fileno fileno
+#endif
+
+// SSE2 is part of every x86-64 CPU, AVX2 is checked at run time. Other CPUs
+// use the scalar filter kernels.
+#if defined(__x86_64__) || defined(_M_X64)
+#define HAS_X86_FILTER_KERNELS
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#define MAX_NUM_CLIENTS 64
+#define CLIENT_READ_CHUNK_SIZE 4096
+#define CLIENT_SEND_TIMEOUT_SECONDS 10
+#define MAX_CLIENT_LINE_LEN (4 * 1024 * 1024)
+#define SCRIPT_READ_CHUNK_SIZE 65536
 
 /*
 Keep a global list of tpd - in real life, this will be stored
@@ -23,9 +68,75 @@ in shared memory.  Build a set of functions/methods around this.
 */
 tpd_list *g_tpd_list = NULL;
 
+/* Resident state, only used when g_resident_mode is set. */
+bool g_resident_mode = false;
+bool g_deferred_writes = false;
+file_signature g_tpd_list_signature;
+
+/* Table pages shared by all statements and tables. */
+int64_t g_buffer_pool_size = DEFAULT_BUFFER_POOL_SIZE;
+int64_t g_sort_memory_size = DEFAULT_SORT_MEMORY_SIZE;
+int64_t g_group_memory_size = DEFAULT_GROUP_MEMORY_SIZE;
+int g_num_worker_threads = 0;
+buffer_pool g_buffer_pool;
+table_file *g_table_files = NULL;
+int g_statement_number = 0;
+
+/* Log records of deferred changes, written after their pages. */
+log_entry *g_pending_log = NULL;
+log_entry **g_pending_log_tail = &g_pending_log;
+
 int main(int argc, char **argv) {
+  // "--buffer-pool-mb size", "--sort-memory-mb size" and
+  // "--group-memory-mb size" may come before the arguments of every mode.
+  while ((argc >= 3) && ((strcmp(argv[1], "--buffer-pool-mb") == 0) ||
+                         (strcmp(argv[1], "--sort-memory-mb") == 0) ||
+                         (strcmp(argv[1], "--group-memory-mb") == 0))) {
+    int size_mb = atoi(argv[2]);
+    if (size_mb <= 0) {
+      printf("Error - invalid memory size: %s\n", argv[2]);
+      return 1;
+    }
+    if (strcmp(argv[1], "--buffer-pool-mb") == 0) {
+      g_buffer_pool_size = (int64_t)size_mb * 1024 * 1024;
+    } else if (strcmp(argv[1], "--group-memory-mb") == 0) {
+      g_group_memory_size = (int64_t)size_mb * 1024 * 1024;
+    } else {
+      g_sort_memory_size = (int64_t)size_mb * 1024 * 1024;
+    }
+    argc -= 2;
+    argv += 2;
+  }
+
+  if ((argc == 2 || argc == 3) && strcmp(argv[1], "--serve") == 0) {
+    return run_server(argc == 3 ? argv[2] : kDbSocketFile);
+  }
+
+  // A script is read from stdin when it is redirected, or with "-f -".
+  if ((argc == 1) && !isatty(fileno(stdin))) {
+    return run_script(stdin);
+  }
+
+  if ((argc == 3) && strcmp(argv[1], "-f") == 0) {
+    if (strcmp(argv[2], "-") == 0) {
+      return run_script(stdin);
+    }
+    FILE *fhandle = fopen(argv[2], "r");
+    if (fhandle == NULL) {
+      printf("Error - cannot open script file: %s\n", argv[2]);
+      return FILE_OPEN_ERROR;
+    }
+    int rc = run_script(fhandle);
+    fclose(fhandle);
+    return rc;
+  }
+
   if ((argc != 2) || (strlen(argv[1]) == 0)) {
-    printf("Usage: db \"command statement\"");
+    printf("Usage: db \"command statement\"\n");
+    printf("       db -f script_file, or db -f - to read stdin\n");
+    printf("       db --serve [socket_file]\n");
+    printf("Options: --buffer-pool-mb size, --sort-memory-mb size, "
+           "--group-memory-mb size, before any of the above\n");
     return 1;
   }
 
@@ -33,6 +144,7 @@ int main(int argc, char **argv) {
 
   // Free g_tpd_list since all changes have been stored in files.
   free(g_tpd_list);
+  free_buffer_pool();
 
   return rc;
 }
@@ -45,7 +157,13 @@ int reload_global_tpd_list() {
 
 int execute_statement(char *statement, int verbose) {
   token_list *tok_list = NULL, *tok_ptr = NULL;
-  int rc = initialize_tpd_list(kDbFile, &g_tpd_list);
+  int rc = 0;
+  if (g_resident_mode) {
+    // Reuse the tpd list kept from previous statements if it is up to date.
+    rc = refresh_resident_tpd_list();
+  } else {
+    rc = initialize_tpd_list(kDbFile, &g_tpd_list);
+  }
 
   if (rc) {
     printf("\nError in initialize_tpd_list().\nrc = %d\n", rc);
@@ -69,17 +187,37 @@ int execute_statement(char *statement, int verbose) {
 
     int cmd_type = INVALID_STATEMENT;
     if (!rc) {
+      g_statement_number++;
       rc = do_semantic(tok_list, &cmd_type);
 
+      // Undo the changes of a failed statement, then write the changed
+      // pages unless they are deferred.
+      if (rc) {
+        rollback_table_files();
+      }
+      int io_rc = finish_table_io();
+      if (!rc) {
+        rc = io_rc;
+      }
+
       // Log command if it is executed successfully.
       if ((!rc) &&
           (cmd_type == CREATE_TABLE || cmd_type == DROP_TABLE ||
-           cmd_type == INSERT || cmd_type == DELETE || cmd_type == UPDATE)) {
+           cmd_type == INSERT || cmd_type == DELETE || cmd_type == UPDATE ||
+           cmd_type == LOAD_DATA)) {
         // Log '<timestamp> "original DDL/DML statement within double quotes"'
         append_log_with_timestamp(statement, current_timestamp());
       }
     }
 
+    // The in-memory tpd list is not kept in sync by DDL, RESTORE and
+    // ROLLFORWARD, so a resident copy must be re-read after them.
+    if (g_resident_mode &&
+        (cmd_type == CREATE_TABLE || cmd_type == DROP_TABLE ||
+         cmd_type == RESTORE_FROM_IMAGE || cmd_type == ROLLFORWARD)) {
+      invalidate_resident_tpd_list();
+    }
+
     if (rc && verbose) {
       tok_ptr = tok_list;
       while (tok_ptr) {
@@ -109,8 +247,14 @@ int get_token(char *command, token_list **tok_list) {
   bool done = false;
 
   start = cur = command;
+  // New tokens are added after the last one, so add_to_list() does not have
+  // to walk the whole list for each token of a long statement.
+  token_list **tok_tail = tok_list;
   while (!done) {
     bool found_keyword = false;
+    while (*tok_tail != NULL) {
+      tok_tail = &((*tok_tail)->next);
+    }
 
     /* This is the TOP Level for each token */
     memset((void *)temp_string, '\0', MAX_TOK_LEN);
@@ -133,7 +277,7 @@ int get_token(char *command, token_list **tok_list) {
         is not a blank, (, ), or a comma, then append this
         character to temp_string, and flag this as an error */
         temp_string[i++] = *cur++;
-        add_to_list(tok_list, temp_string, TOKEN_CLASS_ERROR, INVALID);
+        add_to_list(tok_tail, temp_string, TOKEN_CLASS_ERROR, INVALID);
         rc = INVALID;
         done = true;
       } else {
@@ -156,19 +300,19 @@ int get_token(char *command, token_list **tok_list) {
             t_class = TOKEN_CLASS_KEYWORD;
           }
 
-          add_to_list(tok_list, temp_string, t_class, KEYWORD_OFFSET + j);
+          add_to_list(tok_tail, temp_string, t_class, KEYWORD_OFFSET + j);
         } else {
           if (strlen(temp_string) <= MAX_IDENT_LEN) {
-            add_to_list(tok_list, temp_string, TOKEN_CLASS_IDENTIFIER, IDENT);
+            add_to_list(tok_tail, temp_string, TOKEN_CLASS_IDENTIFIER, IDENT);
           } else {
-            add_to_list(tok_list, temp_string, TOKEN_CLASS_ERROR, INVALID);
+            add_to_list(tok_tail, temp_string, TOKEN_CLASS_ERROR, INVALID);
             rc = INVALID;
             done = true;
           }
         }
 
         if (!*cur) {
-          add_to_list(tok_list, "", TOKEN_CLASS_TERMINATOR, EOC);
+          add_to_list(tok_tail, "", TOKEN_CLASS_TERMINATOR, EOC);
           done = true;
         }
       }
@@ -183,14 +327,14 @@ int get_token(char *command, token_list **tok_list) {
         is not a blank or a ), then append this
         character to temp_string, and flag this as an error */
         temp_string[i++] = *cur++;
-        add_to_list(tok_list, temp_string, TOKEN_CLASS_ERROR, INVALID);
+        add_to_list(tok_tail, temp_string, TOKEN_CLASS_ERROR, INVALID);
         rc = INVALID;
         done = true;
       } else {
-        add_to_list(tok_list, temp_string, TOKEN_CLASS_CONSTANT, INT_LITERAL);
+        add_to_list(tok_tail, temp_string, TOKEN_CLASS_CONSTANT, INT_LITERAL);
 
         if (!*cur) {
-          add_to_list(tok_list, "", TOKEN_CLASS_TERMINATOR, EOC);
+          add_to_list(tok_tail, "", TOKEN_CLASS_TERMINATOR, EOC);
           done = true;
         }
       }
@@ -225,10 +369,10 @@ int get_token(char *command, token_list **tok_list) {
 
       temp_string[i++] = *cur++;
 
-      add_to_list(tok_list, temp_string, TOKEN_CLASS_SYMBOL, t_value);
+      add_to_list(tok_tail, temp_string, TOKEN_CLASS_SYMBOL, t_value);
 
       if (!*cur) {
-        add_to_list(tok_list, "", TOKEN_CLASS_TERMINATOR, EOC);
+        add_to_list(tok_tail, "", TOKEN_CLASS_TERMINATOR, EOC);
         done = true;
       }
     } else if (*cur == '\'') {
@@ -242,27 +386,27 @@ int get_token(char *command, token_list **tok_list) {
 
       if (!*cur) {
         /* If we reach the end of line */
-        add_to_list(tok_list, temp_string, TOKEN_CLASS_ERROR, INVALID);
+        add_to_list(tok_tail, temp_string, TOKEN_CLASS_ERROR, INVALID);
         rc = INVALID;
         done = true;
       } else {
         /* must be a ' */
-        add_to_list(tok_list, temp_string, TOKEN_CLASS_CONSTANT,
+        add_to_list(tok_tail, temp_string, TOKEN_CLASS_CONSTANT,
                     STRING_LITERAL);
         cur++;
         if (!*cur) {
-          add_to_list(tok_list, "", TOKEN_CLASS_TERMINATOR, EOC);
+          add_to_list(tok_tail, "", TOKEN_CLASS_TERMINATOR, EOC);
           done = true;
         }
       }
     } else {
       if (!*cur) {
-        add_to_list(tok_list, "", TOKEN_CLASS_TERMINATOR, EOC);
+        add_to_list(tok_tail, "", TOKEN_CLASS_TERMINATOR, EOC);
         done = true;
       } else {
         /* not a ident, number, or valid symbol */
         temp_string[i++] = *cur++;
-        add_to_list(tok_list, temp_string, TOKEN_CLASS_ERROR, INVALID);
+        add_to_list(tok_tail, temp_string, TOKEN_CLASS_ERROR, INVALID);
         rc = INVALID;
         done = true;
       }
@@ -352,6 +496,15 @@ int do_semantic(token_list *tok_list, int *p_cmd_type) {
     printf("ROLLFORWARD statement\n");
     cur_cmd = ROLLFORWARD;
     cur = cur->next;
+  } else if (cur->tok_value == K_SYNC) {
+    printf("SYNC statement\n");
+    cur_cmd = SYNC_TABLES;
+    cur = cur->next;
+  } else if ((cur->tok_value == K_LOAD) &&
+             ((cur->next != NULL) && (cur->next->tok_value == K_DATA))) {
+    printf("LOAD DATA statement\n");
+    cur_cmd = LOAD_DATA;
+    cur = cur->next->next;
   } else {
     printf("Invalid statement\n");
     rc = cur_cmd;
@@ -362,7 +515,7 @@ int do_semantic(token_list *tok_list, int *p_cmd_type) {
   if (g_tpd_list->db_flags & ROLLFORWARD_PENDING) {
     if (cur_cmd == CREATE_TABLE || cur_cmd == DROP_TABLE || cur_cmd == INSERT ||
         cur_cmd == DELETE || cur_cmd == UPDATE || cur_cmd == BACKUP_TO_IMAGE ||
-        cur_cmd == RESTORE_FROM_IMAGE) {
+        cur_cmd == RESTORE_FROM_IMAGE || cur_cmd == LOAD_DATA) {
       *p_cmd_type = cur_cmd;
       rc = ROLLFORWARD_PENDING_ACCESS_VIOLATION;
       return rc;
@@ -376,6 +529,16 @@ int do_semantic(token_list *tok_list, int *p_cmd_type) {
     }
   }
 
+  // BACKUP, RESTORE and ROLLFORWARD work on the .tab files directly, so any
+  // deferred table changes must reach the files first.
+  if (cur_cmd == BACKUP_TO_IMAGE || cur_cmd == RESTORE_FROM_IMAGE ||
+      cur_cmd == ROLLFORWARD) {
+    if ((rc = flush_buffer_pool()) != 0) {
+      *p_cmd_type = cur_cmd;
+      return rc;
+    }
+  }
+
   if (cur_cmd != INVALID_STATEMENT) {
     switch (cur_cmd) {
       case CREATE_TABLE:
@@ -411,6 +574,12 @@ int do_semantic(token_list *tok_list, int *p_cmd_type) {
       case ROLLFORWARD:
         rc = sem_rollforward(cur);
         break;
+      case SYNC_TABLES:
+        rc = sem_sync(cur);
+        break;
+      case LOAD_DATA:
+        rc = sem_load_data(cur);
+        break;
       default:
         ; /* no action */
     }
@@ -420,6 +589,33 @@ int do_semantic(token_list *tok_list, int *p_cmd_type) {
   return rc;
 }
 
+int backup_table_file(tpd_entry *tab_entry, FILE *f_backup) {
+  // Opening the table also upgrades a file of an earlier version before it
+  // is copied. The pages have been flushed by do_semantic().
+  table_file *file = NULL;
+  int rc = open_table_file(tab_entry, &file);
+  if (rc) {
+    return rc;
+  }
+  table_file_header tab_header = file->header;
+
+  /* We use 32-bit integer to occupy 4 bytes as the length of a table file.
+  A table of 2GB or more is written as a length of -1 followed by the 64-bit
+  length. */
+  int32_t table_size = -1;
+  if (tab_header.file_size <= INT32_MAX) {
+    table_size = (int32_t)tab_header.file_size;
+  }
+  fwrite(&table_size, sizeof(table_size), 1, f_backup);
+  if (table_size == -1) {
+    fwrite(&tab_header.file_size, sizeof(tab_header.file_size), 1, f_backup);
+  }
+
+  // Copy the table content, bytes of an incomplete append are not included.
+  _fseeki64(file->fhandle, 0, SEEK_SET);
+  return copy_file_bytes(file->fhandle, f_backup, tab_header.file_size);
+}
+
 int sem_restore(token_list *t_list) {
   int rc = 0;
   token_list *cur = t_list;
@@ -652,6 +848,17 @@ int sem_rollforward(token_list *t_list) {
   return rc;
 }
 
+int sem_sync(token_list *t_list) {
+  int rc = 0;
+  token_list *cur = t_list;
+  if (cur->tok_value != EOC) {
+    rc = INVALID_STATEMENT;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+  return flush_buffer_pool();
+}
+
 int sem_create_table(token_list *t_list) {
   int rc = 0;
   token_list *cur;
@@ -824,11 +1031,27 @@ int sem_create_table(token_list *t_list) {
 
         } while ((rc == 0) && (!column_done));
 
+        // WITH FORMAT COLUMNAR stores the table column by column.
+        if (column_done && (cur->tok_value == K_WITH) &&
+            (cur->next->tok_value == K_FORMAT) &&
+            (cur->next->next->tok_value == K_COLUMNAR)) {
+          tab_entry.tpd_flags |= TPD_FLAG_COLUMNAR;
+          cur = cur->next->next->next;
+        }
+
         if ((column_done) && (cur->tok_value != EOC)) {
           rc = INVALID_TABLE_DEFINITION;
           cur->tok_value = INVALID;
         }
 
+        // A record must fit in a page of the table file.
+        table_file_header tab_header;
+        if (!rc && (init_table_file_header(
+                        &tab_header, get_record_size(col_entry, cur_id)) != 0)) {
+          rc = INVALID_TABLE_DEFINITION;
+          cur->tok_value = INVALID;
+        }
+
         if (!rc) {
           /* Now finished building tpd and add it to the tpd list */
           tab_entry.num_columns = cur_id;
@@ -850,7 +1073,7 @@ int sem_create_table(token_list *t_list) {
             // Create .tab file.
             if (!rc) {
               rc = create_tab_file(tab_entry.table_name, col_entry,
-                                   tab_entry.num_columns);
+                                   tab_entry.num_columns, tab_entry.tpd_flags);
               if (rc) {
                 cur->tok_value = INVALID;
               }
@@ -890,6 +1113,8 @@ int sem_drop_table(token_list *t_list) {
           // Also delete table_name.tab file.
           char table_filename[MAX_IDENT_LEN + 5];
           sprintf(table_filename, "%s.tab", cur->tok_string);
+          discard_table_pages(cur->tok_string);
+          remove_table_journal(cur->tok_string);
           if (remove(table_filename) != 0) {
             rc = FILE_REMOVE_ERROR;
             cur->tok_value = INVALID;
@@ -1071,7 +1296,7 @@ int initialize_tpd_list(const char *db_filename, tpd_list **pp_tpd_list) {
     }
   } else {
     /* There is a valid dbfile - get file size */
-    int file_size = get_file_size(fhandle);
+    int file_size = (int)get_file_size(fhandle);
     printf("%s size = %d\n", db_filename, file_size);
     p_tpd_list = (tpd_list *)calloc(1, file_size);
 
@@ -1251,18 +1476,101 @@ int sem_insert(token_list *t_list) {
   }
 
   cur = cur->next;
-  if ((cur->tok_value != K_VALUES) || (cur->next->tok_value != S_LEFT_PAREN)) {
+  if (cur->tok_value != K_VALUES) {
     rc = INVALID_STATEMENT;
     cur->tok_value = INVALID;
     return rc;
   }
+  cur = cur->next;
+
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  int record_size = get_record_size(cd_entries, tab_entry->num_columns);
+
+  // Every tuple is checked and encoded into one contiguous buffer first, so
+  // a bad tuple anywhere in the statement leaves the table untouched.
+  int num_tuples = 0;
+  int max_num_tuples = 16;
+  char *record_bytes = (char *)malloc(record_size * max_num_tuples);
+  if (record_bytes == NULL) {
+    return MEMORY_ERROR;
+  }
+
+  bool tuples_done = false;
+  while (!tuples_done) {
+    field_value field_values[MAX_NUM_COL];
+    int num_values = 0;
+    if ((rc = parse_insert_tuple(&cur, field_values, &num_values)) != 0) {
+      break;
+    }
+
+    // The order and number of columns must be same for field_values and
+    // cd_entries.
+    rc = check_insert_values(field_values, num_values, cd_entries,
+                             tab_entry->num_columns);
+    if (rc) {
+      cur->tok_value = INVALID;
+      break;
+    }
+
+    if (num_tuples == max_num_tuples) {
+      char *new_bytes =
+          (char *)realloc(record_bytes, record_size * max_num_tuples * 2);
+      if (new_bytes == NULL) {
+        rc = MEMORY_ERROR;
+        break;
+      }
+      record_bytes = new_bytes;
+      max_num_tuples *= 2;
+    }
+
+    // Compose the new record.
+    field_value *field_value_ptrs[MAX_NUM_COL];
+    for (int i = 0; i < num_values; i++) {
+      field_value_ptrs[i] = &field_values[i];
+    }
+    fill_raw_record_bytes(cd_entries, field_value_ptrs, num_values,
+                          record_bytes + record_size * num_tuples,
+                          record_size);
+    num_tuples++;
+
+    if (cur->tok_value == EOC) {
+      tuples_done = true;
+    } else if (cur->tok_value == S_COMMA) {
+      cur = cur->next;
+    } else {
+      rc = INVALID_STATEMENT;
+      cur->tok_value = INVALID;
+      break;
+    }
+  }
+
+  if (rc) {
+    free(record_bytes);
+    return rc;
+  }
 
-  cur = cur->next->next;
+  // Only the last page is read, the other records are not touched.
+  rc = append_table_records(tab_entry, record_bytes, num_tuples);
+  free(record_bytes);
+  return rc;
+}
+
+int parse_insert_tuple(token_list **p_cur, field_value field_values[],
+                       int *p_num_values) {
+  int rc = 0;
+  token_list *cur = *p_cur;
+
+  if (cur->tok_value != S_LEFT_PAREN) {
+    rc = INVALID_STATEMENT;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+  cur = cur->next;
 
   // Read all the value tokens and store them in a field_value array.
   bool values_done = false;
-  field_value field_values[MAX_NUM_COL];
-  memset(field_values, '\0', sizeof(field_values));
+  memset(field_values, '\0', sizeof(field_value) * MAX_NUM_COL);
   int num_values = 0;
   while (!values_done) {
     // Check if values count is greater than MAX_NUM_COL.
@@ -1306,74 +1614,327 @@ int sem_insert(token_list *t_list) {
     num_values++;
   }
 
-  if (values_done && (cur->tok_value != EOC)) {
+  if (rc) {
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  *p_cur = cur;
+  *p_num_values = num_values;
+  return rc;
+}
+
+int sem_load_data(token_list *t_list) {
+  int rc = 0;
+  token_list *cur = t_list;
+
+  if (cur->tok_value != STRING_LITERAL) {
     rc = INVALID_STATEMENT;
     cur->tok_value = INVALID;
     return rc;
   }
+  char *data_filename = cur->tok_string;
 
-  if (rc) {
+  cur = cur->next;
+  if (cur->tok_value != K_INTO) {
+    rc = INVALID_STATEMENT;
     cur->tok_value = INVALID;
     return rc;
   }
 
-  cd_entry *cd_entries = NULL;
-  get_cd_entries(tab_entry, &cd_entries);
-  // The order and number of columns must be same for field_values and
-  // cd_entries.
-  rc = check_insert_values(field_values, num_values, cd_entries,
-                           tab_entry->num_columns);
+  cur = cur->next;
+  if (!can_be_identifier(cur)) {
+    rc = INVALID_TABLE_NAME;
+    cur->tok_value = INVALID;
+    return rc;
+  }
 
-  if (rc) {
+  // Check whether the table name exists.
+  tpd_entry *tab_entry = get_tpd_from_list(cur->tok_string);
+  if (tab_entry == NULL) {
+    rc = TABLE_NOT_EXIST;
     cur->tok_value = INVALID;
     return rc;
   }
 
-  // It is the heap memory owner of the content of the whole table.
-  // Do not forget to free it later.
-  table_file_header *tab_header = NULL;
-  if ((rc = load_table_records(tab_entry, &tab_header)) != 0) {
+  cur = cur->next;
+  if (cur->tok_value != EOC) {
+    rc = INVALID_STATEMENT;
+    cur->tok_value = INVALID;
     return rc;
   }
 
-  if (tab_header->num_records >= MAX_NUM_ROW) {
-    rc = MAX_ROW_EXCEEDED;
-    free(tab_header);
+  FILE *f_data = NULL;
+  if ((f_data = fopen(data_filename, "rb")) == NULL) {
+    printf("Error - cannot open data file %s.\n", data_filename);
+    return FILE_OPEN_ERROR;
+  }
+
+  // A failed load is rolled back like any other statement, see
+  // rollback_table_files().
+  table_file *file = NULL;
+  if ((rc = open_table_file(tab_entry, &file)) != 0) {
+    fclose(f_data);
     return rc;
   }
 
-  // Compose the new record.
-  char *record_bytes = (char *)malloc(tab_header->record_size);
-  field_value *field_value_ptrs[MAX_NUM_COL];
-  for (int i = 0; i < num_values; i++) {
-    field_value_ptrs[i] = &field_values[i];
+  int64_t num_old_records = file->header.num_records;
+  int line_number = 0;
+  rc = load_data_file(f_data, tab_entry, &line_number);
+  fclose(f_data);
+
+  if ((rc == INVALID_VALUE) || (rc == INVALID_VALUES_COUNT) ||
+      (rc == DATA_TYPE_MISMATCH) || (rc == UNEXPECTED_NULL_VALUE)) {
+    printf("Error - invalid data at line %d of %s.\n", line_number,
+           data_filename);
+  } else if (!rc) {
+    printf("%lld rows loaded.\n",
+           (long long)(file->header.num_records - num_old_records));
   }
-  fill_raw_record_bytes(cd_entries, field_value_ptrs, num_values, record_bytes,
-                        tab_header->record_size);
+  return rc;
+}
 
-  // Append the new record to the .tab file.
-  char table_filename[MAX_IDENT_LEN + 5];
-  sprintf(table_filename, "%s.tab", tab_header->tpd_ptr->table_name);
-  FILE *fhandle = NULL;
-  if ((fhandle = fopen(table_filename, "wbc")) == NULL) {
-    rc = FILE_OPEN_ERROR;
-  } else {
-    // Add one more record in table header.
-    int old_table_file_size = tab_header->file_size;
-    tab_header->num_records++;
-    tab_header->file_size += tab_header->record_size;
-    tab_header->tpd_ptr = NULL;  // Reset tpd pointer.
-
-    fwrite(tab_header, old_table_file_size, 1, fhandle);
-    fwrite(record_bytes, tab_header->record_size, 1, fhandle);
-    fflush(fhandle);
-    fclose(fhandle);
+int load_data_file(FILE *f_data, tpd_entry *tab_entry, int *p_line_number) {
+  int rc = 0;
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  table_file *file = NULL;
+  if ((rc = open_table_file(tab_entry, &file)) != 0) {
+    return rc;
   }
-  free(record_bytes);
-  free(tab_header);
+
+  int capacity = LOAD_BLOCK_SIZE;
+  int length = 0;
+  char *block = (char *)malloc(capacity);
+  if (block == NULL) {
+    return MEMORY_ERROR;
+  }
+
+  int num_workers = get_num_worker_threads();
+  if (num_workers < 1) {
+    num_workers = 1;
+  } else if (num_workers > MAX_LOAD_WORKERS) {
+    num_workers = MAX_LOAD_WORKERS;
+  }
+
+  // Encoded blocks are appended as they are produced.
+  *p_line_number = 0;
+  bool is_eof = false;
+  while (!rc && !is_eof) {
+    length += (int)fread(block + length, 1, capacity - length, f_data);
+    is_eof = (length < capacity);
+
+    // Only whole lines are encoded, the rest is kept for the next block.
+    int block_end = length;
+    if (!is_eof) {
+      while ((block_end > 0) && (block[block_end - 1] != '\n')) {
+        block_end--;
+      }
+      if (block_end == 0) {
+        // A single line does not fit in the block.
+        char *new_block = (char *)realloc(block, capacity * 2);
+        if (new_block == NULL) {
+          rc = MEMORY_ERROR;
+          break;
+        }
+        block = new_block;
+        capacity *= 2;
+        continue;
+      }
+    }
+
+    // Split the block into one chunk per worker on line boundaries.
+    load_chunk chunks[MAX_LOAD_WORKERS];
+    int num_chunks = 0;
+    char *chunk_start = block;
+    char *block_stop = block + block_end;
+    while ((num_chunks < num_workers) && (chunk_start < block_stop)) {
+      char *chunk_end = block_stop;
+      if (num_chunks < num_workers - 1) {
+        chunk_end = chunk_start + (block_stop - chunk_start) /
+                                      (num_workers - num_chunks);
+        while ((chunk_end < block_stop) && (chunk_end[-1] != '\n')) {
+          chunk_end++;
+        }
+      }
+      load_chunk *chunk = &chunks[num_chunks];
+      memset(chunk, '\0', sizeof(load_chunk));
+      chunk->start = chunk_start;
+      chunk->end = chunk_end;
+      chunk->cd_entries = cd_entries;
+      chunk->num_columns = tab_entry->num_columns;
+      chunk->record_size = file->header.record_size;
+      num_chunks++;
+      chunk_start = chunk_end;
+    }
+
+    if (num_chunks == 1) {
+      encode_load_chunk(&chunks[0]);
+    } else {
+      std::thread workers[MAX_LOAD_WORKERS];
+      for (int i = 0; i < num_chunks; i++) {
+        workers[i] = std::thread(encode_load_chunk, &chunks[i]);
+      }
+      for (int i = 0; i < num_chunks; i++) {
+        workers[i].join();
+      }
+    }
+
+    // Write the chunks in input order and stop at the first failing one.
+    for (int i = 0; i < num_chunks; i++) {
+      if (!rc) {
+        *p_line_number += chunks[i].num_lines;
+        if (chunks[i].rc) {
+          rc = chunks[i].rc;
+        } else if (chunks[i].num_records > 0) {
+          rc = append_table_records(tab_entry, chunks[i].record_bytes,
+                                    chunks[i].num_records);
+        }
+      }
+      free(chunks[i].record_bytes);
+    }
+
+    memmove(block, block + block_end, length - block_end);
+    length -= block_end;
+  }
+
+  free(block);
   return rc;
 }
 
+void encode_load_chunk(load_chunk *chunk) {
+  // Each line holds at most one record.
+  int max_num_records = 1;
+  for (char *p = chunk->start; p < chunk->end; p++) {
+    if (*p == '\n') {
+      max_num_records++;
+    }
+  }
+  chunk->record_bytes =
+      (char *)malloc((size_t)max_num_records * chunk->record_size);
+  if (chunk->record_bytes == NULL) {
+    chunk->rc = MEMORY_ERROR;
+    return;
+  }
+
+  char *line = chunk->start;
+  while (line < chunk->end) {
+    char *line_end = (char *)memchr(line, '\n', chunk->end - line);
+    char *next_line = (line_end == NULL) ? chunk->end : line_end + 1;
+    if (line_end == NULL) {
+      line_end = chunk->end;
+    }
+    if ((line_end > line) && (line_end[-1] == '\r')) {
+      line_end--;
+    }
+    chunk->num_lines++;
+
+    // Empty lines are skipped.
+    if (line_end > line) {
+      chunk->rc = encode_csv_record(
+          chunk->cd_entries, chunk->num_columns, line, line_end,
+          chunk->record_bytes + (size_t)chunk->num_records * chunk->record_size,
+          chunk->record_size);
+      if (chunk->rc) {
+        return;
+      }
+      chunk->num_records++;
+    }
+    line = next_line;
+  }
+}
+
+int encode_csv_record(cd_entry cd_entries[], int num_columns, char *line,
+                      char *line_end, char record_bytes[], int record_size) {
+  /* Fields are separated by ',' and may be double-quoted, with "" standing
+  for a quote. An empty or NULL field that is not quoted is a null value.
+  The record layout is the same as fill_raw_record_bytes(), where an empty
+  string has the zero length byte of the null value, so NOT NULL is
+  checked on the encoded length. An int field is decimal digits, as in
+  INSERT, but may also have a sign, so that negative values can be loaded.
+  It must fit in an int. */
+  memset(record_bytes, '\0', record_size);
+  char value[MAX_STRING_LEN + 1];
+  char *pos = line;
+  int cur_offset_in_record = 0;
+  for (int i = 0; i < num_columns; i++) {
+    if (i > 0) {
+      if ((pos >= line_end) || (*pos != ',')) {
+        return INVALID_VALUES_COUNT;
+      }
+      pos++;
+    }
+
+    int value_length = 0;
+    bool is_quoted = (pos < line_end) && (*pos == '"');
+    if (is_quoted) {
+      pos++;
+      while (true) {
+        if (pos >= line_end) {
+          // Missing closing quote.
+          return INVALID_VALUE;
+        }
+        if (*pos == '"') {
+          pos++;
+          if ((pos >= line_end) || (*pos != '"')) {
+            break;
+          }
+        }
+        if (value_length >= MAX_STRING_LEN) {
+          return DATA_TYPE_MISMATCH;
+        }
+        value[value_length++] = *pos++;
+      }
+    } else {
+      while ((pos < line_end) && (*pos != ',')) {
+        if (value_length >= MAX_STRING_LEN) {
+          return DATA_TYPE_MISMATCH;
+        }
+        value[value_length++] = *pos++;
+      }
+    }
+    value[value_length] = '\0';
+
+    if (!is_quoted && ((value_length == 0) || (stricmp(value, "NULL") == 0))) {
+      // A zero length byte stands for the null value.
+    } else if (cd_entries[i].col_type == T_INT) {
+      const char *digits = value;
+      if ((*digits == '-') || (*digits == '+')) {
+        digits++;
+      }
+      if (is_quoted || !isdigit((unsigned char)*digits)) {
+        return DATA_TYPE_MISMATCH;
+      }
+      char *digits_end = NULL;
+      errno = 0;
+      long long_value = strtol(value, &digits_end, 10);
+      if ((*digits_end != '\0') || (errno == ERANGE) ||
+          (long_value < INT_MIN) || (long_value > INT_MAX)) {
+        return DATA_TYPE_MISMATCH;
+      }
+      int int_value = (int)long_value;
+      record_bytes[cur_offset_in_record] = (char)cd_entries[i].col_len;
+      memcpy(record_bytes + cur_offset_in_record + 1, &int_value,
+             cd_entries[i].col_len);
+    } else {
+      if (value_length > cd_entries[i].col_len) {
+        return DATA_TYPE_MISMATCH;
+      }
+      record_bytes[cur_offset_in_record] = (char)value_length;
+      memcpy(record_bytes + cur_offset_in_record + 1, value, value_length);
+    }
+    if ((record_bytes[cur_offset_in_record] == 0) && cd_entries[i].not_null) {
+      return UNEXPECTED_NULL_VALUE;
+    }
+    cur_offset_in_record += (1 + cd_entries[i].col_len);
+  }
+
+  if (pos != line_end) {
+    return INVALID_VALUES_COUNT;
+  }
+  return 0;
+}
+
 int sem_backup(token_list *t_list) {
   int rc = 0;
   token_list *cur = t_list;
@@ -1405,44 +1966,26 @@ int sem_backup(token_list *t_list) {
     return rc;
   }
 
-  table_file_header *tab_headers[MAX_NUM_TABLE];
-  for (int i = 0; i < MAX_NUM_TABLE; i++) {
-    tab_headers[i] = NULL;
-  }
-
-  for (int i = 0; i < num_tables; i++) {
-    if ((rc = load_table_records(tab_entry, &(tab_headers[i]))) != 0) {
-      return rc;
-    }
-    // Move to next table.
-    tab_entry = (tpd_entry *)((char *)tab_entry + tab_entry->tpd_size);
-  }
-
   fhandle = NULL;
   if ((fhandle = fopen(img_file_name, "wbc")) == NULL) {
     rc = FILE_OPEN_ERROR;
   } else {
     // Write dbfile.bin to the backup file.
     fwrite(g_tpd_list, g_tpd_list->list_size, 1, fhandle);
-    // Write each table file contant to the backup file.
-    // We use 32-bit integer to occupy 4 bytes as the length of a table file.
-    int32_t table_size = 0;
-    for (int i = 0; i < num_tables; i++) {
-      // Reset tpd pointer.
-      tab_headers[i]->tpd_ptr = NULL;
-      table_size = tab_headers[i]->file_size;
-      // Write table size.
-      fwrite(&table_size, sizeof(table_size), 1, fhandle);
-      // Write table content.
-      fwrite(tab_headers[i], tab_headers[i]->file_size, 1, fhandle);
+    // Write each table file contant to the backup file, one table at a time.
+    for (int i = 0; (i < num_tables) && !rc; i++) {
+      rc = backup_table_file(tab_entry, fhandle);
+      // Move to next table.
+      tab_entry = (tpd_entry *)((char *)tab_entry + tab_entry->tpd_size);
+    }
+    if (!rc) {
+      rc = commit_file(fhandle);
     }
-    fflush(fhandle);
     fclose(fhandle);
-  }
-
-  for (int i = 0; i < num_tables; i++) {
-    free(tab_headers[i]);
-    tab_headers[i] = NULL;
+    if (rc) {
+      // Do not leave an incomplete image behind.
+      remove(img_file_name);
+    }
   }
 
   // Write log.
@@ -1459,54 +2002,37 @@ int sem_select(token_list *t_list) {
   int rc = 0;
   token_list *cur = t_list;
 
+  // A SELECT with GROUP BY or aggregates has a select list of its own.
+  bool is_select_list = true;
+  for (token_list *p_token = t_list; p_token->tok_value != EOC;
+       p_token = p_token->next) {
+    if (p_token->tok_value == K_FROM) {
+      is_select_list = false;
+    }
+    if (((p_token->tok_value == K_GROUP) &&
+         (p_token->next->tok_value == K_BY)) ||
+        (is_select_list &&
+         (p_token->tok_class == TOKEN_CLASS_FUNCTION_NAME))) {
+      return sem_select_groups(t_list);
+    }
+  }
+
   field_name field_names[MAX_NUM_COL];
   bool fields_done = false;
   int wildcard_field_index = -1;
   int num_fields = 0;
 
-  // Try parse aggregate operator: SUM, AVG, or COUNT.
-  int aggregate_type = 0;
-  if (cur->tok_class == TOKEN_CLASS_FUNCTION_NAME &&
-      cur->next->tok_value == S_LEFT_PAREN) {
-    aggregate_type = cur->tok_value;  // Can be F_COUNT, F_SUM, or F_AVG.
-    if (!(can_be_identifier(cur->next->next) ||
-          (cur->next->next != NULL && cur->next->next->tok_value == S_STAR))) {
+  // Extract field names.
+  while (!fields_done) {
+    if (!(can_be_identifier(cur) || cur->tok_value == S_STAR)) {
       // Error column name.
       rc = INVALID_COLUMN_NAME;
       cur->tok_value = INVALID;
       return rc;
     }
-    cur = cur->next->next;
-    strcpy(field_names[num_fields].name, cur->tok_string);
-    field_names[num_fields].linked_token = cur;
-    if (strcmp(cur->tok_string, "*") == 0) {
-      wildcard_field_index = 0;
-    }
-    cur = cur->next;
-    if (cur->tok_value != S_RIGHT_PAREN) {
-      // Error column name.
-      rc = INVALID_COLUMN_NAME;
-      cur->tok_value = INVALID;
-      return rc;
-    } else {
-      cur = cur->next;
-      num_fields++;
-      fields_done = true;
-    }
-  }
-
-  // Extract field names. However, it will be skipped if the unique aggregate
-  // field is found.
-  while (!fields_done) {
-    if (!(can_be_identifier(cur) || cur->tok_value == S_STAR)) {
-      // Error column name.
-      rc = INVALID_COLUMN_NAME;
-      cur->tok_value = INVALID;
-      return rc;
-    }
-
-    // Check if wildcard has already been caught.
-    if (wildcard_field_index == 0) {
+
+    // Check if wildcard has already been caught.
+    if (wildcard_field_index == 0) {
       rc = INVALID_COLUMN_NAME;
       cur->tok_value = INVALID;
       return rc;
@@ -1580,148 +2106,67 @@ int sem_select(token_list *t_list) {
       field_names[i].linked_token->tok_value = INVALID;
       return rc;
     } else {
-      // SUM and AVG aggregate functions are only valid on the unique interger
-      // column.
-      if ((aggregate_type == F_SUM) || (aggregate_type == F_AVG)) {
-        if ((num_fields == 1) && (cd_entries[col_index].col_type == T_INT)) {
-          sorted_cd_entries[i] = &cd_entries[col_index];
-        } else {
-          rc = INVALID_AGGREGATE_COLUMN;
-          field_names[i].linked_token->tok_value = INVALID;
-          return rc;
-        }
-      } else {
-        sorted_cd_entries[i] = &cd_entries[col_index];
-      }
+      sorted_cd_entries[i] = &cd_entries[col_index];
     }
   }
 
-  bool has_where_clause = false;
   record_predicate row_filter;
   memset(&row_filter, '\0', sizeof(record_predicate));
-  row_filter.type = K_AND;  // Set default relationship of conditions.
 
   cur = cur->next;
   // Parse optional WHERE clause.
   if (cur->tok_value == K_WHERE) {
-    has_where_clause = true;
+    cur = cur->next;
+    rc = parse_where_clause(&cur, cd_entries, tab_entry->num_columns,
+                            &row_filter);
+    if (rc) {
+      return rc;
+    }
+  }
 
-    int col_index = -1;
-    int num_conditions = 0;
-    bool has_more_condition = true;
+  // Parse ORDER BY clause, a list of columns each followed by an optional
+  // ASC or DESC.
+  int num_order_by_cols = 0;
+  int order_by_col_ids[MAX_NUM_COL];
+  bool order_by_desc[MAX_NUM_COL];
+  bool is_order_by_col[MAX_NUM_COL];
+  memset(is_order_by_col, '\0', sizeof(is_order_by_col));
 
-    while (has_more_condition) {
-      // Read column name.
+  if (cur->tok_value == K_ORDER && cur->next->tok_value == K_BY) {
+    cur = cur->next;
+    do {
       cur = cur->next;
+      int col_id = -1;
       if (can_be_identifier(cur)) {
-        col_index = get_cd_entry_index(cd_entries, tab_entry->num_columns,
-                                       cur->tok_string);
-        if (col_index > -1) {
-          row_filter.conditions[num_conditions].col_id = col_index;
-          row_filter.conditions[num_conditions].value_type =
-              ((cd_entries[col_index].col_type == T_INT)
-                   ? FIELD_VALUE_TYPE_INT
-                   : FIELD_VALUE_TYPE_STRING);
-        } else {
-          rc = INVALID_COLUMN_NAME;
-          cur->tok_value = INVALID;
-          return rc;
-        }
-      } else {
+        col_id = get_cd_entry_index(cd_entries, tab_entry->num_columns,
+                                    cur->tok_string);
+      }
+      if (col_id < 0) {
         rc = INVALID_COLUMN_NAME;
         cur->tok_value = INVALID;
         return rc;
       }
-
-      // Read relational operator of first condition.
       cur = cur->next;
-      if (cur->tok_value == S_LESS || cur->tok_value == S_GREATER ||
-          cur->tok_value == S_EQUAL) {
-        row_filter.conditions[num_conditions].op_type = cur->tok_value;
-        cur = cur->next;
-        if (cur->tok_value == INT_LITERAL) {
-          if (row_filter.conditions[num_conditions].value_type ==
-              FIELD_VALUE_TYPE_INT) {
-            row_filter.conditions[num_conditions].int_data_value =
-                atoi(cur->tok_string);
-          } else {
-            rc = INVALID_CONDITION_OPERAND;
-            cur->tok_value = INVALID;
-            return rc;
-          }
-        } else if (cur->tok_value == STRING_LITERAL) {
-          if (row_filter.conditions[num_conditions].value_type ==
-              FIELD_VALUE_TYPE_STRING) {
-            strcpy(row_filter.conditions[num_conditions].string_data_value,
-                   cur->tok_string);
-          } else {
-            rc = INVALID_CONDITION_OPERAND;
-            cur->tok_value = INVALID;
-            return rc;
-          }
-        } else {
-          rc = INVALID_CONDITION;
-          cur->tok_value = INVALID;
-          return rc;
-        }
-      } else if (cur->tok_value == K_IS &&
-                 cur->next->tok_value == K_NULL) {  // "IS NULL"
+      bool is_desc = (cur->tok_value == K_DESC);
+      if ((cur->tok_value == K_DESC) || (cur->tok_value == K_ASC)) {
         cur = cur->next;
-        row_filter.conditions[num_conditions].op_type = K_IS;
-      } else if (cur->tok_value == K_IS && cur->next->tok_value == K_NOT &&
-                 cur->next->next->tok_value == K_NULL) {  // "IS NOT NULL"
-        cur = cur->next->next;
-        row_filter.conditions[num_conditions].op_type = K_NOT;
-      } else {
-        rc = INVALID_CONDITION;
-        cur->tok_value = INVALID;
-        return rc;
-      }
-      num_conditions++;
-      row_filter.num_conditions = num_conditions;
-
-      if (num_conditions == MAX_NUM_CONDITION) {
-        break;
       }
 
-      if (cur->next->tok_value == K_AND || cur->next->tok_value == K_OR) {
-        cur = cur->next;
-        has_more_condition = true;
-        row_filter.type = cur->tok_value;
-      } else {
-        has_more_condition = false;
+      // A column which is already in the list does not change the order.
+      if (!is_order_by_col[col_id]) {
+        is_order_by_col[col_id] = true;
+        order_by_col_ids[num_order_by_cols] = col_id;
+        order_by_desc[num_order_by_cols] = is_desc;
+        num_order_by_cols++;
       }
-    }  // End of while.
-    cur = cur->next;
+    } while (cur->tok_value == S_COMMA);
   }
 
-  // Parse ORDER BY clause
-  bool has_order_by_clause = false;
-  bool order_by_desc = false;
-  int order_by_column_id = -1;
-
-  if (cur->tok_value == K_ORDER && cur->next->tok_value == K_BY) {
-    cur = cur->next->next;
-    if (can_be_identifier(cur)) {
-      order_by_column_id = get_cd_entry_index(
-          cd_entries, tab_entry->num_columns, cur->tok_string);
-      if (order_by_column_id > -1) {
-        has_order_by_clause = true;
-        cur = cur->next;
-        if (cur->tok_value == K_DESC) {
-          order_by_desc = true;
-          cur = cur->next;
-        }
-      } else {
-        rc = INVALID_COLUMN_NAME;
-        cur->tok_value = INVALID;
-        return rc;
-      }
-    } else {
-      rc = INVALID_COLUMN_NAME;
-      cur->tok_value = INVALID;
-      return rc;
-    }
+  bool has_limit = false;
+  int limit = 0;
+  int offset = 0;
+  if ((rc = parse_limit_clause(&cur, &has_limit, &limit, &offset)) != 0) {
+    return rc;
   }
 
   if (cur->tok_value != EOC) {
@@ -1730,112 +2175,113 @@ int sem_select(token_list *t_list) {
     return rc;
   }
 
-  // It is the heap memory owner of the content of the whole table.
-  // Do not forget to free it later.
-  table_file_header *tab_header = NULL;
-  if ((rc = load_table_records(tab_entry, &tab_header)) != 0) {
+  // The records are read where they are stored, see open_table_scan().
+  table_scan scan;
+  if ((rc = open_table_scan(tab_entry, &scan, true)) != 0) {
     return rc;
   }
 
-  // Load record rows.
-  char *record_in_table = NULL;
-  get_table_records(tab_header, &record_in_table);
-  int aggregate_int_sum = 0;
-  int num_loaded_records = 0;
-  int aggregate_records_count = 0;
-
-  record_row record_rows[MAX_NUM_ROW];
-  memset(record_rows, '\0', sizeof(record_rows));
-  record_row *p_current_row = NULL;
-  for (int i = 0; i < tab_header->num_records; i++) {
-    // Fill all field values (not only displayed columns) from current record.
-    p_current_row = &record_rows[num_loaded_records];
-    fill_record_row(cd_entries, tab_entry->num_columns, p_current_row,
-                    record_in_table);
-
-    // Do filtering on current record row.
-    if (has_where_clause &&
-        (!apply_row_predicate(cd_entries, tab_entry->num_columns, p_current_row,
-                              &row_filter))) {
-      // Current row is not qualified so should be skipped (i.e. will not be
-      // loaded in final result set).
-      for (int j = 0; j < p_current_row->num_fields; j++) {
-        free(p_current_row->value_ptrs[j]);
-      }
-      memset(p_current_row, '\0', sizeof(record_row));
-    } else {
-      /* Current row survives. */
-      num_loaded_records++;
-
-      if ((aggregate_type == F_SUM) || (aggregate_type == F_AVG)) {
-        // SUM(col) or AVG(col), ignore NULL rows.
-        if (!p_current_row->value_ptrs[sorted_cd_entries[0]->col_id]->is_null) {
-          aggregate_int_sum +=
-              p_current_row->value_ptrs[sorted_cd_entries[0]->col_id]
-                  ->int_value;
-          aggregate_records_count++;
-        }
-      } else if (aggregate_type == F_COUNT) {
-        if (num_fields == 1) {
-          // count(col), ignore NULL rows.
-          if (!p_current_row->value_ptrs[sorted_cd_entries[0]->col_id]
-                   ->is_null) {
-            aggregate_records_count++;
-          }
-        } else {
-          // count(*), include NULL rows.
-          aggregate_records_count++;
-        }
-      }
-    }
+  print_table_border(sorted_cd_entries, num_fields);
+  print_table_column_names(sorted_cd_entries, field_names, num_fields);
+  print_table_border(sorted_cd_entries, num_fields);
 
-    // Move forward to next record.
-    record_in_table += tab_header->record_size;
+  /* The WHERE clause is evaluated on the stored records, and only the
+  projected columns of the rows which qualify are decoded. */
+  select_plan plan;
+  memset(&plan, '\0', sizeof(select_plan));
+  init_record_layout(cd_entries, tab_entry->num_columns, &plan.layout);
+  if ((rc = compile_predicate(&plan.layout, &row_filter,
+                               &plan.where_filter)) != 0) {
+    close_table_scan(&scan);
+    return rc;
   }
-  if (aggregate_type == 0) {
-    print_table_border(sorted_cd_entries, num_fields);
-    print_table_column_names(sorted_cd_entries, field_names, num_fields);
-    print_table_border(sorted_cd_entries, num_fields);
-
-    // Sort records if necessary.
-    if (has_order_by_clause) {
-      sort_records(record_rows, num_loaded_records,
-                   &cd_entries[order_by_column_id], order_by_desc);
-    }
-
-    // Print all sorted records.
-    for (int i = 0; i < num_loaded_records; i++) {
-      print_record_row(sorted_cd_entries, num_fields, &record_rows[i]);
+  plan.num_output_cols = num_fields;
+  plan.output_cd_entries = sorted_cd_entries;
+  plan.num_order_by_cols = num_order_by_cols;
+  memcpy(plan.order_by_col_ids, order_by_col_ids, sizeof(order_by_col_ids));
+  memcpy(plan.order_by_desc, order_by_desc, sizeof(order_by_desc));
+  plan.has_limit = has_limit;
+  plan.limit = limit;
+  plan.offset = offset;
+  bool is_project_col[MAX_NUM_COL];
+  memset(is_project_col, '\0', sizeof(is_project_col));
+  for (int i = 0; i < num_fields; i++) {
+    is_project_col[sorted_cd_entries[i]->col_id] = true;
+  }
+  for (int i = 0; i < num_order_by_cols; i++) {
+    is_project_col[order_by_col_ids[i]] = true;
+  }
+  for (int i = 0; i < tab_entry->num_columns; i++) {
+    if (is_project_col[i]) {
+      plan.project_col_ids[plan.num_project_cols++] = i;
     }
-    print_table_border(sorted_cd_entries, num_fields);
-  } else {
-    // Aggregate result is shown as a 1x1 table.
-    print_aggregate_result(aggregate_type, num_fields, aggregate_records_count,
-                           aggregate_int_sum, sorted_cd_entries);
   }
 
-  // Clean allocated heap memory.
-  free(tab_header);
-  for (int i = 0; i < num_loaded_records; i++) {
-    for (int j = 0; j < record_rows[i].num_fields; j++) {
-      free(record_rows[i].value_ptrs[j]);
-    }
+  // A columnar table only reads the columns of the WHERE clause and the
+  // projected columns.
+  bool is_used_col[MAX_NUM_COL];
+  memcpy(is_used_col, is_project_col, sizeof(is_used_col));
+  for (int i = 0; i < row_filter.num_conditions; i++) {
+    is_used_col[row_filter.conditions[i].col_id] = true;
   }
+  use_scan_columns(&scan, is_used_col);
+
+  rc = run_select_plan(&plan, &scan);
+  close_table_scan(&scan);
+  free_compiled_predicate(&plan.where_filter);
+  print_table_border(sorted_cd_entries, num_fields);
   return rc;
 }
 
-int sem_delete(token_list *t_list) {
+int sem_select_groups(token_list *t_list) {
+  /* SELECT of grouping columns and aggregates with GROUP BY, or of
+  aggregates only. The rows which qualify are grouped by a hash table, then
+  the grouped rows are filtered by HAVING, sorted and limited by a plan of
+  their own. Without GROUP BY, every row is in one group, which is shown
+  like a table of one row. */
   int rc = 0;
   token_list *cur = t_list;
 
-  // Check table name.
+  // The select items are checked once GROUP BY is known.
+  token_list *item_tokens[MAX_NUM_COL];
+  int num_items = 0;
+  bool items_done = false;
+  while (!items_done) {
+    if (num_items == MAX_NUM_COL) {
+      rc = MAX_COLUMN_EXCEEDED;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    item_tokens[num_items++] = cur;
+    if (is_aggregate_call(cur)) {
+      cur = cur->next->next->next->next;
+    } else if (can_be_identifier(cur)) {
+      cur = cur->next;
+    } else {
+      rc = INVALID_COLUMN_NAME;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    if (cur->tok_value == S_COMMA) {
+      cur = cur->next;
+    } else {
+      items_done = true;
+    }
+  }
+
+  if (cur->tok_value != K_FROM) {
+    rc = INVALID_STATEMENT;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  cur = cur->next;
   if (!can_be_identifier(cur)) {
     rc = INVALID_TABLE_NAME;
     cur->tok_value = INVALID;
     return rc;
   }
 
-  // Check whether the table name exists.
   tpd_entry *tab_entry = get_tpd_from_list(cur->tok_string);
   if (tab_entry == NULL) {
     rc = TABLE_NOT_EXIST;
@@ -1843,83 +2289,125 @@ int sem_delete(token_list *t_list) {
     return rc;
   }
 
-  // Get column descriptors.
   cd_entry *cd_entries = NULL;
   get_cd_entries(tab_entry, &cd_entries);
+  int num_columns = tab_entry->num_columns;
 
-  bool has_where_clause = false;
   record_predicate row_filter;
-  memset(&row_filter, '\0', sizeof(row_filter));
-  // Parse WHERE clause.
+  memset(&row_filter, '\0', sizeof(record_predicate));
   cur = cur->next;
   if (cur->tok_value == K_WHERE) {
-    has_where_clause = true;
-    row_filter.type = K_AND;
-    row_filter.num_conditions = 1;
+    cur = cur->next;
+    rc = parse_where_clause(&cur, cd_entries, num_columns, &row_filter);
+    if (rc) {
+      return rc;
+    }
+  }
 
-    // Parse name of the filtering column.
+  // GROUP BY a list of columns, where a repeated column is ignored.
+  select_plan plan;
+  memset(&plan, '\0', sizeof(select_plan));
+  if ((cur->tok_value == K_GROUP) && (cur->next->tok_value == K_BY)) {
     cur = cur->next;
-    if (can_be_identifier(cur)) {
-      int col_index = get_cd_entry_index(cd_entries, tab_entry->num_columns,
-                                         cur->tok_string);
-      if (col_index > -1) {
-        row_filter.conditions[0].col_id = col_index;
-        row_filter.conditions[0].value_type =
-            ((cd_entries[col_index].col_type == T_INT)
-                 ? FIELD_VALUE_TYPE_INT
-                 : FIELD_VALUE_TYPE_STRING);
-      } else {
+    do {
+      cur = cur->next;
+      int col_id = -1;
+      if (can_be_identifier(cur)) {
+        col_id = get_cd_entry_index(cd_entries, num_columns, cur->tok_string);
+      }
+      if (col_id < 0) {
         rc = INVALID_COLUMN_NAME;
         cur->tok_value = INVALID;
         return rc;
       }
-    } else {
-      rc = INVALID_COLUMN_NAME;
-      cur->tok_value = INVALID;
+      bool is_listed = false;
+      for (int i = 0; i < plan.num_group_by_cols; i++) {
+        is_listed = is_listed || (plan.group_by_col_ids[i] == col_id);
+      }
+      if (!is_listed) {
+        plan.group_by_col_ids[plan.num_group_by_cols++] = col_id;
+      }
+      cur = cur->next;
+    } while (cur->tok_value == S_COMMA);
+  }
+
+  grouped_columns grouped;
+  memset(&grouped, '\0', sizeof(grouped_columns));
+  for (int i = 0; i < num_items; i++) {
+    token_list *p_item = item_tokens[i];
+    int col = 0;
+    rc = add_grouped_column(&plan, cd_entries, num_columns, &grouped, &p_item,
+                            true, &col);
+    if (rc) {
       return rc;
     }
+  }
 
-    // Parse the operator and operand of the condition.
+  // HAVING may use aggregates and grouping columns which are not selected,
+  // so they are added to the grouped rows first.
+  if (cur->tok_value == K_HAVING) {
     cur = cur->next;
-    if (cur->tok_value == S_LESS || cur->tok_value == S_GREATER ||
-        cur->tok_value == S_EQUAL) {
-      row_filter.conditions[0].op_type = cur->tok_value;
-      cur = cur->next;
-      if (cur->tok_value == INT_LITERAL) {
-        if (row_filter.conditions[0].value_type == FIELD_VALUE_TYPE_INT) {
-          row_filter.conditions[0].int_data_value = atoi(cur->tok_string);
-        } else {
-          rc = INVALID_CONDITION_OPERAND;
-          cur->tok_value = INVALID;
-          return rc;
+    for (token_list *p_token = cur; p_token->tok_value != EOC;
+         p_token = p_token->next) {
+      bool is_grouping_col = false;
+      if (can_be_identifier(p_token)) {
+        int col_id =
+            get_cd_entry_index(cd_entries, num_columns, p_token->tok_string);
+        for (int i = 0; (i < plan.num_group_by_cols) && (col_id > -1); i++) {
+          if (plan.group_by_col_ids[i] == col_id) {
+            is_grouping_col = true;
+          }
         }
-      } else if (cur->tok_value == STRING_LITERAL) {
-        if (row_filter.conditions[0].value_type == FIELD_VALUE_TYPE_STRING) {
-          strcpy(row_filter.conditions[0].string_data_value, cur->tok_string);
-        } else {
-          rc = INVALID_CONDITION_OPERAND;
-          cur->tok_value = INVALID;
+      }
+      if (is_aggregate_call(p_token) || is_grouping_col) {
+        token_list *p_item = p_token;
+        int col = 0;
+        rc = add_grouped_column(&plan, cd_entries, num_columns, &grouped,
+                                &p_item, false, &col);
+        if (rc) {
           return rc;
         }
-      } else {
-        rc = INVALID_CONDITION;
-        cur->tok_value = INVALID;
-        return rc;
       }
-    } else if (cur->tok_value == K_IS &&
-               cur->next->tok_value == K_NULL) {  // "IS NULL"
-      cur = cur->next;
-      row_filter.conditions[0].op_type = K_IS;
-    } else if (cur->tok_value == K_IS && cur->next->tok_value == K_NOT &&
-               cur->next->next->tok_value == K_NULL) {  // "IS NOT NULL"
-      cur = cur->next->next;
-      row_filter.conditions[0].op_type = K_NOT;
-    } else {
-      rc = INVALID_CONDITION;
-      cur->tok_value = INVALID;
+    }
+    rc = parse_where_clause(&cur, grouped.cd_entries, grouped.num_columns,
+                            &plan.having);
+    if (rc) {
       return rc;
     }
+  }
+
+  // ORDER BY grouping columns and aggregates.
+  select_plan group_plan;
+  memset(&group_plan, '\0', sizeof(select_plan));
+  if (cur->tok_value == K_ORDER && cur->next->tok_value == K_BY) {
+    bool is_order_by_col[MAX_NUM_COL];
+    memset(is_order_by_col, '\0', sizeof(is_order_by_col));
     cur = cur->next;
+    do {
+      cur = cur->next;
+      int col = 0;
+      rc = add_grouped_column(&plan, cd_entries, num_columns, &grouped, &cur,
+                              false, &col);
+      if (rc) {
+        return rc;
+      }
+      bool is_desc = (cur->tok_value == K_DESC);
+      if ((cur->tok_value == K_DESC) || (cur->tok_value == K_ASC)) {
+        cur = cur->next;
+      }
+      if (!is_order_by_col[col]) {
+        is_order_by_col[col] = true;
+        group_plan.order_by_col_ids[group_plan.num_order_by_cols] = col;
+        group_plan.order_by_desc[group_plan.num_order_by_cols] = is_desc;
+        group_plan.num_order_by_cols++;
+      }
+    } while (cur->tok_value == S_COMMA);
+  }
+
+  rc = parse_limit_clause(&cur, &group_plan.has_limit, &group_plan.limit,
+                          &group_plan.offset);
+  if (rc) {
+    return rc;
   }
 
   if (cur->tok_value != EOC) {
@@ -1928,71 +2416,277 @@ int sem_delete(token_list *t_list) {
     return rc;
   }
 
-  // It is the heap memory owner of the content of the whole table.
-  // Do not forget to free it later.
-  table_file_header *tab_header = NULL;
-  if ((rc = load_table_records(tab_entry, &tab_header)) != 0) {
+  table_scan scan;
+  if ((rc = open_table_scan(tab_entry, &scan, true)) != 0) {
     return rc;
   }
 
-  // Load record rows.
-  char *record_in_table = NULL;
-  get_table_records(tab_header, &record_in_table);
-  record_row *p_first_row = NULL;
-  record_row *p_current_row = NULL;
-  record_row *p_previous_row = NULL;
-  int num_loaded_records = 0;
-  int num_affected_records = 0;
-  for (int i = 0; i < tab_header->num_records; i++) {
-    // Fill all field values (not only displayed columns) from current record.
-    if (p_previous_row == NULL) {  // The first record will be loaded.
-      p_current_row = (record_row *)malloc(sizeof(record_row));
-      p_first_row = p_current_row;
-    } else {
-      p_current_row = (record_row *)malloc(sizeof(record_row));
-      p_previous_row->next = p_current_row;
+  // Only the grouping columns and the columns of the aggregates are
+  // projected.
+  init_record_layout(cd_entries, num_columns, &plan.layout);
+  if ((rc = compile_predicate(&plan.layout, &row_filter,
+                               &plan.where_filter)) != 0) {
+    close_table_scan(&scan);
+    return rc;
+  }
+  plan.p_group_plan = &group_plan;
+  init_group_plan(&plan, &group_plan);
+  cd_entry *output_cd_entries[MAX_NUM_COL];
+  for (int i = 0; i < num_items; i++) {
+    output_cd_entries[i] = &grouped.cd_entries[i];
+  }
+  group_plan.num_output_cols = num_items;
+  group_plan.output_cd_entries = output_cd_entries;
+  bool is_project_col[MAX_NUM_COL];
+  memset(is_project_col, '\0', sizeof(is_project_col));
+  for (int i = 0; i < plan.num_group_by_cols; i++) {
+    is_project_col[plan.group_by_col_ids[i]] = true;
+  }
+  for (int a = 0; a < plan.num_group_aggregates; a++) {
+    if (plan.group_aggregates[a].col_id > -1) {
+      is_project_col[plan.group_aggregates[a].col_id] = true;
+    }
+  }
+  for (int i = 0; i < num_columns; i++) {
+    if (is_project_col[i]) {
+      plan.project_col_ids[plan.num_project_cols++] = i;
     }
-    fill_record_row(cd_entries, tab_entry->num_columns, p_current_row,
-                    record_in_table);
-    num_loaded_records++;
+  }
+  bool is_used_col[MAX_NUM_COL];
+  memcpy(is_used_col, is_project_col, sizeof(is_used_col));
+  for (int i = 0; i < row_filter.num_conditions; i++) {
+    is_used_col[row_filter.conditions[i].col_id] = true;
+  }
+  use_scan_columns(&scan, is_used_col);
 
-    // Delete qualified records.
-    if ((!has_where_clause) ||
-        apply_row_predicate(cd_entries, tab_entry->num_columns, p_current_row,
-                            &row_filter)) {
-      free_record_row(p_current_row, false);
-      p_current_row = NULL;
-      if (p_previous_row == NULL) {
-        p_first_row = NULL;
-      } else {
-        p_previous_row->next = NULL;
+  if (plan.num_group_by_cols > 0) {
+    rc = output_grouped_rows(&plan, &scan, &grouped, num_items);
+  } else {
+    // Only the titles are shown when HAVING or LIMIT drops the row.
+    select_pipeline pipeline;
+    rc = open_select_pipeline(&plan, &scan, &pipeline);
+    batch_operator *p_last = &pipeline.operators[pipeline.num_operators - 1];
+    row_batch *p_batch = NULL;
+    if (!rc && ((rc = p_last->next(p_last, &p_batch)) == 0)) {
+      print_aggregate_result(&plan, &grouped, num_items, p_batch);
+    }
+    close_select_pipeline(&pipeline);
+  }
+  close_table_scan(&scan);
+  free_compiled_predicate(&plan.where_filter);
+  return rc;
+}
+
+int parse_limit_clause(token_list **p_cur, bool *p_has_limit, int *p_limit,
+                       int *p_offset) {
+  // Parse an optional LIMIT n, which may be followed by OFFSET m.
+  int rc = 0;
+  token_list *cur = *p_cur;
+  *p_has_limit = false;
+  *p_limit = 0;
+  *p_offset = 0;
+  if (cur->tok_value == K_LIMIT) {
+    *p_has_limit = true;
+    cur = cur->next;
+    if (cur->tok_value != INT_LITERAL) {
+      rc = INVALID_VALUE;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    *p_limit = atoi(cur->tok_string);
+    cur = cur->next;
+    if (cur->tok_value == K_OFFSET) {
+      cur = cur->next;
+      if (cur->tok_value != INT_LITERAL) {
+        rc = INVALID_VALUE;
+        cur->tok_value = INVALID;
+        return rc;
       }
-      num_affected_records++;
-    } else {
-      p_previous_row = p_current_row;
+      *p_offset = atoi(cur->tok_string);
+      cur = cur->next;
     }
+  }
+  *p_cur = cur;
+  return rc;
+}
 
-    // Move forward to next record.
-    record_in_table += tab_header->record_size;
+int add_grouped_column(select_plan *p_plan, cd_entry cd_entries[],
+                       int num_columns, grouped_columns *p_grouped,
+                       token_list **p_cur, bool is_new, int *p_col) {
+  /* A grouping column, or an aggregate of a column or COUNT(*), which gets
+  a new column of the grouped rows, unless !is_new and a column has it
+  already. *p_cur is left after the item. */
+  int rc = 0;
+  token_list *cur = *p_cur;
+  token_list *col_token = cur;
+  int function = 0;
+  if (is_aggregate_call(cur)) {
+    function = cur->tok_value;
+    col_token = cur->next->next;
+  }
+  int col_id = -1;
+  if (can_be_identifier(col_token)) {
+    col_id = get_cd_entry_index(cd_entries, num_columns, col_token->tok_string);
+  }
+  if ((col_id < 0) &&
+      !((function == F_COUNT) && (col_token->tok_value == S_STAR))) {
+    rc = ((function != 0) && (col_token->tok_value == S_STAR))
+             ? INVALID_AGGREGATE_COLUMN
+             : INVALID_COLUMN_NAME;
+    col_token->tok_value = INVALID;
+    return rc;
+  }
+  // SUM and AVG are only valid on an integer column.
+  if (((function == F_SUM) || (function == F_AVG)) &&
+      (cd_entries[col_id].col_type != T_INT)) {
+    rc = INVALID_AGGREGATE_COLUMN;
+    col_token->tok_value = INVALID;
+    return rc;
   }
 
-  printf("Affected records: %d\n", num_affected_records);
-  if (num_affected_records > 0) {
-    // Write records back to .tab file.
-    rc = save_records_to_file(tab_header, p_first_row);
+  // A column which is not aggregated must be a grouping column.
+  grouped_column source;
+  source.group_by_index = -1;
+  source.aggregate_index = -1;
+  if (function == 0) {
+    for (int i = 0; i < p_plan->num_group_by_cols; i++) {
+      if (p_plan->group_by_col_ids[i] == col_id) {
+        source.group_by_index = i;
+      }
+    }
+    if (source.group_by_index < 0) {
+      rc = INVALID_COLUMN_NAME;
+      cur->tok_value = INVALID;
+      return rc;
+    }
   } else {
-    printf("[warning] No records were deleted.\n");
+    for (int a = 0; a < p_plan->num_group_aggregates; a++) {
+      if ((p_plan->group_aggregates[a].function == function) &&
+          (p_plan->group_aggregates[a].col_id == col_id)) {
+        source.aggregate_index = a;
+      }
+    }
   }
+  *p_cur = (function != 0) ? col_token->next->next : cur->next;
 
-  free_record_row(p_first_row, true);
-  free(tab_header);
+  for (int c = 0; !is_new && (c < p_grouped->num_columns); c++) {
+    grouped_column *p_source = &p_plan->grouped_cols[c];
+    if ((p_source->group_by_index == source.group_by_index) &&
+        (p_source->aggregate_index == source.aggregate_index)) {
+      *p_col = c;
+      return rc;
+    }
+  }
+  if (p_grouped->num_columns == MAX_NUM_COL) {
+    rc = MAX_COLUMN_EXCEEDED;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+  if ((function != 0) && (source.aggregate_index < 0)) {
+    source.aggregate_index = p_plan->num_group_aggregates++;
+    group_aggregate *p_aggregate =
+        &p_plan->group_aggregates[source.aggregate_index];
+    p_aggregate->function = function;
+    p_aggregate->col_id = col_id;
+    p_aggregate->state_offset = 0;
+  }
+
+  // An aggregate is titled like "SUM(col)".
+  int col = p_grouped->num_columns;
+  cd_entry *p_entry = &p_grouped->cd_entries[col];
+  char *title = p_grouped->titles[col];
+  if (function == 0) {
+    *p_entry = cd_entries[col_id];
+    strcpy(title, cd_entries[col_id].col_name);
+  } else {
+    const char *col_name = (col_id < 0) ? "*" : cd_entries[col_id].col_name;
+    const char *function_name = keyword_table[function - KEYWORD_OFFSET];
+    int length = strlen(function_name);
+    for (int i = 0; i < length; i++) {
+      title[i] = toupper(function_name[i]);
+    }
+    sprintf(title + length, "(%s)", col_name);
+    memset(p_entry, '\0', sizeof(cd_entry));
+    if (!get_aggregate_name(function, col_name, p_entry->col_name,
+                            sizeof(p_entry->col_name))) {
+      rc = INVALID_COLUMN_NAME;
+      col_token->tok_value = INVALID;
+      return rc;
+    }
+    // The output widens the column to its widest value.
+    p_entry->col_type = T_INT;
+    p_entry->col_len = strlen(title);
+    if ((col_id > -1) && (cd_entries[col_id].col_type != T_INT) &&
+        ((function == F_MIN) || (function == F_MAX))) {
+      p_entry->col_type = cd_entries[col_id].col_type;
+    }
+  }
+  p_entry->col_id = col;
+  p_plan->grouped_cols[col] = source;
+  p_plan->num_grouped_cols = ++p_grouped->num_columns;
+  *p_col = col;
   return rc;
 }
 
-int sem_update(token_list *t_list) {
+bool get_aggregate_name(int function, const char *col_name, char *name,
+                        int size) {
+  // No column of a table has such a name. A col_name too long to fit is
+  // not the name of a column either, and gives false.
+  return snprintf(name, size, "%d:%s", function, col_name) < size;
+}
+
+void init_group_plan(select_plan *p_plan, select_plan *p_group_plan) {
+  /* The columns of a grouped row are the grouped columns of the plan, where
+  integers have 8 bytes. Only COUNT and NOT NULL grouping columns are never
+  NULL. Every column is projected. */
+  record_layout *p_layout = &p_group_plan->layout;
+  int offset = 0;
+  for (int c = 0; c < p_plan->num_grouped_cols; c++) {
+    grouped_column *p_source = &p_plan->grouped_cols[c];
+    column_layout *p_column = &p_layout->columns[c];
+    int function = 0;
+    int col_id = -1;
+    if (p_source->group_by_index > -1) {
+      col_id = p_plan->group_by_col_ids[p_source->group_by_index];
+    } else {
+      function = p_plan->group_aggregates[p_source->aggregate_index].function;
+      col_id = p_plan->group_aggregates[p_source->aggregate_index].col_id;
+    }
+    p_column->col_type = T_INT;
+    p_column->col_len = sizeof(int64_t);
+    p_column->not_null = (function == F_COUNT);
+    if (function == 0) {
+      p_column->not_null = p_plan->layout.columns[col_id].not_null;
+    }
+    if ((col_id > -1) && (p_plan->layout.columns[col_id].col_type != T_INT) &&
+        (function != F_COUNT)) {
+      p_column->col_type = p_plan->layout.columns[col_id].col_type;
+      p_column->col_len = p_plan->layout.columns[col_id].col_len;
+    }
+    p_column->offset = offset;
+    offset += 1 + p_column->col_len;
+    p_group_plan->project_col_ids[c] = c;
+  }
+  p_layout->num_columns = p_plan->num_grouped_cols;
+  p_layout->record_size = offset;
+  p_group_plan->num_project_cols = p_plan->num_grouped_cols;
+}
+
+void print_grouped_column_names(grouped_columns *p_grouped,
+                                int display_widths[], int num_values) {
+  for (int i = 0; i < num_values; i++) {
+    printf("%c %s", '|', p_grouped->titles[i]);
+    repeat_print_char(' ',
+                      display_widths[i] - strlen(p_grouped->titles[i]) + 1);
+  }
+  printf("%c\n", '|');
+}
+
+int sem_delete(token_list *t_list) {
   int rc = 0;
   token_list *cur = t_list;
 
+  // Check table name.
   if (!can_be_identifier(cur)) {
     rc = INVALID_TABLE_NAME;
     cur->tok_value = INVALID;
@@ -2011,11 +2705,103 @@ int sem_update(token_list *t_list) {
   cd_entry *cd_entries = NULL;
   get_cd_entries(tab_entry, &cd_entries);
 
+  record_predicate row_filter;
+  memset(&row_filter, '\0', sizeof(row_filter));
+  // Parse WHERE clause.
   cur = cur->next;
-  if (cur->tok_value != K_SET) {
-    rc = INVALID_STATEMENT;
-    cur->tok_value = INVALID;
-    return rc;
+  if (cur->tok_value == K_WHERE) {
+    cur = cur->next;
+    rc = parse_where_clause(&cur, cd_entries, tab_entry->num_columns,
+                            &row_filter);
+    if (rc) {
+      return rc;
+    }
+  }
+
+  if (cur->tok_value != EOC) {
+    rc = INVALID_STATEMENT;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  // A deleted record only loses its slot, so only the pages with deleted
+  // records are written back.
+  table_scan scan;
+  if ((rc = open_table_scan(tab_entry, &scan, false)) != 0) {
+    return rc;
+  }
+
+  // The WHERE clause is evaluated on the stored record, nothing is decoded.
+  record_layout layout;
+  init_record_layout(cd_entries, tab_entry->num_columns, &layout);
+  compiled_predicate where_filter;
+  if ((rc = compile_predicate(&layout, &row_filter, &where_filter)) != 0) {
+    close_table_scan(&scan);
+    return rc;
+  }
+  bool is_used_col[MAX_NUM_COL];
+  memset(is_used_col, '\0', sizeof(is_used_col));
+  for (int i = 0; i < row_filter.num_conditions; i++) {
+    is_used_col[row_filter.conditions[i].col_id] = true;
+  }
+  use_scan_columns(&scan, is_used_col);
+
+  char *batch_records[FILTER_BATCH_SIZE];
+  uint64_t selection[SELECTION_WORDS];
+  int num_batch_records = 0;
+  int64_t num_affected_records = 0;
+  while (!rc &&
+         ((rc = next_scan_batch(&scan, batch_records, FILTER_BATCH_SIZE,
+                                &num_batch_records)) == 0) &&
+         (num_batch_records > 0)) {
+    // Delete qualified records.
+    eval_compiled_predicate_batch(&where_filter, batch_records,
+                                  num_batch_records, selection);
+    for (int w = 0; w < (num_batch_records + 63) / 64; w++) {
+      num_affected_records += count_selected(selection[w]);
+    }
+    rc = delete_scan_batch(&scan, selection, num_batch_records);
+  }
+  close_table_scan(&scan);
+  free_compiled_predicate(&where_filter);
+  if (rc) {
+    return rc;
+  }
+
+  printf("Affected records: %lld\n", (long long)num_affected_records);
+  if (num_affected_records == 0) {
+    printf("[warning] No records were deleted.\n");
+  }
+  return rc;
+}
+
+int sem_update(token_list *t_list) {
+  int rc = 0;
+  token_list *cur = t_list;
+
+  if (!can_be_identifier(cur)) {
+    rc = INVALID_TABLE_NAME;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  // Check whether the table name exists.
+  tpd_entry *tab_entry = get_tpd_from_list(cur->tok_string);
+  if (tab_entry == NULL) {
+    rc = TABLE_NOT_EXIST;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  // Get column descriptors.
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+
+  cur = cur->next;
+  if (cur->tok_value != K_SET) {
+    rc = INVALID_STATEMENT;
+    cur->tok_value = INVALID;
+    return rc;
   }
 
   // Parse field name of the value to be updated.
@@ -2085,79 +2871,17 @@ int sem_update(token_list *t_list) {
     return rc;
   }
 
-  bool has_where_clause = false;
   record_predicate row_filter;
   memset(&row_filter, '\0', sizeof(row_filter));
   // Parse WHERE clause.
   cur = cur->next;
   if (cur->tok_value == K_WHERE) {
-    has_where_clause = true;
-    row_filter.type = K_AND;
-    row_filter.num_conditions = 1;
-
-    // Parse name of the filtering column.
-    cur = cur->next;
-    if (can_be_identifier(cur)) {
-      int col_index = get_cd_entry_index(cd_entries, tab_entry->num_columns,
-                                         cur->tok_string);
-      if (col_index > -1) {
-        row_filter.conditions[0].col_id = col_index;
-        row_filter.conditions[0].value_type =
-            ((cd_entries[col_index].col_type == T_INT)
-                 ? FIELD_VALUE_TYPE_INT
-                 : FIELD_VALUE_TYPE_STRING);
-      } else {
-        rc = INVALID_COLUMN_NAME;
-        cur->tok_value = INVALID;
-        return rc;
-      }
-    } else {
-      rc = INVALID_COLUMN_NAME;
-      cur->tok_value = INVALID;
-      return rc;
-    }
-
-    // Parse the operator and operand of the condition.
     cur = cur->next;
-    if (cur->tok_value == S_LESS || cur->tok_value == S_GREATER ||
-        cur->tok_value == S_EQUAL) {
-      row_filter.conditions[0].op_type = cur->tok_value;
-      cur = cur->next;
-      if (cur->tok_value == INT_LITERAL) {
-        if (row_filter.conditions[0].value_type == FIELD_VALUE_TYPE_INT) {
-          row_filter.conditions[0].int_data_value = atoi(cur->tok_string);
-        } else {
-          rc = INVALID_CONDITION_OPERAND;
-          cur->tok_value = INVALID;
-          return rc;
-        }
-      } else if (cur->tok_value == STRING_LITERAL) {
-        if (row_filter.conditions[0].value_type == FIELD_VALUE_TYPE_STRING) {
-          strcpy(row_filter.conditions[0].string_data_value, cur->tok_string);
-        } else {
-          rc = INVALID_CONDITION_OPERAND;
-          cur->tok_value = INVALID;
-          return rc;
-        }
-      } else {
-        rc = INVALID_CONDITION;
-        cur->tok_value = INVALID;
-        return rc;
-      }
-    } else if (cur->tok_value == K_IS &&
-               cur->next->tok_value == K_NULL) {  // "IS NULL"
-      cur = cur->next;
-      row_filter.conditions[0].op_type = K_IS;
-    } else if (cur->tok_value == K_IS && cur->next->tok_value == K_NOT &&
-               cur->next->next->tok_value == K_NULL) {  // "IS NOT NULL"
-      cur = cur->next->next;
-      row_filter.conditions[0].op_type = K_NOT;
-    } else {
-      rc = INVALID_CONDITION;
-      cur->tok_value = INVALID;
+    rc = parse_where_clause(&cur, cd_entries, tab_entry->num_columns,
+                            &row_filter);
+    if (rc) {
       return rc;
     }
-    cur = cur->next;
   }
 
   if (cur->tok_value != EOC) {
@@ -2166,32 +2890,54 @@ int sem_update(token_list *t_list) {
     return rc;
   }
 
-  // It is the heap memory owner of the content of the whole table.
-  // Do not forget to free it later.
-  table_file_header *tab_header = NULL;
-  if ((rc = load_table_records(tab_entry, &tab_header)) != 0) {
+  // Records are changed in their pages, and only the changed pages are
+  // written back.
+  table_scan scan;
+  if ((rc = open_table_scan(tab_entry, &scan, false)) != 0) {
     return rc;
   }
 
-  // Load record rows.
-  char *record_in_table = NULL;
-  get_table_records(tab_header, &record_in_table);
-  record_row record_rows[MAX_NUM_ROW];
-  memset(record_rows, '\0', sizeof(record_rows));
-  record_row *p_current_row = NULL;
-  int num_loaded_records = 0;
-  int num_affected_records = 0;
-  for (int i = 0; i < tab_header->num_records; i++) {
-    // Fill all field values (not only displayed columns) from current record.
-    p_current_row = &record_rows[num_loaded_records];
-    fill_record_row(cd_entries, tab_entry->num_columns, p_current_row,
-                    record_in_table);
-    num_loaded_records++;
+  // The WHERE clause is evaluated on the stored record, and only the updated
+  // column of the qualified records is decoded and written.
+  record_layout layout;
+  init_record_layout(cd_entries, tab_entry->num_columns, &layout);
+  row_view current_view;
+  current_view.layout = &layout;
+  field_value row_values[MAX_NUM_COL];
+  compiled_predicate where_filter;
+  if ((rc = compile_predicate(&layout, &row_filter, &where_filter)) != 0) {
+    close_table_scan(&scan);
+    return rc;
+  }
+  bool is_used_col[MAX_NUM_COL];
+  memset(is_used_col, '\0', sizeof(is_used_col));
+  is_used_col[value_to_update.col_id] = true;
+  for (int i = 0; i < row_filter.num_conditions; i++) {
+    is_used_col[row_filter.conditions[i].col_id] = true;
+  }
+  use_scan_columns(&scan, is_used_col);
+
+  char *batch_records[FILTER_BATCH_SIZE];
+  uint64_t selection[SELECTION_WORDS];
+  int num_batch_records = 0;
+  record_row current_row;
+  record_row *p_current_row = &current_row;
+  int64_t num_affected_records = 0;
+  while (!rc &&
+         ((rc = next_scan_batch(&scan, batch_records, FILTER_BATCH_SIZE,
+                                &num_batch_records)) == 0) &&
+         (num_batch_records > 0)) {
+    eval_compiled_predicate_batch(&where_filter, batch_records,
+                                  num_batch_records, selection);
+    for (int i = 0; (i < num_batch_records) && !rc; i++) {
+      // Update qualified records.
+      if (!is_record_selected(selection, i)) {
+        continue;
+      }
+      current_view.record = batch_records[i];
+      materialize_row(&current_view, &value_to_update.col_id, 1,
+                      p_current_row, row_values);
 
-    // Update qualified records.
-    if ((!has_where_clause) ||
-        apply_row_predicate(cd_entries, tab_entry->num_columns, p_current_row,
-                            &row_filter)) {
       // Only update the record if the value is really changed.
       bool value_changed = false;
       if (value_to_update.type == FIELD_VALUE_TYPE_INT) {
@@ -2237,67 +2983,56 @@ int sem_update(token_list *t_list) {
           }
         }
       }
-      if (value_changed) {
-        fill_raw_record_bytes(cd_entries, p_current_row->value_ptrs,
-                              tab_entry->num_columns, record_in_table,
-                              tab_header->record_size);
+      if (value_changed && ((rc = journal_scan_page(&scan)) == 0)) {
+        store_view_column(&current_view, value_to_update.col_id,
+                          p_current_row->value_ptrs[value_to_update.col_id]);
+        rc = update_scan_column(&scan, i, value_to_update.col_id);
         num_affected_records++;
       }
     }
-
-    // Move forward to next record.
-    record_in_table += tab_header->record_size;
+  }
+  close_table_scan(&scan);
+  free_compiled_predicate(&where_filter);
+  if (rc) {
+    return rc;
   }
 
-  printf("Affected records: %d\n", num_affected_records);
+  printf("Affected records: %lld\n", (long long)num_affected_records);
 
-  if (num_affected_records > 0) {
-    // Write records back to .tab file.
-    char table_filename[MAX_IDENT_LEN + 5];
-    sprintf(table_filename, "%s.tab", tab_header->tpd_ptr->table_name);
-    FILE *fhandle = NULL;
-    if ((fhandle = fopen(table_filename, "wbc")) == NULL) {
-      rc = FILE_OPEN_ERROR;
-    } else {
-      tab_header->tpd_ptr = NULL;  // Reset tpd pointer.
-      fwrite(tab_header, tab_header->file_size, 1, fhandle);
-      fflush(fhandle);
-      fclose(fhandle);
-    }
-  } else {
+  if (num_affected_records == 0) {
     printf("[warning] No records were updated.\n");
   }
-
-  free(tab_header);
   return rc;
 }
 
-int create_tab_file(char *table_name, cd_entry cd_entries[], int num_columns) {
+int create_tab_file(char *table_name, cd_entry cd_entries[], int num_columns,
+                    int tpd_flags) {
   int rc = 0;
   table_file_header tab_header;
-
-  int record_size = 0;
-  for (int i = 0; i < num_columns; i++) {
-    record_size += (1 + cd_entries[i].col_len);
+  if (tpd_flags & TPD_FLAG_COLUMNAR) {
+    rc = init_column_file_header(&tab_header, cd_entries, num_columns);
+  } else {
+    rc = init_table_file_header(&tab_header,
+                                get_record_size(cd_entries, num_columns));
+  }
+  if (rc) {
+    return rc;
   }
-  // The total record_size must be rounded to a 4-byte boundary.
-  record_size = round_integer(record_size, 4);
-
-  tab_header.file_size = sizeof(table_file_header);
-  tab_header.record_size = record_size;
-  tab_header.num_records = 0;
-  tab_header.record_offset = sizeof(table_file_header);
-  tab_header.file_header_flag = 0;
-  tab_header.tpd_ptr = NULL;  // Reset tpd pointer.
 
   char table_filename[MAX_IDENT_LEN + 5];
   sprintf(table_filename, "%s.tab", table_name);
+  discard_table_pages(table_name);
+  remove_table_journal(table_name);
   FILE *fhandle = NULL;
 
+  // A new table file is just the header page.
+  char page[TABLE_PAGE_SIZE];
+  memset(page, '\0', TABLE_PAGE_SIZE);
+  memcpy(page, &tab_header, sizeof(table_file_header));
   if ((fhandle = fopen(table_filename, "wbc")) == NULL) {
     rc = FILE_OPEN_ERROR;
   } else {
-    fwrite((void *)&tab_header, tab_header.file_size, 1, fhandle);
+    fwrite(page, TABLE_PAGE_SIZE, 1, fhandle);
     fflush(fhandle);
     fclose(fhandle);
   }
@@ -2305,6 +3040,331 @@ int create_tab_file(char *table_name, cd_entry cd_entries[], int num_columns) {
   return rc;
 }
 
+int parse_where_clause(token_list **p_cur, cd_entry cd_entries[],
+                       int num_columns, record_predicate *p_predicate) {
+  /* Grammar of a WHERE clause, where AND binds tighter than OR:
+       or_expression  := and_expression { OR and_expression }
+       and_expression := not_expression { AND not_expression }
+       not_expression := NOT not_expression | ( or_expression ) | condition
+  *p_cur is left on the first token after the expression. */
+  memset(p_predicate, '\0', sizeof(record_predicate));
+  return parse_boolean_expression(p_cur, cd_entries, num_columns, p_predicate,
+                                  K_OR, 0, &p_predicate->root);
+}
+
+int parse_boolean_expression(token_list **p_cur, cd_entry cd_entries[],
+                             int num_columns, record_predicate *p_predicate,
+                             int op_type, int depth, int *p_node) {
+  // An OR of AND expressions, or an AND of NOT expressions.
+  int rc = 0;
+  int operand = -1;
+  int node = -1;
+  while (!rc) {
+    if (op_type == K_OR) {
+      rc = parse_boolean_expression(p_cur, cd_entries, num_columns,
+                                    p_predicate, K_AND, depth, &operand);
+    } else {
+      rc = parse_not_expression(p_cur, cd_entries, num_columns, p_predicate,
+                                depth, &operand);
+    }
+    if (rc) {
+      break;
+    }
+
+    if (node > -1) {
+      add_predicate_child(p_predicate, node, operand);
+    } else if ((*p_cur)->tok_value == op_type) {
+      // The operator node is only added when there are two operands.
+      node = add_predicate_node(p_predicate, op_type, -1);
+      if (node < 0) {
+        rc = INVALID_CONDITION;
+        (*p_cur)->tok_value = INVALID;
+        break;
+      }
+      add_predicate_child(p_predicate, node, operand);
+    } else {
+      node = operand;
+    }
+
+    if ((*p_cur)->tok_value != op_type) {
+      break;
+    }
+    *p_cur = (*p_cur)->next;
+  }
+  *p_node = node;
+  return rc;
+}
+
+int parse_not_expression(token_list **p_cur, cd_entry cd_entries[],
+                         int num_columns, record_predicate *p_predicate,
+                         int depth, int *p_node) {
+  int rc = 0;
+  token_list *cur = *p_cur;
+  if (depth >= MAX_NUM_PREDICATE_NODES) {
+    rc = INVALID_CONDITION;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  // NOT is an operator unless it is the name of the column of a condition.
+  int next_value = cur->next ? cur->next->tok_value : EOC;
+  if ((cur->tok_value == K_NOT) && (next_value != S_LESS) &&
+      (next_value != S_GREATER) && (next_value != S_EQUAL) &&
+      (next_value != K_IS) && (next_value != K_IN) &&
+      (next_value != K_BETWEEN) && (next_value != K_LIKE)) {
+    int node = add_predicate_node(p_predicate, K_NOT, -1);
+    if (node < 0) {
+      rc = INVALID_CONDITION;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    int operand = -1;
+    *p_cur = cur->next;
+    rc = parse_not_expression(p_cur, cd_entries, num_columns, p_predicate,
+                              depth + 1, &operand);
+    if (!rc) {
+      add_predicate_child(p_predicate, node, operand);
+      *p_node = node;
+    }
+    return rc;
+  }
+
+  if (cur->tok_value == S_LEFT_PAREN) {
+    *p_cur = cur->next;
+    rc = parse_boolean_expression(p_cur, cd_entries, num_columns, p_predicate,
+                                  K_OR, depth + 1, p_node);
+    if (!rc) {
+      if ((*p_cur)->tok_value == S_RIGHT_PAREN) {
+        *p_cur = (*p_cur)->next;
+      } else {
+        rc = INVALID_CONDITION;
+        (*p_cur)->tok_value = INVALID;
+      }
+    }
+    return rc;
+  }
+
+  return parse_condition(p_cur, cd_entries, num_columns, p_predicate, p_node);
+}
+
+int parse_condition(token_list **p_cur, cd_entry cd_entries[], int num_columns,
+                    record_predicate *p_predicate, int *p_node) {
+  int rc = 0;
+  token_list *cur = *p_cur;
+  if (p_predicate->num_conditions == MAX_NUM_CONDITION) {
+    rc = INVALID_CONDITION;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+  record_condition *p_condition =
+      &p_predicate->conditions[p_predicate->num_conditions];
+  memset(p_condition, '\0', sizeof(record_condition));
+
+  // Parse name of the filtering column. An aggregate of HAVING is found by
+  // its name among the columns of the grouped rows.
+  char col_name[MAX_IDENT_LEN + 4];
+  bool is_valid_name = false;
+  if (is_aggregate_call(cur)) {
+    is_valid_name = get_aggregate_name(
+        cur->tok_value, cur->next->next->tok_string, col_name,
+        sizeof(col_name));
+  } else if (can_be_identifier(cur)) {
+    strcpy(col_name, cur->tok_string);
+    is_valid_name = true;
+  }
+  if (is_valid_name) {
+    int col_index = get_cd_entry_index(cd_entries, num_columns, col_name);
+    if (col_index > -1) {
+      p_condition->col_id = col_index;
+      p_condition->value_type = ((cd_entries[col_index].col_type == T_INT)
+                                     ? FIELD_VALUE_TYPE_INT
+                                     : FIELD_VALUE_TYPE_STRING);
+    } else {
+      rc = INVALID_COLUMN_NAME;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+  } else {
+    rc = INVALID_COLUMN_NAME;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  // "NOT IN", "NOT BETWEEN" and "NOT LIKE" are negations.
+  cur = is_aggregate_call(cur) ? cur->next->next->next->next : cur->next;
+  bool is_negated = false;
+  if ((cur->tok_value == K_NOT) && ((cur->next->tok_value == K_IN) ||
+                                    (cur->next->tok_value == K_BETWEEN) ||
+                                    (cur->next->tok_value == K_LIKE))) {
+    is_negated = true;
+    cur = cur->next;
+  }
+  bool is_between = (cur->tok_value == K_BETWEEN);
+  int num_nodes = 1 + (is_between ? 4 : 0) + (is_negated ? 1 : 0);
+  if ((p_predicate->num_nodes + num_nodes > MAX_NUM_PREDICATE_NODES) ||
+      (is_between &&
+       (p_predicate->num_conditions + 2 > MAX_NUM_CONDITION))) {
+    rc = INVALID_CONDITION;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  // Parse the operator and operand of the condition.
+  if (cur->tok_value == S_LESS || cur->tok_value == S_GREATER ||
+      cur->tok_value == S_EQUAL) {
+    p_condition->op_type = cur->tok_value;
+    cur = cur->next;
+    rc = parse_condition_operand(cur, p_condition);
+    if (rc) {
+      return rc;
+    }
+  } else if (cur->tok_value == K_IN) {
+    // "IN (v1, v2, ...)", the values stay in the token list.
+    p_condition->op_type = K_IN;
+    cur = cur->next;
+    if (cur->tok_value != S_LEFT_PAREN) {
+      rc = INVALID_CONDITION;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    cur = cur->next;
+    p_condition->first_in_value = cur;
+    record_condition in_value;
+    in_value.value_type = p_condition->value_type;
+    while (!rc) {
+      rc = parse_condition_operand(cur, &in_value);
+      if (rc) {
+        return rc;
+      }
+      p_condition->num_in_values++;
+      cur = cur->next;
+      if (cur->tok_value == S_RIGHT_PAREN) {
+        break;
+      } else if (cur->tok_value == S_COMMA) {
+        cur = cur->next;
+      } else {
+        rc = INVALID_CONDITION;
+        cur->tok_value = INVALID;
+      }
+    }
+  } else if (cur->tok_value == K_LIKE) {
+    // "LIKE 'pattern'", only for a string column.
+    p_condition->op_type = K_LIKE;
+    cur = cur->next;
+    if (p_condition->value_type != FIELD_VALUE_TYPE_STRING) {
+      rc = INVALID_CONDITION_OPERAND;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    rc = parse_condition_operand(cur, p_condition);
+    if (rc) {
+      return rc;
+    }
+  } else if (is_between) {
+    // "BETWEEN a AND b" is kept as "NOT < a AND NOT > b", which is unknown
+    // for NULL like the comparisons.
+    record_condition *p_upper = p_condition + 1;
+    memcpy(p_upper, p_condition, sizeof(record_condition));
+    p_condition->op_type = S_LESS;
+    p_upper->op_type = S_GREATER;
+    cur = cur->next;
+    rc = parse_condition_operand(cur, p_condition);
+    if (!rc && (cur->next->tok_value != K_AND)) {
+      rc = INVALID_CONDITION;
+      cur->next->tok_value = INVALID;
+    }
+    if (!rc) {
+      cur = cur->next->next;
+      rc = parse_condition_operand(cur, p_upper);
+    }
+    if (rc) {
+      return rc;
+    }
+  } else if (cur->tok_value == K_IS &&
+             cur->next->tok_value == K_NULL) {  // "IS NULL"
+    cur = cur->next;
+    p_condition->op_type = K_IS;
+  } else if (cur->tok_value == K_IS && cur->next->tok_value == K_NOT &&
+             cur->next->next->tok_value == K_NULL) {  // "IS NOT NULL"
+    cur = cur->next->next;
+    p_condition->op_type = K_NOT;
+  } else {
+    rc = INVALID_CONDITION;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  // There is room for the nodes, checked above.
+  int node = add_predicate_node(p_predicate, 0, p_predicate->num_conditions);
+  p_predicate->num_conditions++;
+  if (is_between) {
+    int lower = add_predicate_node(p_predicate, K_NOT, -1);
+    add_predicate_child(p_predicate, lower, node);
+    node = add_predicate_node(p_predicate, 0, p_predicate->num_conditions);
+    p_predicate->num_conditions++;
+    int upper = add_predicate_node(p_predicate, K_NOT, -1);
+    add_predicate_child(p_predicate, upper, node);
+    node = add_predicate_node(p_predicate, K_AND, -1);
+    add_predicate_child(p_predicate, node, lower);
+    add_predicate_child(p_predicate, node, upper);
+  }
+  if (is_negated) {
+    int operand = node;
+    node = add_predicate_node(p_predicate, K_NOT, -1);
+    add_predicate_child(p_predicate, node, operand);
+  }
+  *p_cur = cur->next;
+  *p_node = node;
+  return rc;
+}
+
+int parse_condition_operand(token_list *cur, record_condition *p_condition) {
+  // The literal must have the type of the column.
+  int rc = 0;
+  if (cur->tok_value == INT_LITERAL) {
+    if (p_condition->value_type == FIELD_VALUE_TYPE_INT) {
+      p_condition->int_data_value = atoi(cur->tok_string);
+    } else {
+      rc = INVALID_CONDITION_OPERAND;
+      cur->tok_value = INVALID;
+    }
+  } else if (cur->tok_value == STRING_LITERAL) {
+    if (p_condition->value_type == FIELD_VALUE_TYPE_STRING) {
+      strcpy(p_condition->string_data_value, cur->tok_string);
+      p_condition->string_data_length = strlen(cur->tok_string);
+    } else {
+      rc = INVALID_CONDITION_OPERAND;
+      cur->tok_value = INVALID;
+    }
+  } else {
+    rc = INVALID_CONDITION;
+    cur->tok_value = INVALID;
+  }
+  return rc;
+}
+
+int add_predicate_node(record_predicate *p_predicate, int type,
+                       int condition_index) {
+  if (p_predicate->num_nodes == MAX_NUM_PREDICATE_NODES) {
+    return -1;
+  }
+  int node = p_predicate->num_nodes++;
+  p_predicate->nodes[node].type = type;
+  p_predicate->nodes[node].condition_index = condition_index;
+  p_predicate->nodes[node].first_child = -1;
+  p_predicate->nodes[node].next_sibling = -1;
+  return node;
+}
+
+void add_predicate_child(record_predicate *p_predicate, int parent,
+                         int child) {
+  int *p_link = &p_predicate->nodes[parent].first_child;
+  while (*p_link > -1) {
+    p_link = &p_predicate->nodes[*p_link].next_sibling;
+  }
+  *p_link = child;
+}
+
 int check_insert_values(field_value field_values[], int num_values,
                         cd_entry cd_entries[], int num_columns) {
   int rc = 0;
@@ -2357,34 +3417,30 @@ void free_token_list(token_list *const t_list) {
   }
 }
 
-int load_table_records(tpd_entry *tpd, table_file_header **pp_table_header) {
-  int rc = 0;
-  char table_filename[MAX_IDENT_LEN + 5];
-  sprintf(table_filename, "%s.tab", tpd->table_name);
-  FILE *fhandle = NULL;
-  if ((fhandle = fopen(table_filename, "rbc")) == NULL) {
-    return FILE_OPEN_ERROR;
-  }
-  int file_size = get_file_size(fhandle);
-  table_file_header *tab_header = (table_file_header *)malloc(file_size);
-  fread(tab_header, file_size, 1, fhandle);
-  fclose(fhandle);
-  if (tab_header->file_size != file_size) {
-    rc = TABFILE_CORRUPTION;
-    free(tab_header);
+int64_t get_file_size(FILE *fhandle) {
+  if (!fhandle) {
+    return -1;
   }
-  tab_header->tpd_ptr = tpd;
-  *pp_table_header = tab_header;
-  return rc;
+  struct _stati64 file_stat;
+  _fstati64(_fileno(fhandle), &file_stat);
+  return (int64_t)(file_stat.st_size);
 }
 
-int get_file_size(FILE *fhandle) {
-  if (!fhandle) {
-    return -1;
+int copy_file_bytes(FILE *f_src, FILE *f_dst, int64_t num_bytes) {
+  char buffer[FILE_COPY_CHUNK_SIZE];
+  while (num_bytes > 0) {
+    size_t chunk_size = (num_bytes < FILE_COPY_CHUNK_SIZE)
+                            ? (size_t)num_bytes
+                            : FILE_COPY_CHUNK_SIZE;
+    if (fread(buffer, chunk_size, 1, f_src) != 1) {
+      return FILE_OPEN_ERROR;
+    }
+    if (fwrite(buffer, chunk_size, 1, f_dst) != 1) {
+      return FILE_WRITE_ERROR;
+    }
+    num_bytes -= chunk_size;
   }
-  struct _stat file_stat;
-  _fstat(_fileno(fhandle), &file_stat);
-  return (int)(file_stat.st_size);
+  return 0;
 }
 
 int fill_raw_record_bytes(cd_entry cd_entries[], field_value *field_values[],
@@ -2434,46 +3490,81 @@ int fill_raw_record_bytes(cd_entry cd_entries[], field_value *field_values[],
   return cur_offset_in_record;
 }
 
-int fill_record_row(cd_entry cd_entries[], int num_cols, record_row *p_row,
-                    char record_bytes[]) {
-  memset(p_row, '\0', sizeof(record_row));
-
+void init_record_layout(cd_entry cd_entries[], int num_columns,
+                        record_layout *p_layout) {
+  memset(p_layout, '\0', sizeof(record_layout));
   int offset_in_record = 0;
-  unsigned char value_length = 0;
-  field_value *p_field_value = NULL;
-  for (int i = 0; i < num_cols; i++) {
-    // Get value length.
-    memcpy(&value_length, record_bytes + offset_in_record, 1);
-    offset_in_record += 1;
-
-    // Get field value.
-    p_field_value = (field_value *)malloc(sizeof(field_value));
-    p_field_value->col_id = cd_entries[i].col_id;
-    p_field_value->is_null = (value_length == 0);
-    p_field_value->linked_token = NULL;
-    if (cd_entries[i].col_type == T_INT) {
-      // Set an integer.
-      p_field_value->type = FIELD_VALUE_TYPE_INT;
-      if (!p_field_value->is_null) {
-        memcpy(&p_field_value->int_value, record_bytes + offset_in_record,
-               value_length);
-      }
+  for (int i = 0; i < num_columns; i++) {
+    p_layout->columns[i].offset = offset_in_record;
+    p_layout->columns[i].col_type = cd_entries[i].col_type;
+    p_layout->columns[i].col_len = cd_entries[i].col_len;
+    p_layout->columns[i].not_null = cd_entries[i].not_null;
+    offset_in_record += (1 + cd_entries[i].col_len);
+  }
+  p_layout->num_columns = num_columns;
+  p_layout->record_size = get_record_size(cd_entries, num_columns);
+}
+
+void decode_view_column(row_view *p_row_view, int col_id,
+                        field_value *p_value) {
+  p_value->col_id = col_id;
+  p_value->is_null = is_view_column_null(p_row_view, col_id);
+  p_value->linked_token = NULL;
+  if (p_row_view->layout->columns[col_id].col_type == T_INT) {
+    p_value->type = FIELD_VALUE_TYPE_INT;
+    if (!p_value->is_null) {
+      p_value->int_value = get_view_column_int(p_row_view, col_id);
+    }
+  } else {
+    p_value->type = FIELD_VALUE_TYPE_STRING;
+    if (!p_value->is_null) {
+      int value_length = 0;
+      char *string_value =
+          get_view_column_string(p_row_view, col_id, &value_length);
+      memcpy(p_value->string_value, string_value, value_length);
+      p_value->string_value[value_length] = '\0';
+    }
+  }
+}
+
+void store_view_column(row_view *p_row_view, int col_id,
+                       field_value *p_value) {
+  // Same encoding as fill_raw_record_bytes(), for one column.
+  column_layout *p_column = &p_row_view->layout->columns[col_id];
+  char *field = p_row_view->record + p_column->offset;
+  memset(field, '\0', 1 + p_column->col_len);
+  if (p_value->is_null) {
+    return;
+  }
+  if (p_column->col_type == T_INT) {
+    field[0] = (char)p_column->col_len;
+    memcpy(field + 1, &p_value->int_value, p_column->col_len);
+  } else {
+    int value_length = (int)strlen(p_value->string_value);
+    field[0] = (char)value_length;
+    memcpy(field + 1, p_value->string_value, value_length);
+  }
+}
+
+void materialize_row(row_view *p_row_view, int col_ids[], int num_col_ids,
+                     record_row *p_row, field_value values[]) {
+  /* Only the listed columns get a field value, the other value_ptrs stay
+  NULL. The values are allocated for the row unless values[] is given, in
+  which case a column uses values[col_id]. */
+  memset(p_row, '\0', sizeof(record_row));
+  for (int i = 0; i < num_col_ids; i++) {
+    int col_id = col_ids[i];
+    field_value *p_value = NULL;
+    if (values) {
+      p_value = &values[col_id];
     } else {
-      // Set a string.
-      p_field_value->type = FIELD_VALUE_TYPE_STRING;
-      if (!p_field_value->is_null) {
-        memcpy(p_field_value->string_value, record_bytes + offset_in_record,
-               value_length);
-        p_field_value->string_value[value_length] = '\0';
-      }
+      p_value = (field_value *)malloc(sizeof(field_value));
     }
-    p_row->value_ptrs[i] = p_field_value;
-    offset_in_record += cd_entries[i].col_len;
+    decode_view_column(p_row_view, col_id, p_value);
+    p_row->value_ptrs[col_id] = p_value;
   }
-  p_row->num_fields = num_cols;
-  p_row->sorting_col_id = -1;
+  p_row->num_fields = p_row_view->layout->num_columns;
   p_row->next = NULL;
-  return offset_in_record;
 }
 
 void print_table_border(cd_entry *sorted_cd_entries[], int num_values) {
@@ -2507,42 +3598,6 @@ int column_display_width(cd_entry *col_entry) {
   }
 }
 
-void print_record_row(cd_entry *sorted_cd_entries[], int num_cols,
-                      record_row *row) {
-  int col_gap = 0;
-  char display_value[MAX_STRING_LEN + 1];
-  int col_index = -1;
-  field_value **field_values = row->value_ptrs;
-  bool left_align = true;
-  for (int i = 0; i < num_cols; i++) {
-    col_index = sorted_cd_entries[i]->col_id;
-    left_align = true;
-    if (!field_values[col_index]->is_null) {
-      if (field_values[col_index]->type == FIELD_VALUE_TYPE_INT) {
-        left_align = false;
-        sprintf(display_value, "%d", field_values[col_index]->int_value);
-      } else {
-        strcpy(display_value, field_values[col_index]->string_value);
-      }
-    } else {
-      // Display NULL value as a dash.
-      strcpy(display_value, "-");
-      left_align = (field_values[col_index]->type == FIELD_VALUE_TYPE_STRING);
-    }
-    col_gap =
-        column_display_width(sorted_cd_entries[i]) - strlen(display_value) + 1;
-    if (left_align) {
-      printf("| %s", display_value);
-      repeat_print_char(' ', col_gap);
-    } else {
-      printf("|");
-      repeat_print_char(' ', col_gap);
-      printf("%s ", display_value);
-    }
-  }
-  printf("%c\n", '|');
-}
-
 int get_cd_entry_index(cd_entry cd_entries[], int num_cols, char *col_name) {
   for (int i = 0; i < num_cols; i++) {
     // Column names are case-insensitive.
@@ -2553,89 +3608,115 @@ int get_cd_entry_index(cd_entry cd_entries[], int num_cols, char *col_name) {
   return -1;
 }
 
-void print_aggregate_result(int aggregate_type, int num_fields,
-                            int records_count, int int_sum,
-                            cd_entry *sorted_cd_entries[]) {
-  char display_value[MAX_STRING_LEN + 1];
-  memset(display_value, '\0', sizeof(display_value));
-  if (aggregate_type == F_SUM) {
-    sprintf(display_value, "%d", int_sum);
-  } else if (aggregate_type == F_AVG) {
-    if (records_count == 0) {
-      // Divided by zero error, show as NaN (i.e. Not-a-number).
-      sprintf(display_value, "NaN");
+void print_aggregate_result(select_plan *p_plan, grouped_columns *p_grouped,
+                            int num_values, row_batch *p_batch) {
+  /* The aggregates of a whole table are shown as a table of one row, where
+  a column is as wide as its title or its value. Without any value, SUM
+  shows 0 and AVG shows NaN, while MIN and MAX are NULL. A NULL p_batch,
+  when HAVING or LIMIT drops the row, shows the titles only. */
+  char display_values[MAX_NUM_COL][MAX_STRING_LEN + 1];
+  int display_widths[MAX_NUM_COL];
+  for (int c = 0; c < num_values; c++) {
+    display_widths[c] = strlen(p_grouped->titles[c]);
+    if (!p_batch) {
+      continue;
+    }
+    int row = p_batch->selected[0];
+    column_vector *p_vector = p_batch->columns[c];
+    int function =
+        p_plan->group_aggregates[p_plan->grouped_cols[c].aggregate_index]
+            .function;
+    char *display_value = display_values[c];
+    if (p_vector->is_null[row]) {
+      if (function == F_AVG) {
+        // Divided by zero error, show as NaN (i.e. Not-a-number).
+        strcpy(display_value, "NaN");
+      } else {
+        strcpy(display_value, (function == F_SUM) ? "0" : "-");
+      }
+    } else if (p_vector->col_type == T_INT) {
+      sprintf(display_value, "%lld", (long long)p_vector->long_values[row]);
     } else {
-      sprintf(display_value, "%d", int_sum / records_count);
+      strcpy(display_value,
+             p_vector->string_values + row * p_vector->value_size);
     }
-  } else if (aggregate_type == F_COUNT) {
-    sprintf(display_value, "%d", records_count);
-  }
-
-  char display_title[MAX_STRING_LEN + 1];
-  memset(display_title, '\0', sizeof(display_title));
-  if (num_fields == 1) {
-    // Aggregate on one column.
-    if (aggregate_type == F_SUM) {
-      sprintf(display_title, "SUM(%s)", sorted_cd_entries[0]->col_name);
-    } else if (aggregate_type == F_AVG) {
-      sprintf(display_title, "AVG(%s)", sorted_cd_entries[0]->col_name);
-    } else {  // F_COUNT
-      sprintf(display_title, "COUNT(%s)", sorted_cd_entries[0]->col_name);
+    if ((int)strlen(display_value) > display_widths[c]) {
+      display_widths[c] = strlen(display_value);
     }
-  } else {
-    // Aggregate on one column.
-    sprintf(display_title, "COUNT(*)");
   }
 
-  int display_width = (strlen(display_value) > strlen(display_title))
-                          ? strlen(display_value)
-                          : strlen(display_title);
-  printf("+");
-  repeat_print_char('-', display_width + 2);
-  printf("+\n");
-
-  printf("| %s ", display_title);
-  repeat_print_char(' ', display_width - strlen(display_title));
-  printf("|\n");
-
-  printf("+");
-  repeat_print_char('-', display_width + 2);
-  printf("+\n");
-
-  printf("| %s ", display_value);
-  repeat_print_char(' ', display_width - strlen(display_value));
+  print_aggregate_border(display_widths, num_values);
+  for (int c = 0; c < num_values; c++) {
+    printf("| %s ", p_grouped->titles[c]);
+    repeat_print_char(' ', display_widths[c] - strlen(p_grouped->titles[c]));
+  }
   printf("|\n");
+  print_aggregate_border(display_widths, num_values);
+  if (p_batch) {
+    for (int c = 0; c < num_values; c++) {
+      printf("| %s ", display_values[c]);
+      repeat_print_char(' ', display_widths[c] - strlen(display_values[c]));
+    }
+    printf("|\n");
+  }
+  print_aggregate_border(display_widths, num_values);
+}
 
-  printf("+");
-  repeat_print_char('-', display_width + 2);
+void print_aggregate_border(int display_widths[], int num_values) {
+  for (int c = 0; c < num_values; c++) {
+    printf("+");
+    repeat_print_char('-', display_widths[c] + 2);
+  }
   printf("+\n");
 }
 
 bool apply_row_predicate(cd_entry cd_entries[], int num_cols, record_row *p_row,
                          record_predicate *p_predicate) {
-  if ((!p_predicate) || (p_predicate->num_conditions < 1)) {
+  if ((!p_predicate) || (p_predicate->num_nodes < 1)) {
     return true;
   }
+  // A row qualifies only when the WHERE clause is true, not unknown.
+  return eval_row_predicate_node(p_row, p_predicate, p_predicate->root) ==
+         TRUTH_TRUE;
+}
 
-  // Evaluate the first condition.
-  field_value *lhs_operand =
-      p_row->value_ptrs[p_predicate->conditions[0].col_id];
-  bool result = eval_condition(&p_predicate->conditions[0], lhs_operand);
-  if (p_predicate->num_conditions == 1) {
-    // Only one condition.
-    return result;
-  }
-
-  // Evaluate the second condition.
-  lhs_operand = p_row->value_ptrs[p_predicate->conditions[1].col_id];
-  if (p_predicate->type == K_AND) {
-    // AND conditions.
-    result = result && eval_condition(&p_predicate->conditions[1], lhs_operand);
-  } else {
-    // OR conditions.
-    result = result || eval_condition(&p_predicate->conditions[1], lhs_operand);
+int eval_row_predicate_node(record_row *p_row, record_predicate *p_predicate,
+                            int node) {
+  predicate_node *p_node = &p_predicate->nodes[node];
+  if (p_node->type == 0) {
+    record_condition *p_condition =
+        &p_predicate->conditions[p_node->condition_index];
+    field_value *lhs_operand = p_row->value_ptrs[p_condition->col_id];
+    if (lhs_operand->is_null && (p_condition->op_type != K_IS) &&
+        (p_condition->op_type != K_NOT)) {
+      // Comparing NULL gives unknown.
+      return TRUTH_UNKNOWN;
+    }
+    return eval_condition(p_condition, lhs_operand) ? TRUTH_TRUE
+                                                    : TRUTH_FALSE;
+  }
+
+  if (p_node->type == K_NOT) {
+    int result = eval_row_predicate_node(p_row, p_predicate,
+                                         p_node->first_child);
+    return (result == TRUTH_UNKNOWN) ? TRUTH_UNKNOWN
+           : (result == TRUTH_TRUE)  ? TRUTH_FALSE
+                                     : TRUTH_TRUE;
+  }
+
+  // AND is false when a child is false, OR is true when a child is true.
+  // Otherwise, either is unknown when a child is unknown.
+  int decisive = (p_node->type == K_AND) ? TRUTH_FALSE : TRUTH_TRUE;
+  int result = (p_node->type == K_AND) ? TRUTH_TRUE : TRUTH_FALSE;
+  for (int child = p_node->first_child; child > -1;
+       child = p_predicate->nodes[child].next_sibling) {
+    int child_result = eval_row_predicate_node(p_row, p_predicate, child);
+    if (child_result == decisive) {
+      return decisive;
+    } else if (child_result == TRUTH_UNKNOWN) {
+      result = TRUTH_UNKNOWN;
+    }
   }
-
   return result;
 }
 
@@ -2701,6 +3782,32 @@ bool eval_condition(record_condition *p_condition, field_value *p_field_value) {
       // Operator "IS_NOT_NULL"
       result = !p_field_value->is_null;
       break;
+    case K_IN: {
+      // Operator "IN", an equality with each value of the list.
+      token_list *cur = p_condition->first_in_value;
+      result = false;
+      for (int i = 0; (i < p_condition->num_in_values) && !result; i++) {
+        if (p_field_value->is_null) {
+          break;
+        } else if (p_condition->value_type == FIELD_VALUE_TYPE_INT) {
+          result = (p_field_value->int_value == atoi(cur->tok_string));
+        } else {
+          result = (strcmp(p_field_value->string_value, cur->tok_string) == 0);
+        }
+        cur = cur->next->next;  // Skip the comma.
+      }
+      break;
+    }
+    case K_LIKE:
+      // Operator "LIKE"
+      if (p_field_value->is_null) {
+        result = false;
+      } else {
+        result = match_like_pattern(
+            p_field_value->string_value, strlen(p_field_value->string_value),
+            p_condition->string_data_value, p_condition->string_data_length);
+      }
+      break;
     default:
       // Return true for unknown relational operators.
       printf("[warning] unknown relational operator: %d\n",
@@ -2710,419 +3817,5744 @@ bool eval_condition(record_condition *p_condition, field_value *p_field_value) {
   return result;
 }
 
-void sort_records(record_row rows[], int num_records, cd_entry *p_sorting_col,
-                  bool is_desc) {
-  for (int i = 0; i < num_records; i++) {
-    rows[i].sorting_col_id = p_sorting_col->col_id;
-  }
-  qsort(rows, num_records, sizeof(record_row), records_comparator);
-  record_row temp_record;
-  if (is_desc) {
-    for (int i = 0; i < num_records / 2; i++) {
-      // temp_record := rows[i];
-      memcpy(&temp_record, &rows[i], sizeof(record_row));
-      // rows[i] := rows[num_records - 1 - i];
-      memcpy(&rows[i], &rows[num_records - 1 - i], sizeof(record_row));
-      // rows[num_records - 1 - i] := temp_record;
-      memcpy(&rows[num_records - 1 - i], &temp_record, sizeof(record_row));
-    }
-  }
-}
-
-int records_comparator(const void *arg1, const void *arg2) {
-  record_row *p_record1 = (record_row *)arg1;
-  record_row *p_record2 = (record_row *)arg2;
-  int sorting_col_id = p_record1->sorting_col_id;
-
-  // If result < 0, elem1 less than elem2;
-  // If result = 0, elem1 equivalent to elem2;
-  // If result > 0, elem1 greater than elem2.
-  int result = 0;
-  field_value *p_value1 = p_record1->value_ptrs[sorting_col_id];
-  field_value *p_value2 = p_record2->value_ptrs[sorting_col_id];
-  if (p_value1->type == FIELD_VALUE_TYPE_INT) {
-    // Compare 2 integers.
-    // NULL is smaller than any other values.
-    if (p_value1->is_null) {
-      result = (p_value2->is_null ? 0 : -1);
-    } else {
-      if (p_value2->is_null) {
-        result = 1;
-      } else if (p_value1->int_value < p_value2->int_value) {
-        result = -1;
-      } else if (p_value1->int_value > p_value2->int_value) {
-        result = 1;
+/* Evaluators of compiled conditions, one instantiation per type, operator,
+nullability and negation. They give the same results as eval_condition(),
+and a negated comparison is false for NULL too. */
+template <int op_type, bool is_nullable, bool is_negated>
+bool eval_int_condition(const compiled_condition *p_condition,
+                        const char *record) {
+  if (is_nullable && (record[p_condition->offset] == 0)) {
+    // NULL never satisfies "<", "=" or ">", nor their negation.
+    return false;
+  }
+  int int_value = 0;
+  memcpy(&int_value, record + p_condition->offset + 1, sizeof(int));
+  if (op_type == S_LESS) {
+    return (int_value < p_condition->int_value) != is_negated;
+  } else if (op_type == S_GREATER) {
+    return (int_value > p_condition->int_value) != is_negated;
+  }
+  return (int_value == p_condition->int_value) != is_negated;
+}
+
+template <int op_type, bool is_negated>
+bool eval_string_condition(const compiled_condition *p_condition,
+                           const char *record) {
+  // A string is always checked for NULL, since an empty string is stored
+  // with the zero length byte of NULL even in a NOT NULL column.
+  int length = (unsigned char)record[p_condition->offset];
+  if (length == 0) {
+    return false;
+  }
+  const char *string_value = record + p_condition->offset + 1;
+  if (op_type == S_EQUAL) {
+    return ((length == p_condition->string_length) &&
+            (memcmp(string_value, p_condition->string_value, length) ==
+             0)) != is_negated;
+  }
+
+  // The stored string is not terminated, so it is compared by length like
+  // strcmp() would.
+  int common_length = (length < p_condition->string_length)
+                          ? length
+                          : p_condition->string_length;
+  int comparison =
+      memcmp(string_value, p_condition->string_value, common_length);
+  if (comparison == 0) {
+    comparison = length - p_condition->string_length;
+  }
+  return ((op_type == S_LESS) ? (comparison < 0) : (comparison > 0)) !=
+         is_negated;
+}
+
+template <bool is_nullable, bool is_negated>
+bool eval_in_int_condition(const compiled_condition *p_condition,
+                           const char *record) {
+  if (is_nullable && (record[p_condition->offset] == 0)) {
+    return false;
+  }
+  int int_value = 0;
+  memcpy(&int_value, record + p_condition->offset + 1, sizeof(int));
+  return contains_int_value(p_condition->p_value_set, int_value) !=
+         is_negated;
+}
+
+template <bool is_negated>
+bool eval_in_string_condition(const compiled_condition *p_condition,
+                              const char *record) {
+  if (record[p_condition->offset] == 0) {
+    return false;
+  }
+  return contains_string_value(p_condition->p_value_set,
+                               record + p_condition->offset) != is_negated;
+}
+
+template <int like_pattern, bool is_negated>
+bool eval_like_condition(const compiled_condition *p_condition,
+                         const char *record) {
+  // The pattern is matched on the stored bytes, which are not terminated.
+  int length = (unsigned char)record[p_condition->offset];
+  if (length == 0) {
+    return false;
+  }
+  const char *string_value = record + p_condition->offset + 1;
+  const char *literal = p_condition->string_value;
+  int literal_length = p_condition->string_length;
+  bool result = false;
+  if (like_pattern == LIKE_EXACT) {
+    result = (length == literal_length) &&
+             (memcmp(string_value, literal, length) == 0);
+  } else if (like_pattern == LIKE_PREFIX) {
+    result = (length >= literal_length) &&
+             (memcmp(string_value, literal, literal_length) == 0);
+  } else if (like_pattern == LIKE_SUFFIX) {
+    result = (length >= literal_length) &&
+             (memcmp(string_value + length - literal_length, literal,
+                     literal_length) == 0);
+  } else if (like_pattern == LIKE_INFIX) {
+    // The whole field can be read, past the end of the string.
+    result = get_filter_kernels()->find_bytes(
+        string_value, length, p_condition->col_len, literal, literal_length);
+  } else {
+    result = match_like_pattern(string_value, length, literal,
+                                literal_length);
+  }
+  return result != is_negated;
+}
+
+template <int like_pattern>
+bool (*like_condition_evaluator(bool is_negated))(const compiled_condition *,
+                                                  const char *) {
+  return is_negated ? eval_like_condition<like_pattern, true>
+                    : eval_like_condition<like_pattern, false>;
+}
+
+template <bool is_null, bool is_nullable>
+bool eval_null_condition(const compiled_condition *p_condition,
+                         const char *record) {
+  if (!is_nullable) {
+    return !is_null;
+  }
+  return (record[p_condition->offset] == 0) == is_null;
+}
+
+bool eval_unknown_condition(const compiled_condition *p_condition,
+                            const char *record) {
+  // Unknown relational operators are true, as in eval_condition().
+  (void)p_condition;
+  (void)record;
+  return true;
+}
+
+bool eval_no_condition(const compiled_predicate *p_compiled,
+                       const char *record) {
+  (void)p_compiled;
+  (void)record;
+  return true;
+}
+
+bool eval_one_condition(const compiled_predicate *p_compiled,
+                        const char *record) {
+  const compiled_condition *p_condition =
+      &p_compiled->conditions[p_compiled->nodes[p_compiled->root]
+                                  .condition_index];
+  return p_condition->eval(p_condition, record);
+}
+
+bool eval_predicate_tree(const compiled_predicate *p_compiled,
+                         const char *record) {
+  return eval_compiled_node(p_compiled, p_compiled->root, record);
+}
+
+bool eval_compiled_node(const compiled_predicate *p_compiled, int node,
+                        const char *record) {
+  const predicate_node *p_node = &p_compiled->nodes[node];
+  if (p_node->type == 0) {
+    const compiled_condition *p_condition =
+        &p_compiled->conditions[p_node->condition_index];
+    return p_condition->eval(p_condition, record);
+  }
+
+  // The children are in evaluation order, the first decisive one ends it.
+  bool is_and = (p_node->type == K_AND);
+  for (int child = p_node->first_child; child > -1;
+       child = p_compiled->nodes[child].next_sibling) {
+    if (eval_compiled_node(p_compiled, child, record) != is_and) {
+      return !is_and;
+    }
+  }
+  return is_and;
+}
+
+template <int op_type>
+bool (*int_condition_evaluator(bool is_nullable, bool is_negated))(
+    const compiled_condition *, const char *) {
+  if (is_nullable) {
+    return is_negated ? eval_int_condition<op_type, true, true>
+                      : eval_int_condition<op_type, true, false>;
+  }
+  return is_negated ? eval_int_condition<op_type, false, true>
+                    : eval_int_condition<op_type, false, false>;
+}
+
+void compile_condition(column_layout *p_column, record_condition *p_condition,
+                       bool is_negated, compiled_condition *p_target) {
+  p_target->offset = p_column->offset;
+  p_target->col_len = p_column->col_len;
+  p_target->op_type = p_condition->op_type;
+  p_target->value_type = p_condition->value_type;
+  p_target->int_value = p_condition->int_data_value;
+  p_target->string_length = p_condition->string_data_length;
+  p_target->string_value = p_condition->string_data_value;
+
+  // Only an integer column is known to be never NULL.
+  bool is_nullable = (p_column->col_type != T_INT) || !p_column->not_null;
+  p_target->is_nullable = is_nullable;
+  bool is_int = (p_condition->value_type == FIELD_VALUE_TYPE_INT);
+  switch (p_condition->op_type) {
+    case S_LESS:
+      p_target->is_negated = is_negated;
+      p_target->eval =
+          is_int ? int_condition_evaluator<S_LESS>(is_nullable, is_negated)
+          : is_negated ? eval_string_condition<S_LESS, true>
+                       : eval_string_condition<S_LESS, false>;
+      break;
+    case S_EQUAL:
+      p_target->is_negated = is_negated;
+      p_target->eval =
+          is_int ? int_condition_evaluator<S_EQUAL>(is_nullable, is_negated)
+          : is_negated ? eval_string_condition<S_EQUAL, true>
+                       : eval_string_condition<S_EQUAL, false>;
+      break;
+    case S_GREATER:
+      p_target->is_negated = is_negated;
+      p_target->eval =
+          is_int ? int_condition_evaluator<S_GREATER>(is_nullable, is_negated)
+          : is_negated ? eval_string_condition<S_GREATER, true>
+                       : eval_string_condition<S_GREATER, false>;
+      break;
+    case K_IN:
+      // The value set is built by compile_predicate().
+      p_target->is_negated = is_negated;
+      if (is_int) {
+        p_target->eval =
+            is_nullable ? (is_negated ? eval_in_int_condition<true, true>
+                                      : eval_in_int_condition<true, false>)
+            : is_negated ? eval_in_int_condition<false, true>
+                         : eval_in_int_condition<false, false>;
       } else {
-        result = 0;
+        p_target->eval = is_negated ? eval_in_string_condition<true>
+                                    : eval_in_string_condition<false>;
+      }
+      break;
+    case K_LIKE: {
+      // The literal part of the pattern is compared without wildcards.
+      int start = 0;
+      p_target->is_negated = is_negated;
+      p_target->like_pattern =
+          get_like_pattern(p_condition->string_data_value,
+                           p_condition->string_data_length, &start,
+                           &p_target->string_length);
+      p_target->string_value = p_condition->string_data_value + start;
+      switch (p_target->like_pattern) {
+        case LIKE_EXACT:
+          p_target->eval = like_condition_evaluator<LIKE_EXACT>(is_negated);
+          break;
+        case LIKE_PREFIX:
+          p_target->eval = like_condition_evaluator<LIKE_PREFIX>(is_negated);
+          break;
+        case LIKE_SUFFIX:
+          p_target->eval = like_condition_evaluator<LIKE_SUFFIX>(is_negated);
+          break;
+        case LIKE_INFIX:
+          p_target->eval = like_condition_evaluator<LIKE_INFIX>(is_negated);
+          break;
+        default:
+          p_target->eval = like_condition_evaluator<LIKE_GENERAL>(is_negated);
       }
+      break;
     }
-  } else {
-    // Compare 2 strings.
-    // NULL is smaller than any other values.
-    if (p_value1->is_null) {
-      result = (p_value2->is_null ? 0 : -1);
-    } else {
-      if (p_value2->is_null) {
-        result = 1;
+    case K_IS:
+    case K_NOT:
+      // "IS NULL" under a NOT is "IS NOT NULL", and the other way round.
+      if (is_negated) {
+        p_target->op_type = (p_condition->op_type == K_IS) ? K_NOT : K_IS;
+      }
+      if (p_target->op_type == K_IS) {
+        p_target->eval = is_nullable ? eval_null_condition<true, true>
+                                     : eval_null_condition<true, false>;
       } else {
-        result = strcmp(p_value1->string_value, p_value2->string_value);
+        p_target->eval = is_nullable ? eval_null_condition<false, true>
+                                     : eval_null_condition<false, false>;
       }
-    }
+      break;
+    default:
+      printf("[warning] unknown relational operator: %d\n",
+             p_condition->op_type);
+      p_target->eval = eval_unknown_condition;
   }
-  return result;
 }
 
-void free_record_row(record_row *row, bool to_last) {
-  record_row *current_row = row;
-  record_row *temp = NULL;
-  while (current_row) {
-    for (int i = 0; i < current_row->num_fields; i++) {
-      free(current_row->value_ptrs[i]);
-    }
-    if (!to_last) {
+void estimate_condition(const compiled_condition *p_condition, double *p_cost,
+                        double *p_selectivity) {
+  /* Without column statistics, an equality keeps a tenth of the rows and a
+  range a third. An integer test costs one, a string equality two and a
+  string range four. A NULL test of a NOT NULL column is free. */
+  bool is_int = (p_condition->value_type == FIELD_VALUE_TYPE_INT);
+  switch (p_condition->op_type) {
+    case S_EQUAL:
+      *p_selectivity = 0.1;
+      *p_cost = is_int ? 1 : 2;
+      break;
+    case S_LESS:
+    case S_GREATER:
+      *p_selectivity = 1.0 / 3;
+      *p_cost = is_int ? 1 : 4;
+      break;
+    case K_IN:
+      // Each value as an equality, and a lookup in the set.
+      *p_selectivity = 0.1 * p_condition->p_value_set->num_values;
+      if (*p_selectivity > 0.9) {
+        *p_selectivity = 0.9;
+      }
+      *p_cost = is_int ? 2 : 3;
+      break;
+    case K_LIKE:
+      // A pattern with a wildcard keeps more rows than an equality, and
+      // the further the literal is from the start, the more it costs.
+      *p_selectivity = (p_condition->like_pattern == LIKE_EXACT) ? 0.1 : 0.25;
+      *p_cost = (p_condition->like_pattern == LIKE_EXACT)    ? 2
+                : (p_condition->like_pattern == LIKE_PREFIX) ? 2
+                : (p_condition->like_pattern == LIKE_SUFFIX) ? 3
+                : (p_condition->like_pattern == LIKE_INFIX)  ? 8
+                                                             : 16;
+      break;
+    case K_IS:
+      *p_selectivity = p_condition->is_nullable ? 0.1 : 0;
+      *p_cost = p_condition->is_nullable ? 1 : 0;
+      return;
+    case K_NOT:
+      *p_selectivity = p_condition->is_nullable ? 0.9 : 1;
+      *p_cost = p_condition->is_nullable ? 1 : 0;
+      return;
+    default:
+      *p_selectivity = 1;
+      *p_cost = 0;
       return;
+  }
+  if (p_condition->is_negated) {
+    *p_selectivity = 1 - *p_selectivity;
+  }
+}
+
+void collect_predicate_operands(record_predicate *p_predicate, int node,
+                                bool is_negated, int type, int operands[],
+                                bool negations[], int *p_num_operands) {
+  // Skip the NOT nodes, then merge a node which has the same type once
+  // negated.
+  while (p_predicate->nodes[node].type == K_NOT) {
+    node = p_predicate->nodes[node].first_child;
+    is_negated = !is_negated;
+  }
+  int node_type = p_predicate->nodes[node].type;
+  if (is_negated && (node_type != 0)) {
+    node_type = (node_type == K_AND) ? K_OR : K_AND;
+  }
+  if (node_type != type) {
+    operands[*p_num_operands] = node;
+    negations[*p_num_operands] = is_negated;
+    (*p_num_operands)++;
+    return;
+  }
+  for (int child = p_predicate->nodes[node].first_child; child > -1;
+       child = p_predicate->nodes[child].next_sibling) {
+    collect_predicate_operands(p_predicate, child, is_negated, type, operands,
+                               negations, p_num_operands);
+  }
+}
+
+int compile_predicate_node(record_layout *p_layout,
+                           record_predicate *p_predicate, int node,
+                           bool is_negated, compiled_predicate *p_compiled,
+                           double *p_cost, double *p_selectivity) {
+  predicate_node *p_node = &p_predicate->nodes[node];
+  if (p_node->type == K_NOT) {
+    return compile_predicate_node(p_layout, p_predicate, p_node->first_child,
+                                  !is_negated, p_compiled, p_cost,
+                                  p_selectivity);
+  }
+
+  int target = p_compiled->num_nodes++;
+  predicate_node *p_target = &p_compiled->nodes[target];
+  p_target->first_child = -1;
+  p_target->next_sibling = -1;
+  p_target->condition_index = -1;
+  if (p_node->type == 0) {
+    // Each condition keeps its index, it is only used once.
+    record_condition *p_condition =
+        &p_predicate->conditions[p_node->condition_index];
+    compiled_condition *p_compiled_condition =
+        &p_compiled->conditions[p_node->condition_index];
+    compile_condition(&p_layout->columns[p_condition->col_id], p_condition,
+                      is_negated, p_compiled_condition);
+    estimate_condition(p_compiled_condition, p_cost, p_selectivity);
+    p_target->type = 0;
+    p_target->condition_index = p_node->condition_index;
+    return target;
+  }
+
+  // By De Morgan's laws, a negated AND is an OR of negated children.
+  int type = p_node->type;
+  if (is_negated) {
+    type = (type == K_AND) ? K_OR : K_AND;
+  }
+  p_target->type = type;
+
+  // Children of the same type are merged into this node.
+  int operands[MAX_NUM_PREDICATE_NODES];
+  bool negations[MAX_NUM_PREDICATE_NODES];
+  int num_children = 0;
+  for (int child = p_node->first_child; child > -1;
+       child = p_predicate->nodes[child].next_sibling) {
+    collect_predicate_operands(p_predicate, child, is_negated, type, operands,
+                               negations, &num_children);
+  }
+  int children[MAX_NUM_PREDICATE_NODES];
+  double ranks[MAX_NUM_PREDICATE_NODES];
+  double costs[MAX_NUM_PREDICATE_NODES];
+  double selectivities[MAX_NUM_PREDICATE_NODES];
+  for (int i = 0; i < num_children; i++) {
+    children[i] = compile_predicate_node(p_layout, p_predicate, operands[i],
+                                         negations[i], p_compiled, &costs[i],
+                                         &selectivities[i]);
+  }
+
+  /* An AND child which is often false, or an OR child which is often true,
+  ends the evaluation early. Children are ordered by cost per decisive
+  outcome. */
+  for (int i = 0; i < num_children; i++) {
+    double decisive = (type == K_AND) ? (1 - selectivities[i])
+                                      : selectivities[i];
+    ranks[i] = (decisive > 0) ? costs[i] / decisive : 1e30;
+  }
+  int order[MAX_NUM_PREDICATE_NODES];
+  for (int i = 0; i < num_children; i++) {
+    int j = i;
+    for (; (j > 0) && (ranks[i] < ranks[order[j - 1]]); j--) {
+      order[j] = order[j - 1];
+    }
+    order[j] = i;
+  }
+
+  // Link the children in that order and estimate the node.
+  double cost = 0;
+  double reach = 1;  // Chance that the evaluation reaches the next child.
+  double selectivity = (type == K_AND) ? 1 : 0;
+  for (int i = num_children - 1; i >= 0; i--) {
+    p_compiled->nodes[children[order[i]]].next_sibling = p_target->first_child;
+    p_target->first_child = children[order[i]];
+  }
+  for (int i = 0; i < num_children; i++) {
+    cost += reach * costs[order[i]];
+    if (type == K_AND) {
+      reach *= selectivities[order[i]];
+      selectivity *= selectivities[order[i]];
+    } else {
+      reach *= 1 - selectivities[order[i]];
+      selectivity = 1 - (1 - selectivity) * (1 - selectivities[order[i]]);
     }
-    temp = current_row;
-    current_row = current_row->next;
-    free(temp);
   }
+  *p_cost = cost;
+  *p_selectivity = selectivity;
+  return target;
 }
 
-int save_records_to_file(table_file_header *const tab_header,
-                         record_row *const rows_head) {
+int compile_predicate(record_layout *p_layout, record_predicate *p_predicate,
+                      compiled_predicate *p_compiled) {
   int rc = 0;
-  tpd_entry *const tab_entry = tab_header->tpd_ptr;
-
-  int num_rows = 0;
-  record_row *current_row = rows_head;
-  while (current_row) {
-    num_rows++;
-    current_row = current_row->next;
+  memset(p_compiled, '\0', sizeof(compiled_predicate));
+  if ((p_predicate == NULL) || (p_predicate->num_nodes == 0)) {
+    p_compiled->eval = eval_no_condition;
+    return rc;
   }
 
-  tab_header->num_records = num_rows;
-  tab_header->file_size =
-      sizeof(table_file_header) + tab_header->record_size * num_rows;
-  tab_header->tpd_ptr = NULL;  // Reset tpd pointer.
+  // The values of the IN lists, before the conditions are estimated.
+  for (int i = 0; i < p_predicate->num_conditions; i++) {
+    record_condition *p_condition = &p_predicate->conditions[i];
+    if (p_condition->op_type == K_IN) {
+      rc = build_value_set(&p_layout->columns[p_condition->col_id],
+                           p_condition,
+                           &p_compiled->conditions[i].p_value_set);
+      if (rc) {
+        free_compiled_predicate(p_compiled);
+        return rc;
+      }
+    }
+  }
 
-  char table_filename[MAX_IDENT_LEN + 5];
-  sprintf(table_filename, "%s.tab", tab_entry->table_name);
-  FILE *fhandle = NULL;
-  if ((fhandle = fopen(table_filename, "wbc")) == NULL) {
-    rc = FILE_OPEN_ERROR;
+  double cost = 0;
+  double selectivity = 0;
+  p_compiled->num_conditions = p_predicate->num_conditions;
+  p_compiled->root =
+      compile_predicate_node(p_layout, p_predicate, p_predicate->root, false,
+                             p_compiled, &cost, &selectivity);
+  if (p_compiled->nodes[p_compiled->root].type == 0) {
+    p_compiled->eval = eval_one_condition;
   } else {
-    fwrite(tab_header, tab_header->record_offset, 1, fhandle);
-
-    char *record_raw_bytes = (char *)malloc(tab_header->record_size);
-    cd_entry *cd_entries = NULL;
-    get_cd_entries(tab_entry, &cd_entries);
-    current_row = rows_head;
-    while (current_row) {
-      memset(record_raw_bytes, '\0', tab_header->record_size);
-      fill_raw_record_bytes(cd_entries, current_row->value_ptrs,
-                            tab_entry->num_columns, record_raw_bytes,
-                            tab_header->record_size);
-      fwrite(record_raw_bytes, tab_header->record_size, 1, fhandle);
-      current_row = current_row->next;
-    }
-    free(record_raw_bytes);
-    fflush(fhandle);
-    fclose(fhandle);
+    p_compiled->eval = eval_predicate_tree;
   }
-
   return rc;
 }
 
-int append_log_with_timestamp(const char *msg, time_t timestamp) {
-  char timestamp_text[MAX_LOG_ENTRY_TEXT_LEN + 1];
-  // Convert time to struct tm form in local time.
-  struct tm *t = localtime(&timestamp);
-  // Format is: yyyymmddhhmmss "SQL".
-  sprintf(timestamp_text, "%d%02d%02d%02d%02d%02d \"%s\"", 1900 + t->tm_year,
-          1 + t->tm_mon, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec, msg);
-  return write_log(timestamp_text, true);
+void free_compiled_predicate(compiled_predicate *p_compiled) {
+  for (int i = 0; i < MAX_NUM_CONDITION; i++) {
+    if (p_compiled->conditions[i].p_value_set) {
+      free_value_set(p_compiled->conditions[i].p_value_set);
+      p_compiled->conditions[i].p_value_set = NULL;
+    }
+  }
 }
 
-int write_log(const char *msg, bool is_append) {
-  FILE *fhandle = fopen(kDbLogFile, is_append ? "a" : "w");
-  if (!fhandle) {
-    return FILE_OPEN_ERROR;
-  }
-  fprintf(fhandle, "%s\n", msg);
-  fclose(fhandle);
-  return 0;
+int compare_int_values(const void *p_value1, const void *p_value2) {
+  int value1 = *(const int *)p_value1;
+  int value2 = *(const int *)p_value2;
+  return (value1 > value2) - (value1 < value2);
 }
 
-int scan_log(log_entry **pp_first_log_entry) {
-  FILE *fhandle = fopen(kDbLogFile, "r");
-  if (!fhandle) {
-    return FILE_OPEN_ERROR;
-  }
-  log_entry *p_head = NULL;
-  log_entry *p_cur = NULL;
-  char log_text[MAX_LOG_ENTRY_TEXT_LEN + 1];
-  while (fgets(log_text, sizeof(log_text), fhandle)) {
-    if (!(strlen(log_text) > 1)) {  // skip empty line
-      continue;
+int build_value_set(column_layout *p_column, record_condition *p_condition,
+                    value_set **pp_value_set) {
+  int rc = 0;
+  int num_values = p_condition->num_in_values;
+  value_set *p_value_set = (value_set *)calloc(1, sizeof(value_set));
+  if (!p_value_set) {
+    return MEMORY_ERROR;
+  }
+  *pp_value_set = p_value_set;
+
+  token_list *cur = p_condition->first_in_value;
+  if (p_condition->value_type == FIELD_VALUE_TYPE_INT) {
+    // A sorted array without duplicates.
+    p_value_set->int_values = (int *)malloc(sizeof(int) * num_values);
+    if (!p_value_set->int_values) {
+      return MEMORY_ERROR;
     }
-    if (p_cur == NULL) {  // first log entry
-      p_cur = (log_entry *)malloc(sizeof(log_entry));
-      p_head = p_cur;
-    } else {
-      p_cur->next = (log_entry *)malloc(sizeof(log_entry));
-      p_cur = p_cur->next;
+    for (int i = 0; i < num_values; i++, cur = cur->next->next) {
+      p_value_set->int_values[i] = atoi(cur->tok_string);
     }
-    if (is_a_sql_statement_log_entry(
-            log_text)) {  // a DDL/DML statement with datetime
-      memcpy(p_cur->datetime, log_text, LOG_ENTRY_TIMESTAMP_LEN);
-      p_cur->datetime[LOG_ENTRY_TIMESTAMP_LEN] = '\0';
-      strcpy(p_cur->text, log_text + LOG_ENTRY_TIMESTAMP_LEN + 2);
-    } else {  // a command without datetime
-      p_cur->datetime[0] = '\0';
-      strcpy(p_cur->text, log_text);
+    qsort(p_value_set->int_values, num_values, sizeof(int),
+          compare_int_values);
+    for (int i = 0; i < num_values; i++) {
+      if ((i == 0) || (p_value_set->int_values[i] !=
+                       p_value_set->int_values[p_value_set->num_values - 1])) {
+        p_value_set->int_values[p_value_set->num_values++] =
+            p_value_set->int_values[i];
+      }
     }
-    // Remove trailing double-quote and line-feed.
-    for (int i = strlen(p_cur->text) - 1;
-         (p_cur->text[i] == '\n' || p_cur->text[i] == '"'); i--) {
-      p_cur->text[i] = '\0';
+    return rc;
+  }
+
+  /* A hash table with linear probing, at most half full. The values are
+  stored as the fields of the column, and the strings which cannot be
+  stored in it are left out since no record has them. */
+  p_value_set->value_size = 1 + p_column->col_len;
+  p_value_set->num_buckets = 2;
+  while (p_value_set->num_buckets < 2 * num_values) {
+    p_value_set->num_buckets *= 2;
+  }
+  p_value_set->string_values =
+      (char *)calloc(num_values, p_value_set->value_size);
+  p_value_set->buckets =
+      (int *)malloc(sizeof(int) * p_value_set->num_buckets);
+  if (!p_value_set->string_values || !p_value_set->buckets) {
+    return MEMORY_ERROR;
+  }
+  memset(p_value_set->buckets, 0xff, sizeof(int) * p_value_set->num_buckets);
+  for (int i = 0; i < num_values; i++, cur = cur->next->next) {
+    int length = strlen(cur->tok_string);
+    if ((length == 0) || (length > p_column->col_len)) {
+      continue;
     }
-    strcpy(p_cur->raw_text, log_text);
-    // Remove trailing line-feed for raw_text.
-    int l = strlen(p_cur->raw_text) - 1;
-    if (p_cur->raw_text[l] == '\n') {
-      p_cur->raw_text[l] = '\0';
+    char *field = p_value_set->string_values +
+                  p_value_set->num_values * p_value_set->value_size;
+    field[0] = (char)length;
+    memcpy(field + 1, cur->tok_string, length);
+    if (!contains_string_value(p_value_set, field)) {
+      int mask = p_value_set->num_buckets - 1;
+      int bucket = hash_string_field(field) & mask;
+      while (p_value_set->buckets[bucket] > -1) {
+        bucket = (bucket + 1) & mask;
+      }
+      p_value_set->buckets[bucket] = p_value_set->num_values++;
+    } else {
+      memset(field, '\0', p_value_set->value_size);
     }
-    p_cur->next = NULL;
   }
-  fclose(fhandle);
-  *pp_first_log_entry = p_head;
-  return 0;
+  return rc;
 }
 
-void free_log_entries(log_entry *p_first_log_entry) {
-  if (!p_first_log_entry) {
-    return;
+void free_value_set(value_set *p_value_set) {
+  free(p_value_set->int_values);
+  free(p_value_set->string_values);
+  free(p_value_set->buckets);
+  free(p_value_set);
+}
+
+int get_like_pattern(const char *pattern, int length, int *p_start,
+                     int *p_length) {
+  /* The literal part is what is left once the '%' at both ends are taken
+  off. A pattern with '_', or with '%' inside the literal part, is
+  general. */
+  int start = 0;
+  int end = length;
+  while ((start < end) && (pattern[start] == '%')) {
+    start++;
   }
-  log_entry *p = p_first_log_entry;
-  log_entry *temp = NULL;
-  while (p) {
-    temp = p;
-    p = p->next;
-    free(temp);
+  while ((end > start) && (pattern[end - 1] == '%')) {
+    end--;
+  }
+  *p_start = 0;
+  *p_length = length;
+  if ((memchr(pattern + start, '%', end - start) != NULL) ||
+      (memchr(pattern, '_', length) != NULL)) {
+    return LIKE_GENERAL;
+  }
+
+  *p_start = start;
+  *p_length = end - start;
+  if (start == 0) {
+    return (end == length) ? LIKE_EXACT : LIKE_PREFIX;
   }
+  return (end == length) ? LIKE_SUFFIX : LIKE_INFIX;
 }
 
-int restore_from_backup_file(char *backup_filename, int db_flags) {
-  // Reconstruct tpd_list and fetch table names.
-  FILE *f_backup = fopen(backup_filename, "rb");
-  FILE *f_tmp_dbfile = fopen(kTempDbFile, "wbc");
-  if (f_backup == NULL || f_tmp_dbfile == NULL) {
-    if (f_backup) {
-      fclose(f_backup);
+bool match_like_pattern(const char *string_value, int length,
+                        const char *pattern, int pattern_length) {
+  /* '%' matches any bytes and '_' one byte. On a mismatch, the last '%'
+  takes one more byte and the match goes on after it. The '%' before it
+  never need to take more. */
+  int i = 0;
+  int p = 0;
+  int percent = -1;  // Position of the last '%' in the pattern.
+  int retry = 0;     // Position where its match ends.
+  while (i < length) {
+    if ((p < pattern_length) && (pattern[p] == '%')) {
+      percent = p++;
+      retry = i;
+    } else if ((p < pattern_length) &&
+               ((pattern[p] == '_') || (pattern[p] == string_value[i]))) {
+      i++;
+      p++;
+    } else if (percent > -1) {
+      p = percent + 1;
+      i = ++retry;
+    } else {
+      return false;
     }
-    if (f_tmp_dbfile) {
-      fclose(f_tmp_dbfile);
+  }
+  while ((p < pattern_length) && (pattern[p] == '%')) {
+    p++;
+  }
+  return p == pattern_length;
+}
+
+void eval_compiled_predicate_batch(const compiled_predicate *p_compiled,
+                                   char *records[], int num_records,
+                                   uint64_t selection[]) {
+  int num_words = (num_records + 63) / 64;
+  if (p_compiled->num_nodes == 0) {
+    memset(selection, 0xff, sizeof(uint64_t) * num_words);
+    if (num_records % 64) {
+      selection[num_words - 1] = (1ULL << (num_records % 64)) - 1;
     }
-    return FILE_OPEN_ERROR;
+    return;
   }
-  // This tpd_list will NOT hold the whole db metadata.
-  // It is only used to determine the real size of the whole db metadata.
-  tpd_list tmp_tpd_list;
-  fread(&tmp_tpd_list, sizeof(tmp_tpd_list), 1, f_backup);
-  // Set db_flags.
-  tmp_tpd_list.db_flags = db_flags;
-  // Backup db file with db_flag.
-  fwrite(&tmp_tpd_list, sizeof(tmp_tpd_list), 1, f_tmp_dbfile);
-  // Backup remaining bytes of the db file.
-  char byte;
-  for (int i = sizeof(tmp_tpd_list); i < tmp_tpd_list.list_size; i++) {
-    fread(&byte, sizeof(byte), 1, f_backup);
-    fwrite(&byte, sizeof(byte), 1, f_tmp_dbfile);
+  eval_compiled_node_batch(p_compiled, p_compiled->root, records, num_records,
+                           selection);
+}
+
+void eval_compiled_node_batch(const compiled_predicate *p_compiled, int node,
+                              char *records[], int num_records,
+                              uint64_t selection[]) {
+  /* Each child gives a selection bitmap over the batch, and the bitmaps are
+  joined word by word. The children after an AND which selects no row, or
+  an OR which selects every row, are skipped. */
+  const predicate_node *p_node = &p_compiled->nodes[node];
+  if (p_node->type == 0) {
+    eval_compiled_condition_batch(
+        &p_compiled->conditions[p_node->condition_index], records,
+        num_records, selection);
+    return;
   }
-  fflush(f_tmp_dbfile);
-  fclose(f_tmp_dbfile);
-  tpd_list *p_tpd_list = NULL;
-  initialize_tpd_list(kTempDbFile, &p_tpd_list);
 
-  // Backup .tab file for each table.
-  tpd_entry *cur_entry = &(p_tpd_list->tpd_start);
-  for (int i = 0; i < p_tpd_list->num_tables; i++) {
-    // Get table file size.
-    int32_t table_file_size;
-    fread(&table_file_size, sizeof(table_file_size), 1, f_backup);
-    // Writing table file as a .tab.temp file.
-    char table_filename[MAX_IDENT_LEN + 10];
-    sprintf(table_filename, "%s.tab.temp", cur_entry->table_name);
-    FILE *f_tmp_tab_file = fopen(table_filename, "wbc");
-    if (f_tmp_tab_file == NULL) {
-      return FILE_OPEN_ERROR;
+  int num_words = (num_records + 63) / 64;
+  uint64_t last_word_mask =
+      (num_records % 64) ? (1ULL << (num_records % 64)) - 1 : ~0ULL;
+  bool is_and = (p_node->type == K_AND);
+  uint64_t child_selection[SELECTION_WORDS];
+  int child = p_node->first_child;
+  eval_compiled_node_batch(p_compiled, child, records, num_records,
+                           selection);
+  for (child = p_compiled->nodes[child].next_sibling; child > -1;
+       child = p_compiled->nodes[child].next_sibling) {
+    bool is_decided = true;
+    for (int w = 0; (w < num_words) && is_decided; w++) {
+      uint64_t undecided = is_and ? selection[w] : ~selection[w];
+      if (w == num_words - 1) {
+        undecided &= last_word_mask;
+      }
+      is_decided = (undecided == 0);
     }
-    for (int j = 0; j < table_file_size; j++) {
-      fread(&byte, sizeof(byte), 1, f_backup);
-      fwrite(&byte, sizeof(byte), 1, f_tmp_tab_file);
+    if (is_decided) {
+      return;
     }
-    fclose(f_tmp_tab_file);
 
-    cur_entry =
-        (tpd_entry *)((char *)cur_entry + cur_entry->tpd_size);  // next table
+    eval_compiled_node_batch(p_compiled, child, records, num_records,
+                             child_selection);
+    if (is_and) {
+      for (int w = 0; w < num_words; w++) {
+        selection[w] &= child_selection[w];
+      }
+    } else {
+      for (int w = 0; w < num_words; w++) {
+        selection[w] |= child_selection[w];
+      }
+    }
   }
-  fclose(f_backup);
+}
 
-  // Remove old dbfile and .tab files.
-  remove(kDbFile);
-  list_tables(g_tpd_list, remove_table_file);
+void eval_compiled_condition_batch(const compiled_condition *p_condition,
+                                   char *records[], int num_records,
+                                   uint64_t selection[]) {
+  filter_kernels *kernels = get_filter_kernels();
+  int num_words = (num_records + 63) / 64;
+  uint64_t last_word_mask =
+      (num_records % 64) ? (1ULL << (num_records % 64)) - 1 : ~0ULL;
+  int int_values[FILTER_BATCH_SIZE];
+  unsigned char length_bytes[FILTER_BATCH_SIZE];
+  uint64_t null_selection[SELECTION_WORDS];
+  int offset = p_condition->offset;
+  bool is_int = (p_condition->value_type == FIELD_VALUE_TYPE_INT);
+  bool is_comparison = (p_condition->op_type == S_LESS) ||
+                       (p_condition->op_type == S_EQUAL) ||
+                       (p_condition->op_type == S_GREATER);
+  bool is_null_test =
+      (p_condition->op_type == K_IS) || (p_condition->op_type == K_NOT);
+  bool is_string_equal = !is_int && (p_condition->op_type == S_EQUAL);
+  bool is_int_in = is_int && (p_condition->op_type == K_IN);
+
+  // A negated comparison leaves out the NULL values, as an integer one does.
+  bool uses_null_selection =
+      p_condition->is_nullable &&
+      (is_null_test || is_int_in ||
+       (is_comparison && (is_int || p_condition->is_negated)));
+  if (uses_null_selection) {
+    for (int i = 0; i < num_records; i++) {
+      length_bytes[i] = (unsigned char)records[i][offset];
+    }
+    kernels->filter_null(length_bytes, num_records, null_selection);
+  }
 
-  // Rename ".temp" suffix for all reconstructed files.
-  rename(kTempDbFile, kDbFile);
-  list_tables(p_tpd_list, rename_table_file);
+  if (is_comparison && is_int) {
+    for (int i = 0; i < num_records; i++) {
+      memcpy(&int_values[i], records[i] + offset + 1, sizeof(int));
+    }
+    kernels->filter_int(int_values, num_records, p_condition->op_type,
+                        p_condition->int_value, selection);
+  } else if (is_int_in) {
+    for (int i = 0; i < num_records; i++) {
+      memcpy(&int_values[i], records[i] + offset + 1, sizeof(int));
+    }
+    memset(selection, '\0', sizeof(uint64_t) * num_words);
+    for (int i = 0; i < num_records; i++) {
+      selection[i / 64] |=
+          (uint64_t)contains_int_value(p_condition->p_value_set,
+                                       int_values[i])
+          << (i % 64);
+    }
+  } else if (is_null_test && p_condition->is_nullable) {
+    memcpy(selection, null_selection, sizeof(uint64_t) * num_words);
+    if (p_condition->op_type == K_NOT) {
+      for (int w = 0; w < num_words; w++) {
+        selection[w] = ~selection[w];
+      }
+      selection[num_words - 1] &= last_word_mask;
+    }
+    return;
+  } else if (is_string_equal) {
+    // The length byte first, then the bytes. An empty string is NULL.
+    memset(selection, '\0', sizeof(uint64_t) * num_words);
+    int length = p_condition->string_length;
+    for (int i = 0; (i < num_records) && (length > 0); i++) {
+      if (((unsigned char)records[i][offset] == length) &&
+          kernels->equal_bytes(records[i] + offset + 1,
+                               p_condition->string_value, length)) {
+        selection[i / 64] |= 1ULL << (i % 64);
+      }
+    }
+  } else {
+    // String ranges and IN lists, and the constant conditions of NOT NULL
+    // columns, whose evaluators handle NULL and the negation.
+    memset(selection, '\0', sizeof(uint64_t) * num_words);
+    for (int i = 0; i < num_records; i++) {
+      if (p_condition->eval(p_condition, records[i])) {
+        selection[i / 64] |= 1ULL << (i % 64);
+      }
+    }
+    return;
+  }
 
-  // Refresh g_tpd_list.
-  free(g_tpd_list);
-  g_tpd_list = p_tpd_list;
-  return 0;
+  // The comparison of the kernels, negated if needed, without the NULLs.
+  if (p_condition->is_negated) {
+    for (int w = 0; w < num_words; w++) {
+      selection[w] = ~selection[w];
+    }
+    selection[num_words - 1] &= last_word_mask;
+  }
+  if (uses_null_selection) {
+    for (int w = 0; w < num_words; w++) {
+      selection[w] &= ~null_selection[w];
+    }
+  }
 }
 
-void remove_table_file(tpd_entry *table_entry) {
-  char filename[MAX_IDENT_LEN + 5];
-  sprintf(filename, "%s.tab", table_entry->table_name);
-  remove(filename);
+/* Scalar filter kernels, used when the CPU has no vector instructions
+known to this file. */
+template <int op_type>
+void filter_int_scalar(const int values[], int num_values, int operand,
+                       uint64_t selection[]) {
+  memset(selection, '\0', sizeof(uint64_t) * ((num_values + 63) / 64));
+  for (int i = 0; i < num_values; i++) {
+    bool is_selected = (op_type == S_LESS)      ? (values[i] < operand)
+                       : (op_type == S_GREATER) ? (values[i] > operand)
+                                                : (values[i] == operand);
+    selection[i / 64] |= (uint64_t)is_selected << (i % 64);
+  }
 }
 
-void rename_table_file(tpd_entry *table_entry) {
-  char src_filename[MAX_IDENT_LEN + 10];
-  sprintf(src_filename, "%s.tab.temp", table_entry->table_name);
-  char dst_filename[MAX_IDENT_LEN + 5];
-  sprintf(dst_filename, "%s.tab", table_entry->table_name);
-  rename(src_filename, dst_filename);
+void filter_int_scalar_kernel(const int values[], int num_values, int op_type,
+                              int operand, uint64_t selection[]) {
+  if (op_type == S_LESS) {
+    filter_int_scalar<S_LESS>(values, num_values, operand, selection);
+  } else if (op_type == S_GREATER) {
+    filter_int_scalar<S_GREATER>(values, num_values, operand, selection);
+  } else {
+    filter_int_scalar<S_EQUAL>(values, num_values, operand, selection);
+  }
 }
 
-int list_tables(tpd_list *table_entries,
-                void (*callback)(tpd_entry *table_entry)) {
-  int num_tables = table_entries->num_tables;
-  if (num_tables > 0) {
-    tpd_entry *cur_entry = &(table_entries->tpd_start);
-    for (int i = 0; i < num_tables; i++) {
-      if (callback != NULL) {
-        callback(cur_entry);
-      }
-      cur_entry = (tpd_entry *)((char *)cur_entry + cur_entry->tpd_size);
-    }
+void filter_null_scalar_kernel(const unsigned char length_bytes[],
+                               int num_values, uint64_t selection[]) {
+  memset(selection, '\0', sizeof(uint64_t) * ((num_values + 63) / 64));
+  for (int i = 0; i < num_values; i++) {
+    selection[i / 64] |= (uint64_t)(length_bytes[i] == 0) << (i % 64);
   }
-  return num_tables;
 }
 
-int update_db_flags(int db_flags) {
-  FILE *fhandle = fopen(kDbFile, "r+b");
-  if (fhandle == NULL) {
-    return FILE_OPEN_ERROR;
-  }
-  tpd_list tmp_tpd_list;
-  fread(&tmp_tpd_list, sizeof(tmp_tpd_list), 1, fhandle);
-  tmp_tpd_list.db_flags = db_flags;
-  rewind(fhandle);
-  fwrite(&tmp_tpd_list, sizeof(tmp_tpd_list), 1, fhandle);
-  fclose(fhandle);
-  g_tpd_list->db_flags = db_flags;
-  return 0;
+bool equal_bytes_scalar_kernel(const char *bytes1, const char *bytes2,
+                               int length) {
+  return memcmp(bytes1, bytes2, length) == 0;
 }
 
-int backup_log_file(log_entry *log_entry_head) {
-  char log_bak_filename[10];
-  for (int i = 1; i <= MAX_NUM_LOG_BACKUP_FILES; i++) {
-    sprintf(log_bak_filename, "%s%d", kDbLogFile, i);
-    if (!is_file_readable(log_bak_filename, true)) {
-      break;
-    }
+bool find_bytes_scalar_kernel(const char *bytes, int length, int size,
+                              const char *pattern, int pattern_length) {
+  // Nothing is read past size, even for a length which would exceed it.
+  if (length > size) {
+    length = size;
   }
-  // We found one available log backup filename.
-  FILE *f_log_bak = fopen(log_bak_filename, "w");
-  if (f_log_bak == NULL) {
-    return FILE_OPEN_ERROR;
+  if (pattern_length == 0) {
+    return true;
+  } else if (pattern_length > length) {
+    return false;
   }
-  log_entry *cur_entry = log_entry_head;
-  while (cur_entry) {
-    if (stricmp(cur_entry->text, kRfStartLogEntry) != 0) {
-      fprintf(f_log_bak, "%s\n", cur_entry->raw_text);
+  const char *last = bytes + length - pattern_length;
+  for (const char *p = bytes; p <= last; p++) {
+    p = (const char *)memchr(p, pattern[0], last - p + 1);
+    if (!p) {
+      return false;
+    }
+    if (memcmp(p + 1, pattern + 1, pattern_length - 1) == 0) {
+      return true;
     }
-    cur_entry = cur_entry->next;
   }
-  fclose(f_log_bak);
-  return 0;
+  return false;
 }
 
-int max_days_of_month(int year, int month) {
-  int days_in_month[] = {-1, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-  if (year % 4 == 0 && year % 100 != 0) {
-    days_in_month[2] = 29;
-  } else if (year % 400 == 0) {
-    days_in_month[2] = 29;
+#ifdef HAS_X86_FILTER_KERNELS
+/* SSE2 filter kernels: 4 integers or 16 bytes per instruction. */
+template <int op_type>
+void filter_int_sse2(const int values[], int num_values, int operand,
+                     uint64_t selection[]) {
+  memset(selection, '\0', sizeof(uint64_t) * ((num_values + 63) / 64));
+  __m128i operands = _mm_set1_epi32(operand);
+  int i = 0;
+  for (; i + 4 <= num_values; i += 4) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(values + i));
+    __m128i result = (op_type == S_LESS) ? _mm_cmplt_epi32(block, operands)
+                     : (op_type == S_GREATER)
+                         ? _mm_cmpgt_epi32(block, operands)
+                         : _mm_cmpeq_epi32(block, operands);
+    uint64_t bits = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(result));
+    selection[i / 64] |= bits << (i % 64);
+  }
+  for (; i < num_values; i++) {
+    bool is_selected = (op_type == S_LESS)      ? (values[i] < operand)
+                       : (op_type == S_GREATER) ? (values[i] > operand)
+                                                : (values[i] == operand);
+    selection[i / 64] |= (uint64_t)is_selected << (i % 64);
   }
-  return days_in_month[month];
 }
 
-bool is_timestamp_valid(char *text) {
-  // A valid timestamp should contains 14 digits, like 20140511093524.
-  int num_digits = 0;
-  char *p = text;
-  while (*p) {
-    if (!isdigit(*p)) {
+void filter_int_sse2_kernel(const int values[], int num_values, int op_type,
+                            int operand, uint64_t selection[]) {
+  if (op_type == S_LESS) {
+    filter_int_sse2<S_LESS>(values, num_values, operand, selection);
+  } else if (op_type == S_GREATER) {
+    filter_int_sse2<S_GREATER>(values, num_values, operand, selection);
+  } else {
+    filter_int_sse2<S_EQUAL>(values, num_values, operand, selection);
+  }
+}
+
+void filter_null_sse2_kernel(const unsigned char length_bytes[],
+                             int num_values, uint64_t selection[]) {
+  memset(selection, '\0', sizeof(uint64_t) * ((num_values + 63) / 64));
+  __m128i zeros = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= num_values; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(length_bytes + i));
+    uint64_t bits =
+        (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, zeros));
+    selection[i / 64] |= bits << (i % 64);
+  }
+  for (; i < num_values; i++) {
+    selection[i / 64] |= (uint64_t)(length_bytes[i] == 0) << (i % 64);
+  }
+}
+
+bool equal_bytes_sse2_kernel(const char *bytes1, const char *bytes2,
+                             int length) {
+  int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i block1 = _mm_loadu_si128((const __m128i *)(bytes1 + i));
+    __m128i block2 = _mm_loadu_si128((const __m128i *)(bytes2 + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(block1, block2)) != 0xffff) {
       return false;
     }
-    num_digits++;
-    p++;
   }
-  if (num_digits != 14) {
+  return memcmp(bytes1 + i, bytes2 + i, length - i) == 0;
+}
+
+bool find_bytes_sse2_kernel(const char *bytes, int length, int size,
+                            const char *pattern, int pattern_length) {
+  /* The first and the last bytes of the pattern are compared at 16
+  positions at once, and only the positions where both match are checked.
+  The loads may go past the string up to size, but not the matches. */
+  if ((pattern_length == 0) || (pattern_length > length)) {
+    return pattern_length == 0;
+  }
+  __m128i firsts = _mm_set1_epi8(pattern[0]);
+  __m128i lasts = _mm_set1_epi8(pattern[pattern_length - 1]);
+  int num_starts = length - pattern_length + 1;
+  int i = 0;
+  for (; (i < num_starts) && (i + 15 + pattern_length <= size); i += 16) {
+    __m128i block1 = _mm_loadu_si128((const __m128i *)(bytes + i));
+    __m128i block2 =
+        _mm_loadu_si128((const __m128i *)(bytes + i + pattern_length - 1));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(block1, firsts), _mm_cmpeq_epi8(block2, lasts)));
+    if (num_starts - i < 16) {
+      mask &= (1U << (num_starts - i)) - 1;
+    }
+    for (int j = i; mask; j++, mask >>= 1) {
+      if ((mask & 1) &&
+          (memcmp(bytes + j + 1, pattern + 1, pattern_length - 1) == 0)) {
+        return true;
+      }
+    }
+  }
+  if (i >= num_starts) {
     return false;
   }
+  return find_bytes_scalar_kernel(bytes + i, length - i, size - i, pattern,
+                                  pattern_length);
+}
 
-  char buffer[5];
-  // Parse 4-digit year.
-  memcpy(buffer, text, 4);
-  buffer[4] = '\0';
-  int year = atoi(buffer);
-  if (year < 1900 || year > 2999) {
-    return false;
+/* AVX2 filter kernels: 8 integers or 32 bytes per instruction. */
+template <int op_type>
+TARGET_AVX2 void filter_int_avx2(const int values[], int num_values,
+                                 int operand, uint64_t selection[]) {
+  memset(selection, '\0', sizeof(uint64_t) * ((num_values + 63) / 64));
+  __m256i operands = _mm256_set1_epi32(operand);
+  int i = 0;
+  for (; i + 8 <= num_values; i += 8) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(values + i));
+    __m256i result = (op_type == S_LESS)
+                         ? _mm256_cmpgt_epi32(operands, block)
+                     : (op_type == S_GREATER)
+                         ? _mm256_cmpgt_epi32(block, operands)
+                         : _mm256_cmpeq_epi32(block, operands);
+    uint64_t bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(result));
+    selection[i / 64] |= bits << (i % 64);
+  }
+  for (; i < num_values; i++) {
+    bool is_selected = (op_type == S_LESS)      ? (values[i] < operand)
+                       : (op_type == S_GREATER) ? (values[i] > operand)
+                                                : (values[i] == operand);
+    selection[i / 64] |= (uint64_t)is_selected << (i % 64);
   }
+}
 
-  // Parse 2-digit month.
-  memcpy(buffer, text + 4, 2);
-  buffer[2] = '\0';
-  int month = atoi(buffer);
-  if (month < 1 || month > 12) {
-    return false;
+void filter_int_avx2_kernel(const int values[], int num_values, int op_type,
+                            int operand, uint64_t selection[]) {
+  if (op_type == S_LESS) {
+    filter_int_avx2<S_LESS>(values, num_values, operand, selection);
+  } else if (op_type == S_GREATER) {
+    filter_int_avx2<S_GREATER>(values, num_values, operand, selection);
+  } else {
+    filter_int_avx2<S_EQUAL>(values, num_values, operand, selection);
   }
+}
 
-  // Parse 2-digit day.
-  memcpy(buffer, text + 6, 2);
-  buffer[2] = '\0';
-  int day = atoi(buffer);
-  if (day < 1 || day > max_days_of_month(year, month)) {
-    return false;
+TARGET_AVX2 void filter_null_avx2_kernel(const unsigned char length_bytes[],
+                                         int num_values,
+                                         uint64_t selection[]) {
+  memset(selection, '\0', sizeof(uint64_t) * ((num_values + 63) / 64));
+  __m256i zeros = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 32 <= num_values; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(length_bytes + i));
+    uint64_t bits =
+        (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zeros));
+    selection[i / 64] |= bits << (i % 64);
+  }
+  for (; i < num_values; i++) {
+    selection[i / 64] |= (uint64_t)(length_bytes[i] == 0) << (i % 64);
   }
+}
 
-  // Parse 2-digit 24-hr hour, from 00 to 23.
-  memcpy(buffer, text + 8, 2);
-  buffer[2] = '\0';
-  int hour = atoi(buffer);
-  if (hour < 0 || hour > 23) {
-    return false;
+TARGET_AVX2 bool equal_bytes_avx2_kernel(const char *bytes1,
+                                         const char *bytes2, int length) {
+  int i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i block1 = _mm256_loadu_si256((const __m256i *)(bytes1 + i));
+    __m256i block2 = _mm256_loadu_si256((const __m256i *)(bytes2 + i));
+    if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block1, block2)) !=
+        0xffffffffU) {
+      return false;
+    }
   }
+  return memcmp(bytes1 + i, bytes2 + i, length - i) == 0;
+}
 
-  // Parse 2-digit minute.
-  memcpy(buffer, text + 10, 2);
-  buffer[2] = '\0';
-  int minute = atoi(buffer);
-  if (minute < 0 || minute > 59) {
+TARGET_AVX2 bool find_bytes_avx2_kernel(const char *bytes, int length,
+                                        int size, const char *pattern,
+                                        int pattern_length) {
+  if ((pattern_length == 0) || (pattern_length > length)) {
+    return pattern_length == 0;
+  }
+  __m256i firsts = _mm256_set1_epi8(pattern[0]);
+  __m256i lasts = _mm256_set1_epi8(pattern[pattern_length - 1]);
+  int num_starts = length - pattern_length + 1;
+  int i = 0;
+  for (; (i < num_starts) && (i + 31 + pattern_length <= size); i += 32) {
+    __m256i block1 = _mm256_loadu_si256((const __m256i *)(bytes + i));
+    __m256i block2 =
+        _mm256_loadu_si256((const __m256i *)(bytes + i + pattern_length - 1));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(block1, firsts),
+                         _mm256_cmpeq_epi8(block2, lasts)));
+    if (num_starts - i < 32) {
+      mask &= (1U << (num_starts - i)) - 1;
+    }
+    for (int j = i; mask; j++, mask >>= 1) {
+      if ((mask & 1) &&
+          (memcmp(bytes + j + 1, pattern + 1, pattern_length - 1) == 0)) {
+        return true;
+      }
+    }
+  }
+  // The rest is shorter than a vector.
+  if (i >= num_starts) {
     return false;
   }
+  return find_bytes_sse2_kernel(bytes + i, length - i, size - i, pattern,
+                                pattern_length);
+}
 
-  // Parse 2-digit second.
-  memcpy(buffer, text + 12, 2);
-  buffer[2] = '\0';
-  int second = atoi(buffer);
-  if (second < 0 || second > 59) {
+bool cpu_supports_avx2() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  // The OS must save the YMM registers too.
+  __cpuid(info, 1);
+  if (((info[2] & (1 << 27)) == 0) || ((_xgetbv(0) & 6) != 6)) {
     return false;
   }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+int list_filter_kernels(filter_kernels *kernels[]) {
+  /* The kernels usable on this CPU, the scalar ones first and the fastest
+  last. */
+  static filter_kernels scalar_kernels = {
+      "scalar", filter_int_scalar_kernel, filter_null_scalar_kernel,
+      equal_bytes_scalar_kernel, find_bytes_scalar_kernel};
+  int num_kernels = 0;
+  kernels[num_kernels++] = &scalar_kernels;
+#ifdef HAS_X86_FILTER_KERNELS
+  static filter_kernels sse2_kernels = {
+      "sse2", filter_int_sse2_kernel, filter_null_sse2_kernel,
+      equal_bytes_sse2_kernel, find_bytes_sse2_kernel};
+  static filter_kernels avx2_kernels = {
+      "avx2", filter_int_avx2_kernel, filter_null_avx2_kernel,
+      equal_bytes_avx2_kernel, find_bytes_avx2_kernel};
+  kernels[num_kernels++] = &sse2_kernels;
+  if (cpu_supports_avx2()) {
+    kernels[num_kernels++] = &avx2_kernels;
+  }
+#endif
+  return num_kernels;
+}
 
-  return true;
+filter_kernels *find_best_filter_kernels() {
+  filter_kernels *kernels[3];
+  int num_kernels = list_filter_kernels(kernels);
+  return kernels[num_kernels - 1];
+}
+
+filter_kernels *get_filter_kernels() {
+  // Chosen once, when the first batch is filtered.
+  static filter_kernels *p_best_kernels = find_best_filter_kernels();
+  return p_best_kernels;
+}
+
+int run_select_plan(select_plan *p_plan, table_scan *p_scan) {
+  // Output the batches pulled from the last operator as they come.
+  select_pipeline pipeline;
+  int rc = open_select_pipeline(p_plan, p_scan, &pipeline);
+  batch_operator *p_last = &pipeline.operators[pipeline.num_operators - 1];
+  row_batch *p_batch = NULL;
+  while (!rc && ((rc = p_last->next(p_last, &p_batch)) == 0) && p_batch) {
+    output_batch(p_last->p_plan->output_cd_entries,
+                 p_last->p_plan->num_output_cols, p_batch);
+    // Stop when the output is lost, e.g. to a client which stopped reading.
+    if (ferror(stdout)) {
+      rc = FILE_WRITE_ERROR;
+    }
+  }
+  close_select_pipeline(&pipeline);
+  return rc;
+}
+
+int output_grouped_rows(select_plan *p_plan, table_scan *p_scan,
+                        grouped_columns *p_grouped, int num_values) {
+  /* Like the aggregates of a whole table, a column is as wide as its title or
+  its widest value. The display values of the rows are spooled to a
+  temporary file, each ended by '\0', until the widths are known, then the
+  table is printed from the file. */
+  FILE *f_spool = tmpfile();
+  if (!f_spool) {
+    return FILE_OPEN_ERROR;
+  }
+  int display_widths[MAX_NUM_COL];
+  for (int c = 0; c < num_values; c++) {
+    display_widths[c] = column_display_width(&p_grouped->cd_entries[c]);
+  }
+  int64_t num_rows = 0;
+  select_pipeline pipeline;
+  int rc = open_select_pipeline(p_plan, p_scan, &pipeline);
+  batch_operator *p_last = &pipeline.operators[pipeline.num_operators - 1];
+  row_batch *p_batch = NULL;
+  while (!rc && ((rc = p_last->next(p_last, &p_batch)) == 0) && p_batch) {
+    for (int i = 0; i < p_batch->num_selected; i++) {
+      int row = p_batch->selected[i];
+      for (int c = 0; c < num_values; c++) {
+        column_vector *p_vector =
+            p_batch->columns[p_grouped->cd_entries[c].col_id];
+        char int_display[24];
+        const char *display_value =
+            get_display_value(p_vector, row, int_display);
+        int value_length = strlen(display_value);
+        if (value_length > display_widths[c]) {
+          display_widths[c] = value_length;
+        }
+        fwrite(display_value, 1, value_length + 1, f_spool);
+      }
+    }
+    num_rows += p_batch->num_selected;
+    if (ferror(f_spool)) {
+      rc = FILE_WRITE_ERROR;
+    }
+  }
+  close_select_pipeline(&pipeline);
+  if (rc) {
+    fclose(f_spool);
+    return rc;
+  }
+
+  print_aggregate_border(display_widths, num_values);
+  print_grouped_column_names(p_grouped, display_widths, num_values);
+  print_aggregate_border(display_widths, num_values);
+  rewind(f_spool);
+  char text[65536];
+  char display_value[MAX_STRING_LEN + 1];
+  int max_line_length = 2;
+  for (int c = 0; c < num_values; c++) {
+    max_line_length += display_widths[c] + 3;
+  }
+  int length = 0;
+  for (int64_t r = 0; (r < num_rows) && !rc; r++) {
+    if (length + max_line_length > (int)sizeof(text)) {
+      fwrite(text, 1, length, stdout);
+      length = 0;
+    }
+    for (int c = 0; c < num_values; c++) {
+      int value_length = 0;
+      int ch = 0;
+      while (((ch = getc(f_spool)) != EOF) && (ch != '\0') &&
+             (value_length < MAX_STRING_LEN)) {
+        display_value[value_length++] = (char)ch;
+      }
+      display_value[value_length] = '\0';
+      // Like a short sort run, a short spool was not written whole.
+      if (ch == EOF) {
+        rc = FILE_WRITE_ERROR;
+      }
+      length += append_display_cell(
+          text + length, display_value, display_widths[c],
+          p_grouped->cd_entries[c].col_type != T_INT);
+    }
+    text[length++] = '|';
+    text[length++] = '\n';
+  }
+  fwrite(text, 1, length, stdout);
+  fclose(f_spool);
+  print_aggregate_border(display_widths, num_values);
+  // Stop when the output is lost, e.g. to a client which stopped reading.
+  if (!rc && ferror(stdout)) {
+    rc = FILE_WRITE_ERROR;
+  }
+  return rc;
+}
+
+int open_select_pipeline(select_plan *p_plan, table_scan *p_scan,
+                         select_pipeline *p_pipeline) {
+  /* scan -> filter -> project, then group or sort when the statement has
+  them. Only the grouping and the sort read their whole input before they
+  return. The sort applies LIMIT itself,
+  otherwise a limit before the project stops the scan. A mapped table is
+  scanned, filtered and projected by a pool of workers instead, unless the
+  limit may stop the scan early. Scans through the buffer pool stay on one
+  thread. The grouping is followed by the sort or the limit of the grouped
+  rows, which run the plan of the grouped rows. */
+  memset(p_pipeline, '\0', sizeof(select_pipeline));
+  int (*next_functions[MAX_NUM_OPERATORS])(batch_operator *, row_batch **);
+  int num_operators = 0;
+  bool is_limited = p_plan->has_limit && (p_plan->num_order_by_cols == 0);
+  int64_t pages_per_morsel = 0;
+  if (p_scan->mapped_file && !is_limited &&
+      (get_num_scan_workers(get_num_morsels(p_scan, &pages_per_morsel)) >
+       1)) {
+    next_functions[num_operators++] = next_parallel_scan_operator;
+  } else {
+    next_functions[num_operators++] = next_scan_operator;
+    next_functions[num_operators++] = next_filter_operator;
+    if (is_limited) {
+      next_functions[num_operators++] = next_limit_operator;
+    }
+    next_functions[num_operators++] = next_project_operator;
+  }
+  if ((p_plan->num_group_by_cols > 0) || has_ungrouped_aggregates(p_plan)) {
+    next_functions[num_operators++] = next_group_operator;
+    if (p_plan->p_group_plan->num_order_by_cols > 0) {
+      next_functions[num_operators++] = next_sort_operator;
+    } else if (p_plan->p_group_plan->has_limit) {
+      next_functions[num_operators++] = next_limit_operator;
+    }
+  } else if (p_plan->num_order_by_cols > 0) {
+    next_functions[num_operators++] = next_sort_operator;
+  }
+
+  int rc = 0;
+  select_plan *p_operator_plan = p_plan;
+  for (int i = 0; i < num_operators; i++) {
+    batch_operator *p_operator = &p_pipeline->operators[i];
+    p_operator->next = next_functions[i];
+    p_operator->child = (i > 0) ? &p_pipeline->operators[i - 1] : NULL;
+    if (p_operator->next == next_group_operator) {
+      p_operator_plan = p_plan->p_group_plan;
+    }
+    p_operator->p_plan = p_operator_plan;
+    for (int c = 0; c < p_operator_plan->num_project_cols; c++) {
+      int col_id = p_operator_plan->project_col_ids[c];
+      init_column_vector(&p_operator->vectors[col_id],
+                         &p_operator_plan->layout.columns[col_id]);
+      init_column_vector(&p_operator->buffer.columns[col_id],
+                         &p_operator_plan->layout.columns[col_id]);
+    }
+    p_pipeline->num_operators++;
+  }
+
+  // The grouping lays out the states of the aggregates before the workers
+  // of a parallel scan update them.
+  for (int i = 0; (i < num_operators) && !rc; i++) {
+    batch_operator *p_operator = &p_pipeline->operators[i];
+    if (p_operator->next == next_group_operator) {
+      rc = init_group_table(p_plan, &p_operator->p_groups);
+    }
+  }
+
+  // The scan, the grouping and the sort return batches of their own.
+  p_pipeline->operators[0].p_scan = p_scan;
+  for (int i = 0; (i < num_operators) && !rc; i++) {
+    batch_operator *p_operator = &p_pipeline->operators[i];
+    if ((p_operator->next == next_scan_operator) ||
+        (p_operator->next == next_sort_operator) ||
+        (p_operator->next == next_parallel_scan_operator) ||
+        (p_operator->next == next_group_operator)) {
+      p_operator->p_batch = (row_batch *)calloc(1, sizeof(row_batch));
+      if (p_operator->p_batch == NULL) {
+        rc = MEMORY_ERROR;
+      }
+    }
+    if (!rc && (p_operator->next == next_parallel_scan_operator)) {
+      rc = start_scan_pool(p_plan, p_scan, &p_operator->p_pool);
+    } else if ((p_operator->next == next_project_operator) ||
+               (p_operator->next == next_group_operator)) {
+      select_plan *p_vectors_plan = p_operator->p_plan;
+      for (int c = 0; (c < p_vectors_plan->num_project_cols) && !rc; c++) {
+        rc = reserve_column_vector(
+            &p_operator->vectors[p_vectors_plan->project_col_ids[c]],
+            FILTER_BATCH_SIZE);
+      }
+    }
+  }
+  return rc;
+}
+
+void close_select_pipeline(select_pipeline *p_pipeline) {
+  for (int i = 0; i < p_pipeline->num_operators; i++) {
+    batch_operator *p_operator = &p_pipeline->operators[i];
+    select_plan *p_plan = p_operator->p_plan;
+    for (int c = 0; c < p_plan->num_project_cols; c++) {
+      int col_id = p_plan->project_col_ids[c];
+      free_column_vector(&p_operator->vectors[col_id]);
+      free_column_vector(&p_operator->buffer.columns[col_id]);
+    }
+    free(p_operator->buffer.keys);
+    free(p_operator->buffer.entries);
+    free_run_merge(&p_operator->buffer.merge);
+    if (p_operator->p_pool) {
+      stop_scan_pool(p_operator->p_pool);
+    }
+    if (p_operator->p_groups) {
+      free_group_table(p_operator->p_groups);
+    }
+    free(p_operator->p_batch);
+  }
+  p_pipeline->num_operators = 0;
+}
+
+int next_scan_operator(batch_operator *p_operator, row_batch **pp_batch) {
+  row_batch *p_batch = p_operator->p_batch;
+  *pp_batch = NULL;
+  int rc = next_scan_batch(p_operator->p_scan, p_batch->records,
+                           FILTER_BATCH_SIZE, &p_batch->num_rows);
+  if (!rc && (p_batch->num_rows > 0)) {
+    // Every row is selected until the filter runs.
+    p_batch->num_selected = p_batch->num_rows;
+    *pp_batch = p_batch;
+  }
+  return rc;
+}
+
+int next_parallel_scan_operator(batch_operator *p_operator,
+                                row_batch **pp_batch) {
+  /* The rows of the morsels are returned in table order, each morsel after
+  its worker is done with it. The partial aggregates of the workers are
+  added up by the grouping. */
+  scan_pool *p_pool = p_operator->p_pool;
+  row_batch *p_batch = p_operator->p_batch;
+  *pp_batch = NULL;
+  while (p_pool->next_morsel < p_pool->num_morsels) {
+    morsel_result *p_result = &p_pool->morsels[p_pool->next_morsel];
+    {
+      std::unique_lock<std::mutex> lock(p_pool->mutex);
+      while (!p_result->is_done) {
+        p_pool->changed.wait(lock);
+      }
+    }
+    if (p_result->rc) {
+      return p_result->rc;
+    }
+    int num_rows = p_result->num_rows - p_operator->position;
+    if (num_rows > 0) {
+      p_batch->num_selected =
+          (num_rows > FILTER_BATCH_SIZE) ? FILTER_BATCH_SIZE : num_rows;
+      for (int i = 0; i < p_batch->num_selected; i++) {
+        p_batch->selected[i] = p_operator->position + i;
+      }
+      for (int col_id = 0; col_id < MAX_NUM_COL; col_id++) {
+        p_batch->columns[col_id] = &p_result->columns[col_id];
+      }
+      p_operator->position += p_batch->num_selected;
+      *pp_batch = p_batch;
+      return 0;
+    }
+
+    // The batches of the morsel have been used, which lets the workers go
+    // one morsel further.
+    for (int col_id = 0; col_id < MAX_NUM_COL; col_id++) {
+      free_column_vector(&p_result->columns[col_id]);
+    }
+    p_operator->position = 0;
+    std::lock_guard<std::mutex> lock(p_pool->mutex);
+    p_pool->next_morsel++;
+    p_pool->changed.notify_all();
+  }
+  return 0;
+}
+
+int get_num_morsels(table_scan *p_scan, int64_t *p_pages_per_morsel) {
+  // Page 0 holds the table header only.
+  table_file_header *tab_header = &p_scan->file->header;
+  *p_pages_per_morsel =
+      p_scan->is_columnar ? tab_header->pages_per_group : MORSEL_PAGES;
+  int64_t num_data_pages = get_num_pages(tab_header) - 1;
+  if (num_data_pages < 1) {
+    return 0;
+  }
+  return (int)((num_data_pages + *p_pages_per_morsel - 1) /
+               *p_pages_per_morsel);
+}
+
+int get_num_worker_threads() {
+  // One thread per core unless g_num_worker_threads says otherwise.
+  if (g_num_worker_threads > 0) {
+    return g_num_worker_threads;
+  }
+  return (int)std::thread::hardware_concurrency();
+}
+
+int get_num_scan_workers(int num_morsels) {
+  int num_workers = get_num_worker_threads();
+  if (num_workers > MAX_SCAN_WORKERS) {
+    num_workers = MAX_SCAN_WORKERS;
+  }
+  return (num_workers > num_morsels) ? num_morsels : num_workers;
+}
+
+int start_scan_pool(select_plan *p_plan, table_scan *p_scan,
+                    scan_pool **pp_pool) {
+  scan_pool *p_pool = new scan_pool();
+  p_pool->p_plan = p_plan;
+  p_pool->p_scan = p_scan;
+  p_pool->num_morsels = get_num_morsels(p_scan, &p_pool->pages_per_morsel);
+  p_pool->num_workers = get_num_scan_workers(p_pool->num_morsels);
+  p_pool->morsels =
+      (morsel_result *)calloc(p_pool->num_morsels, sizeof(morsel_result));
+  // The states of each worker are on cache lines of their own.
+  if (has_ungrouped_aggregates(p_plan)) {
+    p_pool->aggregate_row_size =
+        round_integer(init_aggregate_states(p_plan), 64);
+    p_pool->aggregate_rows = (unsigned char *)calloc(
+        p_pool->num_workers, p_pool->aggregate_row_size);
+  }
+  if ((p_pool->morsels == NULL) ||
+      ((p_pool->aggregate_row_size > 0) && (p_pool->aggregate_rows == NULL))) {
+    free(p_pool->morsels);
+    free(p_pool->aggregate_rows);
+    delete p_pool;
+    return MEMORY_ERROR;
+  }
+  for (int m = 0; m < p_pool->num_morsels; m++) {
+    for (int c = 0; c < p_plan->num_project_cols; c++) {
+      int col_id = p_plan->project_col_ids[c];
+      init_column_vector(&p_pool->morsels[m].columns[col_id],
+                         &p_plan->layout.columns[col_id]);
+    }
+  }
+  for (int i = 0; i < p_pool->num_workers; i++) {
+    p_pool->queue_heads[i] = 0;
+  }
+  for (int i = 0; i < p_pool->num_workers; i++) {
+    p_pool->workers[i] = std::thread(run_scan_worker, p_pool, i);
+  }
+  *pp_pool = p_pool;
+  return 0;
+}
+
+void stop_scan_pool(scan_pool *p_pool) {
+  // The workers finish their current morsel, if any.
+  {
+    std::lock_guard<std::mutex> lock(p_pool->mutex);
+    p_pool->is_stopping = true;
+    p_pool->changed.notify_all();
+  }
+  for (int i = 0; i < p_pool->num_workers; i++) {
+    p_pool->workers[i].join();
+  }
+  for (int m = 0; m < p_pool->num_morsels; m++) {
+    for (int col_id = 0; col_id < MAX_NUM_COL; col_id++) {
+      free_column_vector(&p_pool->morsels[m].columns[col_id]);
+    }
+  }
+  free(p_pool->morsels);
+  free(p_pool->aggregate_rows);
+  delete p_pool;
+}
+
+int take_morsel(scan_pool *p_pool, int worker) {
+  // Queue q holds the morsels q, q + num_workers, q + 2 * num_workers...
+  for (int i = 0; i < p_pool->num_workers; i++) {
+    int queue = (worker + i) % p_pool->num_workers;
+    int morsel = queue + p_pool->queue_heads[queue].fetch_add(1) *
+                             p_pool->num_workers;
+    if (morsel < p_pool->num_morsels) {
+      return morsel;
+    }
+  }
+  return -1;
+}
+
+void run_scan_worker(scan_pool *p_pool, int worker) {
+  /* Each worker has its own scan of the mapping, batch and projected
+  columns, and its own partial states of the aggregates. */
+  select_plan *p_plan = p_pool->p_plan;
+  unsigned char *aggregate_row = NULL;
+  table_scan scan = *p_pool->p_scan;
+  scan.page = NULL;
+  scan.frame = NULL;
+  scan.batch_bytes = NULL;
+  row_batch *p_batch = (row_batch *)calloc(1, sizeof(row_batch));
+  column_vector vectors[MAX_NUM_COL];
+  int rc = (p_batch == NULL) ? MEMORY_ERROR : 0;
+  if (!rc && (p_pool->aggregate_row_size > 0)) {
+    aggregate_row = (unsigned char *)calloc(1, p_pool->aggregate_row_size);
+    if (aggregate_row == NULL) {
+      rc = MEMORY_ERROR;
+    }
+  }
+  if (!rc && scan.is_columnar) {
+    scan.batch_bytes = (char *)calloc(FILTER_BATCH_SIZE,
+                                      scan.file->header.record_size);
+    if (scan.batch_bytes == NULL) {
+      rc = MEMORY_ERROR;
+    }
+  }
+  for (int c = 0; c < p_plan->num_project_cols; c++) {
+    int col_id = p_plan->project_col_ids[c];
+    init_column_vector(&vectors[col_id], &p_plan->layout.columns[col_id]);
+    if (!rc) {
+      rc = reserve_column_vector(&vectors[col_id], FILTER_BATCH_SIZE);
+    }
+  }
+
+  // Morsels are still taken after an error, which each one returns.
+  int morsel = -1;
+  while ((morsel = take_morsel(p_pool, worker)) >= 0) {
+    {
+      std::unique_lock<std::mutex> lock(p_pool->mutex);
+      while (!p_pool->is_stopping &&
+             (morsel >= p_pool->next_morsel + 2 * p_pool->num_workers)) {
+        p_pool->changed.wait(lock);
+      }
+      if (p_pool->is_stopping) {
+        break;
+      }
+    }
+    morsel_result *p_result = &p_pool->morsels[morsel];
+    int morsel_rc = rc;
+    if (!morsel_rc) {
+      int64_t first_page = 1 + morsel * p_pool->pages_per_morsel;
+      morsel_rc = scan_morsel(p_plan, &scan, first_page,
+                              first_page + p_pool->pages_per_morsel, p_batch,
+                              vectors, aggregate_row, p_result);
+    }
+    std::lock_guard<std::mutex> lock(p_pool->mutex);
+    if (aggregate_row) {
+      memcpy(p_pool->aggregate_rows +
+                 (size_t)worker * p_pool->aggregate_row_size,
+             aggregate_row, p_pool->aggregate_row_size);
+    }
+    p_result->rc = morsel_rc;
+    p_result->is_done = true;
+    p_pool->changed.notify_all();
+  }
+
+  free(scan.batch_bytes);
+  free(p_batch);
+  free(aggregate_row);
+  for (int c = 0; c < p_plan->num_project_cols; c++) {
+    free_column_vector(&vectors[p_plan->project_col_ids[c]]);
+  }
+}
+
+int scan_morsel(select_plan *p_plan, table_scan *p_scan, int64_t first_page,
+                int64_t end_page, row_batch *p_batch, column_vector vectors[],
+                unsigned char *aggregate_row, morsel_result *p_result) {
+  /* The pages of the morsel are filtered and projected like those of a
+  whole scan. The rows are aggregated into the partial states of the worker,
+  or else kept in the result. */
+  int rc = 0;
+  p_scan->page_number =
+      p_scan->is_columnar ? first_page - p_scan->file->header.pages_per_group
+                          : first_page - 1;
+  p_scan->end_page_number = end_page;
+  while (((rc = next_scan_batch(p_scan, p_batch->records, FILTER_BATCH_SIZE,
+                                &p_batch->num_rows)) == 0) &&
+         (p_batch->num_rows > 0)) {
+    filter_batch(p_plan, p_batch);
+    if (p_batch->num_selected == 0) {
+      continue;
+    }
+    project_batch(p_plan, p_batch, vectors);
+    if (aggregate_row) {
+      aggregate_batch(p_plan, p_batch, aggregate_row);
+      continue;
+    }
+    int num_rows = p_result->num_rows + p_batch->num_selected;
+    if (num_rows > p_result->capacity) {
+      int new_capacity = (p_result->capacity == 0) ? FILTER_BATCH_SIZE
+                                                   : p_result->capacity * 2;
+      if (new_capacity < num_rows) {
+        new_capacity = num_rows;
+      }
+      for (int c = 0; (c < p_plan->num_project_cols) && !rc; c++) {
+        rc = reserve_column_vector(
+            &p_result->columns[p_plan->project_col_ids[c]], new_capacity);
+      }
+      if (rc) {
+        break;
+      }
+      p_result->capacity = new_capacity;
+    }
+    copy_batch_rows(p_plan, p_batch, p_result->columns, p_result->num_rows);
+    p_result->num_rows = num_rows;
+  }
+  release_scan_page(p_scan);
+  return rc;
+}
+
+int next_filter_operator(batch_operator *p_operator, row_batch **pp_batch) {
+  // Batches without any qualified row are not returned.
+  int rc = 0;
+  while (((rc = p_operator->child->next(p_operator->child, pp_batch)) == 0) &&
+         *pp_batch) {
+    filter_batch(p_operator->p_plan, *pp_batch);
+    if ((*pp_batch)->num_selected > 0) {
+      break;
+    }
+  }
+  return rc;
+}
+
+int next_project_operator(batch_operator *p_operator, row_batch **pp_batch) {
+  int rc = p_operator->child->next(p_operator->child, pp_batch);
+  if (!rc && *pp_batch) {
+    project_batch(p_operator->p_plan, *pp_batch, p_operator->vectors);
+  }
+  return rc;
+}
+
+int next_sort_operator(batch_operator *p_operator, row_batch **pp_batch) {
+  int rc = 0;
+  select_plan *p_plan = p_operator->p_plan;
+  sort_buffer *p_buffer = &p_operator->buffer;
+  row_batch *p_batch = p_operator->p_batch;
+  if (p_plan->has_limit && (p_plan->limit == 0)) {
+    *pp_batch = NULL;
+    return rc;
+  }
+  if (!p_operator->is_done) {
+    /* Buffer the whole input and sort it on the first call. A LIMIT which
+    keeps at most MAX_TOP_K_ROWS rows only buffers those rows. */
+    long long num_limit_rows = (long long)p_plan->offset + p_plan->limit;
+    bool is_top_k = p_plan->has_limit && (num_limit_rows <= MAX_TOP_K_ROWS);
+    if (is_top_k) {
+      rc = init_top_k_buffer(p_plan, p_buffer, (int)num_limit_rows);
+      if (rc) {
+        return rc;
+      }
+    }
+    row_batch *p_child_batch = NULL;
+    while (((rc = p_operator->child->next(p_operator->child,
+                                          &p_child_batch)) == 0) &&
+           p_child_batch) {
+      if (!is_top_k) {
+        // Spill the buffer before it goes over the sort memory.
+        if ((p_buffer->num_rows > 0) &&
+            (p_buffer->num_rows + p_child_batch->num_selected >
+             get_max_sort_rows(p_plan))) {
+          rc = spill_sort_buffer(p_plan, p_buffer);
+        }
+        if (!rc) {
+          rc = add_sort_batch(p_plan, p_child_batch, p_buffer);
+        }
+        if (rc) {
+          return rc;
+        }
+      } else {
+        add_top_k_batch(p_plan, p_child_batch, p_buffer);
+      }
+    }
+    if (rc) {
+      return rc;
+    }
+    p_operator->is_done = true;
+    if (is_top_k) {
+      heap_sort_entries(p_buffer, p_buffer->entries, 0, p_buffer->num_rows);
+    } else if (p_buffer->merge.num_runs > 0) {
+      rc = start_run_merge(p_plan, p_buffer);
+    } else if (p_buffer->num_rows > 0) {
+      rc = sort_buffered_rows(p_plan, p_buffer);
+    }
+    if (rc) {
+      return rc;
+    }
+    if (p_plan->has_limit && (p_buffer->merge.num_runs == 0)) {
+      // Skip the OFFSET rows and drop the rows after the LIMIT.
+      if (num_limit_rows < p_buffer->num_rows) {
+        p_buffer->num_rows = (int)num_limit_rows;
+      }
+      p_operator->position = (p_plan->offset < p_buffer->num_rows)
+                                 ? p_plan->offset
+                                 : p_buffer->num_rows;
+    }
+    for (int c = 0; c < p_plan->num_project_cols; c++) {
+      int col_id = p_plan->project_col_ids[c];
+      p_batch->columns[col_id] = &p_buffer->columns[col_id];
+    }
+  }
+
+  // Then return the sorted rows by batches over the buffered columns.
+  *pp_batch = NULL;
+  if (p_buffer->merge.num_runs > 0) {
+    return next_merged_batch(p_operator, pp_batch);
+  }
+  int num_rows = p_buffer->num_rows - p_operator->position;
+  if (num_rows > 0) {
+    p_batch->num_selected =
+        (num_rows > FILTER_BATCH_SIZE) ? FILTER_BATCH_SIZE : num_rows;
+    for (int i = 0; i < p_batch->num_selected; i++) {
+      p_batch->selected[i] = p_buffer->entries[p_operator->position + i].row;
+    }
+    p_operator->position += p_batch->num_selected;
+    *pp_batch = p_batch;
+  }
+  return rc;
+}
+
+int next_merged_batch(batch_operator *p_operator, row_batch **pp_batch) {
+  /* The rows of the runs are merged as they are returned, and decoded in
+  the buffered columns. position counts the merged rows, with the OFFSET
+  rows. */
+  int rc = 0;
+  select_plan *p_plan = p_operator->p_plan;
+  sort_buffer *p_buffer = &p_operator->buffer;
+  run_merge *p_merge = &p_buffer->merge;
+  row_batch *p_batch = p_operator->p_batch;
+  long long num_limit_rows = (long long)p_plan->offset + p_plan->limit;
+  int num_rows = 0;
+  while (!rc && (num_rows < FILTER_BATCH_SIZE) &&
+         (!p_plan->has_limit || (p_operator->position < num_limit_rows))) {
+    int run = p_merge->tree.nodes[0];
+    sort_run *p_run = &p_merge->runs[run];
+    if (p_run->position == p_run->num_block_rows) {
+      break;
+    }
+    if (!p_plan->has_limit || (p_operator->position >= p_plan->offset)) {
+      read_sort_row(p_plan,
+                    p_run->block + (size_t)p_run->position * p_merge->row_size,
+                    p_buffer, num_rows);
+      p_batch->selected[num_rows] = num_rows;
+      num_rows++;
+    }
+    p_operator->position++;
+    rc = next_run_row(p_merge, run);
+  }
+  *pp_batch = NULL;
+  if (!rc && (num_rows > 0)) {
+    p_batch->num_selected = num_rows;
+    *pp_batch = p_batch;
+  }
+  return rc;
+}
+
+int next_limit_operator(batch_operator *p_operator, row_batch **pp_batch) {
+  /* Skip the OFFSET rows, then return rows until the LIMIT. The child is
+  not pulled after that, so the scan reads no more records. */
+  int rc = 0;
+  select_plan *p_plan = p_operator->p_plan;
+  long long num_limit_rows = (long long)p_plan->offset + p_plan->limit;
+  row_batch *p_batch = NULL;
+  *pp_batch = NULL;
+  while ((p_plan->limit > 0) && (p_operator->position < num_limit_rows) &&
+         ((rc = p_operator->child->next(p_operator->child, &p_batch)) == 0) &&
+         p_batch) {
+    int first = 0;
+    if (p_operator->position < p_plan->offset) {
+      first = p_plan->offset - p_operator->position;
+      if (first > p_batch->num_selected) {
+        first = p_batch->num_selected;
+      }
+    }
+    int num_rows = p_batch->num_selected - first;
+    if (num_rows > num_limit_rows - p_operator->position - first) {
+      num_rows = (int)(num_limit_rows - p_operator->position - first);
+    }
+    p_operator->position += first + num_rows;
+    if (num_rows > 0) {
+      memmove(p_batch->selected, p_batch->selected + first,
+              sizeof(int) * num_rows);
+      p_batch->num_selected = num_rows;
+      *pp_batch = p_batch;
+      return rc;
+    }
+  }
+  return rc;
+}
+
+int next_group_operator(batch_operator *p_operator, row_batch **pp_batch) {
+  /* Group the whole input on the first call, then return the groups by
+  batches of grouped rows, without those which HAVING rejects. The groups
+  of the spilled partitions come after those left in the table. Aggregates
+  without GROUP BY have one group even without any row, which also gets
+  the partial states of the workers of a parallel scan. */
+  int rc = 0;
+  group_table *p_groups = p_operator->p_groups;
+  select_plan *p_plan = p_groups->p_plan;
+  row_batch *p_batch = p_operator->p_batch;
+  *pp_batch = NULL;
+  if (!p_operator->is_done) {
+    row_batch *p_child_batch = NULL;
+    while (((rc = p_operator->child->next(p_operator->child,
+                                          &p_child_batch)) == 0) &&
+           p_child_batch) {
+      if ((rc = add_group_batch(p_groups, p_child_batch)) != 0) {
+        return rc;
+      }
+    }
+    if (!rc && has_ungrouped_aggregates(p_plan)) {
+      unsigned char *group_row = NULL;
+      rc = find_single_group(p_groups, &group_row);
+      scan_pool *p_pool = p_operator->child->p_pool;
+      for (int i = 0; !rc && p_pool && (i < p_pool->num_workers); i++) {
+        merge_group_states(p_groups, group_row,
+                           p_pool->aggregate_rows +
+                               (size_t)i * p_pool->aggregate_row_size);
+      }
+    }
+    if (rc || ((rc = finish_group_pass(p_groups)) != 0)) {
+      return rc;
+    }
+    p_operator->is_done = true;
+    for (int c = 0; c < p_plan->num_grouped_cols; c++) {
+      p_batch->columns[c] = &p_operator->vectors[c];
+    }
+  }
+
+  while (!rc && ((p_groups->position < p_groups->num_groups) ||
+                 (p_groups->num_partitions > 0))) {
+    if (p_groups->position == p_groups->num_groups) {
+      rc = load_group_partition(p_groups);
+      continue;
+    }
+    int num_rows = p_groups->num_groups - p_groups->position;
+    if (num_rows > FILTER_BATCH_SIZE) {
+      num_rows = FILTER_BATCH_SIZE;
+    }
+    p_batch->num_selected = 0;
+    for (int i = 0; i < num_rows; i++) {
+      output_group_row(p_groups,
+                       p_groups->rows + (size_t)(p_groups->position + i) *
+                                            p_groups->row_size,
+                       p_operator->vectors, i);
+      if ((p_plan->having.num_nodes == 0) ||
+          (eval_group_predicate_node(&p_plan->having, p_plan->having.root,
+                                     p_operator->vectors, i) == TRUTH_TRUE)) {
+        p_batch->selected[p_batch->num_selected++] = i;
+      }
+    }
+    p_groups->position += num_rows;
+    if (p_batch->num_selected > 0) {
+      *pp_batch = p_batch;
+      break;
+    }
+  }
+  return rc;
+}
+
+int init_group_table(select_plan *p_plan, group_table **pp_groups) {
+  /* The states of the aggregates are laid out first, then the key. The
+  table starts with FILTER_BATCH_SIZE groups and doubles up to the memory
+  budget, which counts a row, its hash and two buckets per group. */
+  group_table *p_groups = (group_table *)calloc(1, sizeof(group_table));
+  *pp_groups = p_groups;
+  if (p_groups == NULL) {
+    return MEMORY_ERROR;
+  }
+  p_groups->p_plan = p_plan;
+  p_groups->key_offset = init_aggregate_states(p_plan);
+  for (int i = 0; i < p_plan->num_group_by_cols; i++) {
+    p_groups->key_col_offsets[i] = p_groups->key_size;
+    p_groups->key_size +=
+        get_key_size(&p_plan->layout, 1, &p_plan->group_by_col_ids[i]);
+  }
+  p_groups->row_size =
+      round_integer(p_groups->key_offset + p_groups->key_size, 8);
+  int64_t max_groups =
+      g_group_memory_size /
+      (p_groups->row_size + sizeof(uint32_t) + 2 * sizeof(int));
+  if (max_groups < 1) {
+    max_groups = 1;
+  } else if (max_groups > INT32_MAX / 4) {
+    max_groups = INT32_MAX / 4;
+  }
+  p_groups->max_groups = (int)max_groups;
+  return grow_group_table(p_groups);
+}
+
+int init_aggregate_states(select_plan *p_plan) {
+  // Lay out the states of the aggregates, and return their size.
+  int state_offset = 0;
+  for (int a = 0; a < p_plan->num_group_aggregates; a++) {
+    group_aggregate *p_aggregate = &p_plan->group_aggregates[a];
+    p_aggregate->state_offset = state_offset;
+    state_offset += sizeof(aggregate_state);
+    if (((p_aggregate->function == F_MIN) ||
+         (p_aggregate->function == F_MAX)) &&
+        (p_plan->layout.columns[p_aggregate->col_id].col_type != T_INT)) {
+      state_offset += round_integer(
+          p_plan->layout.columns[p_aggregate->col_id].col_len + 1, 8);
+    }
+  }
+  return state_offset;
+}
+
+void free_group_table(group_table *p_groups) {
+  for (int i = 0; i < NUM_GROUP_PARTITIONS; i++) {
+    if (p_groups->spilled_runs[i].file) {
+      fclose(p_groups->spilled_runs[i].file);
+    }
+    free(p_groups->spilled_runs[i].block);
+  }
+  for (int i = 0; i < p_groups->num_partitions; i++) {
+    fclose(p_groups->partitions[i].run.file);
+    free(p_groups->partitions[i].run.block);
+  }
+  free(p_groups->partitions);
+  free(p_groups->rows);
+  free(p_groups->hashes);
+  free(p_groups->buckets);
+  free(p_groups);
+}
+
+void clear_group_table(group_table *p_groups) {
+  p_groups->num_groups = 0;
+  p_groups->position = 0;
+  memset(p_groups->buckets, 0xff, sizeof(int) * p_groups->num_buckets);
+}
+
+int add_group_batch(group_table *p_groups, row_batch *p_batch) {
+  // Find or add the group of each selected row, then update its aggregates.
+  select_plan *p_plan = p_groups->p_plan;
+  if (p_plan->num_group_by_cols == 0) {
+    unsigned char *group_row = NULL;
+    int rc = find_single_group(p_groups, &group_row);
+    if (!rc) {
+      aggregate_batch(p_plan, p_batch, group_row);
+    }
+    return rc;
+  }
+  unsigned char key[MAX_NUM_COL * (MAX_STRING_LEN + 1)];
+  for (int i = 0; i < p_batch->num_selected; i++) {
+    int row = p_batch->selected[i];
+    encode_key(&p_plan->layout, p_plan->num_group_by_cols,
+               p_plan->group_by_col_ids, NULL, p_batch->columns, row, key);
+    int group = 0;
+    bool is_new = false;
+    int rc = find_group(p_groups, key,
+                        hash_group_key(key, p_groups->key_size), &group,
+                        &is_new);
+    if (rc) {
+      return rc;
+    }
+    unsigned char *group_row =
+        p_groups->rows + (size_t)group * p_groups->row_size;
+    if (is_new) {
+      memset(group_row, '\0', p_groups->key_offset);
+    }
+    update_group_states(p_groups, group_row, p_batch, row);
+  }
+  return 0;
+}
+
+int find_single_group(group_table *p_groups, unsigned char **p_group_row) {
+  // The group of aggregates without GROUP BY, whose key is empty.
+  unsigned char key[1] = {0};
+  int group = 0;
+  bool is_new = false;
+  int rc = find_group(p_groups, key, hash_group_key(key, 0), &group, &is_new);
+  if (rc) {
+    return rc;
+  }
+  *p_group_row = p_groups->rows + (size_t)group * p_groups->row_size;
+  if (is_new) {
+    memset(*p_group_row, '\0', p_groups->key_offset);
+  }
+  return rc;
+}
+
+int find_group(group_table *p_groups, const unsigned char *key, uint32_t hash,
+               int *p_group, bool *p_is_new) {
+  /* A new group gets the key, and the caller sets its states. When the
+  table is full, it grows, or its groups are spilled unless it holds a
+  partition which may not be split any more. */
+  int mask = p_groups->num_buckets - 1;
+  int bucket = hash & mask;
+  for (; p_groups->buckets[bucket] > -1; bucket = (bucket + 1) & mask) {
+    int group = p_groups->buckets[bucket];
+    if ((p_groups->hashes[group] == hash) &&
+        (memcmp(p_groups->rows + (size_t)group * p_groups->row_size +
+                    p_groups->key_offset,
+                key, p_groups->key_size) == 0)) {
+      *p_group = group;
+      *p_is_new = false;
+      return 0;
+    }
+  }
+
+  if (p_groups->num_groups == p_groups->capacity) {
+    int rc = ((p_groups->capacity < p_groups->max_groups) ||
+              (p_groups->depth == MAX_GROUP_SPILL_DEPTH))
+                 ? grow_group_table(p_groups)
+                 : spill_group_table(p_groups);
+    return rc ? rc : find_group(p_groups, key, hash, p_group, p_is_new);
+  }
+  int group = p_groups->num_groups++;
+  p_groups->buckets[bucket] = group;
+  p_groups->hashes[group] = hash;
+  memcpy(p_groups->rows + (size_t)group * p_groups->row_size +
+             p_groups->key_offset,
+         key, p_groups->key_size);
+  *p_group = group;
+  *p_is_new = true;
+  return 0;
+}
+
+int grow_group_table(group_table *p_groups) {
+  /* Double the capacity, up to max_groups unless the partition may not be
+  split any more, then rebuild the buckets from the hashes. */
+  int64_t capacity = (p_groups->capacity > 0) ? 2 * (int64_t)p_groups->capacity
+                                              : FILTER_BATCH_SIZE;
+  if ((p_groups->depth < MAX_GROUP_SPILL_DEPTH) &&
+      (capacity > p_groups->max_groups)) {
+    capacity = p_groups->max_groups;
+  }
+  if (capacity > INT32_MAX / 4) {
+    return MEMORY_ERROR;
+  }
+  unsigned char *rows = (unsigned char *)realloc(
+      p_groups->rows, (size_t)capacity * p_groups->row_size);
+  if (rows == NULL) {
+    return MEMORY_ERROR;
+  }
+  p_groups->rows = rows;
+  uint32_t *hashes =
+      (uint32_t *)realloc(p_groups->hashes, sizeof(uint32_t) * capacity);
+  if (hashes == NULL) {
+    return MEMORY_ERROR;
+  }
+  p_groups->hashes = hashes;
+  int num_buckets = 2;
+  while (num_buckets < 2 * capacity) {
+    num_buckets *= 2;
+  }
+  free(p_groups->buckets);
+  p_groups->buckets = (int *)malloc(sizeof(int) * num_buckets);
+  if (p_groups->buckets == NULL) {
+    p_groups->num_buckets = 0;
+    return MEMORY_ERROR;
+  }
+  p_groups->capacity = (int)capacity;
+  p_groups->num_buckets = num_buckets;
+  memset(p_groups->buckets, 0xff, sizeof(int) * num_buckets);
+  int mask = num_buckets - 1;
+  for (int group = 0; group < p_groups->num_groups; group++) {
+    int bucket = p_groups->hashes[group] & mask;
+    while (p_groups->buckets[bucket] > -1) {
+      bucket = (bucket + 1) & mask;
+    }
+    p_groups->buckets[bucket] = group;
+  }
+  return 0;
+}
+
+void update_group_states(group_table *p_groups, unsigned char *group_row,
+                         row_batch *p_batch, int row) {
+  /* COUNT(*) counts every row, the other aggregates count the values which
+  are not NULL. MIN and MAX take the first value of the group. */
+  select_plan *p_plan = p_groups->p_plan;
+  for (int a = 0; a < p_plan->num_group_aggregates; a++) {
+    group_aggregate *p_aggregate = &p_plan->group_aggregates[a];
+    aggregate_state *p_state =
+        (aggregate_state *)(group_row + p_aggregate->state_offset);
+    if (p_aggregate->col_id < 0) {
+      p_state->records_count++;
+      continue;
+    }
+    column_vector *p_vector = p_batch->columns[p_aggregate->col_id];
+    if (p_vector->is_null[row]) {
+      continue;
+    }
+    bool is_min = (p_aggregate->function == F_MIN);
+    if (is_min || (p_aggregate->function == F_MAX)) {
+      update_min_max_state(is_min, p_vector, row, p_state);
+    } else if (p_aggregate->function != F_COUNT) {
+      p_state->int_sum += p_vector->int_values[row];
+    }
+    p_state->records_count++;
+  }
+}
+
+void update_min_max_state(bool is_min, const column_vector *p_vector, int row,
+                          aggregate_state *p_state) {
+  // The caller counts the value, which is not NULL.
+  if (p_vector->col_type == T_INT) {
+    int64_t value = p_vector->int_values[row];
+    if ((p_state->records_count == 0) ||
+        (is_min ? (value < p_state->int_sum) : (value > p_state->int_sum))) {
+      p_state->int_sum = value;
+    }
+  } else {
+    const char *string_value =
+        p_vector->string_values + row * p_vector->value_size;
+    char *p_value = (char *)(p_state + 1);
+    int result = strcmp(string_value, p_value);
+    if ((p_state->records_count == 0) ||
+        (is_min ? (result < 0) : (result > 0))) {
+      strcpy(p_value, string_value);
+    }
+  }
+}
+
+void merge_group_states(group_table *p_groups, unsigned char *group_row,
+                        const unsigned char *other_row) {
+  // Add the states of another row of the same group.
+  select_plan *p_plan = p_groups->p_plan;
+  for (int a = 0; a < p_plan->num_group_aggregates; a++) {
+    group_aggregate *p_aggregate = &p_plan->group_aggregates[a];
+    aggregate_state *p_state =
+        (aggregate_state *)(group_row + p_aggregate->state_offset);
+    const aggregate_state *p_other =
+        (const aggregate_state *)(other_row + p_aggregate->state_offset);
+    bool is_min = (p_aggregate->function == F_MIN);
+    if ((p_other->records_count == 0) ||
+        (!is_min && (p_aggregate->function != F_MAX))) {
+      merge_aggregate_state(p_state, p_other);
+      continue;
+    }
+    if (p_plan->layout.columns[p_aggregate->col_id].col_type == T_INT) {
+      if ((p_state->records_count == 0) ||
+          (is_min ? (p_other->int_sum < p_state->int_sum)
+                  : (p_other->int_sum > p_state->int_sum))) {
+        p_state->int_sum = p_other->int_sum;
+      }
+    } else {
+      char *p_value = (char *)(p_state + 1);
+      const char *p_other_value = (const char *)(p_other + 1);
+      int result = strcmp(p_other_value, p_value);
+      if ((p_state->records_count == 0) ||
+          (is_min ? (result < 0) : (result > 0))) {
+        strcpy(p_value, p_other_value);
+      }
+    }
+    p_state->records_count += p_other->records_count;
+  }
+}
+
+int spill_group_table(group_table *p_groups) {
+  // Each group goes to the partition of its hash, then the table is empty.
+  int rc = 0;
+  int row_size = p_groups->row_size;
+  for (int group = 0; (group < p_groups->num_groups) && !rc; group++) {
+    sort_run *p_run = &p_groups->spilled_runs[get_group_partition(
+        p_groups->hashes[group], p_groups->depth)];
+    if ((p_run->file == NULL) &&
+        ((rc = open_sort_run(p_run, row_size)) != 0)) {
+      break;
+    }
+    memcpy(p_run->block + (size_t)p_run->num_block_rows * row_size,
+           p_groups->rows + (size_t)group * row_size, row_size);
+    if (++p_run->num_block_rows == get_run_block_rows(row_size)) {
+      rc = flush_sort_run(p_run, row_size);
+    }
+  }
+  clear_group_table(p_groups);
+  p_groups->is_spilled = true;
+  return rc;
+}
+
+int finish_group_pass(group_table *p_groups) {
+  /* Once the table has spilled, its last groups are spilled too, and each
+  partition waits to be grouped on its own, one level deeper. */
+  if (!p_groups->is_spilled) {
+    return 0;
+  }
+  int rc = spill_group_table(p_groups);
+  for (int i = 0; (i < NUM_GROUP_PARTITIONS) && !rc; i++) {
+    sort_run *p_run = &p_groups->spilled_runs[i];
+    if (p_run->file == NULL) {
+      continue;
+    }
+    if ((rc = flush_sort_run(p_run, p_groups->row_size)) != 0) {
+      break;
+    }
+    group_partition *partitions = (group_partition *)realloc(
+        p_groups->partitions,
+        sizeof(group_partition) * (p_groups->num_partitions + 1));
+    if (partitions == NULL) {
+      rc = MEMORY_ERROR;
+      break;
+    }
+    p_groups->partitions = partitions;
+    partitions[p_groups->num_partitions].run = *p_run;
+    partitions[p_groups->num_partitions].depth = p_groups->depth + 1;
+    p_groups->num_partitions++;
+    memset(p_run, '\0', sizeof(sort_run));
+  }
+  p_groups->is_spilled = false;
+  return rc;
+}
+
+int load_group_partition(group_table *p_groups) {
+  /* Group the rows of the last partition, whose groups may have been
+  spilled more than once, so the rows of a group are merged. */
+  group_partition partition = p_groups->partitions[--p_groups->num_partitions];
+  sort_run *p_run = &partition.run;
+  int row_size = p_groups->row_size;
+  int key_offset = p_groups->key_offset;
+  clear_group_table(p_groups);
+  p_groups->depth = partition.depth;
+  rewind(p_run->file);
+  int rc = 0;
+  while (!rc && ((rc = read_sort_run(p_run, row_size)) == 0) &&
+         (p_run->num_block_rows > 0)) {
+    for (int i = 0; (i < p_run->num_block_rows) && !rc; i++) {
+      const unsigned char *row = p_run->block + (size_t)i * row_size;
+      int group = 0;
+      bool is_new = false;
+      rc = find_group(p_groups, row + key_offset,
+                      hash_group_key(row + key_offset, p_groups->key_size),
+                      &group, &is_new);
+      if (rc) {
+        break;
+      }
+      unsigned char *group_row = p_groups->rows + (size_t)group * row_size;
+      if (is_new) {
+        memcpy(group_row, row, key_offset);
+      } else {
+        merge_group_states(p_groups, group_row, row);
+      }
+    }
+  }
+  fclose(p_run->file);
+  free(p_run->block);
+  return rc ? rc : finish_group_pass(p_groups);
+}
+
+void output_group_row(group_table *p_groups, const unsigned char *group_row,
+                      column_vector vectors[], int row) {
+  /* The grouping columns are decoded from the key. SUM, AVG, MIN and MAX
+  are NULL for a group without values, and AVG is truncated like the AVG
+  of a whole table. */
+  select_plan *p_plan = p_groups->p_plan;
+  for (int c = 0; c < p_plan->num_grouped_cols; c++) {
+    grouped_column *p_source = &p_plan->grouped_cols[c];
+    column_vector *p_vector = &vectors[c];
+    if (p_source->group_by_index > -1) {
+      column_layout *p_column =
+          &p_plan->layout
+               .columns[p_plan->group_by_col_ids[p_source->group_by_index]];
+      const unsigned char *key =
+          group_row + p_groups->key_offset +
+          p_groups->key_col_offsets[p_source->group_by_index];
+      if (p_column->col_type == T_INT) {
+        p_vector->is_null[row] = !p_column->not_null && (*key++ == 0);
+        uint32_t value = ((uint32_t)key[0] << 24) | ((uint32_t)key[1] << 16) |
+                         ((uint32_t)key[2] << 8) | (uint32_t)key[3];
+        p_vector->long_values[row] = (int32_t)(value ^ 0x80000000U);
+      } else {
+        char *string_value =
+            p_vector->string_values + row * p_vector->value_size;
+        memcpy(string_value, key, p_column->col_len);
+        string_value[p_column->col_len] = '\0';
+        p_vector->is_null[row] = (string_value[0] == '\0');
+      }
+      continue;
+    }
+
+    group_aggregate *p_aggregate =
+        &p_plan->group_aggregates[p_source->aggregate_index];
+    const aggregate_state *p_state =
+        (const aggregate_state *)(group_row + p_aggregate->state_offset);
+    p_vector->is_null[row] = (p_aggregate->function != F_COUNT) &&
+                             (p_state->records_count == 0);
+    if (p_vector->col_type != T_INT) {
+      strcpy(p_vector->string_values + row * p_vector->value_size,
+             (const char *)(p_state + 1));
+    } else if (p_aggregate->function == F_COUNT) {
+      p_vector->long_values[row] = p_state->records_count;
+    } else if (p_aggregate->function == F_AVG) {
+      p_vector->long_values[row] =
+          (p_state->records_count == 0)
+              ? 0
+              : p_state->int_sum / p_state->records_count;
+    } else {
+      p_vector->long_values[row] = p_state->int_sum;
+    }
+  }
+}
+
+int eval_group_predicate_node(record_predicate *p_predicate, int node,
+                              column_vector vectors[], int row) {
+  // Like eval_row_predicate_node(), on a row of grouped rows.
+  predicate_node *p_node = &p_predicate->nodes[node];
+  if (p_node->type == 0) {
+    record_condition *p_condition =
+        &p_predicate->conditions[p_node->condition_index];
+    column_vector *p_vector = &vectors[p_condition->col_id];
+    if (p_vector->is_null[row] && (p_condition->op_type != K_IS) &&
+        (p_condition->op_type != K_NOT)) {
+      return TRUTH_UNKNOWN;
+    }
+    return eval_group_condition(p_condition, p_vector, row) ? TRUTH_TRUE
+                                                            : TRUTH_FALSE;
+  }
+
+  if (p_node->type == K_NOT) {
+    int result = eval_group_predicate_node(p_predicate, p_node->first_child,
+                                           vectors, row);
+    return (result == TRUTH_UNKNOWN) ? TRUTH_UNKNOWN
+           : (result == TRUTH_TRUE)  ? TRUTH_FALSE
+                                     : TRUTH_TRUE;
+  }
+
+  int decisive = (p_node->type == K_AND) ? TRUTH_FALSE : TRUTH_TRUE;
+  int result = (p_node->type == K_AND) ? TRUTH_TRUE : TRUTH_FALSE;
+  for (int child = p_node->first_child; child > -1;
+       child = p_predicate->nodes[child].next_sibling) {
+    int child_result =
+        eval_group_predicate_node(p_predicate, child, vectors, row);
+    if (child_result == decisive) {
+      return decisive;
+    } else if (child_result == TRUTH_UNKNOWN) {
+      result = TRUTH_UNKNOWN;
+    }
+  }
+  return result;
+}
+
+bool eval_group_condition(record_condition *p_condition,
+                          column_vector *p_vector, int row) {
+  /* Like eval_condition(), with the 64-bit integers of grouped rows. The
+  value is not NULL, unless the operator is IS NULL or IS NOT NULL. */
+  int op_type = p_condition->op_type;
+  if ((op_type == K_IS) || (op_type == K_NOT)) {
+    return p_vector->is_null[row] == (op_type == K_IS);
+  }
+  token_list *cur = p_condition->first_in_value;
+  if (p_vector->col_type == T_INT) {
+    int64_t value = p_vector->long_values[row];
+    if (op_type == K_IN) {
+      for (int i = 0; i < p_condition->num_in_values; i++) {
+        if (value == atoi(cur->tok_string)) {
+          return true;
+        }
+        cur = cur->next->next;  // Skip the comma.
+      }
+      return false;
+    }
+    return (op_type == S_LESS)      ? (value < p_condition->int_data_value)
+           : (op_type == S_GREATER) ? (value > p_condition->int_data_value)
+                                    : (value == p_condition->int_data_value);
+  }
+
+  const char *string_value =
+      p_vector->string_values + row * p_vector->value_size;
+  if (op_type == K_IN) {
+    for (int i = 0; i < p_condition->num_in_values; i++) {
+      if (strcmp(string_value, cur->tok_string) == 0) {
+        return true;
+      }
+      cur = cur->next->next;  // Skip the comma.
+    }
+    return false;
+  } else if (op_type == K_LIKE) {
+    return match_like_pattern(string_value, strlen(string_value),
+                              p_condition->string_data_value,
+                              p_condition->string_data_length);
+  }
+  int result = strcmp(string_value, p_condition->string_data_value);
+  return (op_type == S_LESS)      ? (result < 0)
+         : (op_type == S_GREATER) ? (result > 0)
+                                  : (result == 0);
+}
+
+void filter_batch(select_plan *p_plan, row_batch *p_batch) {
+  // Turn the selection bitmap of the WHERE clause into a selection vector.
+  uint64_t selection[SELECTION_WORDS];
+  eval_compiled_predicate_batch(&p_plan->where_filter, p_batch->records,
+                                p_batch->num_rows, selection);
+  p_batch->num_selected = 0;
+  for (int w = 0; w * 64 < p_batch->num_rows; w++) {
+    uint64_t word = selection[w];
+    for (int bit = 0; word; bit++, word >>= 1) {
+      if (word & 1) {
+        p_batch->selected[p_batch->num_selected++] = w * 64 + bit;
+      }
+    }
+  }
+}
+
+void project_batch(select_plan *p_plan, row_batch *p_batch,
+                   column_vector vectors[]) {
+  // Decode the projected columns of the selected rows, one column at a time.
+  memset(p_batch->columns, '\0', sizeof(p_batch->columns));
+  for (int c = 0; c < p_plan->num_project_cols; c++) {
+    int col_id = p_plan->project_col_ids[c];
+    column_layout *p_column = &p_plan->layout.columns[col_id];
+    column_vector *p_vector = &vectors[col_id];
+    if (p_column->col_type == T_INT) {
+      for (int i = 0; i < p_batch->num_selected; i++) {
+        int row = p_batch->selected[i];
+        const char *field = p_batch->records[row] + p_column->offset;
+        p_vector->is_null[row] = (field[0] == 0);
+        memcpy(&p_vector->int_values[row], field + 1, sizeof(int));
+      }
+    } else {
+      for (int i = 0; i < p_batch->num_selected; i++) {
+        int row = p_batch->selected[i];
+        const char *field = p_batch->records[row] + p_column->offset;
+        int value_length = (unsigned char)field[0];
+        char *string_value =
+            p_vector->string_values + row * p_vector->value_size;
+        p_vector->is_null[row] = (value_length == 0);
+        memcpy(string_value, field + 1, value_length);
+        string_value[value_length] = '\0';
+      }
+    }
+    p_batch->columns[col_id] = p_vector;
+  }
+}
+
+void aggregate_batch(select_plan *p_plan, row_batch *p_batch,
+                     unsigned char *states) {
+  // Update the states of every aggregate, laid out like in a group row.
+  for (int a = 0; a < p_plan->num_group_aggregates; a++) {
+    group_aggregate *p_aggregate = &p_plan->group_aggregates[a];
+    aggregate_column_batch(
+        p_aggregate, p_batch,
+        (aggregate_state *)(states + p_aggregate->state_offset));
+  }
+}
+
+void aggregate_column_batch(const group_aggregate *p_aggregate,
+                            row_batch *p_batch, aggregate_state *p_state) {
+  if (p_aggregate->col_id < 0) {
+    // COUNT(*), include NULL rows.
+    p_state->records_count += p_batch->num_selected;
+    return;
+  }
+
+  column_vector *p_vector = p_batch->columns[p_aggregate->col_id];
+  bool is_min = (p_aggregate->function == F_MIN);
+  if (is_min || (p_aggregate->function == F_MAX)) {
+    // MIN(col) or MAX(col), ignore NULL rows.
+    for (int i = 0; i < p_batch->num_selected; i++) {
+      int row = p_batch->selected[i];
+      if (!p_vector->is_null[row]) {
+        update_min_max_state(is_min, p_vector, row, p_state);
+        p_state->records_count++;
+      }
+    }
+    return;
+  }
+
+  // SUM(col), AVG(col) or COUNT(col), ignore NULL rows. The loop has no
+  // branch, a NULL row adds 0. COUNT(col) of a string column has no sum.
+  int64_t num_values = 0;
+  int64_t int_sum = 0;
+  if (p_aggregate->function == F_COUNT) {
+    for (int i = 0; i < p_batch->num_selected; i++) {
+      num_values += !p_vector->is_null[p_batch->selected[i]];
+    }
+  } else {
+    for (int i = 0; i < p_batch->num_selected; i++) {
+      int row = p_batch->selected[i];
+      int is_value = !p_vector->is_null[row];
+      num_values += is_value;
+      int_sum += (int64_t)p_vector->int_values[row] * is_value;
+    }
+  }
+  p_state->records_count += num_values;
+  p_state->int_sum += int_sum;
+}
+
+int add_sort_batch(select_plan *p_plan, row_batch *p_batch,
+                   sort_buffer *p_buffer) {
+  // Keep the projected columns of the selected rows, which grow as needed.
+  int num_rows = p_buffer->num_rows + p_batch->num_selected;
+  if (num_rows > p_buffer->capacity) {
+    int new_capacity = (p_buffer->capacity == 0) ? FILTER_BATCH_SIZE
+                                                 : p_buffer->capacity * 2;
+    if (new_capacity < num_rows) {
+      new_capacity = num_rows;
+    }
+    int64_t max_rows = get_max_sort_rows(p_plan);
+    if ((new_capacity > max_rows) && (max_rows >= num_rows)) {
+      new_capacity = (int)max_rows;
+    }
+    for (int c = 0; c < p_plan->num_project_cols; c++) {
+      int col_id = p_plan->project_col_ids[c];
+      int rc = reserve_column_vector(&p_buffer->columns[col_id], new_capacity);
+      if (rc) {
+        return rc;
+      }
+    }
+    p_buffer->capacity = new_capacity;
+  }
+
+  copy_batch_rows(p_plan, p_batch, p_buffer->columns, p_buffer->num_rows);
+  p_buffer->num_rows = num_rows;
+  return 0;
+}
+
+void copy_batch_rows(select_plan *p_plan, row_batch *p_batch,
+                     column_vector columns[], int first_row) {
+  // The projected columns of the selected rows, from first_row on.
+  for (int c = 0; c < p_plan->num_project_cols; c++) {
+    int col_id = p_plan->project_col_ids[c];
+    column_vector *p_src = p_batch->columns[col_id];
+    column_vector *p_dst = &columns[col_id];
+    for (int i = 0; i < p_batch->num_selected; i++) {
+      copy_vector_value(p_src, p_batch->selected[i], p_dst, first_row + i);
+    }
+  }
+}
+
+int sort_buffered_rows(select_plan *p_plan, sort_buffer *p_buffer) {
+  /* Each row gets a normalized key, which is sorted as bytes. The rows are
+  split into one range per worker, which encodes and sorts the keys of its
+  range, then the ranges are merged. */
+  sort_task tasks[MAX_SORT_WORKERS];
+  int num_tasks = 0;
+  int rc = run_sort_tasks(p_plan, p_buffer, false, tasks, &num_tasks);
+  if (rc || (num_tasks == 1)) {
+    return rc;
+  }
+  return merge_sorted_ranges(p_buffer, tasks, num_tasks);
+}
+
+int spill_sort_buffer(select_plan *p_plan, sort_buffer *p_buffer) {
+  /* Each worker writes its sorted range to a run of its own, and the runs
+  are numbered in input order. The buffer is then empty. */
+  run_merge *p_merge = &p_buffer->merge;
+  sort_run *runs = (sort_run *)realloc(
+      p_merge->runs, sizeof(sort_run) * (p_merge->num_runs + MAX_SORT_WORKERS));
+  if (runs == NULL) {
+    return MEMORY_ERROR;
+  }
+  memset(runs + p_merge->num_runs, '\0', sizeof(sort_run) * MAX_SORT_WORKERS);
+  p_merge->runs = runs;
+  p_merge->key_size = get_sort_key_size(p_plan);
+  p_merge->row_size = get_sort_row_size(p_plan);
+
+  sort_task tasks[MAX_SORT_WORKERS];
+  int num_tasks = 0;
+  int rc = run_sort_tasks(p_plan, p_buffer, true, tasks, &num_tasks);
+  p_merge->num_runs += num_tasks;
+  p_buffer->num_rows = 0;
+  free(p_buffer->keys);
+  free(p_buffer->entries);
+  p_buffer->keys = NULL;
+  p_buffer->entries = NULL;
+  return rc;
+}
+
+int run_sort_tasks(select_plan *p_plan, sort_buffer *p_buffer,
+                   bool is_spilled, sort_task tasks[], int *p_num_tasks) {
+  int num_rows = p_buffer->num_rows;
+  int key_size = get_sort_key_size(p_plan);
+  p_buffer->key_size = key_size;
+  free(p_buffer->keys);
+  free(p_buffer->entries);
+  p_buffer->keys = NULL;
+  p_buffer->entries = (sort_entry *)malloc(sizeof(sort_entry) * num_rows);
+  if (p_buffer->entries == NULL) {
+    return MEMORY_ERROR;
+  }
+  if (key_size > 8) {
+    p_buffer->keys = (unsigned char *)malloc((size_t)key_size * num_rows);
+    if (p_buffer->keys == NULL) {
+      return MEMORY_ERROR;
+    }
+  }
+
+  int num_tasks = get_num_sort_tasks(num_rows);
+  for (int i = 0; i < num_tasks; i++) {
+    sort_task *p_task = &tasks[i];
+    p_task->p_plan = p_plan;
+    p_task->p_buffer = p_buffer;
+    p_task->begin = (int)((int64_t)num_rows * i / num_tasks);
+    p_task->end = (int)((int64_t)num_rows * (i + 1) / num_tasks);
+    p_task->p_run =
+        is_spilled ? &p_buffer->merge.runs[p_buffer->merge.num_runs + i] : NULL;
+    p_task->rc = 0;
+  }
+  if (num_tasks == 1) {
+    run_sort_task(&tasks[0]);
+  } else {
+    std::thread workers[MAX_SORT_WORKERS];
+    for (int i = 0; i < num_tasks; i++) {
+      workers[i] = std::thread(run_sort_task, &tasks[i]);
+    }
+    for (int i = 0; i < num_tasks; i++) {
+      workers[i].join();
+    }
+  }
+
+  *p_num_tasks = num_tasks;
+  for (int i = 0; i < num_tasks; i++) {
+    if (tasks[i].rc) {
+      return tasks[i].rc;
+    }
+  }
+  return 0;
+}
+
+int get_num_sort_tasks(int num_rows) {
+  // One task per core, each with at least MIN_SORT_TASK_ROWS rows.
+  int num_tasks = get_num_worker_threads();
+  if (num_tasks > MAX_SORT_WORKERS) {
+    num_tasks = MAX_SORT_WORKERS;
+  }
+  if (num_tasks > num_rows / MIN_SORT_TASK_ROWS) {
+    num_tasks = num_rows / MIN_SORT_TASK_ROWS;
+  }
+  return (num_tasks < 1) ? 1 : num_tasks;
+}
+
+void run_sort_task(sort_task *p_task) {
+  /* Keys of integers only are sorted by LSD radix sort, the others by
+  pdqsort. */
+  select_plan *p_plan = p_task->p_plan;
+  sort_buffer *p_buffer = p_task->p_buffer;
+  int key_size = p_buffer->key_size;
+  column_vector *columns[MAX_NUM_COL];
+  for (int col_id = 0; col_id < MAX_NUM_COL; col_id++) {
+    columns[col_id] = &p_buffer->columns[col_id];
+  }
+  unsigned char key[MAX_NUM_COL * MAX_STRING_LEN];
+  for (int row = p_task->begin; row < p_task->end; row++) {
+    unsigned char *p_key =
+        p_buffer->keys ? p_buffer->keys + (size_t)row * key_size : key;
+    encode_sort_key(p_plan, columns, row, p_key);
+    p_buffer->entries[row].prefix = get_sort_key_prefix(p_key, key_size);
+    p_buffer->entries[row].row = row;
+  }
+
+  bool is_int_key = true;
+  for (int i = 0; i < p_plan->num_order_by_cols; i++) {
+    if (p_plan->layout.columns[p_plan->order_by_col_ids[i]].col_type !=
+        T_INT) {
+      is_int_key = false;
+    }
+  }
+  if (is_int_key) {
+    p_task->rc = radix_sort_entries(p_buffer, p_buffer->entries,
+                                    p_task->begin, p_task->end);
+  } else {
+    // Up to log2(n) unbalanced partitions before heapsort.
+    int bad_allowed = 1;
+    for (int n = p_task->end - p_task->begin; n > 1; n /= 2) {
+      bad_allowed++;
+    }
+    pdqsort_entries(p_buffer, p_buffer->entries, p_task->begin, p_task->end,
+                    bad_allowed);
+  }
+  if (!p_task->rc && p_task->p_run) {
+    p_task->rc = write_sort_run(p_plan, p_buffer, p_task->begin, p_task->end,
+                                p_task->p_run);
+  }
+}
+
+int merge_sorted_ranges(sort_buffer *p_buffer, sort_task tasks[],
+                        int num_tasks) {
+  sort_entry *entries =
+      (sort_entry *)malloc(sizeof(sort_entry) * p_buffer->num_rows);
+  if (entries == NULL) {
+    return MEMORY_ERROR;
+  }
+  sorted_ranges ranges;
+  ranges.p_buffer = p_buffer;
+  for (int i = 0; i < num_tasks; i++) {
+    ranges.begins[i] = tasks[i].begin;
+    ranges.ends[i] = tasks[i].end;
+  }
+  loser_tree tree;
+  init_loser_tree(&tree, num_tasks, &ranges, is_less_range);
+  for (int i = 0; i < p_buffer->num_rows; i++) {
+    int range = tree.nodes[0];
+    entries[i] = p_buffer->entries[ranges.begins[range]++];
+    replay_loser_tree(&tree, range);
+  }
+  free(p_buffer->entries);
+  p_buffer->entries = entries;
+  return 0;
+}
+
+bool is_less_range(const void *p_sources, int range1, int range2) {
+  // An empty range comes after the others.
+  const sorted_ranges *p_ranges = (const sorted_ranges *)p_sources;
+  bool has_entry1 = p_ranges->begins[range1] < p_ranges->ends[range1];
+  bool has_entry2 = p_ranges->begins[range2] < p_ranges->ends[range2];
+  if (!has_entry1 || !has_entry2) {
+    return has_entry1 || (!has_entry2 && (range1 < range2));
+  }
+  const sort_entry *entries = p_ranges->p_buffer->entries;
+  return compare_sort_entries(p_ranges->p_buffer,
+                              &entries[p_ranges->begins[range1]],
+                              &entries[p_ranges->begins[range2]]) < 0;
+}
+
+void init_loser_tree(loser_tree *p_tree, int num_sources,
+                     const void *p_sources,
+                     bool (*is_less)(const void *, int, int)) {
+  /* Source i is the leaf num_sources + i, and node n plays the winners of
+  the nodes 2n and 2n + 1. */
+  p_tree->num_sources = num_sources;
+  p_tree->p_sources = p_sources;
+  p_tree->is_less = is_less;
+  int winners[2 * MAX_MERGE_RUNS];
+  for (int i = 0; i < num_sources; i++) {
+    winners[num_sources + i] = i;
+  }
+  for (int node = num_sources - 1; node > 0; node--) {
+    int source1 = winners[2 * node];
+    int source2 = winners[2 * node + 1];
+    bool is_first = is_less(p_sources, source1, source2);
+    winners[node] = is_first ? source1 : source2;
+    p_tree->nodes[node] = is_first ? source2 : source1;
+  }
+  p_tree->nodes[0] = (num_sources > 1) ? winners[1] : 0;
+}
+
+void replay_loser_tree(loser_tree *p_tree, int source) {
+  // The source has moved to its next row, it plays the losers on its path.
+  int winner = source;
+  for (int node = (p_tree->num_sources + source) / 2; node > 0; node /= 2) {
+    if (p_tree->is_less(p_tree->p_sources, p_tree->nodes[node], winner)) {
+      int loser = winner;
+      winner = p_tree->nodes[node];
+      p_tree->nodes[node] = loser;
+    }
+  }
+  p_tree->nodes[0] = winner;
+}
+
+int64_t get_max_sort_rows(select_plan *p_plan) {
+  // A buffered row, its key, its entry and the entry used by radix sort.
+  int64_t row_size = get_sort_row_size(p_plan) + 2 * sizeof(sort_entry);
+  int64_t max_rows = g_sort_memory_size / row_size;
+  return (max_rows < 1) ? 1 : max_rows;
+}
+
+int get_sort_row_size(select_plan *p_plan) {
+  int row_size = get_sort_key_size(p_plan);
+  for (int c = 0; c < p_plan->num_project_cols; c++) {
+    column_layout *p_column =
+        &p_plan->layout.columns[p_plan->project_col_ids[c]];
+    row_size += 1 + ((p_column->col_type == T_INT) ? p_column->col_len
+                                                   : p_column->col_len + 1);
+  }
+  return row_size;
+}
+
+void write_sort_row(select_plan *p_plan, sort_buffer *p_buffer,
+                    const sort_entry *p_entry, unsigned char *row) {
+  // The key, then a NULL flag and the value of each projected column.
+  for (int b = 0; b < p_buffer->key_size; b++) {
+    *row++ = (unsigned char)get_sort_key_byte(p_buffer, p_entry, b);
+  }
+  for (int c = 0; c < p_plan->num_project_cols; c++) {
+    column_vector *p_vector = &p_buffer->columns[p_plan->project_col_ids[c]];
+    *row++ = p_vector->is_null[p_entry->row] ? 1 : 0;
+    if (is_long_vector(p_vector)) {
+      memcpy(row, &p_vector->long_values[p_entry->row], sizeof(int64_t));
+      row += sizeof(int64_t);
+    } else if (p_vector->col_type == T_INT) {
+      memcpy(row, &p_vector->int_values[p_entry->row], sizeof(int));
+      row += sizeof(int);
+    } else {
+      memcpy(row,
+             p_vector->string_values + p_entry->row * p_vector->value_size,
+             p_vector->value_size);
+      row += p_vector->value_size;
+    }
+  }
+}
+
+void read_sort_row(select_plan *p_plan, const unsigned char *row,
+                   sort_buffer *p_buffer, int dst_row) {
+  row += p_buffer->merge.key_size;
+  for (int c = 0; c < p_plan->num_project_cols; c++) {
+    column_vector *p_vector = &p_buffer->columns[p_plan->project_col_ids[c]];
+    p_vector->is_null[dst_row] = (*row++ != 0);
+    if (is_long_vector(p_vector)) {
+      memcpy(&p_vector->long_values[dst_row], row, sizeof(int64_t));
+      row += sizeof(int64_t);
+    } else if (p_vector->col_type == T_INT) {
+      memcpy(&p_vector->int_values[dst_row], row, sizeof(int));
+      row += sizeof(int);
+    } else {
+      memcpy(p_vector->string_values + dst_row * p_vector->value_size, row,
+             p_vector->value_size);
+      row += p_vector->value_size;
+    }
+  }
+}
+
+int write_sort_run(select_plan *p_plan, sort_buffer *p_buffer, int begin,
+                   int end, sort_run *p_run) {
+  int row_size = p_buffer->merge.row_size;
+  int rc = open_sort_run(p_run, row_size);
+  for (int i = begin; (i < end) && !rc; i++) {
+    write_sort_row(p_plan, p_buffer, &p_buffer->entries[i],
+                   p_run->block + (size_t)p_run->num_block_rows * row_size);
+    if (++p_run->num_block_rows == get_run_block_rows(row_size)) {
+      rc = flush_sort_run(p_run, row_size);
+    }
+  }
+  if (!rc) {
+    rc = flush_sort_run(p_run, row_size);
+  }
+  return rc;
+}
+
+int open_sort_run(sort_run *p_run, int row_size) {
+  // The temporary file is removed when it is closed.
+  memset(p_run, '\0', sizeof(sort_run));
+  p_run->block =
+      (unsigned char *)malloc((size_t)get_run_block_rows(row_size) * row_size);
+  if (p_run->block == NULL) {
+    return MEMORY_ERROR;
+  }
+  if ((p_run->file = tmpfile()) == NULL) {
+    return FILE_OPEN_ERROR;
+  }
+  return 0;
+}
+
+int flush_sort_run(sort_run *p_run, int row_size) {
+  if ((p_run->num_block_rows > 0) &&
+      (fwrite(p_run->block, row_size, p_run->num_block_rows, p_run->file) !=
+       (size_t)p_run->num_block_rows)) {
+    return FILE_WRITE_ERROR;
+  }
+  p_run->num_rows += p_run->num_block_rows;
+  p_run->num_block_rows = 0;
+  return (fflush(p_run->file) == 0) ? 0 : FILE_WRITE_ERROR;
+}
+
+int read_sort_run(sort_run *p_run, int row_size) {
+  /* The next block of the run, which is empty at the end. A short read
+  means the run was not written whole. */
+  int num_rows = get_run_block_rows(row_size);
+  if (num_rows > p_run->num_rows) {
+    num_rows = (int)p_run->num_rows;
+  }
+  if ((num_rows > 0) &&
+      (fread(p_run->block, row_size, num_rows, p_run->file) !=
+       (size_t)num_rows)) {
+    return FILE_WRITE_ERROR;
+  }
+  p_run->num_rows -= num_rows;
+  p_run->num_block_rows = num_rows;
+  p_run->position = 0;
+  return 0;
+}
+
+int start_run_merge(select_plan *p_plan, sort_buffer *p_buffer) {
+  /* The rows left in the buffer are spilled too. Then MAX_MERGE_RUNS runs
+  at most are merged, after passes which merge groups of them. */
+  int rc = 0;
+  if (p_buffer->num_rows > 0) {
+    rc = spill_sort_buffer(p_plan, p_buffer);
+  }
+  while (!rc && (p_buffer->merge.num_runs > MAX_MERGE_RUNS)) {
+    rc = merge_run_pass(&p_buffer->merge);
+  }
+  if (!rc && (p_buffer->capacity < FILTER_BATCH_SIZE)) {
+    for (int c = 0; (c < p_plan->num_project_cols) && !rc; c++) {
+      rc = reserve_column_vector(
+          &p_buffer->columns[p_plan->project_col_ids[c]], FILTER_BATCH_SIZE);
+    }
+    p_buffer->capacity = FILTER_BATCH_SIZE;
+  }
+  if (!rc) {
+    rc = init_run_merge(&p_buffer->merge);
+  }
+  return rc;
+}
+
+int init_run_merge(run_merge *p_merge) {
+  for (int i = 0; i < p_merge->num_runs; i++) {
+    sort_run *p_run = &p_merge->runs[i];
+    rewind(p_run->file);
+    int rc = read_sort_run(p_run, p_merge->row_size);
+    if (rc) {
+      return rc;
+    }
+  }
+  init_loser_tree(&p_merge->tree, p_merge->num_runs, p_merge, is_less_run);
+  return 0;
+}
+
+int next_run_row(run_merge *p_merge, int run) {
+  sort_run *p_run = &p_merge->runs[run];
+  int rc = 0;
+  if (++p_run->position == p_run->num_block_rows) {
+    rc = read_sort_run(p_run, p_merge->row_size);
+  }
+  replay_loser_tree(&p_merge->tree, run);
+  return rc;
+}
+
+int merge_run_pass(run_merge *p_merge) {
+  // Each group of MAX_MERGE_RUNS runs becomes one run, in the same order.
+  int num_runs = (p_merge->num_runs + MAX_MERGE_RUNS - 1) / MAX_MERGE_RUNS;
+  sort_run *runs = (sort_run *)calloc(num_runs, sizeof(sort_run));
+  if (runs == NULL) {
+    return MEMORY_ERROR;
+  }
+  int rc = 0;
+  for (int i = 0; (i < num_runs) && !rc; i++) {
+    run_merge group = *p_merge;
+    group.runs = p_merge->runs + i * MAX_MERGE_RUNS;
+    group.num_runs = p_merge->num_runs - i * MAX_MERGE_RUNS;
+    if (group.num_runs > MAX_MERGE_RUNS) {
+      group.num_runs = MAX_MERGE_RUNS;
+    }
+    sort_run *p_run = &runs[i];
+    if (!(rc = open_sort_run(p_run, p_merge->row_size)) &&
+        !(rc = init_run_merge(&group))) {
+      while (!rc) {
+        int run = group.tree.nodes[0];
+        sort_run *p_group_run = &group.runs[run];
+        if (p_group_run->position == p_group_run->num_block_rows) {
+          break;
+        }
+        memcpy(p_run->block + (size_t)p_run->num_block_rows * group.row_size,
+               p_group_run->block +
+                   (size_t)p_group_run->position * group.row_size,
+               group.row_size);
+        if (++p_run->num_block_rows == get_run_block_rows(group.row_size)) {
+          rc = flush_sort_run(p_run, group.row_size);
+        }
+        if (!rc) {
+          rc = next_run_row(&group, run);
+        }
+      }
+    }
+    if (!rc) {
+      rc = flush_sort_run(p_run, p_merge->row_size);
+    }
+  }
+
+  free_run_merge(p_merge);
+  p_merge->runs = runs;
+  p_merge->num_runs = num_runs;
+  return rc;
+}
+
+bool is_less_run(const void *p_sources, int run1, int run2) {
+  // A run at its end comes after the others, and equal keys by run.
+  const run_merge *p_merge = (const run_merge *)p_sources;
+  const sort_run *p_run1 = &p_merge->runs[run1];
+  const sort_run *p_run2 = &p_merge->runs[run2];
+  bool has_row1 = p_run1->position < p_run1->num_block_rows;
+  bool has_row2 = p_run2->position < p_run2->num_block_rows;
+  if (!has_row1 || !has_row2) {
+    return has_row1 || (!has_row2 && (run1 < run2));
+  }
+  int result =
+      memcmp(p_run1->block + (size_t)p_run1->position * p_merge->row_size,
+             p_run2->block + (size_t)p_run2->position * p_merge->row_size,
+             p_merge->key_size);
+  return (result < 0) || ((result == 0) && (run1 < run2));
+}
+
+void free_run_merge(run_merge *p_merge) {
+  for (int i = 0; i < p_merge->num_runs; i++) {
+    if (p_merge->runs[i].file) {
+      fclose(p_merge->runs[i].file);
+    }
+    free(p_merge->runs[i].block);
+  }
+  free(p_merge->runs);
+  p_merge->runs = NULL;
+  p_merge->num_runs = 0;
+}
+
+int init_top_k_buffer(select_plan *p_plan, sort_buffer *p_buffer,
+                      int num_top_rows) {
+  // One more key holds the key of the row which is being added.
+  for (int c = 0; c < p_plan->num_project_cols; c++) {
+    int rc = reserve_column_vector(
+        &p_buffer->columns[p_plan->project_col_ids[c]], num_top_rows);
+    if (rc) {
+      return rc;
+    }
+  }
+  p_buffer->capacity = num_top_rows;
+  p_buffer->num_top_rows = num_top_rows;
+  p_buffer->key_size = get_sort_key_size(p_plan) + 4;
+  p_buffer->keys = (unsigned char *)malloc((size_t)p_buffer->key_size *
+                                           (num_top_rows + 1));
+  p_buffer->entries = (sort_entry *)malloc(sizeof(sort_entry) * num_top_rows);
+  if ((p_buffer->keys == NULL) || (p_buffer->entries == NULL)) {
+    return MEMORY_ERROR;
+  }
+  return 0;
+}
+
+void add_top_k_batch(select_plan *p_plan, row_batch *p_batch,
+                     sort_buffer *p_buffer) {
+  /* The entries are a heap with the greatest key at the root, and a row
+  replaces the root when its key is smaller. The key ends with the number
+  of the row in the input, so equal values keep their order. */
+  int key_size = p_buffer->key_size;
+  int num_top_rows = p_buffer->num_top_rows;
+  unsigned char *new_key = p_buffer->keys + (size_t)num_top_rows * key_size;
+  for (int i = 0; i < p_batch->num_selected; i++) {
+    int src_row = p_batch->selected[i];
+    uint32_t input_row = (uint32_t)p_buffer->num_input_rows++;
+    encode_sort_key(p_plan, p_batch->columns, src_row, new_key);
+    new_key[key_size - 4] = (unsigned char)(input_row >> 24);
+    new_key[key_size - 3] = (unsigned char)(input_row >> 16);
+    new_key[key_size - 2] = (unsigned char)(input_row >> 8);
+    new_key[key_size - 1] = (unsigned char)input_row;
+    sort_entry entry;
+    entry.prefix = get_sort_key_prefix(new_key, key_size);
+    entry.row = num_top_rows;
+    int node = 0;
+    if (p_buffer->num_rows < num_top_rows) {
+      node = p_buffer->num_rows++;
+      entry.row = node;
+    } else if (compare_sort_entries(p_buffer, &entry, &p_buffer->entries[0]) <
+               0) {
+      entry.row = p_buffer->entries[0].row;
+    } else {
+      continue;
+    }
+
+    int dst_row = entry.row;
+    memcpy(p_buffer->keys + (size_t)dst_row * key_size, new_key, key_size);
+    for (int c = 0; c < p_plan->num_project_cols; c++) {
+      int col_id = p_plan->project_col_ids[c];
+      copy_vector_value(p_batch->columns[col_id], src_row,
+                        &p_buffer->columns[col_id], dst_row);
+    }
+    p_buffer->entries[node] = entry;
+    if (node > 0) {
+      sift_up_sort_entries(p_buffer, p_buffer->entries, node);
+    } else {
+      sift_down_sort_entries(p_buffer, p_buffer->entries, 0,
+                             p_buffer->num_rows);
+    }
+  }
+}
+
+int get_sort_key_size(select_plan *p_plan) {
+  return get_key_size(&p_plan->layout, p_plan->num_order_by_cols,
+                      p_plan->order_by_col_ids);
+}
+
+void encode_sort_key(select_plan *p_plan, column_vector *columns[], int row,
+                     unsigned char *key) {
+  encode_key(&p_plan->layout, p_plan->num_order_by_cols,
+             p_plan->order_by_col_ids, p_plan->order_by_desc, columns, row,
+             key);
+}
+
+int get_key_size(record_layout *p_layout, int num_cols, const int col_ids[]) {
+  int key_size = 0;
+  for (int i = 0; i < num_cols; i++) {
+    column_layout *p_column = &p_layout->columns[col_ids[i]];
+    if (p_column->col_type == T_INT) {
+      key_size += p_column->not_null ? p_column->col_len
+                                     : p_column->col_len + 1;
+    } else {
+      key_size += p_column->col_len;
+    }
+  }
+  return key_size;
+}
+
+void encode_key(record_layout *p_layout, int num_cols, const int col_ids[],
+                const bool is_desc[], column_vector *columns[], int row,
+                unsigned char *key) {
+  /* A nullable integer starts with a byte which is 0 for NULL, then the
+  value is stored big-endian with its sign bit flipped. A string is padded
+  with zeros, and NULL is the empty string. So NULL comes first and
+  memcmp() orders the keys as the values. DESC inverts the bytes of its
+  column, and is_desc is NULL when every column is ascending. */
+  for (int i = 0; i < num_cols; i++) {
+    int col_id = col_ids[i];
+    column_layout *p_column = &p_layout->columns[col_id];
+    column_vector *p_vector = columns[col_id];
+    unsigned char *p_start = key;
+    if (p_column->col_type == T_INT) {
+      bool is_null = p_vector->is_null[row];
+      if (!p_column->not_null) {
+        *key++ = is_null ? 0 : 1;
+      }
+      if (is_long_vector(p_vector)) {
+        uint64_t value = is_null ? 0
+                                 : ((uint64_t)p_vector->long_values[row] ^
+                                    0x8000000000000000ULL);
+        for (int b = 7; b >= 0; b--) {
+          *key++ = (unsigned char)(value >> (8 * b));
+        }
+      } else {
+        uint32_t value =
+            is_null ? 0 : ((uint32_t)p_vector->int_values[row] ^ 0x80000000U);
+        key[0] = (unsigned char)(value >> 24);
+        key[1] = (unsigned char)(value >> 16);
+        key[2] = (unsigned char)(value >> 8);
+        key[3] = (unsigned char)value;
+        key += 4;
+      }
+    } else {
+      const char *string_value =
+          p_vector->string_values + row * p_vector->value_size;
+      int length = strlen(string_value);
+      memcpy(key, string_value, length);
+      memset(key + length, '\0', p_column->col_len - length);
+      key += p_column->col_len;
+    }
+    if (is_desc && is_desc[i]) {
+      for (unsigned char *p = p_start; p < key; p++) {
+        *p = (unsigned char)~*p;
+      }
+    }
+  }
+}
+
+int compare_sort_entries(const sort_buffer *p_buffer,
+                         const sort_entry *p_entry1,
+                         const sort_entry *p_entry2) {
+  // The prefixes, the rest of the keys, then the rows.
+  if (p_entry1->prefix != p_entry2->prefix) {
+    return (p_entry1->prefix < p_entry2->prefix) ? -1 : 1;
+  }
+  if (p_buffer->key_size > 8) {
+    int result =
+        memcmp(p_buffer->keys + (size_t)p_entry1->row * p_buffer->key_size + 8,
+               p_buffer->keys + (size_t)p_entry2->row * p_buffer->key_size + 8,
+               p_buffer->key_size - 8);
+    if (result != 0) {
+      return result;
+    }
+  }
+  return (p_entry1->row > p_entry2->row) - (p_entry1->row < p_entry2->row);
+}
+
+int radix_sort_entries(const sort_buffer *p_buffer, sort_entry entries[],
+                       int begin, int end) {
+  /* LSD radix sort, from the last byte of the keys to the first. Each pass
+  is stable, so rows with equal keys keep their order, and a byte which is
+  the same in every key is skipped. */
+  int num_rows = end - begin;
+  if (num_rows == 0) {
+    return 0;
+  }
+  sort_entry *buffers[2];
+  buffers[0] = entries + begin;
+  buffers[1] = (sort_entry *)malloc(sizeof(sort_entry) * num_rows);
+  if (buffers[1] == NULL) {
+    return MEMORY_ERROR;
+  }
+  int current = 0;
+  for (int b = p_buffer->key_size - 1; b >= 0; b--) {
+    sort_entry *entries = buffers[current];
+    int offsets[256];
+    memset(offsets, '\0', sizeof(offsets));
+    for (int i = 0; i < num_rows; i++) {
+      offsets[get_sort_key_byte(p_buffer, &entries[i], b)]++;
+    }
+    if (offsets[get_sort_key_byte(p_buffer, &entries[0], b)] == num_rows) {
+      continue;
+    }
+    int offset = 0;
+    for (int digit = 0; digit < 256; digit++) {
+      int count = offsets[digit];
+      offsets[digit] = offset;
+      offset += count;
+    }
+    sort_entry *sorted_entries = buffers[1 - current];
+    for (int i = 0; i < num_rows; i++) {
+      sorted_entries[offsets[get_sort_key_byte(p_buffer, &entries[i], b)]++] =
+          entries[i];
+    }
+    current = 1 - current;
+  }
+  if (current == 1) {
+    memcpy(buffers[0], buffers[1], sizeof(sort_entry) * num_rows);
+  }
+  free(buffers[1]);
+  return 0;
+}
+
+void pdqsort_entries(const sort_buffer *p_buffer, sort_entry entries[],
+                     int begin, int end, int bad_allowed) {
+  /* Pattern-defeating quicksort: a quicksort whose pivot is the median of
+  3 entries, or of 9 for large ranges, and which sorts small ranges by
+  insertion sort. Unbalanced partitions shuffle a few entries, and too many
+  of them switch to heapsort. A range which needed no swap to partition is
+  often sorted already, so it is tried with an insertion sort which gives
+  up after a few moves. No two entries are equal, the rows differ. */
+  while (true) {
+    int size = end - begin;
+    if (size < 24) {
+      insertion_sort_entries(p_buffer, entries, begin, end);
+      return;
+    }
+
+    // The pivot is moved to begin, with a greater entry on its right.
+    int middle = begin + size / 2;
+    if (size > 128) {
+      sort3_entries(p_buffer, entries, begin, middle, end - 1);
+      sort3_entries(p_buffer, entries, begin + 1, middle - 1, end - 2);
+      sort3_entries(p_buffer, entries, begin + 2, middle + 1, end - 3);
+      sort3_entries(p_buffer, entries, middle - 1, middle, middle + 1);
+      swap_sort_entries(&entries[begin], &entries[middle]);
+    } else {
+      sort3_entries(p_buffer, entries, middle, begin, end - 1);
+    }
+
+    bool already_partitioned = false;
+    int pivot = partition_sort_entries(p_buffer, entries, begin, end,
+                                       &already_partitioned);
+    int left_size = pivot - begin;
+    int right_size = end - pivot - 1;
+    if ((left_size < size / 8) || (right_size < size / 8)) {
+      if (--bad_allowed == 0) {
+        heap_sort_entries(p_buffer, entries, begin, end);
+        return;
+      }
+      if (left_size >= 24) {
+        swap_sort_entries(&entries[begin], &entries[begin + left_size / 4]);
+        swap_sort_entries(&entries[pivot - 1],
+                          &entries[pivot - left_size / 4]);
+      }
+      if (right_size >= 24) {
+        swap_sort_entries(&entries[pivot + 1],
+                          &entries[pivot + 1 + right_size / 4]);
+        swap_sort_entries(&entries[end - 1], &entries[end - right_size / 4]);
+      }
+    } else if (already_partitioned &&
+               partial_insertion_sort_entries(p_buffer, entries, begin,
+                                              pivot) &&
+               partial_insertion_sort_entries(p_buffer, entries, pivot + 1,
+                                              end)) {
+      return;
+    }
+
+    // The left range by recursion, the right one by the loop.
+    pdqsort_entries(p_buffer, entries, begin, pivot, bad_allowed);
+    begin = pivot + 1;
+  }
+}
+
+void sort3_entries(const sort_buffer *p_buffer, sort_entry entries[], int a,
+                   int b, int c) {
+  if (compare_sort_entries(p_buffer, &entries[b], &entries[a]) < 0) {
+    swap_sort_entries(&entries[a], &entries[b]);
+  }
+  if (compare_sort_entries(p_buffer, &entries[c], &entries[b]) < 0) {
+    swap_sort_entries(&entries[b], &entries[c]);
+    if (compare_sort_entries(p_buffer, &entries[b], &entries[a]) < 0) {
+      swap_sort_entries(&entries[a], &entries[b]);
+    }
+  }
+}
+
+void insertion_sort_entries(const sort_buffer *p_buffer, sort_entry entries[],
+                            int begin, int end) {
+  for (int i = begin + 1; i < end; i++) {
+    sort_entry entry = entries[i];
+    int j = i;
+    for (; (j > begin) &&
+           (compare_sort_entries(p_buffer, &entry, &entries[j - 1]) < 0);
+         j--) {
+      entries[j] = entries[j - 1];
+    }
+    entries[j] = entry;
+  }
+}
+
+bool partial_insertion_sort_entries(const sort_buffer *p_buffer,
+                                    sort_entry entries[], int begin,
+                                    int end) {
+  // Give up once 8 entries were moved, the range is left partly sorted.
+  int num_moves = 0;
+  for (int i = begin + 1; i < end; i++) {
+    sort_entry entry = entries[i];
+    int j = i;
+    for (; (j > begin) &&
+           (compare_sort_entries(p_buffer, &entry, &entries[j - 1]) < 0);
+         j--) {
+      entries[j] = entries[j - 1];
+    }
+    entries[j] = entry;
+    num_moves += i - j;
+    if (num_moves > 8) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int partition_sort_entries(const sort_buffer *p_buffer, sort_entry entries[],
+                           int begin, int end, bool *p_already_partitioned) {
+  /* The entries smaller than the pivot at begin go left, the others right,
+  and the pivot between them. The scans need no bound check: there is a
+  greater entry on the right of the pivot, and once an entry was found
+  smaller, one on the left too. */
+  sort_entry pivot = entries[begin];
+  int first = begin;
+  int last = end;
+  while (compare_sort_entries(p_buffer, &entries[++first], &pivot) < 0) {
+  }
+  if (first - 1 == begin) {
+    while ((first < last) &&
+           (compare_sort_entries(p_buffer, &entries[--last], &pivot) > 0)) {
+    }
+  } else {
+    while (compare_sort_entries(p_buffer, &entries[--last], &pivot) > 0) {
+    }
+  }
+
+  *p_already_partitioned = (first >= last);
+  while (first < last) {
+    swap_sort_entries(&entries[first], &entries[last]);
+    while (compare_sort_entries(p_buffer, &entries[++first], &pivot) < 0) {
+    }
+    while (compare_sort_entries(p_buffer, &entries[--last], &pivot) > 0) {
+    }
+  }
+  int pivot_position = first - 1;
+  entries[begin] = entries[pivot_position];
+  entries[pivot_position] = pivot;
+  return pivot_position;
+}
+
+void heap_sort_entries(const sort_buffer *p_buffer, sort_entry entries[],
+                       int begin, int end) {
+  sort_entry *heap = entries + begin;
+  int size = end - begin;
+  for (int i = size / 2 - 1; i >= 0; i--) {
+    sift_down_sort_entries(p_buffer, heap, i, size);
+  }
+  for (int i = size - 1; i > 0; i--) {
+    swap_sort_entries(&heap[0], &heap[i]);
+    sift_down_sort_entries(p_buffer, heap, 0, i);
+  }
+}
+
+void sift_down_sort_entries(const sort_buffer *p_buffer, sort_entry heap[],
+                            int node, int size) {
+  // The greatest entry is at the root.
+  while (2 * node + 1 < size) {
+    int child = 2 * node + 1;
+    if ((child + 1 < size) &&
+        (compare_sort_entries(p_buffer, &heap[child], &heap[child + 1]) < 0)) {
+      child++;
+    }
+    if (compare_sort_entries(p_buffer, &heap[node], &heap[child]) > 0) {
+      return;
+    }
+    swap_sort_entries(&heap[node], &heap[child]);
+    node = child;
+  }
+}
+
+void sift_up_sort_entries(const sort_buffer *p_buffer, sort_entry heap[],
+                          int node) {
+  while (node > 0) {
+    int parent = (node - 1) / 2;
+    if (compare_sort_entries(p_buffer, &heap[parent], &heap[node]) > 0) {
+      return;
+    }
+    swap_sort_entries(&heap[parent], &heap[node]);
+    node = parent;
+  }
+}
+
+void output_batch(cd_entry *output_cd_entries[], int num_output_cols,
+                  row_batch *p_batch) {
+  /* One line per row, where strings are left-aligned and integers are
+  right-aligned. The lines are built in text and written by one fwrite()
+  whenever it may not hold another line. */
+  char text[65536];
+  int max_line_length = num_output_cols * (MAX_STRING_LEN + 4) + 2;
+  int length = 0;
+  int display_widths[MAX_NUM_COL];
+  for (int c = 0; c < num_output_cols; c++) {
+    display_widths[c] = column_display_width(output_cd_entries[c]);
+  }
+
+  for (int i = 0; i < p_batch->num_selected; i++) {
+    int row = p_batch->selected[i];
+    if (length + max_line_length > (int)sizeof(text)) {
+      fwrite(text, 1, length, stdout);
+      length = 0;
+    }
+    for (int c = 0; c < num_output_cols; c++) {
+      column_vector *p_vector = p_batch->columns[output_cd_entries[c]->col_id];
+      char int_display[24];
+      length += append_display_cell(
+          text + length, get_display_value(p_vector, row, int_display),
+          display_widths[c], p_vector->col_type != T_INT);
+    }
+    text[length++] = '|';
+    text[length++] = '\n';
+  }
+  fwrite(text, 1, length, stdout);
+}
+
+const char *get_display_value(column_vector *p_vector, int row,
+                              char int_display[]) {
+  // Display NULL value as a dash.
+  if (p_vector->is_null[row]) {
+    return "-";
+  } else if (is_long_vector(p_vector)) {
+    sprintf(int_display, "%lld", (long long)p_vector->long_values[row]);
+    return int_display;
+  } else if (p_vector->col_type == T_INT) {
+    sprintf(int_display, "%d", p_vector->int_values[row]);
+    return int_display;
+  }
+  return p_vector->string_values + row * p_vector->value_size;
+}
+
+int append_display_cell(char *text, const char *display_value,
+                        int display_width, bool left_align) {
+  // A cell of display_width + 3 characters, or more for a longer value.
+  int length = 0;
+  int value_length = strlen(display_value);
+  int col_gap = display_width - value_length + 1;
+  if (col_gap < 0) {
+    col_gap = 0;
+  }
+  if (left_align) {
+    text[length++] = '|';
+    text[length++] = ' ';
+    memcpy(text + length, display_value, value_length);
+    length += value_length;
+    memset(text + length, ' ', col_gap);
+    length += col_gap;
+  } else {
+    text[length++] = '|';
+    memset(text + length, ' ', col_gap);
+    length += col_gap;
+    memcpy(text + length, display_value, value_length);
+    length += value_length;
+    text[length++] = ' ';
+  }
+  return length;
+}
+
+void init_column_vector(column_vector *p_vector, column_layout *p_column) {
+  memset(p_vector, '\0', sizeof(column_vector));
+  p_vector->col_type = p_column->col_type;
+  p_vector->value_size = p_column->col_len + 1;
+}
+
+int reserve_column_vector(column_vector *p_vector, int capacity) {
+  bool *is_null = (bool *)realloc(p_vector->is_null, sizeof(bool) * capacity);
+  if (is_null == NULL) {
+    return MEMORY_ERROR;
+  }
+  p_vector->is_null = is_null;
+  if (is_long_vector(p_vector)) {
+    int64_t *long_values = (int64_t *)realloc(p_vector->long_values,
+                                              sizeof(int64_t) * capacity);
+    if (long_values == NULL) {
+      return MEMORY_ERROR;
+    }
+    p_vector->long_values = long_values;
+  } else if (p_vector->col_type == T_INT) {
+    int *int_values =
+        (int *)realloc(p_vector->int_values, sizeof(int) * capacity);
+    if (int_values == NULL) {
+      return MEMORY_ERROR;
+    }
+    p_vector->int_values = int_values;
+  } else {
+    char *string_values = (char *)realloc(
+        p_vector->string_values, (size_t)p_vector->value_size * capacity);
+    if (string_values == NULL) {
+      return MEMORY_ERROR;
+    }
+    p_vector->string_values = string_values;
+  }
+  p_vector->capacity = capacity;
+  return 0;
+}
+
+void free_column_vector(column_vector *p_vector) {
+  free(p_vector->is_null);
+  free(p_vector->int_values);
+  free(p_vector->long_values);
+  free(p_vector->string_values);
+  memset(p_vector, '\0', sizeof(column_vector));
+}
+
+void free_record_row(record_row *row, bool to_last) {
+  record_row *current_row = row;
+  record_row *temp = NULL;
+  while (current_row) {
+    for (int i = 0; i < current_row->num_fields; i++) {
+      free(current_row->value_ptrs[i]);
+    }
+    if (!to_last) {
+      return;
+    }
+    temp = current_row;
+    current_row = current_row->next;
+    free(temp);
+  }
+}
+
+int commit_table_header(FILE *fhandle, table_file_header *tab_header) {
+  // Only file_size and num_records are rewritten, by one write.
+  size_t offset = offsetof(table_file_header, file_size);
+  size_t length = offsetof(table_file_header, record_size) - offset;
+  _fseeki64(fhandle, offset, SEEK_SET);
+  if (fwrite((char *)tab_header + offset, length, 1, fhandle) != 1) {
+    return FILE_WRITE_ERROR;
+  }
+  return commit_file(fhandle);
+}
+
+int init_table_file_header(table_file_header *tab_header, int record_size) {
+  memset(tab_header, '\0', sizeof(table_file_header));
+
+  // Each record takes its bytes and one slot, and the records start on a
+  // 4-byte boundary after the slot array.
+  int records_per_page = (TABLE_PAGE_SIZE - (int)sizeof(page_header)) /
+                         (record_size + (int)sizeof(uint16_t));
+  int record_offset = 0;
+  while (records_per_page > 0) {
+    record_offset = ((int)sizeof(page_header) +
+                     (int)sizeof(uint16_t) * records_per_page + 3) &
+                    ~3;
+    if (record_offset + records_per_page * record_size <= TABLE_PAGE_SIZE) {
+      break;
+    }
+    records_per_page--;
+  }
+  if (records_per_page < 1) {
+    return INVALID_TABLE_DEFINITION;
+  }
+
+  tab_header->magic = TABLE_FILE_MAGIC;
+  tab_header->format_version = TABLE_FILE_VERSION;
+  tab_header->file_size = TABLE_PAGE_SIZE;
+  tab_header->num_records = 0;
+  tab_header->record_size = record_size;
+  tab_header->record_offset = record_offset;
+  tab_header->file_header_flag = 0;
+  tab_header->page_size = TABLE_PAGE_SIZE;
+  tab_header->records_per_page = records_per_page;
+  return 0;
+}
+
+int init_column_file_header(table_file_header *tab_header,
+                            cd_entry cd_entries[], int num_columns) {
+  int rc = init_table_file_header(tab_header,
+                                  get_record_size(cd_entries, num_columns));
+  if (rc) {
+    return rc;
+  }
+  column_segment segments[MAX_NUM_COL];
+  tab_header->file_header_flag = TABLE_FILE_COLUMNAR;
+  tab_header->records_per_page = COLUMN_GROUP_ROWS;
+  tab_header->record_offset = 0;
+  tab_header->pages_per_group =
+      init_column_segments(cd_entries, num_columns, segments);
+  return rc;
+}
+
+int init_column_segments(cd_entry cd_entries[], int num_columns,
+                         column_segment segments[]) {
+  // The segments follow the first page of the group, in column order. The
+  // number of pages of a group is returned.
+  int first_page = 1;
+  for (int i = 0; i < num_columns; i++) {
+    segments[i].first_page = first_page;
+    segments[i].value_size = (cd_entries[i].col_type == T_INT)
+                                 ? (int)sizeof(int)
+                                 : 1 + cd_entries[i].col_len;
+    segments[i].values_per_page = TABLE_PAGE_SIZE / segments[i].value_size;
+    first_page += (COLUMN_GROUP_ROWS + segments[i].values_per_page - 1) /
+                  segments[i].values_per_page;
+  }
+  return first_page;
+}
+
+void fill_data_page(char *page, table_file_header *tab_header,
+                    int64_t page_number, char *record_bytes, int num_records) {
+  memset(page, '\0', TABLE_PAGE_SIZE);
+  page_header *p_page_header = get_page_header(page);
+  uint16_t *slots = get_page_slots(page);
+  p_page_header->page_number = page_number;
+  p_page_header->num_slots = num_records;
+  for (int i = 0; i < num_records; i++) {
+    slots[i] = (uint16_t)(tab_header->record_offset +
+                          i * tab_header->record_size);
+  }
+  memcpy(page + tab_header->record_offset, record_bytes,
+         (size_t)num_records * tab_header->record_size);
+}
+
+int upgrade_table_file(tpd_entry *tpd) {
+  // Version 1 and 2 files store the records one after another after the
+  // header. They are copied into the pages of a new file.
+  char table_filename[MAX_IDENT_LEN + 5];
+  char tmp_filename[MAX_IDENT_LEN + 10];
+  if ((snprintf(table_filename, sizeof(table_filename), "%s.tab",
+                tpd->table_name) >= (int)sizeof(table_filename)) ||
+      (snprintf(tmp_filename, sizeof(tmp_filename), "%s.tab.temp",
+                tpd->table_name) >= (int)sizeof(tmp_filename))) {
+    return FILE_OPEN_ERROR;
+  }
+  FILE *fhandle = NULL;
+  if ((fhandle = fopen(table_filename, "rb")) == NULL) {
+    return FILE_OPEN_ERROR;
+  }
+  int64_t file_size = get_file_size(fhandle);
+  table_file_header_v2 old_header;
+  memset(&old_header, '\0', sizeof(old_header));
+  size_t header_size =
+      fread(&old_header, 1, sizeof(table_file_header_v2), fhandle);
+
+  int64_t old_file_size = 0;
+  int64_t old_num_records = 0;
+  int old_record_size = 0;
+  int old_record_offset = 0;
+  int old_flag = 0;
+  if ((old_header.magic == TABLE_FILE_MAGIC) &&
+      (header_size == sizeof(table_file_header_v2))) {
+    if (old_header.format_version != 2) {
+      fclose(fhandle);
+      return TABFILE_CORRUPTION;
+    }
+    old_file_size = old_header.file_size;
+    old_num_records = old_header.num_records;
+    old_record_size = old_header.record_size;
+    old_record_offset = old_header.record_offset;
+    old_flag = old_header.file_header_flag;
+  } else if (header_size >= sizeof(table_file_header_v1)) {
+    table_file_header_v1 *v1_header = (table_file_header_v1 *)&old_header;
+    old_file_size = v1_header->file_size;
+    old_num_records = v1_header->num_records;
+    old_record_size = v1_header->record_size;
+    old_record_offset = v1_header->record_offset;
+    old_flag = v1_header->file_header_flag;
+  }
+
+  table_file_header tab_header;
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tpd, &cd_entries);
+  if ((old_record_size != get_record_size(cd_entries, tpd->num_columns)) ||
+      (old_record_offset < (int)sizeof(table_file_header_v1)) ||
+      (old_num_records < 0) || (old_file_size > file_size) ||
+      (old_file_size !=
+       old_record_offset + old_num_records * old_record_size) ||
+      (init_table_file_header(&tab_header, old_record_size) != 0)) {
+    fclose(fhandle);
+    return TABFILE_CORRUPTION;
+  }
+  int records_per_page = tab_header.records_per_page;
+  int64_t num_data_pages =
+      (old_num_records + records_per_page - 1) / records_per_page;
+  tab_header.num_records = old_num_records;
+  tab_header.file_size = (1 + num_data_pages) * TABLE_PAGE_SIZE;
+  tab_header.file_header_flag = old_flag;
+
+  // The new file replaces the old one only once it is complete.
+  int rc = 0;
+  FILE *f_tmp_tab_file = NULL;
+  char *page = (char *)calloc(1, TABLE_PAGE_SIZE);
+  char *record_bytes = (char *)malloc(records_per_page * old_record_size);
+  if ((page == NULL) || (record_bytes == NULL)) {
+    rc = MEMORY_ERROR;
+  } else if ((f_tmp_tab_file = fopen(tmp_filename, "wbc")) == NULL) {
+    rc = FILE_OPEN_ERROR;
+  } else {
+    memcpy(page, &tab_header, sizeof(table_file_header));
+    if (fwrite(page, TABLE_PAGE_SIZE, 1, f_tmp_tab_file) != 1) {
+      rc = FILE_WRITE_ERROR;
+    }
+    _fseeki64(fhandle, old_record_offset, SEEK_SET);
+    int64_t num_records_left = old_num_records;
+    for (int64_t i = 1; (i <= num_data_pages) && !rc; i++) {
+      int num_records = (int)((num_records_left < records_per_page)
+                                  ? num_records_left
+                                  : records_per_page);
+      if (fread(record_bytes, old_record_size, num_records, fhandle) !=
+          (size_t)num_records) {
+        rc = TABFILE_CORRUPTION;
+      } else {
+        fill_data_page(page, &tab_header, i, record_bytes, num_records);
+        if (fwrite(page, TABLE_PAGE_SIZE, 1, f_tmp_tab_file) != 1) {
+          rc = FILE_WRITE_ERROR;
+        }
+      }
+      num_records_left -= num_records;
+    }
+    if (!rc) {
+      rc = commit_file(f_tmp_tab_file);
+    }
+    fclose(f_tmp_tab_file);
+  }
+  fclose(fhandle);
+  free(page);
+  free(record_bytes);
+  if (rc) {
+    remove(tmp_filename);
+    return rc;
+  }
+
+  // On POSIX, rename() replaces the old file at once, so a crash leaves one
+  // table file or the other. Windows does not rename over a file.
+  discard_table_pages(tpd->table_name);
+#ifdef _WIN32
+  remove(table_filename);
+#endif
+  if (rename(tmp_filename, table_filename) != 0) {
+    return FILE_WRITE_ERROR;
+  }
+  remove_table_journal(tpd->table_name);
+  // Not to stdout, where it would mix with the result of the query.
+  fprintf(stderr, "Table file %s upgraded to version %d.\n", table_filename,
+          TABLE_FILE_VERSION);
+  return rc;
+}
+
+int append_table_records(tpd_entry *tab_entry, char *record_bytes,
+                         int num_records) {
+  int rc = 0;
+  table_file *file = NULL;
+  if ((rc = open_table_file(tab_entry, &file)) != 0) {
+    return rc;
+  }
+
+  /* The free room of the last page is filled first, then new pages are
+  added after it. The pages and the header only reach the file when the
+  table is flushed, see flush_table_file(). Records only go to positions
+  no slot points to, so the journal just keeps the header of the last
+  page. */
+  table_file_header *tab_header = &file->header;
+  if (tab_header->file_header_flag & TABLE_FILE_COLUMNAR) {
+    return append_column_records(tab_entry, file, record_bytes, num_records);
+  }
+  int64_t page_number = get_num_pages(tab_header) - 1;
+  bool is_new_page = false;
+  if (page_number < 1) {
+    page_number++;
+    is_new_page = true;
+  }
+  int num_records_left = num_records;
+  while (num_records_left > 0) {
+    buffer_frame *frame = NULL;
+    if ((rc = pin_page(file, page_number, is_new_page, &frame)) != 0) {
+      break;
+    }
+    if (!is_new_page &&
+        ((rc = journal_page(file, frame, sizeof(page_header))) != 0)) {
+      unpin_page(frame, false);
+      break;
+    }
+    page_header *p_page_header = get_page_header(frame->page);
+    uint16_t *slots = get_page_slots(frame->page);
+    if (is_new_page) {
+      p_page_header->page_number = page_number;
+      tab_header->file_size += TABLE_PAGE_SIZE;
+    }
+
+    // A record goes to a position which no slot points to.
+    bool is_used[TABLE_PAGE_SIZE / sizeof(uint16_t)];
+    memset(is_used, '\0', sizeof(bool) * tab_header->records_per_page);
+    for (int i = 0; i < p_page_header->num_slots; i++) {
+      is_used[(slots[i] - tab_header->record_offset) /
+              tab_header->record_size] = true;
+    }
+    bool is_page_dirty = is_new_page;
+    for (int i = 0; (i < tab_header->records_per_page) &&
+                    (num_records_left > 0);
+         i++) {
+      if (!is_used[i]) {
+        is_page_dirty = true;
+        int record_offset =
+            tab_header->record_offset + i * tab_header->record_size;
+        memcpy(frame->page + record_offset, record_bytes,
+               tab_header->record_size);
+        slots[p_page_header->num_slots++] = (uint16_t)record_offset;
+        record_bytes += tab_header->record_size;
+        num_records_left--;
+      }
+    }
+    unpin_page(frame, is_page_dirty);
+    page_number++;
+    is_new_page = true;
+  }
+
+  tab_header->num_records += num_records - num_records_left;
+  file->is_dirty = true;
+  return rc;
+}
+
+int append_column_records(tpd_entry *tab_entry, table_file *file,
+                          char *record_bytes, int num_records) {
+  /* Rows are added after the last row of the last row group, then in new
+  groups. The rows deleted from a group are not reused, so the values and
+  bits of the rows added to a group only need the journal to keep the
+  header of its first page. */
+  int rc = 0;
+  table_file_header *tab_header = &file->header;
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  column_segment segments[MAX_NUM_COL];
+  int pages_per_group =
+      init_column_segments(cd_entries, tab_entry->num_columns, segments);
+  record_layout layout;
+  init_record_layout(cd_entries, tab_entry->num_columns, &layout);
+
+  int64_t group_page_number = get_num_pages(tab_header) - pages_per_group;
+  bool is_new_group = false;
+  if (group_page_number < 1) {
+    group_page_number += pages_per_group;
+    is_new_group = true;
+  }
+  int num_records_left = num_records;
+  while (num_records_left > 0) {
+    // Every page of a new group is written, so the file has no holes.
+    for (int i = 0; is_new_group && (i < pages_per_group) && !rc; i++) {
+      buffer_frame *frame = NULL;
+      if ((rc = pin_page(file, group_page_number + i, true, &frame)) == 0) {
+        if (i == 0) {
+          get_page_header(frame->page)->page_number = group_page_number;
+        }
+        unpin_page(frame, true);
+        tab_header->file_size += TABLE_PAGE_SIZE;
+      }
+    }
+    buffer_frame *group_frame = NULL;
+    if (rc || ((rc = pin_page(file, group_page_number, false,
+                              &group_frame)) != 0)) {
+      break;
+    }
+    if ((rc = journal_page(file, group_frame, sizeof(page_header))) != 0) {
+      unpin_page(group_frame, false);
+      break;
+    }
+    page_header *p_group_header = get_page_header(group_frame->page);
+    int first_row = p_group_header->num_slots;
+    int num_rows = COLUMN_GROUP_ROWS - first_row;
+    if (num_rows > num_records_left) {
+      num_rows = num_records_left;
+    }
+
+    for (int col_id = 0; (col_id < tab_entry->num_columns) && !rc;
+         col_id++) {
+      column_segment *p_segment = &segments[col_id];
+      column_layout *p_column = &layout.columns[col_id];
+      unsigned char *null_bitmap =
+          get_group_null_bitmap(group_frame->page, col_id);
+      buffer_frame *frame = NULL;
+      for (int row = first_row; row < first_row + num_rows; row++) {
+        char *field = record_bytes +
+                      (row - first_row) * tab_header->record_size +
+                      p_column->offset;
+        int64_t page_number = group_page_number + p_segment->first_page +
+                              row / p_segment->values_per_page;
+        if ((frame == NULL) || (frame->page_number != page_number)) {
+          if (frame) {
+            unpin_page(frame, true);
+          }
+          if ((rc = pin_page(file, page_number, false, &frame)) != 0) {
+            frame = NULL;
+            break;
+          }
+        }
+        char *value = frame->page + (row % p_segment->values_per_page) *
+                                        p_segment->value_size;
+        bool is_null = (field[0] == 0);
+        set_bit(null_bitmap, row, is_null);
+        if (is_null) {
+          memset(value, '\0', p_segment->value_size);
+        } else if (p_column->col_type == T_INT) {
+          memcpy(value, field + 1, sizeof(int));
+        } else {
+          memcpy(value, field, p_segment->value_size);
+        }
+      }
+      if (frame) {
+        unpin_page(frame, true);
+      }
+    }
+
+    if (!rc) {
+      unsigned char *live_bitmap = get_group_live_bitmap(group_frame->page);
+      for (int row = first_row; row < first_row + num_rows; row++) {
+        set_bit(live_bitmap, row, true);
+      }
+      p_group_header->num_slots += num_rows;
+      tab_header->num_records += num_rows;
+      record_bytes += (size_t)num_rows * tab_header->record_size;
+      num_records_left -= num_rows;
+    }
+    unpin_page(group_frame, num_rows > 0);
+    group_page_number += pages_per_group;
+    is_new_group = true;
+  }
+
+  file->is_dirty = true;
+  return rc;
+}
+
+int commit_file(FILE *fhandle) {
+  // The "c" flag of fopen() makes fflush() commit to disk only with the MSVC
+  // CRT, other platforms need an explicit fsync().
+  if (fflush(fhandle) != 0) {
+    return FILE_WRITE_ERROR;
+  }
+#ifndef _WIN32
+  if (fsync(fileno(fhandle)) != 0) {
+    return FILE_WRITE_ERROR;
+  }
+#endif
+  return 0;
+}
+
+int append_log_with_timestamp(const char *msg, time_t timestamp) {
+  // A multi-row INSERT can be longer than MAX_LOG_ENTRY_TEXT_LEN.
+  char *timestamp_text =
+      (char *)malloc(strlen(msg) + LOG_ENTRY_TIMESTAMP_LEN + 8);
+  if (timestamp_text == NULL) {
+    return MEMORY_ERROR;
+  }
+  // Convert time to struct tm form in local time.
+  struct tm *t = localtime(&timestamp);
+  // Format is: yyyymmddhhmmss "SQL".
+  sprintf(timestamp_text, "%d%02d%02d%02d%02d%02d \"%s\"", 1900 + t->tm_year,
+          1 + t->tm_mon, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec, msg);
+
+  // A deferred change is logged once its pages are written, see
+  // flush_buffer_pool(), so the log never lists a change the .tab files
+  // miss.
+  if (g_deferred_writes) {
+    log_entry *p_entry = (log_entry *)calloc(1, sizeof(log_entry));
+    if (p_entry == NULL) {
+      free(timestamp_text);
+      return MEMORY_ERROR;
+    }
+    p_entry->raw_text = timestamp_text;
+    *g_pending_log_tail = p_entry;
+    g_pending_log_tail = &p_entry->next;
+    return 0;
+  }
+  int rc = write_log(timestamp_text, true);
+  free(timestamp_text);
+  return rc;
+}
+
+int write_pending_log() {
+  int rc = 0;
+  while (g_pending_log && !rc) {
+    log_entry *p_entry = g_pending_log;
+    rc = write_log(p_entry->raw_text, true);
+    if (!rc) {
+      g_pending_log = p_entry->next;
+      free(p_entry->raw_text);
+      free(p_entry);
+    }
+  }
+  if (g_pending_log == NULL) {
+    g_pending_log_tail = &g_pending_log;
+  }
+  return rc;
+}
+
+void discard_pending_log() {
+  free_log_entries(g_pending_log);
+  g_pending_log = NULL;
+  g_pending_log_tail = &g_pending_log;
+}
+
+int write_log(const char *msg, bool is_append) {
+  FILE *fhandle = fopen(kDbLogFile, is_append ? "a" : "w");
+  if (!fhandle) {
+    return FILE_OPEN_ERROR;
+  }
+  int rc = 0;
+  if (fprintf(fhandle, "%s\n", msg) < 0) {
+    rc = FILE_WRITE_ERROR;
+  }
+  if ((fclose(fhandle) != 0) && !rc) {
+    rc = FILE_WRITE_ERROR;
+  }
+  return rc;
+}
+
+int scan_log(log_entry **pp_first_log_entry) {
+  FILE *fhandle = fopen(kDbLogFile, "r");
+  if (!fhandle) {
+    return FILE_OPEN_ERROR;
+  }
+  log_entry *p_head = NULL;
+  log_entry *p_cur = NULL;
+  char *log_text = NULL;
+  while (read_text_line(fhandle, &log_text)) {
+    if (!(strlen(log_text) > 1)) {  // skip empty line
+      free(log_text);
+      continue;
+    }
+    if (p_cur == NULL) {  // first log entry
+      p_cur = (log_entry *)malloc(sizeof(log_entry));
+      p_head = p_cur;
+    } else {
+      p_cur->next = (log_entry *)malloc(sizeof(log_entry));
+      p_cur = p_cur->next;
+    }
+    if (is_a_sql_statement_log_entry(
+            log_text)) {  // a DDL/DML statement with datetime
+      memcpy(p_cur->datetime, log_text, LOG_ENTRY_TIMESTAMP_LEN);
+      p_cur->datetime[LOG_ENTRY_TIMESTAMP_LEN] = '\0';
+      p_cur->text = strdup(log_text + LOG_ENTRY_TIMESTAMP_LEN + 2);
+    } else {  // a command without datetime
+      p_cur->datetime[0] = '\0';
+      p_cur->text = strdup(log_text);
+    }
+    // Remove trailing double-quote and line-feed.
+    for (int i = strlen(p_cur->text) - 1;
+         (i >= 0) && (p_cur->text[i] == '\n' || p_cur->text[i] == '"'); i--) {
+      p_cur->text[i] = '\0';
+    }
+    p_cur->raw_text = log_text;
+    // Remove trailing line-feed for raw_text.
+    int l = strlen(p_cur->raw_text) - 1;
+    if (p_cur->raw_text[l] == '\n') {
+      p_cur->raw_text[l] = '\0';
+    }
+    p_cur->next = NULL;
+  }
+  fclose(fhandle);
+  *pp_first_log_entry = p_head;
+  return 0;
+}
+
+void free_log_entries(log_entry *p_first_log_entry) {
+  if (!p_first_log_entry) {
+    return;
+  }
+  log_entry *p = p_first_log_entry;
+  log_entry *temp = NULL;
+  while (p) {
+    temp = p;
+    p = p->next;
+    free(temp->text);
+    free(temp->raw_text);
+    free(temp);
+  }
+}
+
+bool read_text_line(FILE *fhandle, char **pp_line) {
+  // Read a whole line of any length, including the trailing line-feed.
+  int capacity = MAX_LOG_ENTRY_TEXT_LEN + 1;
+  int length = 0;
+  char *line = (char *)malloc(capacity);
+  if (line == NULL) {
+    return false;
+  }
+  while (fgets(line + length, capacity - length, fhandle)) {
+    length += strlen(line + length);
+    if ((length > 0) && (line[length - 1] == '\n')) {
+      break;
+    }
+    if (length + 1 == capacity) {
+      char *new_line = (char *)realloc(line, capacity * 2);
+      if (new_line == NULL) {
+        break;
+      }
+      line = new_line;
+      capacity *= 2;
+    }
+  }
+  if (length == 0) {
+    free(line);
+    return false;
+  }
+  *pp_line = line;
+  return true;
+}
+
+int restore_from_backup_file(char *backup_filename, int db_flags) {
+  // Reconstruct tpd_list and fetch table names.
+  FILE *f_backup = fopen(backup_filename, "rb");
+  FILE *f_tmp_dbfile = fopen(kTempDbFile, "wbc");
+  if (f_backup == NULL || f_tmp_dbfile == NULL) {
+    if (f_backup) {
+      fclose(f_backup);
+    }
+    if (f_tmp_dbfile) {
+      fclose(f_tmp_dbfile);
+    }
+    return FILE_OPEN_ERROR;
+  }
+  // This tpd_list will NOT hold the whole db metadata.
+  // It is only used to determine the real size of the whole db metadata.
+  tpd_list tmp_tpd_list;
+  fread(&tmp_tpd_list, sizeof(tmp_tpd_list), 1, f_backup);
+  // Set db_flags.
+  tmp_tpd_list.db_flags = db_flags;
+  // Backup db file with db_flag.
+  fwrite(&tmp_tpd_list, sizeof(tmp_tpd_list), 1, f_tmp_dbfile);
+  // Backup remaining bytes of the db file.
+  copy_file_bytes(f_backup, f_tmp_dbfile,
+                  tmp_tpd_list.list_size - sizeof(tmp_tpd_list));
+  fflush(f_tmp_dbfile);
+  fclose(f_tmp_dbfile);
+  tpd_list *p_tpd_list = NULL;
+  initialize_tpd_list(kTempDbFile, &p_tpd_list);
+
+  // Backup .tab file for each table.
+  tpd_entry *cur_entry = &(p_tpd_list->tpd_start);
+  for (int i = 0; i < p_tpd_list->num_tables; i++) {
+    // Get table file size, -1 is followed by a 64-bit size.
+    int32_t table_size;
+    int64_t table_file_size;
+    fread(&table_size, sizeof(table_size), 1, f_backup);
+    table_file_size = table_size;
+    if (table_size == -1) {
+      fread(&table_file_size, sizeof(table_file_size), 1, f_backup);
+    }
+    // Writing table file as a .tab.temp file.
+    char table_filename[MAX_IDENT_LEN + 10];
+    sprintf(table_filename, "%s.tab.temp", cur_entry->table_name);
+    FILE *f_tmp_tab_file = fopen(table_filename, "wbc");
+    if (f_tmp_tab_file == NULL) {
+      return FILE_OPEN_ERROR;
+    }
+    copy_file_bytes(f_backup, f_tmp_tab_file, table_file_size);
+    fclose(f_tmp_tab_file);
+
+    cur_entry =
+        (tpd_entry *)((char *)cur_entry + cur_entry->tpd_size);  // next table
+  }
+  fclose(f_backup);
+
+  // Remove old dbfile and .tab files.
+  discard_table_pages(NULL);
+  remove(kDbFile);
+  list_tables(g_tpd_list, remove_table_file);
+
+  // Rename ".temp" suffix for all reconstructed files.
+  rename(kTempDbFile, kDbFile);
+  list_tables(p_tpd_list, rename_table_file);
+
+  // Refresh g_tpd_list.
+  free(g_tpd_list);
+  g_tpd_list = p_tpd_list;
+  return 0;
+}
+
+void remove_table_file(tpd_entry *table_entry) {
+  char filename[MAX_IDENT_LEN + 5];
+  if (snprintf(filename, sizeof(filename), "%s.tab",
+               table_entry->table_name) < (int)sizeof(filename)) {
+    remove(filename);
+  }
+  remove_table_journal(table_entry->table_name);
+}
+
+void rename_table_file(tpd_entry *table_entry) {
+  char src_filename[MAX_IDENT_LEN + 10];
+  char dst_filename[MAX_IDENT_LEN + 5];
+  if ((snprintf(src_filename, sizeof(src_filename), "%s.tab.temp",
+                table_entry->table_name) < (int)sizeof(src_filename)) &&
+      (snprintf(dst_filename, sizeof(dst_filename), "%s.tab",
+                table_entry->table_name) < (int)sizeof(dst_filename))) {
+    rename(src_filename, dst_filename);
+  }
+}
+
+int list_tables(tpd_list *table_entries,
+                void (*callback)(tpd_entry *table_entry)) {
+  int num_tables = table_entries->num_tables;
+  if (num_tables > 0) {
+    tpd_entry *cur_entry = &(table_entries->tpd_start);
+    for (int i = 0; i < num_tables; i++) {
+      if (callback != NULL) {
+        callback(cur_entry);
+      }
+      cur_entry = (tpd_entry *)((char *)cur_entry + cur_entry->tpd_size);
+    }
+  }
+  return num_tables;
+}
+
+int update_db_flags(int db_flags) {
+  FILE *fhandle = fopen(kDbFile, "r+b");
+  if (fhandle == NULL) {
+    return FILE_OPEN_ERROR;
+  }
+  tpd_list tmp_tpd_list;
+  fread(&tmp_tpd_list, sizeof(tmp_tpd_list), 1, fhandle);
+  tmp_tpd_list.db_flags = db_flags;
+  rewind(fhandle);
+  fwrite(&tmp_tpd_list, sizeof(tmp_tpd_list), 1, fhandle);
+  fclose(fhandle);
+  g_tpd_list->db_flags = db_flags;
+  return 0;
+}
+
+int backup_log_file(log_entry *log_entry_head) {
+  char log_bak_filename[10];
+  for (int i = 1; i <= MAX_NUM_LOG_BACKUP_FILES; i++) {
+    sprintf(log_bak_filename, "%s%d", kDbLogFile, i);
+    if (!is_file_readable(log_bak_filename, true)) {
+      break;
+    }
+  }
+  // We found one available log backup filename.
+  FILE *f_log_bak = fopen(log_bak_filename, "w");
+  if (f_log_bak == NULL) {
+    return FILE_OPEN_ERROR;
+  }
+  log_entry *cur_entry = log_entry_head;
+  while (cur_entry) {
+    if (stricmp(cur_entry->text, kRfStartLogEntry) != 0) {
+      fprintf(f_log_bak, "%s\n", cur_entry->raw_text);
+    }
+    cur_entry = cur_entry->next;
+  }
+  fclose(f_log_bak);
+  return 0;
+}
+
+int max_days_of_month(int year, int month) {
+  int days_in_month[] = {-1, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  if (year % 4 == 0 && year % 100 != 0) {
+    days_in_month[2] = 29;
+  } else if (year % 400 == 0) {
+    days_in_month[2] = 29;
+  }
+  return days_in_month[month];
+}
+
+bool is_timestamp_valid(char *text) {
+  // A valid timestamp should contains 14 digits, like 20140511093524.
+  int num_digits = 0;
+  char *p = text;
+  while (*p) {
+    if (!isdigit(*p)) {
+      return false;
+    }
+    num_digits++;
+    p++;
+  }
+  if (num_digits != 14) {
+    return false;
+  }
+
+  char buffer[5];
+  // Parse 4-digit year.
+  memcpy(buffer, text, 4);
+  buffer[4] = '\0';
+  int year = atoi(buffer);
+  if (year < 1900 || year > 2999) {
+    return false;
+  }
+
+  // Parse 2-digit month.
+  memcpy(buffer, text + 4, 2);
+  buffer[2] = '\0';
+  int month = atoi(buffer);
+  if (month < 1 || month > 12) {
+    return false;
+  }
+
+  // Parse 2-digit day.
+  memcpy(buffer, text + 6, 2);
+  buffer[2] = '\0';
+  int day = atoi(buffer);
+  if (day < 1 || day > max_days_of_month(year, month)) {
+    return false;
+  }
+
+  // Parse 2-digit 24-hr hour, from 00 to 23.
+  memcpy(buffer, text + 8, 2);
+  buffer[2] = '\0';
+  int hour = atoi(buffer);
+  if (hour < 0 || hour > 23) {
+    return false;
+  }
+
+  // Parse 2-digit minute.
+  memcpy(buffer, text + 10, 2);
+  buffer[2] = '\0';
+  int minute = atoi(buffer);
+  if (minute < 0 || minute > 59) {
+    return false;
+  }
+
+  // Parse 2-digit second.
+  memcpy(buffer, text + 12, 2);
+  buffer[2] = '\0';
+  int second = atoi(buffer);
+  if (second < 0 || second > 59) {
+    return false;
+  }
+
+  return true;
+}
+
+int get_file_signature(const char *filename, file_signature *p_signature) {
+  struct _stati64 file_stat;
+  if (_stati64(filename, &file_stat) != 0) {
+    return FILE_OPEN_ERROR;
+  }
+  p_signature->file_size = (long long)file_stat.st_size;
+  p_signature->modified_time = file_stat.st_mtime;
+  p_signature->inode = (long long)file_stat.st_ino;
+  // Two changes within the same second differ by the nanoseconds only.
+#if defined(_WIN32)
+  p_signature->modified_nsec = 0;
+#elif defined(__APPLE__)
+  p_signature->modified_nsec = file_stat.st_mtimespec.tv_nsec;
+#else
+  p_signature->modified_nsec = file_stat.st_mtim.tv_nsec;
+#endif
+  return 0;
+}
+
+int refresh_resident_tpd_list() {
+  file_signature signature;
+  int rc = get_file_signature(kDbFile, &signature);
+  if ((rc == 0) && (g_tpd_list != NULL) &&
+      is_same_file_signature(&g_tpd_list_signature, &signature)) {
+    // Nothing has changed since the tpd list was read.
+    return 0;
+  }
+
+  invalidate_resident_tpd_list();
+  if ((rc = initialize_tpd_list(kDbFile, &g_tpd_list)) != 0) {
+    return rc;
+  }
+  // The db file may have just been created by initialize_tpd_list().
+  if (get_file_signature(kDbFile, &g_tpd_list_signature) != 0) {
+    memset(&g_tpd_list_signature, '\0', sizeof(g_tpd_list_signature));
+  }
+  return 0;
+}
+
+void invalidate_resident_tpd_list() {
+  free(g_tpd_list);
+  g_tpd_list = NULL;
+  memset(&g_tpd_list_signature, '\0', sizeof(g_tpd_list_signature));
+}
+
+int init_buffer_pool() {
+  buffer_pool *pool = &g_buffer_pool;
+  int num_frames = (int)(g_buffer_pool_size / TABLE_PAGE_SIZE);
+  if (num_frames < MIN_BUFFER_POOL_FRAMES) {
+    num_frames = MIN_BUFFER_POOL_FRAMES;
+  }
+  pool->frames = (buffer_frame *)calloc(num_frames, sizeof(buffer_frame));
+  pool->hash_buckets = (int *)malloc(sizeof(int) * num_frames);
+  pool->pages = (char *)malloc((size_t)num_frames * TABLE_PAGE_SIZE);
+  if (pool->frames == NULL || pool->hash_buckets == NULL ||
+      pool->pages == NULL) {
+    free_buffer_pool();
+    return MEMORY_ERROR;
+  }
+  for (int i = 0; i < num_frames; i++) {
+    pool->frames[i].page_number = -1;
+    pool->frames[i].hash_next = -1;
+    pool->frames[i].page = pool->pages + (size_t)i * TABLE_PAGE_SIZE;
+    pool->hash_buckets[i] = -1;
+  }
+  pool->num_frames = num_frames;
+  pool->clock_hand = 0;
+  return 0;
+}
+
+void free_buffer_pool() {
+  discard_table_pages(NULL);
+  free(g_buffer_pool.frames);
+  free(g_buffer_pool.hash_buckets);
+  free(g_buffer_pool.pages);
+  memset(&g_buffer_pool, '\0', sizeof(buffer_pool));
+}
+
+int get_page_bucket(const char *table_name, int64_t page_number) {
+  // Table names are case insensitive.
+  unsigned int hash = (unsigned int)page_number;
+  for (const char *p = table_name; *p; p++) {
+    hash = hash * 31 + (unsigned int)tolower(*p);
+  }
+  return (int)(hash % (unsigned int)g_buffer_pool.num_frames);
+}
+
+void remove_page_from_hash(int frame_index) {
+  buffer_pool *pool = &g_buffer_pool;
+  buffer_frame *frame = &pool->frames[frame_index];
+  int *p_next = &pool->hash_buckets[get_page_bucket(frame->table_name,
+                                                    frame->page_number)];
+  while (*p_next != -1) {
+    if (*p_next == frame_index) {
+      *p_next = frame->hash_next;
+      break;
+    }
+    p_next = &pool->frames[*p_next].hash_next;
+  }
+  frame->hash_next = -1;
+  frame->page_number = -1;
+  frame->pin_count = 0;
+  frame->is_dirty = false;
+  frame->is_referenced = false;
+  frame->journaled_statement = 0;
+}
+
+int pin_page(table_file *file, int64_t page_number, bool is_new_page,
+             buffer_frame **pp_frame) {
+  int rc = 0;
+  buffer_pool *pool = &g_buffer_pool;
+  if ((pool->frames == NULL) && ((rc = init_buffer_pool()) != 0)) {
+    return rc;
+  }
+
+  // The page may already be in the pool.
+  int bucket = get_page_bucket(file->table_name, page_number);
+  for (int i = pool->hash_buckets[bucket]; i != -1;
+       i = pool->frames[i].hash_next) {
+    buffer_frame *frame = &pool->frames[i];
+    if ((frame->page_number == page_number) &&
+        (stricmp(frame->table_name, file->table_name) == 0)) {
+      frame->pin_count++;
+      frame->is_referenced = true;
+      *pp_frame = frame;
+      return rc;
+    }
+  }
+
+  /* CLOCK eviction: a referenced frame gets a second chance and the hand
+  moves on. After two turns every unpinned frame has been considered. */
+  int victim = -1;
+  for (int i = 0; (i < 2 * pool->num_frames) && (victim == -1); i++) {
+    buffer_frame *frame = &pool->frames[pool->clock_hand];
+    if ((frame->page_number == -1) ||
+        ((frame->pin_count == 0) && !frame->is_referenced)) {
+      victim = pool->clock_hand;
+    } else if (frame->pin_count == 0) {
+      frame->is_referenced = false;
+    }
+    pool->clock_hand = (pool->clock_hand + 1) % pool->num_frames;
+  }
+  if (victim == -1) {
+    return BUFFER_POOL_EXHAUSTED;
+  }
+
+  buffer_frame *frame = &pool->frames[victim];
+  if (frame->page_number != -1) {
+    if (frame->is_dirty &&
+        ((rc = write_page(find_table_file(frame->table_name), frame)) != 0)) {
+      return rc;
+    }
+    remove_page_from_hash(victim);
+  }
+
+  if (is_new_page) {
+    memset(frame->page, '\0', TABLE_PAGE_SIZE);
+  } else {
+    FILE *fhandle = get_table_fhandle(file);
+    if (fhandle == NULL) {
+      return FILE_OPEN_ERROR;
+    }
+    _fseeki64(fhandle, page_number * TABLE_PAGE_SIZE, SEEK_SET);
+    if (fread(frame->page, TABLE_PAGE_SIZE, 1, fhandle) != 1) {
+      return TABFILE_CORRUPTION;
+    }
+
+    if ((rc = check_data_page(&file->header, frame->page, page_number)) != 0) {
+      return rc;
+    }
+  }
+
+  strcpy(frame->table_name, file->table_name);
+  frame->page_number = page_number;
+  frame->pin_count = 1;
+  frame->is_dirty = false;
+  frame->is_referenced = true;
+  frame->journaled_statement = 0;
+  frame->hash_next = pool->hash_buckets[bucket];
+  pool->hash_buckets[bucket] = victim;
+  *pp_frame = frame;
+  return rc;
+}
+
+int check_data_page(table_file_header *tab_header, char *page,
+                    int64_t page_number) {
+  // Check the page before any slot is followed.
+  page_header *p_page_header = get_page_header(page);
+  uint16_t *slots = get_page_slots(page);
+  if (tab_header->file_header_flag & TABLE_FILE_COLUMNAR) {
+    // Only the first page of a row group has a header.
+    if ((page_number - 1) % tab_header->pages_per_group != 0) {
+      return 0;
+    }
+    if ((p_page_header->page_number != page_number) ||
+        (p_page_header->num_slots < 0) ||
+        (p_page_header->num_slots > tab_header->records_per_page)) {
+      return TABFILE_CORRUPTION;
+    }
+    return 0;
+  }
+  if ((p_page_header->page_number != page_number) ||
+      (p_page_header->num_slots < 0) ||
+      (p_page_header->num_slots > tab_header->records_per_page)) {
+    return TABFILE_CORRUPTION;
+  }
+  for (int i = 0; i < p_page_header->num_slots; i++) {
+    if ((slots[i] < tab_header->record_offset) ||
+        (slots[i] + tab_header->record_size > TABLE_PAGE_SIZE)) {
+      return TABFILE_CORRUPTION;
+    }
+  }
+  return 0;
+}
+
+void unpin_page(buffer_frame *frame, bool is_dirty) {
+  frame->pin_count--;
+  if (is_dirty) {
+    frame->is_dirty = true;
+  }
+}
+
+FILE *get_table_fhandle(table_file *file) {
+  // The file is opened again by the first statement which needs it.
+  if (file->fhandle == NULL) {
+    char table_filename[MAX_IDENT_LEN + 5];
+    snprintf(table_filename, sizeof(table_filename), "%s.tab",
+             file->table_name);
+    file->fhandle = fopen(table_filename, "r+bc");
+  }
+  return file->fhandle;
+}
+
+int write_page(table_file *file, buffer_frame *frame) {
+  // A committed page is only overwritten once its journal entry is on disk.
+  int rc = 0;
+  if ((frame->page_number < get_num_pages(&file->committed_header)) &&
+      ((rc = sync_table_journal(file)) != 0)) {
+    return rc;
+  }
+  FILE *fhandle = get_table_fhandle(file);
+  if (fhandle == NULL) {
+    return FILE_OPEN_ERROR;
+  }
+  _fseeki64(fhandle, frame->page_number * TABLE_PAGE_SIZE, SEEK_SET);
+  if (fwrite(frame->page, TABLE_PAGE_SIZE, 1, fhandle) != 1) {
+    return FILE_WRITE_ERROR;
+  }
+  frame->is_dirty = false;
+  return rc;
+}
+
+int journal_page(table_file *file, buffer_frame *frame, int length) {
+  /* Pages added by the statement are dropped with the header, and a page
+  only needs its content from before the first change of each statement.
+  The entries of earlier statements are kept so that a statement can be
+  rolled back without flushing the ones before it. */
+  if ((frame->page_number >= get_num_pages(&file->statement_header)) ||
+      ((frame->journaled_statement == g_statement_number) &&
+       (frame->journaled_length >= length))) {
+    return 0;
+  }
+
+  if (file->journal == NULL) {
+    char journal_filename[MAX_IDENT_LEN + 13];
+    if (!get_journal_filename(file->table_name, journal_filename,
+                              sizeof(journal_filename)) ||
+        ((file->journal = fopen(journal_filename, "w+bc")) == NULL)) {
+      return FILE_OPEN_ERROR;
+    }
+    if (fwrite(&file->committed_header, sizeof(table_file_header), 1,
+               file->journal) != 1) {
+      return FILE_WRITE_ERROR;
+    }
+#ifndef _WIN32
+    // The entry of the new journal in the directory must be on disk too.
+    int dir_fd = open(".", O_RDONLY);
+    if (dir_fd != -1) {
+      fsync(dir_fd);
+      close(dir_fd);
+    }
+#endif
+  }
+
+  journal_entry entry;
+  memset(&entry, '\0', sizeof(journal_entry));
+  entry.page_number = frame->page_number;
+  entry.length = length;
+  _fseeki64(file->journal, 0, SEEK_END);
+  if ((fwrite(&entry, sizeof(journal_entry), 1, file->journal) != 1) ||
+      (fwrite(frame->page, length, 1, file->journal) != 1)) {
+    return FILE_WRITE_ERROR;
+  }
+  file->is_journal_synced = false;
+  frame->journaled_statement = g_statement_number;
+  frame->journaled_length = length;
+  return 0;
+}
+
+int sync_table_journal(table_file *file) {
+  int rc = 0;
+  if ((file->journal != NULL) && !file->is_journal_synced &&
+      ((rc = commit_file(file->journal)) == 0)) {
+    file->is_journal_synced = true;
+  }
+  return rc;
+}
+
+int clear_table_journal(table_file *file) {
+  // The committed table no longer needs the journal. Its header is cleared
+  // first, so that a journal left behind by a crash is ignored.
+  if (file->journal == NULL) {
+    return 0;
+  }
+  table_file_header empty_header;
+  memset(&empty_header, '\0', sizeof(table_file_header));
+  _fseeki64(file->journal, 0, SEEK_SET);
+  int rc = 0;
+  if (fwrite(&empty_header, sizeof(table_file_header), 1, file->journal) !=
+      1) {
+    rc = FILE_WRITE_ERROR;
+  }
+  if (!rc) {
+    rc = commit_file(file->journal);
+  }
+  fclose(file->journal);
+  file->journal = NULL;
+  if (!rc) {
+    remove_table_journal(file->table_name);
+  }
+  return rc;
+}
+
+int recover_table_file(const char *table_name) {
+  /* A journal left by a crash holds the committed header of the table file
+  and the content of the pages before they were changed. The entries are
+  restored in reverse order, so the oldest content of a page is the one
+  left, then the header is committed and the journal removed. An entry
+  which is not complete was never synced, so its page was not written. */
+  char journal_filename[MAX_IDENT_LEN + 13];
+  FILE *journal = NULL;
+  if (!get_journal_filename(table_name, journal_filename,
+                            sizeof(journal_filename)) ||
+      ((journal = fopen(journal_filename, "rb")) == NULL)) {
+    return 0;
+  }
+  char table_filename[MAX_IDENT_LEN + 5];
+  snprintf(table_filename, sizeof(table_filename), "%s.tab", table_name);
+  FILE *fhandle = NULL;
+  table_file_header tab_header;
+  if ((fread(&tab_header, sizeof(table_file_header), 1, journal) != 1) ||
+      (tab_header.magic != TABLE_FILE_MAGIC) ||
+      ((fhandle = fopen(table_filename, "r+bc")) == NULL)) {
+    fclose(journal);
+    remove(journal_filename);
+    return 0;
+  }
+
+  int64_t *entry_offsets = NULL;
+  int num_entries = 0;
+  int rc = read_journal_offsets(journal, sizeof(table_file_header),
+                                &entry_offsets, &num_entries);
+  journal_entry entry;
+  char page[TABLE_PAGE_SIZE];
+  for (int i = num_entries - 1; (i >= 0) && !rc; i--) {
+    _fseeki64(journal, entry_offsets[i] - (int64_t)sizeof(journal_entry),
+              SEEK_SET);
+    if ((fread(&entry, sizeof(journal_entry), 1, journal) != 1) ||
+        (fread(page, entry.length, 1, journal) != 1)) {
+      rc = TABFILE_CORRUPTION;
+    } else if (entry.page_number < get_num_pages(&tab_header)) {
+      _fseeki64(fhandle, entry.page_number * TABLE_PAGE_SIZE, SEEK_SET);
+      if (fwrite(page, entry.length, 1, fhandle) != 1) {
+        rc = FILE_WRITE_ERROR;
+      }
+    }
+  }
+  if (!rc) {
+    rc = commit_file(fhandle);
+  }
+  if (!rc) {
+    rc = commit_table_header(fhandle, &tab_header);
+  }
+  free(entry_offsets);
+  fclose(fhandle);
+  fclose(journal);
+  if (!rc) {
+    remove(journal_filename);
+  }
+  return rc;
+}
+
+int read_journal_offsets(FILE *journal, int64_t offset,
+                         int64_t **pp_offsets, int *p_num_entries) {
+  // Offsets of the page bytes of the complete entries from offset on.
+  int rc = 0;
+  int num_entries = 0;
+  int max_entries = 0;
+  int64_t *entry_offsets = NULL;
+  int64_t journal_size = get_file_size(journal);
+  journal_entry entry;
+  _fseeki64(journal, offset, SEEK_SET);
+  while ((fread(&entry, sizeof(journal_entry), 1, journal) == 1) &&
+         (entry.page_number >= 1) && (entry.length > 0) &&
+         (entry.length <= TABLE_PAGE_SIZE)) {
+    offset = _ftelli64(journal);
+    if (offset + entry.length > journal_size) {
+      break;
+    }
+    if (num_entries == max_entries) {
+      max_entries = (max_entries == 0) ? 64 : max_entries * 2;
+      int64_t *new_offsets = (int64_t *)realloc(
+          entry_offsets, sizeof(int64_t) * max_entries);
+      if (new_offsets == NULL) {
+        rc = MEMORY_ERROR;
+        break;
+      }
+      entry_offsets = new_offsets;
+    }
+    entry_offsets[num_entries++] = offset;
+    _fseeki64(journal, offset + entry.length, SEEK_SET);
+  }
+  *pp_offsets = entry_offsets;
+  *p_num_entries = num_entries;
+  return rc;
+}
+
+int rollback_table_files() {
+  /* A failed statement leaves the tables it opened as they were before it.
+  If the rollback of a table fails too, its pages are dropped and the
+  journal restores the committed table when it is opened again. */
+  int rc = 0;
+  table_file *cur_file = g_table_files;
+  while (cur_file) {
+    table_file *next_file = cur_file->next;
+    if (cur_file->statement_number == g_statement_number) {
+      int rollback_rc = rollback_table_file(cur_file);
+      if (rollback_rc) {
+        discard_table_pages(cur_file->table_name);
+        if (!rc) {
+          rc = rollback_rc;
+        }
+      }
+    }
+    cur_file = next_file;
+  }
+  return rc;
+}
+
+int rollback_table_file(table_file *file) {
+  // The pages added by the statement are dropped with its header.
+  buffer_pool *pool = &g_buffer_pool;
+  int64_t num_pages = get_num_pages(&file->statement_header);
+  for (int i = 0; i < pool->num_frames; i++) {
+    buffer_frame *frame = &pool->frames[i];
+    if ((frame->page_number >= num_pages) &&
+        (stricmp(frame->table_name, file->table_name) == 0)) {
+      remove_page_from_hash(i);
+    }
+  }
+  file->header = file->statement_header;
+  if (file->journal == NULL) {
+    return 0;
+  }
+
+  // The pages it changed get back the content they had before it, from its
+  // own journal entries in reverse order.
+  if (fflush(file->journal) != 0) {
+    return FILE_WRITE_ERROR;
+  }
+  int64_t *entry_offsets = NULL;
+  int num_entries = 0;
+  int rc = read_journal_offsets(file->journal, file->journal_statement_offset,
+                                &entry_offsets, &num_entries);
+  char page[TABLE_PAGE_SIZE];
+  for (int i = num_entries - 1; (i >= 0) && !rc; i--) {
+    journal_entry entry;
+    buffer_frame *frame = NULL;
+    _fseeki64(file->journal,
+              entry_offsets[i] - (int64_t)sizeof(journal_entry), SEEK_SET);
+    if ((fread(&entry, sizeof(journal_entry), 1, file->journal) != 1) ||
+        (fread(page, entry.length, 1, file->journal) != 1)) {
+      rc = TABFILE_CORRUPTION;
+    } else if ((rc = pin_page(file, entry.page_number, false, &frame)) ==
+               0) {
+      memcpy(frame->page, page, entry.length);
+      unpin_page(frame, true);
+    }
+  }
+  free(entry_offsets);
+  return rc;
+}
+
+void remove_table_journal(const char *table_name) {
+  char journal_filename[MAX_IDENT_LEN + 13];
+  if (get_journal_filename(table_name, journal_filename,
+                           sizeof(journal_filename))) {
+    remove(journal_filename);
+  }
+}
+
+bool get_journal_filename(const char *table_name, char *filename,
+                          int size) {
+  // The parser rejects table names longer than MAX_IDENT_LEN.
+  return snprintf(filename, size, "%s.tab.journal", table_name) < size;
+}
+
+int open_table_file(tpd_entry *tpd, table_file **pp_file) {
+  int rc = 0;
+  char table_filename[MAX_IDENT_LEN + 5];
+  if (snprintf(table_filename, sizeof(table_filename), "%s.tab",
+               tpd->table_name) >= (int)sizeof(table_filename)) {
+    return FILE_OPEN_ERROR;
+  }
+
+  // Clean pages kept from an earlier statement are valid as long as the
+  // file has not been changed since.
+  table_file *file = find_table_file(tpd->table_name);
+  if ((file != NULL) && (file->fhandle == NULL) && !file->is_dirty) {
+    file_signature signature;
+    if ((get_file_signature(table_filename, &signature) != 0) ||
+        !is_same_file_signature(&file->signature, &signature)) {
+      discard_table_pages(tpd->table_name);
+      file = NULL;
+    }
+  }
+
+  if (file == NULL) {
+    if ((rc = recover_table_file(tpd->table_name)) != 0) {
+      return rc;
+    }
+    FILE *fhandle = NULL;
+    if ((fhandle = fopen(table_filename, "r+bc")) == NULL) {
+      return FILE_OPEN_ERROR;
+    }
+    table_file_header tab_header;
+    int64_t file_size = get_file_size(fhandle);
+    if ((fread(&tab_header, sizeof(table_file_header), 1, fhandle) != 1) ||
+        (tab_header.magic != TABLE_FILE_MAGIC) ||
+        (tab_header.format_version < TABLE_FILE_VERSION)) {
+      // Convert a file of an earlier version first, then read it again.
+      fclose(fhandle);
+      if ((rc = upgrade_table_file(tpd)) != 0) {
+        return rc;
+      }
+      return open_table_file(tpd, pp_file);
+    }
+
+    // Bytes beyond file_size are left by pages added by a flush which did
+    // not complete (see flush_table_file()), they are not part of the table.
+    cd_entry *cd_entries = NULL;
+    get_cd_entries(tpd, &cd_entries);
+    bool is_columnar = (tpd->tpd_flags & TPD_FLAG_COLUMNAR) != 0;
+    bool is_valid_layout = false;
+    if (is_columnar) {
+      column_segment segments[MAX_NUM_COL];
+      int pages_per_group =
+          init_column_segments(cd_entries, tpd->num_columns, segments);
+      is_valid_layout =
+          (tab_header.file_header_flag & TABLE_FILE_COLUMNAR) &&
+          (tab_header.records_per_page == COLUMN_GROUP_ROWS) &&
+          (tab_header.pages_per_group == pages_per_group) &&
+          ((tab_header.file_size / TABLE_PAGE_SIZE - 1) % pages_per_group ==
+           0);
+    } else {
+      is_valid_layout =
+          !(tab_header.file_header_flag & TABLE_FILE_COLUMNAR) &&
+          (tab_header.records_per_page >= 1) &&
+          (tab_header.record_offset >=
+           (int)(sizeof(page_header) +
+                 sizeof(uint16_t) * tab_header.records_per_page)) &&
+          (tab_header.record_offset +
+               tab_header.records_per_page * tab_header.record_size <=
+           TABLE_PAGE_SIZE);
+    }
+    if ((tab_header.format_version != TABLE_FILE_VERSION) ||
+        (tab_header.page_size != TABLE_PAGE_SIZE) ||
+        (tab_header.record_size !=
+         get_record_size(cd_entries, tpd->num_columns)) ||
+        !is_valid_layout || (tab_header.file_size < TABLE_PAGE_SIZE) ||
+        (tab_header.file_size % TABLE_PAGE_SIZE != 0) ||
+        (tab_header.file_size > file_size) || (tab_header.num_records < 0)) {
+      fclose(fhandle);
+      return TABFILE_CORRUPTION;
+    }
+
+    file = (table_file *)calloc(1, sizeof(table_file));
+    if (file == NULL) {
+      fclose(fhandle);
+      return MEMORY_ERROR;
+    }
+    strcpy(file->table_name, tpd->table_name);
+    file->header = tab_header;
+    file->committed_header = tab_header;
+    file->statement_number = -1;
+    file->fhandle = fhandle;
+    if (get_file_signature(table_filename, &file->signature) != 0) {
+      memset(&file->signature, '\0', sizeof(file_signature));
+    }
+    file->next = g_table_files;
+    g_table_files = file;
+  }
+
+  if (get_table_fhandle(file) == NULL) {
+    return FILE_OPEN_ERROR;
+  }
+  // The state of the table before the statement changes it.
+  if (file->statement_number != g_statement_number) {
+    file->statement_number = g_statement_number;
+    file->statement_header = file->header;
+    file->journal_statement_offset = sizeof(table_file_header);
+    if (file->journal) {
+      _fseeki64(file->journal, 0, SEEK_END);
+      file->journal_statement_offset = _ftelli64(file->journal);
+    }
+  }
+  *pp_file = file;
+  return rc;
+}
+
+table_file *find_table_file(const char *table_name) {
+  table_file *cur_file = g_table_files;
+  while (cur_file) {
+    if (stricmp(cur_file->table_name, table_name) == 0) {
+      return cur_file;
+    }
+    cur_file = cur_file->next;
+  }
+  return NULL;
+}
+
+int flush_table_file(table_file *file) {
+  int rc = 0;
+  if (!file->is_dirty) {
+    return rc;
+  }
+
+  /* The pages are written and committed before the header is patched.
+  file_size and num_records are next to each other in the header and are
+  rewritten by a single write. Pages of the committed file are overwritten
+  only once the journal holds their former content (see write_page()), and
+  the journal is cleared after the header. So a crash before the header is
+  written leaves the old header, which ignores the pages added after it,
+  and the journal, from which open_table_file() restores the other pages.
+  A crash after it leaves the new table. */
+  buffer_pool *pool = &g_buffer_pool;
+  for (int i = 0; (i < pool->num_frames) && !rc; i++) {
+    buffer_frame *frame = &pool->frames[i];
+    if ((frame->page_number != -1) &&
+        (stricmp(frame->table_name, file->table_name) == 0)) {
+      if (frame->is_dirty) {
+        rc = write_page(file, frame);
+      }
+      frame->journaled_statement = 0;
+    }
+  }
+  FILE *fhandle = get_table_fhandle(file);
+  if (fhandle == NULL) {
+    return FILE_OPEN_ERROR;
+  }
+  if (!rc) {
+    rc = commit_file(fhandle);
+  }
+  if (!rc) {
+    rc = commit_table_header(fhandle, &file->header);
+  }
+  if (!rc) {
+    // The changes of the statement so far can no longer be rolled back.
+    file->committed_header = file->header;
+    file->statement_header = file->header;
+    file->journal_statement_offset = sizeof(table_file_header);
+    rc = clear_table_journal(file);
+  }
+  if (!rc) {
+    file->is_dirty = false;
+    char table_filename[MAX_IDENT_LEN + 5];
+    snprintf(table_filename, sizeof(table_filename), "%s.tab",
+             file->table_name);
+    rc = get_file_signature(table_filename, &file->signature);
+  }
+  return rc;
+}
+
+int flush_buffer_pool() {
+  int rc = 0;
+  table_file *cur_file = g_table_files;
+  while (cur_file) {
+    int flush_rc = flush_table_file(cur_file);
+    if (!rc) {
+      rc = flush_rc;
+    }
+    cur_file = cur_file->next;
+  }
+  // The log records of deferred changes follow their pages.
+  if (!rc) {
+    rc = write_pending_log();
+  }
+  return rc;
+}
+
+void close_table_files() {
+  table_file *cur_file = g_table_files;
+  while (cur_file) {
+    if (cur_file->fhandle) {
+      fclose(cur_file->fhandle);
+      cur_file->fhandle = NULL;
+    }
+    cur_file = cur_file->next;
+  }
+}
+
+void discard_table_pages(const char *table_name) {
+  // A NULL table name drops the pages of all tables. Dirty pages are
+  // dropped without being written.
+  buffer_pool *pool = &g_buffer_pool;
+  for (int i = 0; i < pool->num_frames; i++) {
+    buffer_frame *frame = &pool->frames[i];
+    if ((frame->page_number != -1) &&
+        ((table_name == NULL) ||
+         (stricmp(frame->table_name, table_name) == 0))) {
+      remove_page_from_hash(i);
+    }
+  }
+
+  table_file *cur_file = g_table_files;
+  table_file *prev_file = NULL;
+  while (cur_file) {
+    table_file *next_file = cur_file->next;
+    if ((table_name == NULL) ||
+        (stricmp(cur_file->table_name, table_name) == 0)) {
+      if (prev_file == NULL) {
+        g_table_files = next_file;
+      } else {
+        prev_file->next = next_file;
+      }
+      if (cur_file->fhandle) {
+        fclose(cur_file->fhandle);
+      }
+      // A journal is left for the next open_table_file() to recover.
+      if (cur_file->journal) {
+        fclose(cur_file->journal);
+      }
+      free(cur_file);
+    } else {
+      prev_file = cur_file;
+    }
+    cur_file = next_file;
+  }
+}
+
+int finish_table_io() {
+  int rc = 0;
+  if (!g_deferred_writes) {
+    rc = flush_buffer_pool();
+  }
+  close_table_files();
+  // Without resident mode, every statement reads the files again.
+  if (!g_resident_mode) {
+    discard_table_pages(NULL);
+  }
+  return rc;
+}
+
+int open_table_scan(tpd_entry *tpd, table_scan *p_scan, bool is_read_only) {
+  memset(p_scan, '\0', sizeof(table_scan));
+  int rc = open_table_file(tpd, &p_scan->file);
+  if (rc) {
+    return rc;
+  }
+
+  // All the columns of a columnar table are read unless use_scan_columns()
+  // says otherwise.
+  table_file_header *tab_header = &p_scan->file->header;
+  if (tab_header->file_header_flag & TABLE_FILE_COLUMNAR) {
+    cd_entry *cd_entries = NULL;
+    get_cd_entries(tpd, &cd_entries);
+    p_scan->is_columnar = true;
+    init_column_segments(cd_entries, tpd->num_columns, p_scan->segments);
+    init_record_layout(cd_entries, tpd->num_columns, &p_scan->layout);
+    for (int i = 0; i < tpd->num_columns; i++) {
+      p_scan->is_used_col[i] = true;
+    }
+    p_scan->batch_bytes =
+        (char *)calloc(FILTER_BATCH_SIZE, tab_header->record_size);
+    if (p_scan->batch_bytes == NULL) {
+      return MEMORY_ERROR;
+    }
+  }
+
+#ifndef _WIN32
+  /* A read-only scan of a table without unwritten changes reads the pages
+  where the file is mapped, so they are neither copied into the buffer pool
+  nor evict the pages cached there. A columnar scan skips the segments of
+  unused columns, so it is not read ahead sequentially. */
+  if (is_read_only && !p_scan->file->is_dirty &&
+      (tab_header->file_size > TABLE_PAGE_SIZE)) {
+    void *mapped_file =
+        mmap(NULL, (size_t)tab_header->file_size, PROT_READ, MAP_SHARED,
+             fileno(p_scan->file->fhandle), 0);
+    if (mapped_file != MAP_FAILED) {
+      if (!p_scan->is_columnar) {
+        madvise(mapped_file, (size_t)tab_header->file_size, MADV_SEQUENTIAL);
+      }
+      p_scan->mapped_file = (char *)mapped_file;
+      p_scan->mapped_size = tab_header->file_size;
+    }
+  }
+#endif
+  return rc;
+}
+
+int next_scan_record(table_scan *p_scan, char **pp_record) {
+  int rc = 0;
+  *pp_record = NULL;
+  while (true) {
+    if (p_scan->page) {
+      p_scan->slot++;
+      if (p_scan->slot < get_page_header(p_scan->page)->num_slots) {
+        *pp_record = p_scan->page + get_page_slots(p_scan->page)[p_scan->slot];
+        return rc;
+      }
+      release_scan_page(p_scan);
+    }
+
+    // Page 0 holds the table header only.
+    p_scan->page_number++;
+    if ((p_scan->page_number >= get_num_pages(&p_scan->file->header)) ||
+        ((p_scan->end_page_number > 0) &&
+         (p_scan->page_number >= p_scan->end_page_number))) {
+      return rc;
+    }
+    if ((rc = get_scan_page(p_scan, p_scan->page_number, &p_scan->frame,
+                            &p_scan->page)) != 0) {
+      return rc;
+    }
+    p_scan->slot = -1;
+  }
+}
+
+int get_scan_page(table_scan *p_scan, int64_t page_number,
+                  buffer_frame **pp_frame, char **pp_page) {
+  // A mapped page is checked like a page read into the buffer pool.
+  *pp_frame = NULL;
+  *pp_page = NULL;
+  if (p_scan->mapped_file) {
+    char *page = p_scan->mapped_file + page_number * TABLE_PAGE_SIZE;
+    int rc = check_data_page(&p_scan->file->header, page, page_number);
+    if (!rc) {
+      *pp_page = page;
+    }
+    return rc;
+  }
+  buffer_frame *frame = NULL;
+  int rc = pin_page(p_scan->file, page_number, false, &frame);
+  if (!rc) {
+    *pp_frame = frame;
+    *pp_page = frame->page;
+  }
+  return rc;
+}
+
+int next_scan_batch(table_scan *p_scan, char *records[], int max_records,
+                    int *p_num_records) {
+  /* The records of a batch come from one page, which stays available until
+  the next call. The scan is left on the last record of the batch. */
+  if (p_scan->is_columnar) {
+    return next_column_batch(p_scan, records, max_records, p_num_records);
+  }
+  int rc = 0;
+  char *record = NULL;
+  *p_num_records = 0;
+  if (((rc = next_scan_record(p_scan, &record)) != 0) || (record == NULL)) {
+    return rc;
+  }
+  int num_records = 0;
+  records[num_records++] = record;
+  int num_slots = get_page_header(p_scan->page)->num_slots;
+  uint16_t *slots = get_page_slots(p_scan->page);
+  while ((num_records < max_records) && (p_scan->slot + 1 < num_slots)) {
+    p_scan->slot++;
+    records[num_records++] = p_scan->page + slots[p_scan->slot];
+  }
+  *p_num_records = num_records;
+  return rc;
+}
+
+void use_scan_columns(table_scan *p_scan, const bool is_used_col[]) {
+  memcpy(p_scan->is_used_col, is_used_col, sizeof(p_scan->is_used_col));
+}
+
+int next_column_batch(table_scan *p_scan, char *records[], int max_records,
+                      int *p_num_records) {
+  /* The rows of a batch come from one row group, which stays pinned until
+  the next call. Their records hold the used columns only. */
+  int rc = 0;
+  table_file_header *tab_header = &p_scan->file->header;
+  int num_records = 0;
+  *p_num_records = 0;
+  while (num_records == 0) {
+    if (p_scan->page == NULL) {
+      p_scan->page_number = (p_scan->page_number < 1)
+                                ? 1
+                                : p_scan->page_number +
+                                      tab_header->pages_per_group;
+      if ((p_scan->page_number >= get_num_pages(tab_header)) ||
+          ((p_scan->end_page_number > 0) &&
+           (p_scan->page_number >= p_scan->end_page_number))) {
+        return rc;
+      }
+      if ((rc = get_scan_page(p_scan, p_scan->page_number, &p_scan->frame,
+                              &p_scan->page)) != 0) {
+        return rc;
+      }
+      p_scan->slot = -1;
+    }
+
+    // Deleted rows are skipped.
+    int num_rows = get_page_header(p_scan->page)->num_slots;
+    unsigned char *live_bitmap = get_group_live_bitmap(p_scan->page);
+    while ((num_records < max_records) && (p_scan->slot + 1 < num_rows)) {
+      p_scan->slot++;
+      if (is_bit_set(live_bitmap, p_scan->slot)) {
+        p_scan->batch_rows[num_records++] = p_scan->slot;
+      }
+    }
+    if (num_records == 0) {
+      release_scan_page(p_scan);
+    }
+  }
+
+  for (int i = 0; (i < p_scan->layout.num_columns) && !rc; i++) {
+    if (p_scan->is_used_col[i]) {
+      rc = read_column_batch(p_scan, i, num_records);
+    }
+  }
+  if (rc) {
+    return rc;
+  }
+  for (int i = 0; i < num_records; i++) {
+    records[i] = p_scan->batch_bytes + i * tab_header->record_size;
+  }
+  *p_num_records = num_records;
+  return rc;
+}
+
+int read_column_batch(table_scan *p_scan, int col_id, int num_records) {
+  // The values are copied into the records of the batch, encoded as in the
+  // row format.
+  int rc = 0;
+  column_segment *p_segment = &p_scan->segments[col_id];
+  column_layout *p_column = &p_scan->layout.columns[col_id];
+  unsigned char *null_bitmap = get_group_null_bitmap(p_scan->page, col_id);
+  int record_size = p_scan->file->header.record_size;
+  buffer_frame *frame = NULL;
+  char *page = NULL;
+  int64_t current_page_number = -1;
+  for (int i = 0; i < num_records; i++) {
+    int row = p_scan->batch_rows[i];
+    char *field = p_scan->batch_bytes + i * record_size + p_column->offset;
+    if (is_bit_set(null_bitmap, row)) {
+      memset(field, '\0', 1 + p_column->col_len);
+      continue;
+    }
+    int64_t page_number = p_scan->page_number + p_segment->first_page +
+                          row / p_segment->values_per_page;
+    if (page_number != current_page_number) {
+      if (frame) {
+        unpin_page(frame, false);
+      }
+      if ((rc = get_scan_page(p_scan, page_number, &frame, &page)) != 0) {
+        break;
+      }
+      current_page_number = page_number;
+    }
+    char *value =
+        page + (row % p_segment->values_per_page) * p_segment->value_size;
+    if (p_column->col_type == T_INT) {
+      field[0] = (char)sizeof(int);
+      memcpy(field + 1, value, sizeof(int));
+    } else {
+      memcpy(field, value, p_segment->value_size);
+    }
+  }
+  if (frame) {
+    unpin_page(frame, false);
+  }
+  return rc;
+}
+
+int update_scan_column(table_scan *p_scan, int batch_index, int col_id) {
+  // A row format record was changed where it is stored.
+  if (!p_scan->is_columnar) {
+    mark_scan_record_dirty(p_scan);
+    return 0;
+  }
+
+  // The value is written back to the segment of the column.
+  column_segment *p_segment = &p_scan->segments[col_id];
+  column_layout *p_column = &p_scan->layout.columns[col_id];
+  int row = p_scan->batch_rows[batch_index];
+  char *field = p_scan->batch_bytes +
+                batch_index * p_scan->file->header.record_size +
+                p_column->offset;
+  bool is_null = (field[0] == 0);
+  buffer_frame *frame = NULL;
+  int rc = pin_page(p_scan->file,
+                    p_scan->page_number + p_segment->first_page +
+                        row / p_segment->values_per_page,
+                    false, &frame);
+  if (rc) {
+    return rc;
+  }
+  if ((rc = journal_page(p_scan->file, frame, TABLE_PAGE_SIZE)) != 0) {
+    unpin_page(frame, false);
+    return rc;
+  }
+  char *value = frame->page +
+                (row % p_segment->values_per_page) * p_segment->value_size;
+  if (is_null) {
+    memset(value, '\0', p_segment->value_size);
+  } else if (p_column->col_type == T_INT) {
+    memcpy(value, field + 1, sizeof(int));
+  } else {
+    memcpy(value, field, p_segment->value_size);
+  }
+  unpin_page(frame, true);
+  set_bit(get_group_null_bitmap(p_scan->page, col_id), row, is_null);
+  mark_scan_record_dirty(p_scan);
+  return rc;
+}
+
+void release_scan_page(table_scan *p_scan) {
+  if (p_scan->frame) {
+    unpin_page(p_scan->frame, p_scan->is_page_dirty);
+    p_scan->frame = NULL;
+  }
+  p_scan->page = NULL;
+  p_scan->is_page_dirty = false;
+}
+
+int journal_scan_page(table_scan *p_scan) {
+  // The first page of a row group holds the bitmaps of its rows.
+  if (p_scan->frame == NULL) {
+    return 0;
+  }
+  return journal_page(p_scan->file, p_scan->frame, TABLE_PAGE_SIZE);
+}
+
+int delete_scan_batch(table_scan *p_scan, const uint64_t selection[],
+                      int num_records) {
+  int rc = 0;
+  bool is_any_selected = false;
+  for (int w = 0; w < (num_records + 63) / 64; w++) {
+    is_any_selected = is_any_selected || (selection[w] != 0);
+  }
+  if (!is_any_selected || ((rc = journal_scan_page(p_scan)) != 0)) {
+    return rc;
+  }
+
+  // A deleted row of a columnar table is cleared from the rows of its group.
+  if (p_scan->is_columnar) {
+    unsigned char *live_bitmap = get_group_live_bitmap(p_scan->page);
+    int num_deleted = 0;
+    for (int i = 0; i < num_records; i++) {
+      if (is_record_selected(selection, i)) {
+        set_bit(live_bitmap, p_scan->batch_rows[i], false);
+        num_deleted++;
+      }
+    }
+    if (num_deleted > 0) {
+      p_scan->file->header.num_records -= num_deleted;
+      mark_scan_record_dirty(p_scan);
+    }
+    return rc;
+  }
+
+  // The slots of the batch which are not selected are moved down over the
+  // deleted ones, then the slots after the batch follow them.
+  page_header *p_page_header = get_page_header(p_scan->page);
+  uint16_t *slots = get_page_slots(p_scan->page);
+  int first_slot = p_scan->slot - num_records + 1;
+  int next_slot = first_slot;
+  for (int i = 0; i < num_records; i++) {
+    if (!is_record_selected(selection, i)) {
+      slots[next_slot++] = slots[first_slot + i];
+    }
+  }
+  int num_deleted = first_slot + num_records - next_slot;
+  if (num_deleted == 0) {
+    return rc;
+  }
+  memmove(&slots[next_slot], &slots[p_scan->slot + 1],
+          sizeof(uint16_t) * (p_page_header->num_slots - p_scan->slot - 1));
+  p_page_header->num_slots -= num_deleted;
+  p_scan->slot = next_slot - 1;
+  p_scan->is_page_dirty = true;
+  p_scan->file->header.num_records -= num_deleted;
+  p_scan->file->is_dirty = true;
+  return rc;
+}
+
+void close_table_scan(table_scan *p_scan) {
+  release_scan_page(p_scan);
+  free(p_scan->batch_bytes);
+  p_scan->batch_bytes = NULL;
+#ifndef _WIN32
+  if (p_scan->mapped_file) {
+    munmap(p_scan->mapped_file, (size_t)p_scan->mapped_size);
+    p_scan->mapped_file = NULL;
+  }
+#endif
+}
+
+#ifndef _WIN32
+volatile sig_atomic_t g_server_stopping = 0;
+
+void handle_server_signal(int signum) {
+  (void)signum;
+  g_server_stopping = 1;
+}
+#endif
+
+int run_server(const char *socket_path) {
+#ifdef _WIN32
+  printf("Error - server mode is not supported on this platform.\n");
+  return 1;
+#else
+  /* Each client sends statements separated by line-feeds. The output of a
+  statement is sent back as it would be printed by "db", followed by a single
+  '\0' byte which marks the end of the response. Statements are executed one
+  at a time, so clients never see each other's partial results. */
+  struct sockaddr_un address;
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    printf("Error - socket file name is too long: %s\n", socket_path);
+    return 1;
+  }
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    printf("Error - cannot create socket.\n");
+    return FILE_OPEN_ERROR;
+  }
+  memset(&address, '\0', sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_path);
+  unlink(socket_path);
+  if ((bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0) ||
+      (listen(listen_fd, MAX_NUM_CLIENTS) != 0)) {
+    printf("Error - cannot listen on socket file: %s\n", socket_path);
+    close(listen_fd);
+    return FILE_OPEN_ERROR;
+  }
+
+  // A client hanging up in the middle of a response must not kill the server.
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, handle_server_signal);
+  signal(SIGTERM, handle_server_signal);
+
+  g_resident_mode = true;
+  printf("Server is listening on %s\n", socket_path);
+  fflush(stdout);
+
+  server_client clients[MAX_NUM_CLIENTS];
+  struct pollfd poll_fds[MAX_NUM_CLIENTS + 1];
+  int num_clients = 0;
+  while (!g_server_stopping) {
+    poll_fds[0].fd = listen_fd;
+    poll_fds[0].events = POLLIN;
+    poll_fds[0].revents = 0;
+    for (int i = 0; i < num_clients; i++) {
+      poll_fds[i + 1].fd = clients[i].fd;
+      poll_fds[i + 1].events = POLLIN;
+      poll_fds[i + 1].revents = 0;
+    }
+
+    if (poll(poll_fds, num_clients + 1, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    // Serve the connected clients first, then drop those which hung up.
+    int num_alive_clients = 0;
+    for (int i = 0; i < num_clients; i++) {
+      bool alive = true;
+      if (poll_fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+        alive = (read_client_statements(&clients[i]) == 0);
+      }
+      if (alive) {
+        clients[num_alive_clients++] = clients[i];
+      } else {
+        close(clients[i].fd);
+        free(clients[i].buffer);
+      }
+    }
+    num_clients = num_alive_clients;
+
+    if (poll_fds[0].revents & POLLIN) {
+      int client_fd = accept(listen_fd, NULL, NULL);
+      if (client_fd >= 0) {
+        // A client which stops reading its responses must not block the
+        // server, its sends fail after a while and it is dropped.
+        struct timeval send_timeout;
+        memset(&send_timeout, '\0', sizeof(send_timeout));
+        send_timeout.tv_sec = CLIENT_SEND_TIMEOUT_SECONDS;
+        setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout,
+                   sizeof(send_timeout));
+        if (num_clients < MAX_NUM_CLIENTS) {
+          memset(&clients[num_clients], '\0', sizeof(server_client));
+          clients[num_clients].fd = client_fd;
+          num_clients++;
+        } else {
+          close(client_fd);
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < num_clients; i++) {
+    close(clients[i].fd);
+    free(clients[i].buffer);
+  }
+  close(listen_fd);
+  unlink(socket_path);
+
+  free_buffer_pool();
+  invalidate_resident_tpd_list();
+  g_resident_mode = false;
+  return 0;
+#endif
+}
+
+int read_client_statements(server_client *client) {
+#ifdef _WIN32
+  return FILE_OPEN_ERROR;
+#else
+  // Make room for the next chunk and a terminating '\0'.
+  if (client->capacity - client->length < CLIENT_READ_CHUNK_SIZE + 1) {
+    int capacity = client->capacity + CLIENT_READ_CHUNK_SIZE + 1;
+    char *buffer = (char *)realloc(client->buffer, capacity);
+    if (buffer == NULL) {
+      return MEMORY_ERROR;
+    }
+    client->buffer = buffer;
+    client->capacity = capacity;
+  }
+
+  int num_bytes =
+      read(client->fd, client->buffer + client->length, CLIENT_READ_CHUNK_SIZE);
+  if (num_bytes <= 0) {
+    // The client has closed the connection.
+    return FILE_OPEN_ERROR;
+  }
+  client->length += num_bytes;
+  client->buffer[client->length] = '\0';
+
+  // Execute every complete line and keep the incomplete tail for later.
+  int rc = 0;
+  char *line = client->buffer;
+  char *line_end = NULL;
+  while (!rc && ((line_end = strchr(line, '\n')) != NULL)) {
+    *line_end = '\0';
+    if ((line_end > line) && (*(line_end - 1) == '\r')) {
+      *(line_end - 1) = '\0';
+    }
+    if (strlen(line) > 0) {
+      rc = execute_client_statement(client, line);
+    }
+    line = line_end + 1;
+  }
+  client->length -= (int)(line - client->buffer);
+  memmove(client->buffer, line, client->length + 1);
+
+  // A client which never ends its line is answered and dropped before its
+  // buffer grows without bound.
+  if (!rc && (client->length > MAX_CLIENT_LINE_LEN)) {
+    char message[64];
+    int length = snprintf(message, sizeof(message),
+                          "Error - statement longer than %d bytes.\n",
+                          MAX_CLIENT_LINE_LEN);
+    // The '\0' after the message ends the response.
+    if (write(client->fd, message, length + 1) != length + 1) {
+      return FILE_WRITE_ERROR;
+    }
+    rc = STATEMENT_TOO_LONG;
+  }
+  return rc;
+#endif
+}
+
+int execute_client_statement(server_client *client, char *statement) {
+#ifdef _WIN32
+  return FILE_OPEN_ERROR;
+#else
+  // Send everything printed while executing the statement to the client.
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  dup2(client->fd, STDOUT_FILENO);
+
+  execute_statement(statement, 1);
+
+  fflush(stdout);
+  // A send which timed out leaves the error flag of stdout set.
+  bool is_sent = !ferror(stdout);
+  clearerr(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+
+  // Mark the end of the response.
+  char terminator = '\0';
+  if (!is_sent || (write(client->fd, &terminator, 1) != 1)) {
+    return FILE_WRITE_ERROR;
+  }
+  return 0;
+#endif
+}
+
+int run_script(FILE *fhandle) {
+  /* Statements are separated by ';'. Line-feeds and tabs outside string
+  literals are treated as blanks, so a statement can span several lines. All
+  statements share the resident tpd list and buffer pool, and table changes
+  are written to the .tab files at SYNC statements and at the end. */
+  int rc = 0;
+  int num_statements = 0;
+  int num_failed_statements = 0;
+  int capacity = SCRIPT_READ_CHUNK_SIZE;
+  int length = 0;
+  bool in_string_literal = false;
+  char *statement = (char *)malloc(capacity);
+  char *chunk = (char *)malloc(SCRIPT_READ_CHUNK_SIZE);
+  if (statement == NULL || chunk == NULL) {
+    free(statement);
+    free(chunk);
+    return MEMORY_ERROR;
+  }
+
+  g_resident_mode = true;
+  g_deferred_writes = true;
+
+  bool done = false;
+  while (!done) {
+    int num_bytes = (int)fread(chunk, 1, SCRIPT_READ_CHUNK_SIZE, fhandle);
+    if (num_bytes <= 0) {
+      // Treat the end of input as the end of the last statement.
+      done = true;
+      chunk[0] = ';';
+      num_bytes = 1;
+    }
+
+    for (int i = 0; i < num_bytes; i++) {
+      char c = chunk[i];
+      if (c == '\'') {
+        in_string_literal = !in_string_literal;
+      } else if (!in_string_literal && (c == '\n' || c == '\r' || c == '\t')) {
+        c = ' ';
+      }
+
+      if (c != ';' || in_string_literal) {
+        if (length + 1 >= capacity) {
+          char *new_statement = (char *)realloc(statement, capacity * 2);
+          if (new_statement == NULL) {
+            rc = MEMORY_ERROR;
+            done = true;
+            break;
+          }
+          statement = new_statement;
+          capacity *= 2;
+        }
+        statement[length++] = c;
+        continue;
+      }
+
+      // Trim the statement and execute it unless it is empty.
+      statement[length] = '\0';
+      char *start = statement;
+      while (*start == ' ') {
+        start++;
+      }
+      while ((length > 0) && (statement[length - 1] == ' ')) {
+        statement[--length] = '\0';
+      }
+      if (strlen(start) > 0) {
+        num_statements++;
+        int exec_rc = execute_statement(start, 0);
+        if (exec_rc) {
+          num_failed_statements++;
+          printf("Error in statement %d: %s\nrc=%d\n", num_statements, start,
+                 exec_rc);
+          rc = exec_rc;
+        }
+      }
+      length = 0;
+    }
+  }
+
+  int flush_rc = flush_buffer_pool();
+  if (flush_rc) {
+    printf("Error - cannot write table changes to disk.\nrc=%d\n", flush_rc);
+    rc = flush_rc;
+  }
+  printf("%d statements executed, %d failed.\n", num_statements,
+         num_failed_statements);
+
+  // The changes were not written, so neither are their log records.
+  discard_pending_log();
+  free_buffer_pool();
+  invalidate_resident_tpd_list();
+  g_deferred_writes = false;
+  g_resident_mode = false;
+  free(statement);
+  free(chunk);
+  return rc;
 }
@@ -7,15 +7,21 @@ prototype for the db.exe program.
 *********************************************************************/
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #define MAX_IDENT_LEN 16
 #define MAX_STRING_LEN 255
 #define MAX_NUM_COL 16
-#define MAX_NUM_ROW 1000
 #define MAX_NUM_TABLE 1000
-#define MAX_NUM_CONDITION 2
+#define MAX_NUM_CONDITION 32
+#define MAX_NUM_PREDICATE_NODES 64
 #define MAX_TOK_LEN 256
 #define KEYWORD_OFFSET 10
 #define STRING_BREAK " (),<>="
@@ -24,12 +30,39 @@ prototype for the db.exe program.
 #define LOG_ENTRY_TIMESTAMP_LEN 14
 #define MAX_LOG_ENTRY_TEXT_LEN 1000
 #define MAX_NUM_LOG_BACKUP_FILES 999
+#define TABLE_FILE_MAGIC 0x32424154  // "TAB2"
+#define TABLE_FILE_VERSION 3
+#define TABLE_PAGE_SIZE 8192
+#define DEFAULT_BUFFER_POOL_SIZE (64 * 1024 * 1024)
+#define MIN_BUFFER_POOL_FRAMES 16
+#define FILE_COPY_CHUNK_SIZE 65536
+#define MAX_LOAD_WORKERS 8
+#define LOAD_BLOCK_SIZE (4 * 1024 * 1024)
+#define FILTER_BATCH_SIZE 1024
+#define COLUMN_GROUP_ROWS 2048
+#define TPD_FLAG_COLUMNAR 1
+#define TABLE_FILE_COLUMNAR 1
+#define SELECTION_WORDS ((FILTER_BATCH_SIZE + 63) / 64)
+#define MAX_NUM_OPERATORS 5
+#define MAX_TOP_K_ROWS 65536
+#define DEFAULT_SORT_MEMORY_SIZE (256 * 1024 * 1024)
+#define MAX_SORT_WORKERS 8
+#define MIN_SORT_TASK_ROWS 16384
+#define MAX_MERGE_RUNS 64
+#define SORT_RUN_BLOCK_SIZE 65536
+#define MAX_SCAN_WORKERS 64
+#define MORSEL_PAGES 16
+#define DEFAULT_GROUP_MEMORY_SIZE (256 * 1024 * 1024)
+#define NUM_GROUP_PARTITIONS 16
+#define MAX_GROUP_SPILL_DEPTH 4
+#define MAX_TITLE_LEN (MAX_IDENT_LEN + 8)
 
 /* Constants */
 const char kDbFile[] = "dbfile.bin";
 const char kTempDbFile[] = "dbfile.bin.temp";
 const char kDbLogFile[] = "db.log";
 const char kRfStartLogEntry[] = "RF_START";
+const char kDbSocketFile[] = "db.sock";
 
 /* Column descriptor sturcture = 20+4+4+4+4 = 36 bytes */
 typedef struct cd_entry_def {
@@ -119,10 +152,26 @@ typedef enum token_value_def {
   K_RESTORE,          // 37
   K_WITHOUT,          // 38
   K_RF,               // 39
-  K_ROLLFORWARD,      // 40 - new keyword should be added below this line
-  F_SUM,              // 41
-  F_AVG,              // 42
-  F_COUNT,            // 43 - new function name should be added below this line
+  K_ROLLFORWARD,      // 40
+  K_SYNC,             // 41
+  K_LOAD,             // 42
+  K_DATA,             // 43
+  K_WITH,             // 44
+  K_FORMAT,           // 45
+  K_COLUMNAR,         // 46
+  K_IN,               // 47
+  K_BETWEEN,          // 48
+  K_LIKE,             // 49
+  K_ASC,              // 50
+  K_LIMIT,            // 51
+  K_OFFSET,           // 52
+  K_GROUP,            // 53
+  K_HAVING,           // 54 - new keyword should be added below this line
+  F_SUM,              // 55
+  F_AVG,              // 56
+  F_COUNT,            // 57
+  F_MIN,              // 58
+  F_MAX,              // 59 - new function name should be added below this line
   S_LEFT_PAREN = 70,  // 70
   S_RIGHT_PAREN,      // 71
   S_COMMA,            // 72
@@ -138,16 +187,20 @@ typedef enum token_value_def {
 } token_value;
 
 /* This constants must be updated when add new keywords */
-#define TOTAL_KEYWORDS_PLUS_TYPE_NAMES 34
+#define TOTAL_KEYWORDS_PLUS_TYPE_NAMES 50
 
 /* New keyword must be added in the same position/order as the enum
 definition above, otherwise the lookup will be wrong */
 const char *const keyword_table[] = {
-    "int",     "char",   "create",      "table",  "not",    "null",   "drop",
-    "list",    "schema", "for",         "to",     "insert", "into",   "values",
-    "delete",  "from",   "where",       "update", "set",    "select", "order",
-    "by",      "desc",   "is",          "and",    "or",     "backup", "restore",
-    "without", "rf",     "rollforward", "sum",    "avg",    "count"};
+    "int",         "char",   "create",  "table",   "not",     "null",
+    "drop",        "list",   "schema",  "for",     "to",      "insert",
+    "into",        "values", "delete",  "from",    "where",   "update",
+    "set",         "select", "order",   "by",      "desc",    "is",
+    "and",         "or",     "backup",  "restore", "without", "rf",
+    "rollforward", "sync",   "load",    "data",    "with",    "format",
+    "columnar",    "in",     "between", "like",    "asc",     "limit",
+    "offset",      "group",  "having",  "sum",     "avg",     "count",
+    "min",         "max"};
 
 /* This enum defines a set of possible statements */
 typedef enum semantic_statement_def {
@@ -162,7 +215,9 @@ typedef enum semantic_statement_def {
   SELECT,                    // 107
   BACKUP_TO_IMAGE,           // 108
   RESTORE_FROM_IMAGE,        // 109
-  ROLLFORWARD                // 110
+  ROLLFORWARD,               // 110
+  SYNC_TABLES,               // 111
+  LOAD_DATA                  // 112
 } semantic_statement;
 
 /* This enum has a list of all the errors that should be detected
@@ -203,18 +258,73 @@ typedef enum return_codes_def {
   MISSING_RF_START_LOG_ENTRY,            // -288
   DUPLICATE_RF_START_LOG_ENTRY,          // -287
   DB_NOT_IN_ROLLFORWARD_PENDING_STATE,   // -286
-  INVALID_TIMESTAMP_FORMAT               // -285
+  INVALID_TIMESTAMP_FORMAT,              // -285
+  FILE_WRITE_ERROR,                      // -284
+  BUFFER_POOL_EXHAUSTED,                 // -283
+  STATEMENT_TOO_LONG                     // -282
 } return_codes;
 
-/* Table file structures in which we store records of that table */
+/* Table file structures in which we store records of that table. A table
+file is a sequence of pages. Page 0 starts with this header, every other
+page is a data page. */
 typedef struct table_file_header_def {
+  int magic;           // TABLE_FILE_MAGIC.
+  int format_version;  // TABLE_FILE_VERSION.
+  int64_t file_size;   // Size of the pages in use, later bytes are ignored.
+  int64_t num_records;
+  int record_size;
+  int record_offset;  // Offset of the first record in a data page.
+  int file_header_flag;  // TABLE_FILE_COLUMNAR for a columnar table.
+  int page_size;
+  int records_per_page;  // Rows of a row group in a columnar table.
+  int pages_per_group;   // Columnar tables only.
+} table_file_header;
+
+/* A data page starts with this header, followed by the slot array: one
+uint16_t offset per record in the page, in record order. The records are
+stored at record_offset + n * record_size, n < records_per_page. */
+typedef struct page_header_def {
+  int64_t page_number;
+  int num_slots;
+  int reserved;
+} page_header;
+
+/* A columnar table file stores its rows in row groups of COLUMN_GROUP_ROWS
+rows. The first page of a group starts with a page_header, num_slots being
+the number of rows added to the group. It is followed by the bitmap of the
+rows which are not deleted, then by one NULL bitmap per column. Each column
+then has a segment of pages holding the values of the group, without any
+page header. An INT value takes 4 bytes, a CHAR(n) value a length byte and n
+bytes. */
+typedef struct column_segment_def {
+  int first_page;  // First page of the segment, from the start of the group.
+  int value_size;
+  int values_per_page;
+} column_segment;
+
+/* Header of version 2 table files, followed by num_records records at
+record_offset. */
+typedef struct table_file_header_v2_def {
+  int magic;
+  int format_version;
+  int64_t file_size;
+  int64_t num_records;
+  int record_size;
+  int record_offset;
+  int file_header_flag;
+  int reserved;
+} table_file_header_v2;
+
+/* Header of version 1 table files, which start with file_size instead of
+TABLE_FILE_MAGIC. It was followed by an in-memory pointer whose size depends
+on the build which wrote the file, so record_offset locates the records. */
+typedef struct table_file_header_v1_def {
   int file_size;
   int record_size;
   int num_records;
   int record_offset;
   int file_header_flag;
-  tpd_entry *tpd_ptr;
-} table_file_header;
+} table_file_header_v1;
 
 typedef enum field_value_type_def {
   FIELD_VALUE_TYPE_UNKNOWN = 0,  // 0
@@ -243,17 +353,41 @@ typedef struct field_name_def {
 typedef struct record_row_def {
   int num_fields;
   field_value *value_ptrs[MAX_NUM_COL];
-  int sorting_col_id;
   struct record_row_def *next;
 } record_row;
 
+/* Where a column is stored in a record. */
+typedef struct column_layout_def {
+  int offset;  // Offset of the length byte, the data follows it.
+  int col_type;
+  int col_len;
+  int not_null;
+} column_layout;
+
+/* Layout of the records of a table, computed once per statement from its
+column descriptors. */
+typedef struct record_layout_def {
+  int num_columns;
+  int record_size;
+  column_layout columns[MAX_NUM_COL];
+} record_layout;
+
+/* A record read where it is stored. Its columns are only decoded when they
+are used. */
+typedef struct row_view_def {
+  record_layout *layout;
+  char *record;
+} row_view;
+
 /* Condition in record-level predicate by WHERE clause. */
 typedef struct record_condition_def {
   int value_type;  // The enum of field_value_type. It is available only the
                    // operator is in {S_LESS, S_GREATER, S_EQUAL}.
   int col_id;      // LHS operand.
   int op_type;  // Relational operator, can be S_LESS, S_GREATER, S_EQUAL, K_IS
-                // (used in "IS NULL"), or K_NOT (used in "IS NOT NULL").
+                // (used in "IS NULL"), K_NOT (used in "IS NOT NULL"), K_IN
+                // or K_LIKE. BETWEEN is parsed into two negated
+                // comparisons.
   int int_data_value;  // RHS operand. It is available only if data type is
                        // integer and operator is in {S_LESS, S_GREATER,
                        // S_EQUAL}.
@@ -261,21 +395,464 @@ typedef struct record_condition_def {
                                                // only if data type is string
                                                // and operator is in {S_LESS,
                                                // S_GREATER, S_EQUAL}.
+  int string_data_length;  // Length of string_data_value.
+  token_list *first_in_value;  // K_IN only: the literals of the list,
+  int num_in_values;           // separated by commas.
 } record_condition;
 
-/* Record predicate represented as WHERE clause. */
+/* A node of a WHERE expression: a condition, or K_AND, K_OR or K_NOT of
+its children. */
+typedef struct predicate_node_def {
+  int type;             // 0 for a condition, else K_AND, K_OR or K_NOT.
+  int condition_index;  // Conditions only.
+  int first_child;      // -1 if the node has no child.
+  int next_sibling;     // -1 for the last child.
+} predicate_node;
+
+/* Record predicate represented as WHERE clause. It has no node when there
+is no WHERE clause. */
 typedef struct record_predicate_def {
-  int type;  // The relationship of conditions, can be K_AND or K_OR. Set as
-             // K_AND by default if there is only one condition.
   int num_conditions;
   record_condition conditions[MAX_NUM_CONDITION];
+  int num_nodes;
+  int root;
+  predicate_node nodes[MAX_NUM_PREDICATE_NODES];
 } record_predicate;
 
+/* Truth value of a WHERE expression, where a comparison with NULL is
+unknown. */
+typedef enum truth_value_def {
+  TRUTH_FALSE = 0,  // 0
+  TRUTH_TRUE,       // 1
+  TRUTH_UNKNOWN     // 2
+} truth_value;
+
+/* Kinds of LIKE patterns. Only the general one is matched wildcard by
+wildcard, the others compare the literal part of the pattern. */
+typedef enum like_pattern_def {
+  LIKE_EXACT = 0,  // 'abc'
+  LIKE_PREFIX,     // 'abc%'
+  LIKE_SUFFIX,     // '%abc'
+  LIKE_INFIX,      // '%abc%'
+  LIKE_GENERAL     // Any other pattern, or one with '_'.
+} like_pattern;
+
+/* Values of an IN list, built by compile_predicate(). The integers are
+sorted without duplicates. The strings are stored as record fields, a length
+byte then the bytes, in a hash table. */
+typedef struct value_set_def {
+  int num_values;
+  int *int_values;
+  int value_size;  // Bytes of a string field, 1 + col_len.
+  char *string_values;
+  int num_buckets;  // A power of two.
+  int *buckets;     // Index of a string value, or -1.
+} value_set;
+
+/* A condition compiled for the records of one table. eval is specialized for
+the type, the operator and the nullability of the condition, so evaluating
+it takes no switch. */
+typedef struct compiled_condition_def {
+  bool (*eval)(const struct compiled_condition_def *p_condition,
+               const char *record);
+  int offset;  // Offset of the length byte of the column in a record.
+  int col_len;  // Bytes of the column after the length byte.
+  int op_type;
+  int value_type;
+  bool is_nullable;
+  bool is_negated;  // Comparisons under a NOT, false for NULL as well.
+  int int_value;
+  int string_length;
+  const char *string_value;  // For K_LIKE, the literal part of the pattern
+                             // unless it is LIKE_GENERAL.
+  int like_pattern;          // K_LIKE only.
+  value_set *p_value_set;    // K_IN only.
+} compiled_condition;
+
+/* WHERE clause compiled once per statement by compile_predicate(). The NOT
+nodes are pushed down to the conditions, and the children of an AND or an
+OR node are ordered so the cheapest decisive ones are evaluated first. */
+typedef struct compiled_predicate_def {
+  bool (*eval)(const struct compiled_predicate_def *p_predicate,
+               const char *record);
+  int num_conditions;
+  compiled_condition conditions[MAX_NUM_CONDITION];
+  int num_nodes;
+  int root;
+  predicate_node nodes[MAX_NUM_PREDICATE_NODES];  // Without K_NOT nodes.
+} compiled_predicate;
+
+/* Filter kernels of one instruction set. A kernel sets bit i of a selection
+bitmap of SELECTION_WORDS words when value i qualifies, and clears the bits
+after the last value. */
+typedef struct filter_kernels_def {
+  const char *name;  // "avx2", "sse2" or "scalar".
+  void (*filter_int)(const int values[], int num_values, int op_type,
+                     int operand, uint64_t selection[]);
+  void (*filter_null)(const unsigned char length_bytes[], int num_values,
+                      uint64_t selection[]);
+  bool (*equal_bytes)(const char *bytes1, const char *bytes2, int length);
+  // Bytes up to size can be read, a string of length bytes is searched.
+  bool (*find_bytes)(const char *bytes, int length, int size,
+                     const char *pattern, int pattern_length);
+} filter_kernels;
+
+/* Values of one column for the rows of a batch or of a sort buffer. A
+string value is NUL-terminated, in value_size bytes. A T_INT column of 8
+bytes, like the columns of grouped rows, holds 64-bit values. */
+typedef struct column_vector_def {
+  int col_type;
+  int value_size;
+  int capacity;
+  bool *is_null;
+  int *int_values;       // T_INT columns.
+  int64_t *long_values;  // T_INT columns of 8 bytes.
+  char *string_values;   // T_CHAR columns.
+} column_vector;
+
+/* Rows passed between the operators of a SELECT. Only the rows of the
+selection vector take part, and columns[] holds a value at the index of each
+of them. */
+typedef struct row_batch_def {
+  int num_rows;
+  char *records[FILTER_BATCH_SIZE];  // Stored records, set by the scan.
+  int num_selected;
+  int selected[FILTER_BATCH_SIZE];  // Selection vector, set by the filter.
+  column_vector *columns[MAX_NUM_COL];  // Projected columns, or NULL.
+} row_batch;
+
+/* Running state of SUM, AVG or COUNT. Parts of the input can be aggregated
+into states of their own, which merge_aggregate_state() adds up. The 64-bit
+sum of int values cannot overflow. */
+typedef struct aggregate_state_def {
+  int64_t records_count;
+  int64_t int_sum;
+} aggregate_state;
+
+/* A buffered row and its sort key. The key is encoded so that keys
+compare with memcmp(), and prefix holds its first 8 bytes as a big-endian
+number. Rows with equal keys keep their order. */
+typedef struct sort_entry_def {
+  uint64_t prefix;
+  int row;  // Row in the sort buffer.
+} sort_entry;
+
+/* A tournament over sorted sources. Each inner node keeps the source which
+lost its match and nodes[0] the source which won them all, so the matches
+replayed after the winner moves to its next row are those on its path. */
+typedef struct loser_tree_def {
+  int num_sources;
+  int nodes[MAX_MERGE_RUNS];
+  const void *p_sources;
+  bool (*is_less)(const void *p_sources, int source1, int source2);
+} loser_tree;
+
+/* Sorted rows spilled by the sort operator to a temporary file. A row is
+its sort key followed by the projected columns, see write_sort_row(). */
+typedef struct sort_run_def {
+  FILE *file;
+  int64_t num_rows;      // Rows written, then rows left in the file.
+  unsigned char *block;  // Rows being written or read.
+  int num_block_rows;
+  int position;  // Current row of the block when reading.
+} sort_run;
+
+/* Runs merged into one sorted sequence, in the order they were written,
+which breaks the ties between equal keys. */
+typedef struct run_merge_def {
+  int key_size;
+  int row_size;
+  int num_runs;
+  sort_run *runs;
+  loser_tree tree;
+} run_merge;
+
+/* Rows kept by the sort operator until the scan ends. With LIMIT, only
+the first num_top_rows rows are kept in a heap, see add_top_k_batch().
+Over g_sort_memory_size, the rows are spilled to runs which are merged
+when the scan ends. */
+typedef struct sort_buffer_def {
+  int num_rows;
+  int capacity;
+  column_vector columns[MAX_NUM_COL];  // Only the projected columns are used.
+  int key_size;
+  unsigned char *keys;  // Whole keys by row, when over 8 bytes or top-K.
+  sort_entry *entries;  // In sorted order.
+  int num_top_rows;     // 0 when every row is kept.
+  int num_input_rows;
+  run_merge merge;  // No run unless the rows were spilled.
+} sort_buffer;
+
+/* An aggregate computed for each group of a grouped SELECT, or once for a
+SELECT of aggregates only. Its state in a group row is an aggregate_state.
+MIN and MAX of an integer keep the value in int_sum, and MIN and MAX of a
+string have the value after the state. */
+typedef struct group_aggregate_def {
+  int function;      // F_SUM, F_AVG, F_COUNT, F_MIN or F_MAX.
+  int col_id;        // Column of the table, -1 for COUNT(*).
+  int state_offset;  // In a group row.
+} group_aggregate;
+
+/* Where a column of the grouped rows of a SELECT comes from. */
+typedef struct grouped_column_def {
+  int group_by_index;   // Position in GROUP BY, -1 for an aggregate.
+  int aggregate_index;  // -1 for a grouping column.
+} grouped_column;
+
+/* A SELECT statement run by batches: scan, filter and project, then group,
+sort or output. */
+typedef struct select_plan_def {
+  record_layout layout;
+  compiled_predicate where_filter;
+  int num_project_cols;
+  int project_col_ids[MAX_NUM_COL];  // Columns decoded from the records.
+  int num_output_cols;
+  cd_entry **output_cd_entries;
+  int num_order_by_cols;  // 0 without ORDER BY.
+  int order_by_col_ids[MAX_NUM_COL];
+  bool order_by_desc[MAX_NUM_COL];
+  bool has_limit;
+  int limit;
+  int offset;
+
+  // GROUP BY or aggregates only, where aggregates without GROUP BY make one
+  // group. The operators after the grouping run the plan of the grouped
+  // rows, whose HAVING is evaluated by the grouping.
+  int num_group_by_cols;
+  int group_by_col_ids[MAX_NUM_COL];
+  int num_group_aggregates;
+  group_aggregate group_aggregates[MAX_NUM_COL];
+  int num_grouped_cols;
+  grouped_column grouped_cols[MAX_NUM_COL];
+  record_predicate having;
+  struct select_plan_def *p_group_plan;
+} select_plan;
+
+/* Columns of the grouped rows of a SELECT. The visible ones come first, in
+the order of the select list, then those only used by HAVING or ORDER BY.
+An aggregate is named by get_aggregate_name() for HAVING and ORDER BY, and
+its col_len fits its title, widened by the output to its widest value. */
+typedef struct grouped_columns_def {
+  int num_columns;
+  cd_entry cd_entries[MAX_NUM_COL];  // col_id is the position in a row.
+  char titles[MAX_NUM_COL][MAX_TITLE_LEN];
+} grouped_columns;
+
+/* Groups spilled to a temporary file, as group rows. Their hashes have the
+same first depth * 4 bits. */
+typedef struct group_partition_def {
+  sort_run run;
+  int depth;
+} group_partition;
+
+/* Hash aggregation table of a grouped SELECT, with open addressing. A group
+row holds the states of the aggregates, then the key of the group, encoded
+like a sort key so that equal groups have equal keys. Over
+g_group_memory_size, the groups are spilled to partitions by their hash, and
+the partitions are aggregated one after the other, partitioned again while
+they are too large. */
+typedef struct group_table_def {
+  select_plan *p_plan;  // Plan of the rows which are grouped.
+  int key_offset;
+  int key_size;
+  int key_col_offsets[MAX_NUM_COL];  // Of each GROUP BY column in the key.
+  int row_size;  // A multiple of 8, so that the states are aligned.
+  int num_groups;
+  int capacity;
+  int max_groups;  // Over it, the groups are spilled.
+  unsigned char *rows;
+  uint32_t *hashes;  // Hash of the key of each group.
+  int num_buckets;   // A power of two, twice the capacity.
+  int *buckets;      // Group of each bucket, or -1.
+  int depth;         // Depth of the partition being aggregated.
+  bool is_spilled;   // Since the table was last empty.
+  sort_run spilled_runs[NUM_GROUP_PARTITIONS];  // Opened when used.
+  int num_partitions;
+  group_partition *partitions;  // Waiting to be aggregated.
+  int position;                 // Next group to return.
+} group_table;
+
+/* A range of the sort buffer, whose keys are encoded and sorted by one
+worker, which then writes it to a run when the buffer is spilled. */
+typedef struct sort_task_def {
+  select_plan *p_plan;
+  sort_buffer *p_buffer;
+  int begin;
+  int end;
+  sort_run *p_run;  // NULL when the range stays in memory.
+  int rc;
+} sort_task;
+
+/* Sorted ranges of the entries of a sort buffer, merged by a loser tree. */
+typedef struct sorted_ranges_def {
+  const sort_buffer *p_buffer;
+  int begins[MAX_SORT_WORKERS];  // Next entry of each range.
+  int ends[MAX_SORT_WORKERS];
+} sorted_ranges;
+
+/* Size, modification time and inode of a file, used to tell whether a
+resident copy of the file is still up to date. */
+typedef struct file_signature_def {
+  long long file_size;
+  time_t modified_time;
+  long modified_nsec;
+  long long inode;  // A file replaced by rename() has another inode.
+} file_signature;
+
+/* A table page held in the buffer pool. */
+typedef struct buffer_frame_def {
+  char table_name[MAX_IDENT_LEN + 1];
+  int64_t page_number;  // -1 when the frame is free.
+  int pin_count;
+  bool is_dirty;
+  bool is_referenced;  // Second chance bit of the CLOCK eviction.
+  int hash_next;       // Next frame in the same hash bucket, or -1.
+  int journaled_statement;  // Statement which journaled the page, or 0.
+  int journaled_length;     // Bytes of the page it journaled.
+  char *page;               // TABLE_PAGE_SIZE bytes.
+} buffer_frame;
+
+/* Pages of all tables share one pool bounded by g_buffer_pool_size. */
+typedef struct buffer_pool_def {
+  int num_frames;
+  int clock_hand;
+  buffer_frame *frames;
+  int *hash_buckets;  // num_frames buckets, each the first frame or -1.
+  char *pages;
+} buffer_pool;
+
+/* A table file used by the buffer pool. The header is kept in memory and
+written after the dirty pages. A page of the committed file is saved in the
+journal of the table before it is first changed, see journal_page(). */
+typedef struct table_file_def {
+  char table_name[MAX_IDENT_LEN + 1];
+  table_file_header header;
+  table_file_header committed_header;  // Header in the file on disk.
+  table_file_header statement_header;  // Header before the statement.
+  int statement_number;  // Statement which statement_header belongs to.
+  int64_t journal_statement_offset;  // First journal entry of it.
+  bool is_dirty;  // Some pages or the header have not been written yet.
+  file_signature signature;  // Signature of the file when it was read.
+  FILE *fhandle;             // Only open during a statement.
+  FILE *journal;             // <table>.tab.journal, or NULL.
+  bool is_journal_synced;    // All the entries of the journal are on disk.
+  struct table_file_def *next;
+} table_file;
+
+/* The journal of a table starts with the committed header of the table
+file. Each entry is followed by the first length bytes of the page as they
+were before the page was changed. */
+typedef struct journal_entry_def {
+  int64_t page_number;
+  int length;
+  int reserved;
+} journal_entry;
+
+/* Cursor over the records of a table, which pins one page at a time. A
+read-only scan may read the pages from a mapping of the file instead. */
+typedef struct table_scan_def {
+  table_file *file;
+  int64_t page_number;
+  int64_t end_page_number;  // Page after the last one to read, 0 for all.
+  char *page;               // Current page, or NULL.
+  buffer_frame *frame;      // Pinned current page, NULL if it is mapped.
+  int slot;                 // Current slot in the page.
+  bool is_page_dirty;
+  char *mapped_file;  // Mapping of the whole file, or NULL.
+  int64_t mapped_size;
+
+  // Columnar tables only. page is the first page of the current row group
+  // and slot its last row read. The records of a batch are assembled in
+  // batch_bytes from the columns which are used.
+  bool is_columnar;
+  column_segment segments[MAX_NUM_COL];
+  record_layout layout;
+  bool is_used_col[MAX_NUM_COL];
+  char *batch_bytes;
+  int batch_rows[FILTER_BATCH_SIZE];
+} table_scan;
+
+/* Projected columns of the rows of a morsel which qualify. */
+typedef struct morsel_result_def {
+  int num_rows;
+  int capacity;
+  column_vector columns[MAX_NUM_COL];
+  bool is_done;  // Set by the worker, with rc.
+  int rc;
+} morsel_result;
+
+/* Workers which scan, filter and project the morsels of a mapped table. A
+morsel is MORSEL_PAGES pages, or a row group of a columnar table. They are
+dealt to the queues of the workers in turn, and a worker takes the first
+morsel of its own queue, or steals the first one of another queue. So the
+morsels are done about in table order, and a worker waits when its morsel
+is too far ahead of the one being returned. */
+typedef struct scan_pool_def {
+  select_plan *p_plan;
+  table_scan *p_scan;
+  int num_workers;
+  std::thread workers[MAX_SCAN_WORKERS];
+  std::atomic<int> queue_heads[MAX_SCAN_WORKERS];  // Next index in a queue.
+  int num_morsels;
+  int64_t pages_per_morsel;
+  morsel_result *morsels;
+  int aggregate_row_size;         // 0 unless has_ungrouped_aggregates().
+  unsigned char *aggregate_rows;  // Partial states of each worker.
+  std::mutex mutex;  // Guards the fields below and is_done of the morsels.
+  std::condition_variable changed;
+  int next_morsel;  // Morsel being returned by the operator.
+  bool is_stopping;
+} scan_pool;
+
+/* An operator of a SELECT pipeline. next() pulls the batches of the child
+and returns the next batch of the operator, or NULL after the last one. */
+typedef struct batch_operator_def {
+  int (*next)(struct batch_operator_def *p_operator, row_batch **pp_batch);
+  struct batch_operator_def *child;
+  select_plan *p_plan;
+  table_scan *p_scan;                  // Scan only.
+  row_batch *p_batch;                  // Batch of the scan or the sort.
+  column_vector vectors[MAX_NUM_COL];  // Projected columns of the project.
+  sort_buffer buffer;                  // Sort only.
+  scan_pool *p_pool;                   // Parallel scan only.
+  group_table *p_groups;               // Grouping only.
+  int position;  // First sorted row which has not been returned, the rows
+                 // read by the limit, or those of the morsel returned.
+  bool is_done;  // The grouping or the sort has read its whole input.
+} batch_operator;
+
+/* Operators of a SELECT, where each one is the child of the next one. */
+typedef struct select_pipeline_def {
+  int num_operators;
+  batch_operator operators[MAX_NUM_OPERATORS];
+} select_pipeline;
+
+/* A client connected to the server, with its pending input bytes. */
+typedef struct server_client_def {
+  int fd;
+  char *buffer;
+  int length;
+  int capacity;
+} server_client;
+
+/* A piece of a LOAD DATA input block, encoded into records by one worker. */
+typedef struct load_chunk_def {
+  char *start;  // First byte of the CSV lines.
+  char *end;    // One past the last byte.
+  cd_entry *cd_entries;
+  int num_columns;
+  int record_size;
+  char *record_bytes;  // Encoded records, allocated by the worker.
+  int num_records;
+  int num_lines;   // Lines read, including the failing one.
+  int rc;
+} load_chunk;
+
 /* Log entry. */
 typedef struct log_entry_def {
   char datetime[LOG_ENTRY_TIMESTAMP_LEN + 1];
-  char text[MAX_LOG_ENTRY_TEXT_LEN + 1];
-  char raw_text[MAX_LOG_ENTRY_TEXT_LEN + 1];
+  char *text;      // Statement or command, allocated.
+  char *raw_text;  // The whole log line, allocated.
   struct log_entry_def *next;
 } log_entry;
 
@@ -288,52 +865,273 @@ int sem_drop_table(token_list *t_list);
 int sem_list_tables();
 int sem_list_schema(token_list *t_list);
 int sem_insert(token_list *t_list);
+int parse_insert_tuple(token_list **p_cur, field_value field_values[],
+                       int *p_num_values);
 int sem_select(token_list *t_list);
 int sem_delete(token_list *t_list);
 int sem_update(token_list *t_list);
 int sem_backup(token_list *t_list);
+int backup_table_file(tpd_entry *tab_entry, FILE *f_backup);
 int sem_restore(token_list *t_list);
 int sem_rollforward(token_list *t_list);
+int sem_sync(token_list *t_list);
+int sem_load_data(token_list *t_list);
+int load_data_file(FILE *f_data, tpd_entry *tab_entry, int *p_line_number);
+void encode_load_chunk(load_chunk *chunk);
+int encode_csv_record(cd_entry cd_entries[], int num_columns, char *line,
+                      char *line_end, char record_bytes[], int record_size);
 int initialize_tpd_list(const char *db_filename, tpd_list **pp_tpd_list);
 int add_tpd_to_list(tpd_entry *tpd);
 int drop_tpd_from_list(char *tabname);
 tpd_entry *get_tpd_from_list(char *tabname);
-int create_tab_file(char *table_name, cd_entry cd_entries[], int num_columns);
+int create_tab_file(char *table_name, cd_entry cd_entries[], int num_columns,
+                    int tpd_flags);
 int check_insert_values(field_value field_values[], int num_values,
                         cd_entry cd_entries[], int num_columns);
 void free_token_list(token_list *const t_list);
-int load_table_records(tpd_entry *tpd, table_file_header **pp_table_header);
-int get_file_size(FILE *fhandle);
+int append_table_records(tpd_entry *tab_entry, char *record_bytes,
+                         int num_records);
+int upgrade_table_file(tpd_entry *tpd);
+int init_table_file_header(table_file_header *tab_header, int record_size);
+int init_column_file_header(table_file_header *tab_header,
+                            cd_entry cd_entries[], int num_columns);
+int init_column_segments(cd_entry cd_entries[], int num_columns,
+                         column_segment segments[]);
+int append_column_records(tpd_entry *tab_entry, table_file *file,
+                          char *record_bytes, int num_records);
+void fill_data_page(char *page, table_file_header *tab_header,
+                    int64_t page_number, char *record_bytes, int num_records);
+int commit_file(FILE *fhandle);
+int commit_table_header(FILE *fhandle, table_file_header *tab_header);
+int64_t get_file_size(FILE *fhandle);
+int copy_file_bytes(FILE *f_src, FILE *f_dst, int64_t num_bytes);
 int fill_raw_record_bytes(cd_entry cd_entries[], field_value *field_values[],
                           int num_cols, char record_bytes[],
                           int num_record_bytes);
-int fill_record_row(cd_entry cd_entries[], int num_cols, record_row *p_row,
-                    char record_bytes[]);
+void init_record_layout(cd_entry cd_entries[], int num_columns,
+                        record_layout *p_layout);
+void decode_view_column(row_view *p_row_view, int col_id,
+                        field_value *p_value);
+void store_view_column(row_view *p_row_view, int col_id,
+                       field_value *p_value);
+void materialize_row(row_view *p_row_view, int col_ids[], int num_col_ids,
+                     record_row *p_row, field_value values[]);
 void print_table_border(cd_entry *sorted_cd_entries[], int num_values);
 void print_table_column_names(cd_entry *sorted_cd_entries[],
                               field_name field_names[], int num_values);
-void print_record_row(cd_entry *sorted_cd_entries[], int num_cols,
-                      record_row *row);
-void print_aggregate_result(int aggregate_type, int num_fields,
-                            int records_count, int int_sum,
-                            cd_entry *sorted_cd_entries[]);
+void print_aggregate_result(select_plan *p_plan, grouped_columns *p_grouped,
+                            int num_values, row_batch *p_batch);
+void print_aggregate_border(int display_widths[], int num_values);
 int column_display_width(cd_entry *col_entry);
 int get_cd_entry_index(cd_entry cd_entries[], int num_cols, char *col_name);
 bool apply_row_predicate(cd_entry cd_entries[], int num_cols, record_row *p_row,
                          record_predicate *p_predicate);
+int eval_row_predicate_node(record_row *p_row, record_predicate *p_predicate,
+                            int node);
+int parse_where_clause(token_list **p_cur, cd_entry cd_entries[],
+                       int num_columns, record_predicate *p_predicate);
+int parse_boolean_expression(token_list **p_cur, cd_entry cd_entries[],
+                             int num_columns, record_predicate *p_predicate,
+                             int op_type, int depth, int *p_node);
+int parse_not_expression(token_list **p_cur, cd_entry cd_entries[],
+                         int num_columns, record_predicate *p_predicate,
+                         int depth, int *p_node);
+int parse_condition(token_list **p_cur, cd_entry cd_entries[], int num_columns,
+                    record_predicate *p_predicate, int *p_node);
+int parse_condition_operand(token_list *cur, record_condition *p_condition);
+int add_predicate_node(record_predicate *p_predicate, int type,
+                       int condition_index);
+void add_predicate_child(record_predicate *p_predicate, int parent, int child);
 bool eval_condition(record_condition *p_condition, field_value *p_field_value);
-void sort_records(record_row rows[], int num_records, cd_entry *p_sorting_col,
-                  bool is_desc);
+int compile_predicate(record_layout *p_layout, record_predicate *p_predicate,
+                      compiled_predicate *p_compiled);
+void free_compiled_predicate(compiled_predicate *p_compiled);
+int compile_predicate_node(record_layout *p_layout,
+                           record_predicate *p_predicate, int node,
+                           bool is_negated, compiled_predicate *p_compiled,
+                           double *p_cost, double *p_selectivity);
+void collect_predicate_operands(record_predicate *p_predicate, int node,
+                                bool is_negated, int type, int operands[],
+                                bool negations[], int *p_num_operands);
+void compile_condition(column_layout *p_column, record_condition *p_condition,
+                       bool is_negated, compiled_condition *p_target);
+int build_value_set(column_layout *p_column, record_condition *p_condition,
+                    value_set **pp_value_set);
+void free_value_set(value_set *p_value_set);
+int get_like_pattern(const char *pattern, int length, int *p_start,
+                     int *p_length);
+bool match_like_pattern(const char *string_value, int length,
+                        const char *pattern, int pattern_length);
+void estimate_condition(const compiled_condition *p_condition, double *p_cost,
+                        double *p_selectivity);
+bool eval_compiled_node(const compiled_predicate *p_compiled, int node,
+                        const char *record);
+void eval_compiled_node_batch(const compiled_predicate *p_compiled, int node,
+                              char *records[], int num_records,
+                              uint64_t selection[]);
+void eval_compiled_condition_batch(const compiled_condition *p_condition,
+                                   char *records[], int num_records,
+                                   uint64_t selection[]);
+void eval_compiled_predicate_batch(const compiled_predicate *p_compiled,
+                                   char *records[], int num_records,
+                                   uint64_t selection[]);
+filter_kernels *get_filter_kernels();
+int list_filter_kernels(filter_kernels *kernels[]);
+int run_select_plan(select_plan *p_plan, table_scan *p_scan);
+int output_grouped_rows(select_plan *p_plan, table_scan *p_scan,
+                        grouped_columns *p_grouped, int num_values);
+int open_select_pipeline(select_plan *p_plan, table_scan *p_scan,
+                         select_pipeline *p_pipeline);
+void close_select_pipeline(select_pipeline *p_pipeline);
+int next_scan_operator(batch_operator *p_operator, row_batch **pp_batch);
+int next_parallel_scan_operator(batch_operator *p_operator,
+                                row_batch **pp_batch);
+int get_num_morsels(table_scan *p_scan, int64_t *p_pages_per_morsel);
+int get_num_worker_threads();
+int get_num_scan_workers(int num_morsels);
+int start_scan_pool(select_plan *p_plan, table_scan *p_scan,
+                    scan_pool **pp_pool);
+void stop_scan_pool(scan_pool *p_pool);
+int take_morsel(scan_pool *p_pool, int worker);
+void run_scan_worker(scan_pool *p_pool, int worker);
+int scan_morsel(select_plan *p_plan, table_scan *p_scan, int64_t first_page,
+                int64_t end_page, row_batch *p_batch, column_vector vectors[],
+                unsigned char *aggregate_row, morsel_result *p_result);
+int next_filter_operator(batch_operator *p_operator, row_batch **pp_batch);
+int next_project_operator(batch_operator *p_operator, row_batch **pp_batch);
+int next_sort_operator(batch_operator *p_operator, row_batch **pp_batch);
+int next_merged_batch(batch_operator *p_operator, row_batch **pp_batch);
+int next_limit_operator(batch_operator *p_operator, row_batch **pp_batch);
+void filter_batch(select_plan *p_plan, row_batch *p_batch);
+void project_batch(select_plan *p_plan, row_batch *p_batch,
+                   column_vector vectors[]);
+void aggregate_batch(select_plan *p_plan, row_batch *p_batch,
+                     unsigned char *states);
+void aggregate_column_batch(const group_aggregate *p_aggregate,
+                            row_batch *p_batch, aggregate_state *p_state);
+void update_min_max_state(bool is_min, const column_vector *p_vector, int row,
+                          aggregate_state *p_state);
+int add_sort_batch(select_plan *p_plan, row_batch *p_batch,
+                   sort_buffer *p_buffer);
+void copy_batch_rows(select_plan *p_plan, row_batch *p_batch,
+                     column_vector columns[], int first_row);
+int sort_buffered_rows(select_plan *p_plan, sort_buffer *p_buffer);
+int spill_sort_buffer(select_plan *p_plan, sort_buffer *p_buffer);
+int run_sort_tasks(select_plan *p_plan, sort_buffer *p_buffer,
+                   bool is_spilled, sort_task tasks[], int *p_num_tasks);
+int get_num_sort_tasks(int num_rows);
+void run_sort_task(sort_task *p_task);
+int merge_sorted_ranges(sort_buffer *p_buffer, sort_task tasks[],
+                        int num_tasks);
+bool is_less_range(const void *p_sources, int range1, int range2);
+void init_loser_tree(loser_tree *p_tree, int num_sources,
+                     const void *p_sources,
+                     bool (*is_less)(const void *, int, int));
+void replay_loser_tree(loser_tree *p_tree, int source);
+int64_t get_max_sort_rows(select_plan *p_plan);
+int get_sort_row_size(select_plan *p_plan);
+void write_sort_row(select_plan *p_plan, sort_buffer *p_buffer,
+                    const sort_entry *p_entry, unsigned char *row);
+void read_sort_row(select_plan *p_plan, const unsigned char *row,
+                   sort_buffer *p_buffer, int dst_row);
+int write_sort_run(select_plan *p_plan, sort_buffer *p_buffer, int begin,
+                   int end, sort_run *p_run);
+int open_sort_run(sort_run *p_run, int row_size);
+int flush_sort_run(sort_run *p_run, int row_size);
+int read_sort_run(sort_run *p_run, int row_size);
+int start_run_merge(select_plan *p_plan, sort_buffer *p_buffer);
+int init_run_merge(run_merge *p_merge);
+int next_run_row(run_merge *p_merge, int run);
+int merge_run_pass(run_merge *p_merge);
+bool is_less_run(const void *p_sources, int run1, int run2);
+void free_run_merge(run_merge *p_merge);
+int init_top_k_buffer(select_plan *p_plan, sort_buffer *p_buffer,
+                      int num_top_rows);
+void add_top_k_batch(select_plan *p_plan, row_batch *p_batch,
+                     sort_buffer *p_buffer);
+int get_sort_key_size(select_plan *p_plan);
+void encode_sort_key(select_plan *p_plan, column_vector *columns[], int row,
+                     unsigned char *key);
+int compare_sort_entries(const sort_buffer *p_buffer,
+                         const sort_entry *p_entry1,
+                         const sort_entry *p_entry2);
+int radix_sort_entries(const sort_buffer *p_buffer, sort_entry entries[],
+                       int begin, int end);
+void pdqsort_entries(const sort_buffer *p_buffer, sort_entry entries[],
+                     int begin, int end, int bad_allowed);
+void insertion_sort_entries(const sort_buffer *p_buffer, sort_entry entries[],
+                            int begin, int end);
+bool partial_insertion_sort_entries(const sort_buffer *p_buffer,
+                                    sort_entry entries[], int begin,
+                                    int end);
+int partition_sort_entries(const sort_buffer *p_buffer, sort_entry entries[],
+                           int begin, int end, bool *p_already_partitioned);
+void heap_sort_entries(const sort_buffer *p_buffer, sort_entry entries[],
+                       int begin, int end);
+void sift_down_sort_entries(const sort_buffer *p_buffer, sort_entry heap[],
+                            int node, int size);
+void sift_up_sort_entries(const sort_buffer *p_buffer, sort_entry heap[],
+                          int node);
+void sort3_entries(const sort_buffer *p_buffer, sort_entry entries[], int a,
+                   int b, int c);
+void output_batch(cd_entry *output_cd_entries[], int num_output_cols,
+                  row_batch *p_batch);
+const char *get_display_value(column_vector *p_vector, int row,
+                              char int_display[]);
+int append_display_cell(char *text, const char *display_value,
+                        int display_width, bool left_align);
+int get_key_size(record_layout *p_layout, int num_cols, const int col_ids[]);
+void encode_key(record_layout *p_layout, int num_cols, const int col_ids[],
+                const bool is_desc[], column_vector *columns[], int row,
+                unsigned char *key);
+int sem_select_groups(token_list *t_list);
+int parse_limit_clause(token_list **p_cur, bool *p_has_limit, int *p_limit,
+                       int *p_offset);
+int add_grouped_column(select_plan *p_plan, cd_entry cd_entries[],
+                       int num_columns, grouped_columns *p_grouped,
+                       token_list **p_cur, bool is_new, int *p_col);
+bool get_aggregate_name(int function, const char *col_name, char *name,
+                        int size);
+void init_group_plan(select_plan *p_plan, select_plan *p_group_plan);
+void print_grouped_column_names(grouped_columns *p_grouped,
+                                int display_widths[], int num_values);
+int next_group_operator(batch_operator *p_operator, row_batch **pp_batch);
+int init_group_table(select_plan *p_plan, group_table **pp_groups);
+int init_aggregate_states(select_plan *p_plan);
+void free_group_table(group_table *p_groups);
+void clear_group_table(group_table *p_groups);
+int add_group_batch(group_table *p_groups, row_batch *p_batch);
+int find_single_group(group_table *p_groups, unsigned char **p_group_row);
+int find_group(group_table *p_groups, const unsigned char *key, uint32_t hash,
+               int *p_group, bool *p_is_new);
+int grow_group_table(group_table *p_groups);
+void update_group_states(group_table *p_groups, unsigned char *group_row,
+                         row_batch *p_batch, int row);
+void merge_group_states(group_table *p_groups, unsigned char *group_row,
+                        const unsigned char *other_row);
+int spill_group_table(group_table *p_groups);
+int finish_group_pass(group_table *p_groups);
+int load_group_partition(group_table *p_groups);
+void output_group_row(group_table *p_groups, const unsigned char *group_row,
+                      column_vector vectors[], int row);
+int eval_group_predicate_node(record_predicate *p_predicate, int node,
+                              column_vector vectors[], int row);
+bool eval_group_condition(record_condition *p_condition,
+                          column_vector *p_vector, int row);
+void init_column_vector(column_vector *p_vector, column_layout *p_column);
+int reserve_column_vector(column_vector *p_vector, int capacity);
+void free_column_vector(column_vector *p_vector);
 int execute_statement(char *statement, int verbose);
-int records_comparator(const void *arg1, const void *arg2);
+int compare_int_values(const void *p_value1, const void *p_value2);
 void free_record_row(record_row *row, bool to_last);
-int save_records_to_file(table_file_header *const tab_header,
-                         record_row *const rows_head);
 int reload_global_tpd_list();
 int append_log_with_timestamp(const char *msg, time_t timestamp);
 int write_log(const char *msg, bool is_append);
+int write_pending_log();
+void discard_pending_log();
 int scan_log(log_entry **pp_first_log_entry);
 void free_log_entries(log_entry *p_first_log_entry);
+bool read_text_line(FILE *fhandle, char **pp_line);
 int restore_from_backup_file(char *backup_filename, int db_flags);
 int list_tables(tpd_list *table_entries,
                 void (*callback)(tpd_entry *table_entry));
@@ -344,20 +1142,256 @@ int update_db_flags(int db_flags);
 int backup_log_file(log_entry *log_entry_head);
 bool is_timestamp_valid(char *text);
 int max_days_of_month(int year, int month);
+int get_file_signature(const char *filename, file_signature *p_signature);
+int refresh_resident_tpd_list();
+void invalidate_resident_tpd_list();
+int init_buffer_pool();
+void free_buffer_pool();
+int pin_page(table_file *file, int64_t page_number, bool is_new_page,
+             buffer_frame **pp_frame);
+void unpin_page(buffer_frame *frame, bool is_dirty);
+int get_page_bucket(const char *table_name, int64_t page_number);
+void remove_page_from_hash(int frame_index);
+int write_page(table_file *file, buffer_frame *frame);
+FILE *get_table_fhandle(table_file *file);
+int journal_page(table_file *file, buffer_frame *frame, int length);
+int sync_table_journal(table_file *file);
+int clear_table_journal(table_file *file);
+int read_journal_offsets(FILE *journal, int64_t offset,
+                         int64_t **pp_offsets, int *p_num_entries);
+int recover_table_file(const char *table_name);
+int rollback_table_file(table_file *file);
+int rollback_table_files();
+void remove_table_journal(const char *table_name);
+bool get_journal_filename(const char *table_name, char *filename, int size);
+int open_table_file(tpd_entry *tpd, table_file **pp_file);
+table_file *find_table_file(const char *table_name);
+int flush_table_file(table_file *file);
+int flush_buffer_pool();
+void close_table_files();
+void discard_table_pages(const char *table_name);
+int finish_table_io();
+int check_data_page(table_file_header *tab_header, char *page,
+                    int64_t page_number);
+int open_table_scan(tpd_entry *tpd, table_scan *p_scan, bool is_read_only);
+void release_scan_page(table_scan *p_scan);
+int next_scan_record(table_scan *p_scan, char **pp_record);
+void use_scan_columns(table_scan *p_scan, const bool is_used_col[]);
+int next_scan_batch(table_scan *p_scan, char *records[], int max_records,
+                    int *p_num_records);
+int next_column_batch(table_scan *p_scan, char *records[], int max_records,
+                      int *p_num_records);
+int read_column_batch(table_scan *p_scan, int col_id, int num_records);
+int get_scan_page(table_scan *p_scan, int64_t page_number,
+                  buffer_frame **pp_frame, char **pp_page);
+int update_scan_column(table_scan *p_scan, int batch_index, int col_id);
+int journal_scan_page(table_scan *p_scan);
+int delete_scan_batch(table_scan *p_scan, const uint64_t selection[],
+                      int num_records);
+void close_table_scan(table_scan *p_scan);
+int run_script(FILE *fhandle);
+int run_server(const char *socket_path);
+int read_client_statements(server_client *client);
+int execute_client_statement(server_client *client, char *statement);
 
 /* inline functions */
 
+/* Add a partial aggregate state to another one. */
+inline void merge_aggregate_state(aggregate_state *p_state,
+                                  const aggregate_state *p_partial) {
+  p_state->records_count += p_partial->records_count;
+  p_state->int_sum += p_partial->int_sum;
+}
+
 /* Get column descriptor entries from the table descriptor entry. */
 inline void get_cd_entries(tpd_entry *tab_entry, cd_entry **pp_cd_entry) {
   *pp_cd_entry = (cd_entry *)(((char *)tab_entry) + tab_entry->cd_offset);
 }
 
-/* Get pointer to the first record in a table. */
-inline void get_table_records(table_file_header *tab_header, char **pp_record) {
-  *pp_record = NULL;
-  if (tab_header->file_size > tab_header->record_offset) {
-    *pp_record = ((char *)tab_header) + tab_header->record_offset;
+/* Get the header and the slot array of a data page. */
+inline page_header *get_page_header(char *page) { return (page_header *)page; }
+
+inline uint16_t *get_page_slots(char *page) {
+  return (uint16_t *)(page + sizeof(page_header));
+}
+
+/* Number of pages in use in a table file, including the header page. */
+inline int64_t get_num_pages(table_file_header *tab_header) {
+  return tab_header->file_size / tab_header->page_size;
+}
+
+/* Bitmaps of a row group of a columnar table. */
+inline unsigned char *get_group_live_bitmap(char *group_page) {
+  return (unsigned char *)(group_page + sizeof(page_header));
+}
+
+inline unsigned char *get_group_null_bitmap(char *group_page, int col_id) {
+  return get_group_live_bitmap(group_page) +
+         (1 + col_id) * (COLUMN_GROUP_ROWS / 8);
+}
+
+inline bool is_bit_set(const unsigned char *bitmap, int index) {
+  return ((bitmap[index / 8] >> (index % 8)) & 1) != 0;
+}
+
+inline void set_bit(unsigned char *bitmap, int index, bool value) {
+  if (value) {
+    bitmap[index / 8] |= (unsigned char)(1 << (index % 8));
+  } else {
+    bitmap[index / 8] &= (unsigned char)~(1 << (index % 8));
+  }
+}
+
+/* Mark the current record as changed so its page is written back. */
+inline void mark_scan_record_dirty(table_scan *p_scan) {
+  p_scan->is_page_dirty = true;
+  p_scan->file->is_dirty = true;
+}
+
+/* Column accessors of a row view. */
+inline bool is_view_column_null(row_view *p_row_view, int col_id) {
+  return p_row_view->record[p_row_view->layout->columns[col_id].offset] == 0;
+}
+
+inline int get_view_column_int(row_view *p_row_view, int col_id) {
+  int int_value = 0;
+  memcpy(&int_value,
+         p_row_view->record + p_row_view->layout->columns[col_id].offset + 1,
+         sizeof(int));
+  return int_value;
+}
+
+inline char *get_view_column_string(row_view *p_row_view, int col_id,
+                                    int *p_length) {
+  char *field = p_row_view->record + p_row_view->layout->columns[col_id].offset;
+  *p_length = (unsigned char)field[0];
+  return field + 1;
+}
+
+inline bool is_record_selected(const uint64_t selection[], int index) {
+  return ((selection[index / 64] >> (index % 64)) & 1) != 0;
+}
+
+inline int count_selected(uint64_t selection_word) {
+  int count = 0;
+  for (; selection_word; selection_word &= selection_word - 1) {
+    count++;
   }
+  return count;
+}
+
+/* Check if a vector holds the 64-bit integers of grouped rows. */
+inline bool is_long_vector(const column_vector *p_vector) {
+  return (p_vector->col_type == T_INT) &&
+         (p_vector->value_size == sizeof(int64_t) + 1);
+}
+
+/* Copy a value between two vectors of the same column. */
+inline void copy_vector_value(const column_vector *p_src, int src_row,
+                              column_vector *p_dst, int dst_row) {
+  p_dst->is_null[dst_row] = p_src->is_null[src_row];
+  if (is_long_vector(p_src)) {
+    p_dst->long_values[dst_row] = p_src->long_values[src_row];
+  } else if (p_src->col_type == T_INT) {
+    p_dst->int_values[dst_row] = p_src->int_values[src_row];
+  } else {
+    strcpy(p_dst->string_values + dst_row * p_dst->value_size,
+           p_src->string_values + src_row * p_src->value_size);
+  }
+}
+
+/* Byte b of the sort key of an entry. */
+inline int get_sort_key_byte(const sort_buffer *p_buffer,
+                             const sort_entry *p_entry, int b) {
+  if (b < 8) {
+    return (int)((p_entry->prefix >> (56 - 8 * b)) & 0xff);
+  }
+  return p_buffer->keys[(size_t)p_entry->row * p_buffer->key_size + b];
+}
+
+/* Rows of a run which are read or written at once. */
+inline int get_run_block_rows(int row_size) {
+  return (row_size < SORT_RUN_BLOCK_SIZE) ? SORT_RUN_BLOCK_SIZE / row_size : 1;
+}
+
+/* The first 8 bytes of a sort key as a big-endian number. */
+inline uint64_t get_sort_key_prefix(const unsigned char *key, int key_size) {
+  uint64_t prefix = 0;
+  for (int i = 0; i < 8; i++) {
+    prefix = (prefix << 8) | ((i < key_size) ? key[i] : 0);
+  }
+  return prefix;
+}
+
+inline void swap_sort_entries(sort_entry *p_entry1, sort_entry *p_entry2) {
+  sort_entry temp_entry = *p_entry1;
+  *p_entry1 = *p_entry2;
+  *p_entry2 = temp_entry;
+}
+
+inline bool eval_compiled_predicate(const compiled_predicate *p_compiled,
+                                    const char *record) {
+  return p_compiled->eval(p_compiled, record);
+}
+
+/* Lookups in the value set of an IN list. The integer search halves the
+range with a conditional move, so it does not branch on the data. */
+inline bool contains_int_value(const value_set *p_value_set, int value) {
+  const int *base = p_value_set->int_values;
+  int n = p_value_set->num_values;
+  if (n == 0) {
+    return false;
+  }
+  while (n > 1) {
+    int half = n / 2;
+    base = (base[half] <= value) ? base + half : base;
+    n -= half;
+  }
+  return *base == value;
+}
+
+/* FNV-1a hash of a string field, its length byte and its bytes. */
+inline uint32_t hash_string_field(const char *field) {
+  int length = (unsigned char)field[0];
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i <= length; i++) {
+    hash = (hash ^ (unsigned char)field[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/* FNV-1a hash of the key of a group. Its low bits pick the bucket and its
+high bits the partition. */
+inline uint32_t hash_group_key(const unsigned char *key, int key_size) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < key_size; i++) {
+    hash = (hash ^ key[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/* Partition of a group spilled at a depth, by the next 4 bits of its hash. */
+inline int get_group_partition(uint32_t hash, int depth) {
+  return (int)(hash >> (28 - 4 * depth)) & (NUM_GROUP_PARTITIONS - 1);
+}
+
+inline bool has_ungrouped_aggregates(const select_plan *p_plan) {
+  return (p_plan->num_group_aggregates > 0) && (p_plan->num_group_by_cols == 0);
+}
+
+inline bool contains_string_value(const value_set *p_value_set,
+                                  const char *field) {
+  int length = (unsigned char)field[0];
+  int mask = p_value_set->num_buckets - 1;
+  for (int bucket = hash_string_field(field) & mask;
+       p_value_set->buckets[bucket] > -1; bucket = (bucket + 1) & mask) {
+    const char *value = p_value_set->string_values +
+                        p_value_set->buckets[bucket] * p_value_set->value_size;
+    if (memcmp(value, field, 1 + length) == 0) {
+      return true;
+    }
+  }
+  return false;
 }
 
 /* Check if a token can be an identifier. */
@@ -372,11 +1406,30 @@ inline bool can_be_identifier(token_list *token) {
 }
 
 /* Integer round */
+/* Check if the tokens are an aggregate of a column, or COUNT(*). */
+inline bool is_aggregate_call(token_list *token) {
+  return (token->tok_class == TOKEN_CLASS_FUNCTION_NAME) &&
+         (token->next->tok_value == S_LEFT_PAREN) &&
+         (can_be_identifier(token->next->next) ||
+          (token->next->next->tok_value == S_STAR)) &&
+         (token->next->next->next->tok_value == S_RIGHT_PAREN);
+}
+
 inline int round_integer(int value, int round) {
   int m = value % round;
   return m ? (value + round - m) : value;
 }
 
+/* Size of one record: a length byte plus the data of each column, rounded to
+a 4-byte boundary. */
+inline int get_record_size(cd_entry cd_entries[], int num_columns) {
+  int record_size = 0;
+  for (int i = 0; i < num_columns; i++) {
+    record_size += (1 + cd_entries[i].col_len);
+  }
+  return round_integer(record_size, 4);
+}
+
 inline void repeat_print_char(char c, int times) {
   for (int i = 0; i < times; i++) {
     printf("%c", c);
@@ -403,7 +1456,45 @@ inline bool is_a_sql_statement_log_entry(char *raw_text) {
   return isdigit(raw_text[0]) != 0;
 }
 
+inline bool is_same_file_signature(file_signature *p_first,
+                                   file_signature *p_second) {
+  return (p_first->file_size == p_second->file_size) &&
+         (p_first->modified_time == p_second->modified_time) &&
+         (p_first->modified_nsec == p_second->modified_nsec) &&
+         (p_first->inode == p_second->inode);
+}
+
 /* Keep a global list of tpd which will be initialized in db.cpp */
 extern tpd_list *g_tpd_list;
 
+/* When set, the tpd list and table pages stay in memory between statements
+and are only re-read after they change (server and script modes). */
+extern bool g_resident_mode;
+
+/* When set, dirty pages stay in the buffer pool after each statement and
+are only written to the .tab files by flush_buffer_pool() (script mode). */
+extern bool g_deferred_writes;
+
+/* Log records of the deferred changes, in order. flush_buffer_pool() writes
+them after the pages of the changes. */
+extern log_entry *g_pending_log;
+extern log_entry **g_pending_log_tail;
+
+/* Number of the statement being executed, which the journal entries of the
+tables are tagged with. */
+extern int g_statement_number;
+
+/* Memory budget of the buffer pool, in bytes. */
+extern int64_t g_buffer_pool_size;
+
+/* Memory budget of the rows buffered by a sort, in bytes. */
+extern int64_t g_sort_memory_size;
+
+/* Memory budget of the groups of a grouped SELECT, in bytes. */
+extern int64_t g_group_memory_size;
+
+/* Number of worker threads of LOAD DATA, parallel scans and sorts, 0 for
+one per core. */
+extern int g_num_worker_threads;
+
 #endif /* DB_HEADER_FILE */
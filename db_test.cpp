@@ -1,8 +1,15 @@
 #include "CppUnitTest.h"
 #include "../sjsu_cs257/db.h"
+#include <algorithm>
+#include <climits>
 #include <string>
 #include <fstream>
+#include <iterator>
 #include <vector>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
@@ -49,6 +56,29 @@ TEST_METHOD(CreateSuccessfully) {
   Assert::AreEqual(3, tab_entry->num_columns, L"Number of columns.");
 }
 
+TEST_METHOD(EmptyTableIsHeaderPage) {
+  Assert::AreEqual(0, execute_statement(
+                          "CREATE TABLE BOOK(title char(50) NOT NULL, author "
+                          "char(30), copies int)",
+                          1),
+                   L"Return code.");
+  reload_global_tpd_list();
+  // The first data page is only added by the first INSERT.
+  FILE *f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  Assert::AreEqual(static_cast<int64_t>(TABLE_PAGE_SIZE),
+                   get_file_size(f_table), L"Empty table file size.");
+  fclose(f_table);
+  Assert::AreEqual(
+      0, execute_statement("INSERT INTO BOOK VALUES('A', 'B', 1)", 1),
+      L"Return code.");
+  f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  Assert::AreEqual(static_cast<int64_t>(2 * TABLE_PAGE_SIZE),
+                   get_file_size(f_table), L"Table file size.");
+  fclose(f_table);
+}
+
 TEST_METHOD(ExsitingTable) {
   Assert::AreEqual(0, execute_statement(
                           "CREATE TABLE BOOK(title char(50) NOT NULL, author "
@@ -134,9 +164,12 @@ TEST_METHOD(Insert_ZeroedBytesBetweenStoredData) {
   Assert::AreEqual(
       0, execute_statement("INSERT INTO BOOK VALUES('A', 'B', NULL)", 1),
       L"Return code");
+  table_file_header tab_header;
   FILE *f_table = fopen("BOOK.tab", "rb");
   Assert::IsNotNull(f_table);
-  fseek(f_table, sizeof(table_file_header), SEEK_SET);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  // The first record is at the start of the records in the first data page.
+  fseek(f_table, TABLE_PAGE_SIZE + tab_header.record_offset, SEEK_SET);
   char byte;
   // "title" field
   fread(&byte, sizeof(char), 1, f_table);  // skip 8-bit length
@@ -167,6 +200,472 @@ TEST_METHOD(Insert_ZeroedBytesBetweenStoredData) {
   fclose(f_table);
 }
 
+TEST_METHOD(Insert_IgnoresIncompleteAppend) {
+  Assert::AreEqual(
+      0, execute_statement("INSERT INTO BOOK VALUES('A', 'B', 1)", 1),
+      L"Return code");
+  // Simulate a crash after the record bytes were written but before the
+  // table header was patched.
+  FILE *f_table = fopen("BOOK.tab", "ab");
+  Assert::IsNotNull(f_table);
+  fwrite("torn", 4, 1, f_table);
+  fclose(f_table);
+
+  Assert::AreEqual(0, execute_statement("SELECT * FROM BOOK", 1),
+                   L"Return code");
+  Assert::AreEqual(
+      0, execute_statement("INSERT INTO BOOK VALUES('C', 'D', 2)", 1),
+      L"Return code");
+
+  table_file_header tab_header;
+  f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  int64_t file_size = get_file_size(f_table);
+  fclose(f_table);
+  Assert::AreEqual(2, static_cast<int>(tab_header.num_records),
+                   L"Number of records");
+  // Both records are in the first data page.
+  Assert::AreEqual(static_cast<int64_t>(2 * TABLE_PAGE_SIZE),
+                   tab_header.file_size, L"Table file size in header");
+  Assert::IsTrue(tab_header.file_size <= file_size, L"Table file size");
+}
+
+TEST_METHOD(Insert_RestoresPagesFromJournal) {
+  Assert::AreEqual(
+      0, execute_statement("INSERT INTO BOOK VALUES('A', 'B', 1)", 1),
+      L"Return code");
+  table_file_header tab_header;
+  char page[TABLE_PAGE_SIZE];
+  FILE *f_table = fopen("BOOK.tab", "r+b");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  fseek(f_table, TABLE_PAGE_SIZE, SEEK_SET);
+  fread(page, TABLE_PAGE_SIZE, 1, f_table);
+
+  // Simulate a crash after the journal was synced and the first data page
+  // and the header were overwritten.
+  FILE *f_journal = fopen("BOOK.tab.journal", "wb");
+  Assert::IsNotNull(f_journal);
+  journal_entry entry;
+  memset(&entry, '\0', sizeof(journal_entry));
+  entry.page_number = 1;
+  entry.length = TABLE_PAGE_SIZE;
+  fwrite(&tab_header, sizeof(table_file_header), 1, f_journal);
+  fwrite(&entry, sizeof(journal_entry), 1, f_journal);
+  fwrite(page, TABLE_PAGE_SIZE, 1, f_journal);
+  fclose(f_journal);
+  table_file_header torn_header = tab_header;
+  torn_header.num_records = 2;
+  char torn_page[TABLE_PAGE_SIZE];
+  memcpy(torn_page, page, TABLE_PAGE_SIZE);
+  torn_page[tab_header.record_offset + 1] = 'Z';
+  fseek(f_table, 0, SEEK_SET);
+  fwrite(&torn_header, sizeof(table_file_header), 1, f_table);
+  fseek(f_table, TABLE_PAGE_SIZE, SEEK_SET);
+  fwrite(torn_page, TABLE_PAGE_SIZE, 1, f_table);
+  fclose(f_table);
+
+  Assert::AreEqual(0, execute_statement("SELECT * FROM BOOK", 1),
+                   L"Return code");
+  Assert::IsNull(fopen("BOOK.tab.journal", "rb"), L"Journal removed");
+  f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  fseek(f_table, TABLE_PAGE_SIZE, SEEK_SET);
+  fread(torn_page, TABLE_PAGE_SIZE, 1, f_table);
+  fclose(f_table);
+  Assert::AreEqual(1, static_cast<int>(tab_header.num_records),
+                   L"Number of records");
+  Assert::AreEqual(0, memcmp(page, torn_page, TABLE_PAGE_SIZE),
+                   L"First data page");
+}
+
+TEST_METHOD(Insert_RollsBackFailedStatement) {
+  // Two statements append a record each without a flush between them, and
+  // the second one fails.
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  table_file *file = NULL;
+  char *record_bytes = NULL;
+  for (int i = 0; i < 2; i++) {
+    g_statement_number++;
+    Assert::AreEqual(0, open_table_file(tab_entry, &file), L"Return code");
+    record_bytes = (char *)calloc(1, file->header.record_size);
+    Assert::AreEqual(0, append_table_records(tab_entry, record_bytes, 1),
+                     L"Return code");
+    free(record_bytes);
+  }
+  Assert::AreEqual(0, rollback_table_files(), L"Return code");
+  Assert::AreEqual(0, finish_table_io(), L"Return code");
+
+  table_file_header tab_header;
+  page_header data_page_header;
+  FILE *f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  fseek(f_table, TABLE_PAGE_SIZE, SEEK_SET);
+  fread(&data_page_header, sizeof(page_header), 1, f_table);
+  fclose(f_table);
+  Assert::AreEqual(1, static_cast<int>(tab_header.num_records),
+                   L"Number of records");
+  Assert::AreEqual(1, data_page_header.num_slots, L"Records in the page");
+}
+
+TEST_METHOD(Insert_UpgradesVersion1TableFile) {
+  // A version 1 file: 5 int fields and the tpd pointer, then the records.
+  char record[88];
+  memset(record, '\0', sizeof(record));
+  record[0] = 1;
+  record[1] = 'A';
+  table_file_header_v1 old_header;
+  old_header.record_size = sizeof(record);
+  old_header.num_records = 1;
+  old_header.record_offset = sizeof(old_header) + sizeof(void *);
+  old_header.file_size = old_header.record_offset + sizeof(record);
+  old_header.file_header_flag = 0;
+  void *tpd_ptr = NULL;
+  FILE *f_table = fopen("BOOK.tab", "wb");
+  Assert::IsNotNull(f_table);
+  fwrite(&old_header, sizeof(old_header), 1, f_table);
+  fwrite(&tpd_ptr, sizeof(tpd_ptr), 1, f_table);
+  fwrite(record, sizeof(record), 1, f_table);
+  fclose(f_table);
+
+  Assert::AreEqual(
+      0, execute_statement("INSERT INTO BOOK VALUES('C', 'D', 2)", 1),
+      L"Return code");
+
+  table_file_header tab_header;
+  f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  fseek(f_table, TABLE_PAGE_SIZE + tab_header.record_offset, SEEK_SET);
+  fread(record, sizeof(record), 1, f_table);
+  fclose(f_table);
+  Assert::AreEqual(TABLE_FILE_MAGIC, tab_header.magic, L"Magic");
+  Assert::AreEqual(2, static_cast<int>(tab_header.num_records),
+                   L"Number of records");
+  Assert::AreEqual('A', record[1], L"First record");
+}
+
+TEST_METHOD(InsertMultipleRows) {
+  Assert::AreEqual(0, execute_statement("INSERT INTO BOOK VALUES('A', 'B', 1), "
+                                        "('C', NULL, 2), ('E', 'F', 3)",
+                                        1),
+                   L"Return code");
+  // A bad tuple rejects the whole statement.
+  Assert::AreEqual(static_cast<int>(DATA_TYPE_MISMATCH),
+                   execute_statement(
+                       "INSERT INTO BOOK VALUES('G', 'H', 4), (5, 'I', 6)", 1),
+                   L"Return code");
+  Assert::AreEqual(static_cast<int>(INVALID_STATEMENT),
+                   execute_statement(
+                       "INSERT INTO BOOK VALUES('G', 'H', 4) ('J', 'K', 7)", 1),
+                   L"Return code");
+
+  table_file_header tab_header;
+  FILE *f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  fclose(f_table);
+  Assert::AreEqual(3, static_cast<int>(tab_header.num_records),
+                   L"Number of records");
+}
+
+TEST_METHOD(LoadDataFromCsvFile) {
+  FILE *f_data = fopen("BOOK.csv", "w");
+  Assert::IsNotNull(f_data);
+  fprintf(f_data, "\"Dune, Part 1\",Frank Herbert,3\n");
+  fprintf(f_data, "\"The \"\"Hobbit\"\"\",,NULL\n");
+  fclose(f_data);
+  Assert::AreEqual(0, execute_statement("LOAD DATA 'BOOK.csv' INTO BOOK", 1),
+                   L"Return code");
+
+  // A bad line rejects the whole file.
+  f_data = fopen("BOOK.csv", "w");
+  Assert::IsNotNull(f_data);
+  fprintf(f_data, "Emma,Jane Austen,1\n");
+  fprintf(f_data, "Ulysses,James Joyce,many\n");
+  fclose(f_data);
+  Assert::AreEqual(static_cast<int>(DATA_TYPE_MISMATCH),
+                   execute_statement("LOAD DATA 'BOOK.csv' INTO BOOK", 1),
+                   L"Return code");
+
+  // A quoted empty string is stored as the null value.
+  f_data = fopen("BOOK.csv", "w");
+  Assert::IsNotNull(f_data);
+  fprintf(f_data, "\"\",Jane Austen,1\n");
+  fclose(f_data);
+  Assert::AreEqual(static_cast<int>(UNEXPECTED_NULL_VALUE),
+                   execute_statement("LOAD DATA 'BOOK.csv' INTO BOOK", 1),
+                   L"Return code");
+
+  // An int must fit in an int and be digits after an optional sign.
+  const char *bad_ints[] = {"99999999999", "2147483648", "-2147483649",
+                            " 5", "-", "5 "};
+  for (const char *bad_int : bad_ints) {
+    f_data = fopen("BOOK.csv", "w");
+    Assert::IsNotNull(f_data);
+    fprintf(f_data, "Emma,Jane Austen,%s\n", bad_int);
+    fclose(f_data);
+    Assert::AreEqual(static_cast<int>(DATA_TYPE_MISMATCH),
+                     execute_statement("LOAD DATA 'BOOK.csv' INTO BOOK", 1),
+                     L"Return code");
+  }
+  f_data = fopen("BOOK.csv", "w");
+  Assert::IsNotNull(f_data);
+  fprintf(f_data, "Emma,Jane Austen,-2147483648\n");
+  fprintf(f_data, "Persuasion,Jane Austen,+2147483647\n");
+  fclose(f_data);
+  Assert::AreEqual(0, execute_statement("LOAD DATA 'BOOK.csv' INTO BOOK", 1),
+                   L"Return code");
+  remove("BOOK.csv");
+
+  table_file_header tab_header;
+  FILE *f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  fclose(f_table);
+  Assert::AreEqual(4, static_cast<int>(tab_header.num_records),
+                   L"Number of records");
+}
+
+TEST_METHOD(DeleteAcrossPages) {
+  FILE *f_data = fopen("BOOK.csv", "w");
+  Assert::IsNotNull(f_data);
+  for (int i = 0; i < 200; i++) {
+    fprintf(f_data, "Title %d,Author %d,%d\n", i, i, i);
+  }
+  fclose(f_data);
+  Assert::AreEqual(0, execute_statement("LOAD DATA 'BOOK.csv' INTO BOOK", 1),
+                   L"Return code");
+  remove("BOOK.csv");
+  Assert::AreEqual(0,
+                   execute_statement("DELETE FROM BOOK WHERE copies < 100", 1),
+                   L"Return code");
+
+  table_file_header tab_header;
+  FILE *f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  fclose(f_table);
+  Assert::AreEqual(100, static_cast<int>(tab_header.num_records),
+                   L"Number of records");
+  Assert::IsTrue(tab_header.file_size > 2 * TABLE_PAGE_SIZE,
+                 L"More than one data page");
+
+  // The new record takes the free room in the last page.
+  int64_t file_size = tab_header.file_size;
+  Assert::AreEqual(
+      0, execute_statement("INSERT INTO BOOK VALUES('A', 'B', 1)", 1),
+      L"Return code");
+  f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  fclose(f_table);
+  Assert::AreEqual(101, static_cast<int>(tab_header.num_records),
+                   L"Number of records");
+  Assert::AreEqual(file_size, tab_header.file_size, L"Table file size");
+}
+
+TEST_METHOD(ScanMappedMatchesBuffered) {
+  // Each scan returns the page number and the bytes of every record.
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  auto scan_table = [tab_entry](bool is_read_only, bool *p_is_mapped) {
+    std::vector<std::pair<int64_t, std::string>> records;
+    table_scan scan;
+    Assert::AreEqual(0, open_table_scan(tab_entry, &scan, is_read_only));
+    *p_is_mapped = (scan.mapped_file != NULL);
+    int record_size = scan.file->header.record_size;
+    char *record = NULL;
+    while ((next_scan_record(&scan, &record) == 0) && record) {
+      records.push_back(std::make_pair(scan.page_number,
+                                       std::string(record, record_size)));
+    }
+    close_table_scan(&scan);
+    finish_table_io();
+    return records;
+  };
+
+  // A new table has no data page, so it is not mapped.
+  bool is_mapped = true;
+  Assert::AreEqual(0, static_cast<int>(scan_table(true, &is_mapped).size()),
+                   L"Records of an empty table");
+  Assert::IsFalse(is_mapped, L"Empty table is not mapped");
+
+  FILE *f_data = fopen("BOOK.csv", "w");
+  Assert::IsNotNull(f_data);
+  for (int i = 0; i < 250; i++) {
+    fprintf(f_data, "Title %d,Author %d,%d\n", i, i, i - 100);
+  }
+  fclose(f_data);
+  Assert::AreEqual(0, execute_statement("LOAD DATA 'BOOK.csv' INTO BOOK", 1),
+                   L"Return code");
+  remove("BOOK.csv");
+
+  std::vector<std::pair<int64_t, std::string>> mapped_records =
+      scan_table(true, &is_mapped);
+  Assert::IsTrue(is_mapped, L"Read-only scan is mapped");
+  std::vector<std::pair<int64_t, std::string>> buffered_records =
+      scan_table(false, &is_mapped);
+  Assert::IsFalse(is_mapped, L"Writable scan is buffered");
+  Assert::AreEqual(250, static_cast<int>(mapped_records.size()),
+                   L"Records of the mapped scan");
+  Assert::IsTrue(mapped_records == buffered_records, L"Same records");
+
+  // The last page is partly filled.
+  int64_t last_page = mapped_records.back().first;
+  int first_page_records = 0;
+  int last_page_records = 0;
+  for (size_t i = 0; i < mapped_records.size(); i++) {
+    first_page_records += (mapped_records[i].first == 1);
+    last_page_records += (mapped_records[i].first == last_page);
+  }
+  Assert::IsTrue(last_page > 2, L"More than two data pages");
+  Assert::IsTrue(last_page_records < first_page_records,
+                 L"Last page partly filled");
+
+  // The pages stay mapped once all their records are deleted.
+  Assert::AreEqual(0, execute_statement("DELETE FROM BOOK", 1),
+                   L"Return code");
+  Assert::AreEqual(0, static_cast<int>(scan_table(true, &is_mapped).size()),
+                   L"Records after DELETE");
+  Assert::IsTrue(is_mapped, L"Emptied table is mapped");
+  Assert::AreEqual(0, static_cast<int>(scan_table(false, &is_mapped).size()),
+                   L"Records after DELETE");
+}
+
+TEST_METHOD(ViewColumnsRoundTrip) {
+  // A string column of the maximum length between an int and a short one.
+  cd_entry cd_entries[3];
+  memset(cd_entries, '\0', sizeof(cd_entries));
+  cd_entries[0].col_type = T_CHAR;
+  cd_entries[0].col_len = MAX_STRING_LEN;
+  cd_entries[1].col_id = 1;
+  cd_entries[1].col_type = T_INT;
+  cd_entries[1].col_len = sizeof(int);
+  cd_entries[2].col_id = 2;
+  cd_entries[2].col_type = T_CHAR;
+  cd_entries[2].col_len = 1;
+  record_layout layout;
+  init_record_layout(cd_entries, 3, &layout);
+
+  std::string longest(MAX_STRING_LEN, 'x');
+  const char *titles[] = {NULL, "", "A", longest.c_str()};
+  int copies[] = {0, INT_MIN, -1, 1, INT_MAX};
+  const char *authors[] = {NULL, "B"};
+  for (const char *title : titles) {
+    for (int i = -1; i < 5; i++) {  // -1 is NULL.
+      for (const char *author : authors) {
+        field_value values[3];
+        memset(values, '\0', sizeof(values));
+        values[0].type = FIELD_VALUE_TYPE_STRING;
+        values[0].is_null = (title == NULL);
+        strcpy(values[0].string_value, title ? title : "");
+        values[1].type = FIELD_VALUE_TYPE_INT;
+        values[1].is_null = (i < 0);
+        values[1].int_value = (i < 0) ? 0 : copies[i];
+        values[2].type = FIELD_VALUE_TYPE_STRING;
+        values[2].is_null = (author == NULL);
+        strcpy(values[2].string_value, author ? author : "");
+        field_value *value_ptrs[] = {&values[0], &values[1], &values[2]};
+        std::vector<char> expected(layout.record_size);
+        fill_raw_record_bytes(cd_entries, value_ptrs, 3, expected.data(),
+                              layout.record_size);
+
+        // Each column overwrites the bytes of an older value. The padding
+        // after the last column is not stored.
+        std::vector<char> record(layout.record_size, 'Z');
+        row_view view = {&layout, record.data()};
+        for (int col_id = 0; col_id < 3; col_id++) {
+          store_view_column(&view, col_id, &values[col_id]);
+        }
+        int stored_size = layout.columns[2].offset + 1 + 1;
+        Assert::AreEqual(0, memcmp(expected.data(), record.data(), stored_size),
+                         L"Stored record bytes");
+        for (int col_id = 0; col_id < 3; col_id++) {
+          field_value decoded;
+          memset(&decoded, '\0', sizeof(decoded));
+          decode_view_column(&view, col_id, &decoded);
+          // An empty string has the length byte of NULL.
+          bool is_null = values[col_id].is_null ||
+                         ((values[col_id].type == FIELD_VALUE_TYPE_STRING) &&
+                          (values[col_id].string_value[0] == '\0'));
+          Assert::AreEqual(values[col_id].type, decoded.type, L"Type");
+          Assert::AreEqual(is_null, decoded.is_null, L"NULL");
+          if (decoded.is_null) {
+            continue;
+          }
+          if (decoded.type == FIELD_VALUE_TYPE_INT) {
+            Assert::AreEqual(values[col_id].int_value, decoded.int_value,
+                             L"Int value");
+          } else {
+            Assert::AreEqual(std::string(values[col_id].string_value),
+                             std::string(decoded.string_value),
+                             L"String value");
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_METHOD(ColumnarTable) {
+  remove("BOOK2.tab");
+  Assert::AreEqual(static_cast<int>(INVALID_TABLE_DEFINITION),
+                   execute_statement("CREATE TABLE BOOK2(title char(50) NOT "
+                                     "NULL, copies int) WITH FORMAT",
+                                     1),
+                   L"Return code of incomplete format");
+  Assert::AreEqual(0,
+                   execute_statement("CREATE TABLE BOOK2(title char(50) NOT "
+                                     "NULL, copies int) WITH FORMAT COLUMNAR",
+                                     1),
+                   L"Return code");
+  Assert::AreEqual(
+      0,
+      execute_statement(
+          "INSERT INTO BOOK2 VALUES('A', 1), ('B', NULL), ('C', 3)", 1),
+      L"Return code");
+  Assert::AreEqual(
+      0, execute_statement("UPDATE BOOK2 SET copies = 2 WHERE title = 'B'", 1),
+      L"Return code");
+  Assert::AreEqual(0,
+                   execute_statement("DELETE FROM BOOK2 WHERE copies < 2", 1),
+                   L"Return code");
+  Assert::AreEqual(
+      0, execute_statement("SELECT title FROM BOOK2 WHERE copies > 1", 1),
+      L"Return code");
+  reload_global_tpd_list();
+  Assert::AreEqual(static_cast<int>(TPD_FLAG_COLUMNAR),
+                   get_tpd_from_list("BOOK2")->tpd_flags, L"Table flags");
+
+  // One row group: its first page, then the pages of the title and the
+  // copies columns.
+  table_file_header tab_header;
+  FILE *f_table = fopen("BOOK2.tab", "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  Assert::AreEqual(static_cast<int>(TABLE_FILE_COLUMNAR),
+                   tab_header.file_header_flag, L"Columnar file");
+  Assert::AreEqual(2, static_cast<int>(tab_header.num_records),
+                   L"Number of records");
+  Assert::AreEqual(1 + tab_header.pages_per_group,
+                   static_cast<int>(tab_header.file_size / TABLE_PAGE_SIZE),
+                   L"Number of pages");
+  std::vector<char> page(TABLE_PAGE_SIZE);
+  fseek(f_table, TABLE_PAGE_SIZE, SEEK_SET);
+  fread(page.data(), TABLE_PAGE_SIZE, 1, f_table);
+  fclose(f_table);
+  Assert::AreEqual(3, get_page_header(page.data())->num_slots,
+                   L"Rows added to the group");
+  unsigned char *live_bitmap = get_group_live_bitmap(page.data());
+  Assert::IsFalse(is_bit_set(live_bitmap, 0), L"Deleted row");
+  Assert::IsTrue(is_bit_set(live_bitmap, 1), L"Updated row");
+  Assert::IsFalse(is_bit_set(get_group_null_bitmap(page.data(), 1), 1),
+                  L"Updated value is not NULL");
+}
+
 TEST_METHOD(InsertDataTypeMismatch) {
   Assert::AreEqual(
       static_cast<int>(DATA_TYPE_MISMATCH),
@@ -255,6 +754,1521 @@ TEST_METHOD(UpdateNotNullViolation) {
 }
 ;
 
+TEST_CLASS(PredicateTest) {
+  public : BEGIN_TEST_CLASS_ATTRIBUTE()
+  TEST_CLASS_ATTRIBUTE(L"Descrioption", L"Tests to evaluate WHERE clauses.")
+  END_TEST_CLASS_ATTRIBUTE()
+  TEST_METHOD_INITIALIZE(MethodInitialize) {remove(kDbFile);
+remove("BOOK.tab");
+Assert::AreEqual(0, execute_statement(
+                        "CREATE TABLE BOOK(title char(10), author char(10) "
+                        "NOT NULL, copies int, pages int NOT NULL)",
+                        1),
+                 L"Return code.");
+reload_global_tpd_list();
+}
+
+// The budgets and the worker count are restored even after a failed
+// Assert.
+TEST_METHOD_CLEANUP(MethodFinalize) {
+  g_sort_memory_size = DEFAULT_SORT_MEMORY_SIZE;
+  g_group_memory_size = DEFAULT_GROUP_MEMORY_SIZE;
+  g_num_worker_threads = 0;
+  free(g_tpd_list);
+}
+
+TEST_METHOD(CompiledPredicateMatchesRecordPredicate) {
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  Assert::IsNotNull(tab_entry, L"table BOOK");
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  record_layout layout;
+  init_record_layout(cd_entries, tab_entry->num_columns, &layout);
+
+  // Conditions on every column with every operator.
+  const char *strings[] = {"", "T", "T5"};
+  int ints[] = {0, 5};
+  int ops[] = {S_LESS, S_EQUAL, S_GREATER};
+  std::vector<record_condition> conditions;
+  for (int col_id = 0; col_id < tab_entry->num_columns; col_id++) {
+    record_condition condition;
+    memset(&condition, '\0', sizeof(condition));
+    condition.col_id = col_id;
+    condition.value_type = (cd_entries[col_id].col_type == T_INT)
+                               ? FIELD_VALUE_TYPE_INT
+                               : FIELD_VALUE_TYPE_STRING;
+    for (int op : ops) {
+      condition.op_type = op;
+      if (condition.value_type == FIELD_VALUE_TYPE_INT) {
+        for (int int_value : ints) {
+          condition.int_data_value = int_value;
+          conditions.push_back(condition);
+        }
+      } else {
+        for (const char *string_value : strings) {
+          strcpy(condition.string_data_value, string_value);
+          condition.string_data_length = strlen(string_value);
+          conditions.push_back(condition);
+        }
+      }
+    }
+    condition.op_type = K_IS;
+    conditions.push_back(condition);
+    condition.op_type = K_NOT;
+    conditions.push_back(condition);
+  }
+
+  // Records with NULL, empty, equal, shorter and longer values.
+  const char *titles[] = {NULL, "", "T", "T5", "T50", "U"};
+  const char *authors[] = {"", "S", "T5", "T5a"};
+  int copies[] = {-1, 0, 5, 50};  // -1 is NULL.
+  int pages[] = {0, 5, 50};
+  std::vector<std::vector<char>> records;
+  for (const char *title : titles) {
+    for (const char *author : authors) {
+      for (int num_copies : copies) {
+        for (int num_pages : pages) {
+          std::vector<char> record(layout.record_size);
+          row_view view = {&layout, record.data()};
+          field_value value;
+          memset(&value, '\0', sizeof(value));
+          value.is_null = (title == NULL);
+          strcpy(value.string_value, title ? title : "");
+          store_view_column(&view, 0, &value);
+          value.is_null = false;
+          strcpy(value.string_value, author);
+          store_view_column(&view, 1, &value);
+          value.is_null = (num_copies < 0);
+          value.int_value = num_copies;
+          store_view_column(&view, 2, &value);
+          value.is_null = false;
+          value.int_value = num_pages;
+          store_view_column(&view, 3, &value);
+          records.push_back(record);
+        }
+      }
+    }
+  }
+
+  // Every single condition and its negation, and every pair joined by AND
+  // and by OR, negated or not.
+  std::vector<record_predicate> predicates;
+  for (size_t i = 0; i < conditions.size(); i++) {
+    record_predicate predicate;
+    memset(&predicate, '\0', sizeof(predicate));
+    predicate.num_conditions = 1;
+    predicate.conditions[0] = conditions[i];
+    predicate.root = add_predicate_node(&predicate, 0, 0);
+    predicates.push_back(predicate);
+    int condition_node = predicate.root;
+    predicate.root = add_predicate_node(&predicate, K_NOT, -1);
+    add_predicate_child(&predicate, predicate.root, condition_node);
+    predicates.push_back(predicate);
+    for (size_t j = 0; j < conditions.size(); j++) {
+      for (int type : {K_AND, K_OR}) {
+        memset(&predicate, '\0', sizeof(predicate));
+        predicate.num_conditions = 2;
+        predicate.conditions[0] = conditions[i];
+        predicate.conditions[1] = conditions[j];
+        int node = add_predicate_node(&predicate, type, -1);
+        add_predicate_child(&predicate, node,
+                            add_predicate_node(&predicate, 0, 0));
+        add_predicate_child(&predicate, node,
+                            add_predicate_node(&predicate, 0, 1));
+        predicate.root = node;
+        predicates.push_back(predicate);
+        predicate.root = add_predicate_node(&predicate, K_NOT, -1);
+        add_predicate_child(&predicate, predicate.root, node);
+        predicates.push_back(predicate);
+      }
+    }
+  }
+
+  std::vector<char *> batch_records;
+  for (size_t j = 0; j < records.size(); j++) {
+    batch_records.push_back(records[j].data());
+  }
+  int all_col_ids[] = {0, 1, 2, 3};
+  field_value row_values[MAX_NUM_COL];
+  uint64_t selection[SELECTION_WORDS];
+  for (size_t i = 0; i < predicates.size(); i++) {
+    compiled_predicate compiled;
+    compile_predicate(&layout, &predicates[i], &compiled);
+    eval_compiled_predicate_batch(&compiled, batch_records.data(),
+                                  (int)batch_records.size(), selection);
+    for (size_t j = 0; j < records.size(); j++) {
+      row_view view = {&layout, records[j].data()};
+      record_row row;
+      materialize_row(&view, all_col_ids, 4, &row, row_values);
+      bool expected = apply_row_predicate(cd_entries, tab_entry->num_columns,
+                                          &row, &predicates[i]);
+      Assert::AreEqual(expected,
+                       eval_compiled_predicate(&compiled, records[j].data()),
+                       L"compiled predicate result");
+      Assert::AreEqual(expected, is_record_selected(selection, (int)j),
+                       L"batch predicate result");
+    }
+  }
+}
+
+TEST_METHOD(RawBytePredicateEdgeCases) {
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  Assert::IsNotNull(tab_entry, L"table BOOK");
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  record_layout layout;
+  init_record_layout(cd_entries, tab_entry->num_columns, &layout);
+
+  // Titles which are NULL or equal up to the shorter length, and copies
+  // which are NULL or negative.
+  const char *titles[] = {NULL, "a", "ab", "abc", "abd", "b"};
+  const int kNull = 1;
+  int copies[] = {kNull, INT_MIN, -5, -1, 0, 5, INT_MAX};
+  std::vector<std::vector<char>> records;
+  for (const char *title : titles) {
+    for (int num_copies : copies) {
+      std::vector<char> record(layout.record_size);
+      row_view view = {&layout, record.data()};
+      field_value value;
+      memset(&value, '\0', sizeof(value));
+      value.is_null = (title == NULL);
+      strcpy(value.string_value, title ? title : "");
+      store_view_column(&view, 0, &value);
+      value.is_null = false;
+      strcpy(value.string_value, "x");
+      store_view_column(&view, 1, &value);
+      value.is_null = (num_copies == kNull);
+      value.int_value = num_copies;
+      store_view_column(&view, 2, &value);
+      value.is_null = false;
+      value.int_value = -1 - num_copies;
+      store_view_column(&view, 3, &value);
+      records.push_back(record);
+    }
+  }
+
+  std::vector<record_condition> conditions;
+  record_condition condition;
+  for (int op : {(int)S_LESS, (int)S_EQUAL, (int)S_GREATER}) {
+    for (const char *string_value : {"ab", "abc", "abcd"}) {
+      memset(&condition, '\0', sizeof(condition));
+      condition.col_id = 0;
+      condition.op_type = op;
+      condition.value_type = FIELD_VALUE_TYPE_STRING;
+      strcpy(condition.string_data_value, string_value);
+      condition.string_data_length = strlen(string_value);
+      conditions.push_back(condition);
+    }
+    for (int col_id : {2, 3}) {
+      for (int int_value : {INT_MIN, -5, -1, 0, 1}) {
+        memset(&condition, '\0', sizeof(condition));
+        condition.col_id = col_id;
+        condition.op_type = op;
+        condition.value_type = FIELD_VALUE_TYPE_INT;
+        condition.int_data_value = int_value;
+        conditions.push_back(condition);
+      }
+    }
+  }
+  for (int op : {(int)K_IS, (int)K_NOT}) {
+    for (int col_id : {0, 2}) {
+      memset(&condition, '\0', sizeof(condition));
+      condition.col_id = col_id;
+      condition.op_type = op;
+      condition.value_type = (col_id == 0) ? FIELD_VALUE_TYPE_STRING
+                                           : FIELD_VALUE_TYPE_INT;
+      conditions.push_back(condition);
+    }
+  }
+
+  // The record bytes give the result of the decoded values, one record at
+  // a time and by batch.
+  std::vector<char *> batch_records;
+  for (size_t j = 0; j < records.size(); j++) {
+    batch_records.push_back(records[j].data());
+  }
+  int all_col_ids[] = {0, 1, 2, 3};
+  field_value row_values[MAX_NUM_COL];
+  uint64_t selection[SELECTION_WORDS];
+  for (size_t i = 0; i < conditions.size(); i++) {
+    record_predicate predicate;
+    memset(&predicate, '\0', sizeof(predicate));
+    predicate.num_conditions = 1;
+    predicate.conditions[0] = conditions[i];
+    predicate.root = add_predicate_node(&predicate, 0, 0);
+    compiled_predicate compiled;
+    compile_predicate(&layout, &predicate, &compiled);
+    eval_compiled_predicate_batch(&compiled, batch_records.data(),
+                                  (int)batch_records.size(), selection);
+    for (size_t j = 0; j < records.size(); j++) {
+      row_view view = {&layout, records[j].data()};
+      record_row row;
+      materialize_row(&view, all_col_ids, 4, &row, row_values);
+      bool expected = apply_row_predicate(cd_entries, tab_entry->num_columns,
+                                          &row, &predicate);
+      Assert::AreEqual(expected,
+                       eval_compiled_predicate(&compiled, records[j].data()),
+                       L"raw byte result");
+      Assert::AreEqual(expected, is_record_selected(selection, (int)j),
+                       L"batch result");
+    }
+  }
+
+  // A few results spelled out. The records are by title, then by copies.
+  int num_copies = sizeof(copies) / sizeof(copies[0]);
+  char *null_title = records[0 * num_copies + 4].data();
+  char *ab_title = records[2 * num_copies + 4].data();
+  char *abd_title = records[4 * num_copies + 4].data();
+  char *null_copies = records[1 * num_copies + 0].data();
+  char *min_copies = records[1 * num_copies + 1].data();
+  char *minus_one_copies = records[1 * num_copies + 3].data();
+  auto eval = [&layout](int col_id, int op, const char *string_value,
+                        int int_value, char *record) {
+    record_predicate predicate;
+    memset(&predicate, '\0', sizeof(predicate));
+    record_condition *p_condition = &predicate.conditions[0];
+    p_condition->col_id = col_id;
+    p_condition->op_type = op;
+    if (string_value) {
+      p_condition->value_type = FIELD_VALUE_TYPE_STRING;
+      strcpy(p_condition->string_data_value, string_value);
+      p_condition->string_data_length = strlen(string_value);
+    } else {
+      p_condition->value_type = FIELD_VALUE_TYPE_INT;
+      p_condition->int_data_value = int_value;
+    }
+    predicate.num_conditions = 1;
+    predicate.root = add_predicate_node(&predicate, 0, 0);
+    compiled_predicate compiled;
+    compile_predicate(&layout, &predicate, &compiled);
+    return eval_compiled_predicate(&compiled, record);
+  };
+  Assert::IsTrue(eval(0, S_LESS, "abc", 0, ab_title), L"'ab' < 'abc'");
+  Assert::IsFalse(eval(0, S_LESS, "abc", 0, abd_title), L"'abd' < 'abc'");
+  Assert::IsFalse(eval(0, S_LESS, "abc", 0, null_title), L"NULL < 'abc'");
+  Assert::IsTrue(eval(0, S_EQUAL, "ab", 0, ab_title), L"'ab' = 'ab'");
+  Assert::IsFalse(eval(0, S_EQUAL, "abc", 0, ab_title), L"'ab' = 'abc'");
+  Assert::IsTrue(eval(0, S_GREATER, "abcd", 0, abd_title), L"'abd' > 'abcd'");
+  Assert::IsFalse(eval(0, S_GREATER, "abcd", 0, ab_title), L"'ab' > 'abcd'");
+  Assert::IsTrue(eval(0, K_IS, NULL, 0, null_title), L"NULL IS NULL");
+  Assert::IsFalse(eval(0, K_NOT, NULL, 0, null_title), L"NULL IS NOT NULL");
+  Assert::IsTrue(eval(2, S_LESS, NULL, -5, min_copies), L"INT_MIN < -5");
+  Assert::IsFalse(eval(2, S_LESS, NULL, -5, minus_one_copies), L"-1 < -5");
+  Assert::IsFalse(eval(2, S_LESS, NULL, -5, null_copies), L"NULL < -5");
+  Assert::IsTrue(eval(2, S_GREATER, NULL, INT_MIN, minus_one_copies),
+                 L"-1 > INT_MIN");
+  Assert::IsFalse(eval(2, S_GREATER, NULL, INT_MIN, min_copies),
+                  L"INT_MIN > INT_MIN");
+  Assert::IsFalse(eval(2, S_GREATER, NULL, INT_MIN, null_copies),
+                  L"NULL > INT_MIN");
+  Assert::IsTrue(eval(2, S_EQUAL, NULL, -1, minus_one_copies), L"-1 = -1");
+}
+
+TEST_METHOD(FilterKernelsMatchScalarKernels) {
+  filter_kernels *kernels[3];
+  int num_kernels = list_filter_kernels(kernels);
+  Assert::AreEqual(std::string("scalar"), std::string(kernels[0]->name),
+                   L"scalar kernels come first");
+
+  // Values around the operand, and a count which is not a multiple of the
+  // vector width.
+  int values[FILTER_BATCH_SIZE];
+  unsigned char length_bytes[FILTER_BATCH_SIZE];
+  for (int i = 0; i < FILTER_BATCH_SIZE; i++) {
+    values[i] = (i * 7919) % 11 - 5;
+    length_bytes[i] = (unsigned char)((i * 31) % 3);
+  }
+  char bytes1[100];
+  char bytes2[100];
+  for (int i = 0; i < 100; i++) {
+    bytes1[i] = bytes2[i] = (char)('a' + i % 26);
+  }
+
+  int ops[] = {S_LESS, S_EQUAL, S_GREATER};
+  int counts[] = {FILTER_BATCH_SIZE, 1, 13, 100, 1001};
+  uint64_t expected[SELECTION_WORDS];
+  uint64_t actual[SELECTION_WORDS];
+  for (int k = 1; k < num_kernels; k++) {
+    for (int num_values : counts) {
+      int num_words = (num_values + 63) / 64;
+      for (int op : ops) {
+        kernels[0]->filter_int(values, num_values, op, 0, expected);
+        kernels[k]->filter_int(values, num_values, op, 0, actual);
+        Assert::IsTrue(
+            memcmp(expected, actual, sizeof(uint64_t) * num_words) == 0,
+            L"integer filter");
+      }
+      kernels[0]->filter_null(length_bytes, num_values, expected);
+      kernels[k]->filter_null(length_bytes, num_values, actual);
+      Assert::IsTrue(memcmp(expected, actual, sizeof(uint64_t) * num_words) ==
+                         0,
+                     L"NULL filter");
+    }
+    for (int length = 0; length <= 100; length++) {
+      Assert::IsTrue(kernels[k]->equal_bytes(bytes1, bytes2, length),
+                     L"equal bytes");
+      if (length > 0) {
+        bytes2[length - 1] = 'A';
+        Assert::IsFalse(kernels[k]->equal_bytes(bytes1, bytes2, length),
+                        L"different last byte");
+        bytes2[length - 1] = bytes1[length - 1];
+      }
+    }
+    // Patterns found at each position, and near misses.
+    for (int length = 0; length <= 100; length++) {
+      for (int pattern_length = 0; pattern_length <= 5; pattern_length++) {
+        for (int start = 0; start < 30; start++) {
+          char pattern[5];
+          memcpy(pattern, bytes1 + start, pattern_length);
+          // The bytes past the string are read, but not matched.
+          Assert::AreEqual(kernels[0]->find_bytes(bytes1, length, 100,
+                                                  pattern, pattern_length),
+                           kernels[k]->find_bytes(bytes1, length, 100,
+                                                  pattern, pattern_length),
+                           L"find bytes");
+          if (pattern_length > 1) {
+            pattern[pattern_length - 2] = 'A';
+            Assert::IsFalse(kernels[k]->find_bytes(bytes1, length, length,
+                                                   pattern, pattern_length),
+                            L"pattern not found");
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_METHOD(BatchOperatorsMatchRowByRow) {
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  Assert::IsNotNull(tab_entry, L"table BOOK");
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  select_plan plan;
+  memset(&plan, '\0', sizeof(plan));
+  init_record_layout(cd_entries, tab_entry->num_columns, &plan.layout);
+
+  // Titles with NULL, copies with NULL.
+  std::vector<std::vector<char>> records;
+  std::vector<char *> batch_records;
+  for (int i = 0; i < 300; i++) {
+    std::vector<char> record(plan.layout.record_size);
+    row_view view = {&plan.layout, record.data()};
+    field_value value;
+    memset(&value, '\0', sizeof(value));
+    value.is_null = (i % 7 == 0);
+    sprintf(value.string_value, "T%d", (i * 37) % 100);
+    store_view_column(&view, 0, &value);
+    value.is_null = (i % 5 == 0);
+    value.int_value = i % 9 - 3;
+    store_view_column(&view, 2, &value);
+    value.is_null = false;
+    value.int_value = i;
+    store_view_column(&view, 3, &value);
+    records.push_back(record);
+  }
+  for (size_t i = 0; i < records.size(); i++) {
+    batch_records.push_back(records[i].data());
+  }
+
+  // SUM(pages) WHERE copies > 0, and the same rows ordered by title.
+  record_predicate predicate;
+  memset(&predicate, '\0', sizeof(predicate));
+  predicate.num_conditions = 1;
+  predicate.conditions[0].col_id = 2;
+  predicate.conditions[0].value_type = FIELD_VALUE_TYPE_INT;
+  predicate.conditions[0].op_type = S_GREATER;
+  predicate.conditions[0].int_data_value = 0;
+  predicate.root = add_predicate_node(&predicate, 0, 0);
+  compile_predicate(&plan.layout, &predicate, &plan.where_filter);
+  plan.num_project_cols = 2;
+  plan.project_col_ids[0] = 0;
+  plan.project_col_ids[1] = 3;
+  plan.num_order_by_cols = 1;
+  plan.order_by_col_ids[0] = 0;
+
+  column_vector vectors[MAX_NUM_COL];
+  sort_buffer buffer;
+  memset(&buffer, '\0', sizeof(buffer));
+  for (int col_id : {0, 3}) {
+    init_column_vector(&vectors[col_id], &plan.layout.columns[col_id]);
+    Assert::AreEqual(0, reserve_column_vector(&vectors[col_id],
+                                              FILTER_BATCH_SIZE));
+    init_column_vector(&buffer.columns[col_id], &plan.layout.columns[col_id]);
+  }
+  row_batch batch;
+  batch.num_rows = (int)batch_records.size();
+  memcpy(batch.records, batch_records.data(),
+         sizeof(char *) * batch_records.size());
+  filter_batch(&plan, &batch);
+  project_batch(&plan, &batch, vectors);
+  group_aggregate aggregate = {F_SUM, 3, 0};
+  aggregate_state state;
+  memset(&state, '\0', sizeof(state));
+  aggregate_column_batch(&aggregate, &batch, &state);
+  Assert::AreEqual(0, add_sort_batch(&plan, &batch, &buffer));
+
+  int expected_count = 0;
+  int expected_sum = 0;
+  for (int i = 0; i < 300; i++) {
+    if ((i % 5 != 0) && (i % 9 - 3 > 0)) {
+      Assert::AreEqual(i, batch.selected[expected_count], L"selected row");
+      expected_count++;
+      expected_sum += i;
+    }
+  }
+  Assert::AreEqual(expected_count, batch.num_selected, L"selected rows");
+  Assert::AreEqual(static_cast<int64_t>(expected_count),
+                   state.records_count, L"aggregate count");
+  Assert::AreEqual(static_cast<int64_t>(expected_sum), state.int_sum,
+                   L"aggregate sum");
+
+  Assert::AreEqual(expected_count, buffer.num_rows, L"buffered rows");
+  Assert::AreEqual(0, sort_buffered_rows(&plan, &buffer));
+  for (int i = 1; i < buffer.num_rows; i++) {
+    Assert::IsTrue(compare_sort_entries(&buffer, &buffer.entries[i - 1],
+                                        &buffer.entries[i]) < 0,
+                   L"sorted rows");
+  }
+  Assert::IsTrue(buffer.columns[0].is_null[buffer.entries[0].row],
+                 L"NULL comes first");
+
+  free(buffer.keys);
+  free(buffer.entries);
+  for (int col_id : {0, 3}) {
+    free_column_vector(&vectors[col_id]);
+    free_column_vector(&buffer.columns[col_id]);
+  }
+}
+
+TEST_METHOD(AggregatePartialStates) {
+  group_aggregate aggregate = {F_SUM, 0, 0};
+  column_layout column = {0, T_INT, sizeof(int), 0};
+  column_vector vector;
+  init_column_vector(&vector, &column);
+  Assert::AreEqual(0, reserve_column_vector(&vector, FILTER_BATCH_SIZE));
+  row_batch batch;
+  memset(&batch, '\0', sizeof(batch));
+  batch.columns[0] = &vector;
+  batch.num_selected = 1000;
+  for (int i = 0; i < batch.num_selected; i++) {
+    batch.selected[i] = i;
+    vector.is_null[i] = (i % 10 == 0);
+    vector.int_values[i] = 2000000000;
+  }
+
+  // Two halves aggregated apart and merged, past the range of an int.
+  aggregate_state states[2];
+  memset(states, '\0', sizeof(states));
+  batch.num_selected = 500;
+  aggregate_column_batch(&aggregate, &batch, &states[0]);
+  memmove(batch.selected, batch.selected + 500, sizeof(int) * 500);
+  aggregate_column_batch(&aggregate, &batch, &states[1]);
+  merge_aggregate_state(&states[0], &states[1]);
+  Assert::AreEqual(static_cast<int64_t>(900), states[0].records_count,
+                   L"aggregate count");
+  Assert::AreEqual(static_cast<int64_t>(900) * 2000000000, states[0].int_sum,
+                   L"aggregate sum");
+  free_column_vector(&vector);
+}
+
+// The pages of the rows of BOOK which satisfy a WHERE clause, in order,
+// e.g. "1 3".
+std::string matching_pages(const char *where_clause) {
+  std::string statement = std::string("WHERE ") + where_clause;
+  token_list *tok_list = NULL;
+  Assert::AreEqual(0, get_token((char *)statement.c_str(), &tok_list));
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  select_plan plan;
+  memset(&plan, '\0', sizeof(plan));
+  init_record_layout(cd_entries, tab_entry->num_columns, &plan.layout);
+  record_predicate predicate;
+  memset(&predicate, '\0', sizeof(predicate));
+  token_list *cur = tok_list->next;
+  Assert::AreEqual(0, parse_where_clause(&cur, cd_entries,
+                                         tab_entry->num_columns, &predicate),
+                   L"WHERE clause");
+  Assert::AreEqual(static_cast<int>(EOC), cur->tok_value, L"End of clause");
+  Assert::AreEqual(
+      0, compile_predicate(&plan.layout, &predicate, &plan.where_filter));
+  plan.num_project_cols = 1;
+  plan.project_col_ids[0] = 3;
+  plan.num_order_by_cols = 1;
+  plan.order_by_col_ids[0] = 3;
+
+  table_scan scan;
+  Assert::AreEqual(0, open_table_scan(tab_entry, &scan, true));
+  select_pipeline pipeline;
+  Assert::AreEqual(0, open_select_pipeline(&plan, &scan, &pipeline));
+  batch_operator *p_last = &pipeline.operators[pipeline.num_operators - 1];
+  row_batch *p_batch = NULL;
+  std::string pages;
+  while ((p_last->next(p_last, &p_batch) == 0) && p_batch) {
+    column_vector *p_pages = p_batch->columns[3];
+    for (int i = 0; i < p_batch->num_selected; i++) {
+      pages += (pages.empty() ? "" : " ") +
+               std::to_string(p_pages->int_values[p_batch->selected[i]]);
+    }
+  }
+  close_select_pipeline(&pipeline);
+  close_table_scan(&scan);
+  finish_table_io();
+  // The values of IN lists stay in the tokens.
+  free_token_list(tok_list);
+  return pages;
+}
+
+TEST_METHOD(WhereClauseTrees) {
+  Assert::AreEqual(0, execute_statement(
+                          "INSERT INTO BOOK VALUES('a', 'x', 1, 1), "
+                          "('b', 'x', 2, 2), (NULL, 'x', NULL, 3), "
+                          "('c', 'y', 3, 4), ('d', 'y', NULL, 5), "
+                          "('e', 'y', 0, 6)",
+                          1));
+  Assert::AreEqual(static_cast<int>(INVALID_CONDITION),
+                   execute_statement(
+                       "SELECT * FROM BOOK WHERE (copies > 1 OR pages < 2", 1),
+                   L"Missing parenthesis");
+  Assert::AreEqual(
+      static_cast<int>(INVALID_COLUMN_NAME),
+      execute_statement("SELECT * FROM BOOK WHERE copies > 1 AND NOT", 1),
+      L"Missing condition");
+  Assert::AreEqual(
+      0,
+      execute_statement("SELECT title FROM BOOK WHERE NOT (NOT title = 'a' "
+                        "AND (copies < 2 OR pages > 3)) ORDER BY title",
+                        1),
+      L"Nested expression");
+  // The NULL title of page 3 leaves the AND and its negation unknown.
+  Assert::AreEqual(std::string("1 2"),
+                   matching_pages("NOT (NOT title = 'a' AND (copies < 2 OR "
+                                  "pages > 3))"),
+                   L"Nested expression rows");
+  // Unknown OR true is true, unknown OR false is unknown.
+  Assert::AreEqual(std::string("1 2 4"),
+                   matching_pages("copies > 1 OR title = 'a'"),
+                   L"OR of NULL operands");
+  Assert::AreEqual(std::string("6"),
+                   matching_pages("NOT (copies > 1 OR title = 'a')"),
+                   L"NOT of NULL operands");
+  // Unknown AND false is false, so its negation is true.
+  Assert::AreEqual(std::string("3 4 5 6"),
+                   matching_pages("NOT (copies > 0 AND pages < 3)"),
+                   L"NOT of an AND with NULL operands");
+  Assert::AreEqual(std::string("3 5"),
+                   matching_pages("copies IS NULL OR title IS NULL"),
+                   L"IS NULL");
+  Assert::AreEqual(0,
+                   execute_statement("UPDATE BOOK SET pages = 9 WHERE (title "
+                                     "= 'a' OR title = 'b') AND NOT copies "
+                                     "IS NULL",
+                                     1),
+                   L"UPDATE with an expression");
+  Assert::AreEqual(std::string("3 4 5 6 9 9"), matching_pages("pages > 0"),
+                   L"Rows after UPDATE");
+
+  // Only 'e' qualifies, a NULL copies or title makes the OR unknown and so
+  // its negation.
+  Assert::AreEqual(0,
+                   execute_statement("DELETE FROM BOOK WHERE NOT (copies > 1 "
+                                     "OR title = 'a') AND pages < 7",
+                                     1),
+                   L"DELETE with an expression");
+  Assert::AreEqual(std::string("3 4 5 9 9"), matching_pages("pages > 0"),
+                   L"Rows after DELETE");
+  table_file_header tab_header;
+  FILE *f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  fclose(f_table);
+  Assert::AreEqual(5, static_cast<int>(tab_header.num_records),
+                   L"Number of records");
+}
+
+TEST_METHOD(InListsAndBetween) {
+  Assert::AreEqual(0, execute_statement(
+                          "INSERT INTO BOOK VALUES('a', 'x', 1, 1), "
+                          "('b', 'x', 2, 2), (NULL, 'x', NULL, 3), "
+                          "('c', 'y', 3, 4), ('d', 'y', NULL, 5), "
+                          "('e', 'y', 0, 6)",
+                          1));
+  Assert::AreEqual(
+      static_cast<int>(INVALID_CONDITION_OPERAND),
+      execute_statement("SELECT * FROM BOOK WHERE copies IN (1, 'a')", 1),
+      L"Value of another type");
+  Assert::AreEqual(
+      static_cast<int>(INVALID_CONDITION),
+      execute_statement("SELECT * FROM BOOK WHERE copies IN ()", 1),
+      L"Empty list");
+  // An empty list is an error, so it deletes no row either.
+  Assert::AreEqual(
+      static_cast<int>(INVALID_CONDITION),
+      execute_statement("DELETE FROM BOOK WHERE copies NOT IN ()", 1),
+      L"DELETE with an empty list");
+  Assert::AreEqual(std::string("1 2 3 4 5 6"), matching_pages("pages > 0"),
+                   L"Rows after an empty list");
+  Assert::AreEqual(
+      static_cast<int>(INVALID_CONDITION),
+      execute_statement("SELECT * FROM BOOK WHERE copies BETWEEN 1 2", 1),
+      L"Missing AND");
+  Assert::AreEqual(0,
+                   execute_statement("SELECT title FROM BOOK WHERE pages IN "
+                                     "(6, 1, 4, 1) AND copies BETWEEN 0 "
+                                     "AND 3",
+                                     1),
+                   L"IN and BETWEEN");
+  Assert::AreEqual(std::string("1 4 6"),
+                   matching_pages("pages IN (6, 1, 4, 1) AND copies BETWEEN "
+                                  "0 AND 3"),
+                   L"IN and BETWEEN rows");
+  // A NULL copies is neither IN nor NOT IN the list.
+  Assert::AreEqual(std::string("1 4"), matching_pages("copies IN (1, 3)"),
+                   L"IN with NULL operands");
+  Assert::AreEqual(std::string("2 6"),
+                   matching_pages("copies NOT IN (1, 3)"),
+                   L"NOT IN with NULL operands");
+  Assert::AreEqual(std::string("4 6"),
+                   matching_pages("copies NOT BETWEEN 1 AND 2"),
+                   L"NOT BETWEEN with NULL operands");
+  // Bounds are not swapped, so no value is between 3 and 1.
+  Assert::AreEqual(std::string(""), matching_pages("copies BETWEEN 3 AND 1"),
+                   L"BETWEEN with swapped bounds");
+  Assert::AreEqual(std::string("1 2 4 6"),
+                   matching_pages("copies NOT BETWEEN 3 AND 1"),
+                   L"NOT BETWEEN with swapped bounds");
+
+  // 'c' and 'e' qualify. A NULL copies or title makes both sides unknown.
+  Assert::AreEqual(0,
+                   execute_statement("DELETE FROM BOOK WHERE copies NOT "
+                                     "BETWEEN 1 AND 2 OR title IN ('c', "
+                                     "'zz')",
+                                     1),
+                   L"DELETE with BETWEEN and IN");
+  // Then only 'b', NOT IN is unknown for the NULL title.
+  Assert::AreEqual(
+      0,
+      execute_statement("DELETE FROM BOOK WHERE title NOT IN ('a', 'd')", 1),
+      L"DELETE with NOT IN");
+  Assert::AreEqual(std::string("1 3 5"), matching_pages("pages > 0"),
+                   L"Rows after DELETE");
+  table_file_header tab_header;
+  FILE *f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  fclose(f_table);
+  Assert::AreEqual(3, static_cast<int>(tab_header.num_records),
+                   L"Number of records");
+}
+
+TEST_METHOD(LikePatterns) {
+  Assert::AreEqual(0, execute_statement(
+                          "INSERT INTO BOOK VALUES('abc', 'x', 1, 1), "
+                          "('abd', 'x', 2, 2), (NULL, 'x', NULL, 3), "
+                          "('xabc', 'y', 3, 4), ('a%c', 'y', NULL, 5), "
+                          "('bc', 'y', 0, 6)",
+                          1));
+  Assert::AreEqual(
+      static_cast<int>(INVALID_CONDITION_OPERAND),
+      execute_statement("SELECT * FROM BOOK WHERE copies LIKE '1%'", 1),
+      L"LIKE on an integer column");
+
+  int start = 0;
+  int length = 0;
+  Assert::AreEqual(static_cast<int>(LIKE_PREFIX),
+                   get_like_pattern("ab%%", 4, &start, &length));
+  Assert::AreEqual(2, length, L"prefix length");
+  Assert::AreEqual(static_cast<int>(LIKE_INFIX),
+                   get_like_pattern("%ab%", 4, &start, &length));
+  Assert::AreEqual(1, start, L"infix start");
+  Assert::AreEqual(static_cast<int>(LIKE_GENERAL),
+                   get_like_pattern("%a_%", 4, &start, &length));
+  Assert::IsTrue(match_like_pattern("xabcbc", 6, "%b_%c", 5));
+  Assert::IsFalse(match_like_pattern("xabcb", 5, "%b_%c", 5));
+
+  // NULL is neither LIKE nor NOT LIKE any pattern, even '%'.
+  Assert::AreEqual(std::string("1 2 4 5 6"), matching_pages("title LIKE '%'"),
+                   L"LIKE '%'");
+  Assert::AreEqual(std::string(""), matching_pages("title NOT LIKE '%'"),
+                   L"NOT LIKE '%'");
+  Assert::AreEqual(std::string("1 2 4 6"),
+                   matching_pages("title LIKE '%b%'"), L"% at both ends");
+  Assert::AreEqual(std::string("1 2"), matching_pages("title LIKE '_b_'"),
+                   L"_ at both ends");
+  Assert::AreEqual(std::string("1 4 5 6"),
+                   matching_pages("title LIKE '%_c'"), L"% then _");
+  Assert::AreEqual(std::string("4"), matching_pages("title LIKE '_ab%'"),
+                   L"_ then %");
+  Assert::AreEqual(std::string("1 2 4 5 6"),
+                   matching_pages("title LIKE '_%_'"), L"_ around %");
+  Assert::AreEqual(std::string("2"), matching_pages("title NOT LIKE '%c'"),
+                   L"NOT LIKE with a NULL title");
+
+  // 'abc', 'xabc' and 'a%c', then 'bc'. NULL is neither LIKE nor NOT LIKE.
+  Assert::AreEqual(
+      0,
+      execute_statement("DELETE FROM BOOK WHERE title LIKE '%a_c' OR title "
+                        "LIKE 'x%'",
+                        1),
+      L"DELETE with LIKE");
+  Assert::AreEqual(
+      0,
+      execute_statement("DELETE FROM BOOK WHERE title NOT LIKE 'ab%'", 1),
+      L"DELETE with NOT LIKE");
+  Assert::AreEqual(std::string("2 3"), matching_pages("pages > 0"),
+                   L"Rows after DELETE");
+  table_file_header tab_header;
+  FILE *f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  fclose(f_table);
+  Assert::AreEqual(2, static_cast<int>(tab_header.num_records),
+                   L"Number of records");
+}
+
+TEST_METHOD(PipelineReturnsSortedBatches) {
+  Assert::AreEqual(0, execute_statement(
+                          "INSERT INTO BOOK VALUES('c', 'x', 1, 1), "
+                          "('a', 'x', NULL, 2), (NULL, 'x', 3, 3), "
+                          "('b', 'x', 4, 4)",
+                          1));
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  select_plan plan;
+  memset(&plan, '\0', sizeof(plan));
+  init_record_layout(cd_entries, tab_entry->num_columns, &plan.layout);
+  record_predicate predicate;
+  memset(&predicate, '\0', sizeof(predicate));
+  compile_predicate(&plan.layout, &predicate, &plan.where_filter);
+  plan.num_project_cols = 1;
+  plan.project_col_ids[0] = 0;
+  plan.num_order_by_cols = 1;
+  plan.order_by_col_ids[0] = 0;
+  plan.order_by_desc[0] = true;
+
+  // scan -> filter -> project -> sort, pulled from the sort.
+  table_scan scan;
+  Assert::AreEqual(0, open_table_scan(tab_entry, &scan, true));
+  select_pipeline pipeline;
+  Assert::AreEqual(0, open_select_pipeline(&plan, &scan, &pipeline));
+  Assert::AreEqual(4, pipeline.num_operators, L"Number of operators");
+  batch_operator *p_sort = &pipeline.operators[pipeline.num_operators - 1];
+  row_batch *p_batch = NULL;
+  Assert::AreEqual(0, p_sort->next(p_sort, &p_batch));
+  Assert::IsNotNull(p_batch, L"Sorted batch");
+  Assert::AreEqual(4, p_batch->num_selected, L"Sorted rows");
+  const char *expected_titles[] = {"c", "b", "a"};
+  column_vector *p_titles = p_batch->columns[0];
+  for (int i = 0; i < 3; i++) {
+    Assert::AreEqual(std::string(expected_titles[i]),
+                     std::string(p_titles->string_values +
+                                 p_batch->selected[i] * p_titles->value_size),
+                     L"Title");
+  }
+  Assert::IsTrue(p_titles->is_null[p_batch->selected[3]], L"NULL is last");
+  Assert::AreEqual(0, p_sort->next(p_sort, &p_batch));
+  Assert::IsTrue(p_batch == NULL, L"End of the rows");
+  close_select_pipeline(&pipeline);
+  close_table_scan(&scan);
+  finish_table_io();
+}
+
+TEST_METHOD(SortByColumnList) {
+  Assert::AreEqual(0, execute_statement(
+                          "INSERT INTO BOOK VALUES('c', 'x', 1, 1), "
+                          "('a', 'x', NULL, 2), ('b', 'x', 1, 3), "
+                          "('d', 'x', NULL, 4), ('e', 'x', 2, 5)",
+                          1));
+  Assert::AreEqual(
+      0,
+      execute_statement(
+          "SELECT * FROM BOOK ORDER BY copies DESC, title ASC, pages", 1),
+      L"ORDER BY a column list");
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  select_plan plan;
+  memset(&plan, '\0', sizeof(plan));
+  init_record_layout(cd_entries, tab_entry->num_columns, &plan.layout);
+  plan.num_project_cols = 3;
+  plan.project_col_ids[0] = 0;
+  plan.project_col_ids[1] = 2;
+  plan.project_col_ids[2] = 3;
+
+  // copies DESC, title sorts a string key, and copies, pages DESC an
+  // integer key. NULL is first, or last when descending.
+  int order_by_col_ids[2][2] = {{2, 0}, {2, 3}};
+  bool order_by_desc[2][2] = {{true, false}, {false, true}};
+  const char *expected_titles[2] = {"ebcad", "dabce"};
+  for (int k = 0; k < 2; k++) {
+    plan.num_order_by_cols = 2;
+    memcpy(plan.order_by_col_ids, order_by_col_ids[k], sizeof(int) * 2);
+    memcpy(plan.order_by_desc, order_by_desc[k], sizeof(bool) * 2);
+    record_predicate predicate;
+    memset(&predicate, '\0', sizeof(predicate));
+    compile_predicate(&plan.layout, &predicate, &plan.where_filter);
+    table_scan scan;
+    Assert::AreEqual(0, open_table_scan(tab_entry, &scan, true));
+    select_pipeline pipeline;
+    Assert::AreEqual(0, open_select_pipeline(&plan, &scan, &pipeline));
+    batch_operator *p_sort = &pipeline.operators[pipeline.num_operators - 1];
+    row_batch *p_batch = NULL;
+    Assert::AreEqual(0, p_sort->next(p_sort, &p_batch));
+    Assert::AreEqual(5, p_batch->num_selected, L"Sorted rows");
+    std::string titles;
+    column_vector *p_titles = p_batch->columns[0];
+    for (int i = 0; i < 5; i++) {
+      titles += p_titles->string_values +
+                p_batch->selected[i] * p_titles->value_size;
+    }
+    Assert::AreEqual(std::string(expected_titles[k]), titles, L"Titles");
+    close_select_pipeline(&pipeline);
+    close_table_scan(&scan);
+  }
+  finish_table_io();
+}
+
+TEST_METHOD(SortSpillsToRuns) {
+  std::string statement = "INSERT INTO BOOK VALUES ";
+  for (int i = 0; i < 2500; i++) {
+    char values[64];
+    sprintf(values, "%s('t%d', 'x', %d, %d)", (i > 0) ? ", " : "", i % 37,
+            i % 7, i);
+    statement += values;
+  }
+  Assert::AreEqual(0, execute_statement((char *)statement.c_str(), 1));
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  select_plan plan;
+  memset(&plan, '\0', sizeof(plan));
+  init_record_layout(cd_entries, tab_entry->num_columns, &plan.layout);
+  plan.num_project_cols = 3;
+  plan.project_col_ids[0] = 0;
+  plan.project_col_ids[1] = 2;
+  plan.project_col_ids[2] = 3;
+  plan.num_order_by_cols = 2;
+  plan.order_by_col_ids[0] = 2;
+  plan.order_by_desc[0] = true;
+  plan.order_by_col_ids[1] = 0;
+  record_predicate predicate;
+  memset(&predicate, '\0', sizeof(predicate));
+  compile_predicate(&plan.layout, &predicate, &plan.where_filter);
+
+  // Each batch of the scan is spilled to a run, and equal keys keep the
+  // order of pages.
+  g_sort_memory_size = 1;
+  table_scan scan;
+  Assert::AreEqual(0, open_table_scan(tab_entry, &scan, true));
+  select_pipeline pipeline;
+  Assert::AreEqual(0, open_select_pipeline(&plan, &scan, &pipeline));
+  batch_operator *p_sort = &pipeline.operators[pipeline.num_operators - 1];
+  row_batch *p_batch = NULL;
+  int num_rows = 0;
+  std::string last_title;
+  int last_copies = 0;
+  int last_pages = -1;
+  while ((p_sort->next(p_sort, &p_batch) == 0) && p_batch) {
+    for (int i = 0; i < p_batch->num_selected; i++) {
+      int row = p_batch->selected[i];
+      std::string title(p_batch->columns[0]->string_values +
+                        row * p_batch->columns[0]->value_size);
+      int copies = p_batch->columns[2]->int_values[row];
+      int pages = p_batch->columns[3]->int_values[row];
+      if (num_rows > 0) {
+        Assert::IsTrue(
+            (copies < last_copies) ||
+                ((copies == last_copies) &&
+                 ((title > last_title) ||
+                  ((title == last_title) && (pages > last_pages)))),
+            L"Sorted rows");
+      }
+      last_title = title;
+      last_copies = copies;
+      last_pages = pages;
+      num_rows++;
+    }
+  }
+  Assert::AreEqual(2500, num_rows, L"Merged rows");
+  Assert::IsTrue(p_sort->buffer.merge.num_runs >= 3, L"Spilled runs");
+  close_select_pipeline(&pipeline);
+  close_table_scan(&scan);
+  finish_table_io();
+}
+
+TEST_METHOD(ParallelSortMatchesOneWorker) {
+  FILE *f_data = fopen("BOOK.csv", "w");
+  Assert::IsNotNull(f_data);
+  for (int i = 0; i < 100000; i++) {
+    if (i % 11 == 0) {
+      fprintf(f_data, "t%d,x,NULL,%d\n", i % 37, i);
+    } else {
+      fprintf(f_data, "t%d,x,%d,%d\n", i % 37, i % 7, i);
+    }
+  }
+  fclose(f_data);
+  Assert::AreEqual(0, execute_statement("LOAD DATA 'BOOK.csv' INTO BOOK", 1));
+  remove("BOOK.csv");
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  select_plan plan;
+  memset(&plan, '\0', sizeof(plan));
+  init_record_layout(cd_entries, tab_entry->num_columns, &plan.layout);
+  plan.num_project_cols = 3;
+  plan.project_col_ids[0] = 0;
+  plan.project_col_ids[1] = 2;
+  plan.project_col_ids[2] = 3;
+  plan.num_order_by_cols = 2;
+  plan.order_by_col_ids[0] = 2;
+  plan.order_by_col_ids[1] = 0;
+  plan.order_by_desc[1] = true;
+  record_predicate predicate;
+  memset(&predicate, '\0', sizeof(predicate));
+  compile_predicate(&plan.layout, &predicate, &plan.where_filter);
+
+  // Each sort returns its rows as "title copies pages" and its runs.
+  auto sort_rows = [&](int *p_num_runs) {
+    std::vector<std::string> rows;
+    table_scan scan;
+    Assert::AreEqual(0, open_table_scan(tab_entry, &scan, true));
+    select_pipeline pipeline;
+    Assert::AreEqual(0, open_select_pipeline(&plan, &scan, &pipeline));
+    batch_operator *p_sort = &pipeline.operators[pipeline.num_operators - 1];
+    row_batch *p_batch = NULL;
+    while ((p_sort->next(p_sort, &p_batch) == 0) && p_batch) {
+      for (int i = 0; i < p_batch->num_selected; i++) {
+        int row = p_batch->selected[i];
+        char text[64];
+        sprintf(text, "%s %d %d",
+                p_batch->columns[0]->string_values +
+                    row * p_batch->columns[0]->value_size,
+                p_batch->columns[2]->is_null[row]
+                    ? -1
+                    : p_batch->columns[2]->int_values[row],
+                p_batch->columns[3]->int_values[row]);
+        rows.push_back(text);
+      }
+    }
+    *p_num_runs = p_sort->buffer.merge.num_runs;
+    close_select_pipeline(&pipeline);
+    close_table_scan(&scan);
+    finish_table_io();
+    return rows;
+  };
+
+  int num_runs = 0;
+  g_num_worker_threads = 1;
+  std::vector<std::string> expected_rows = sort_rows(&num_runs);
+  Assert::AreEqual(100000, static_cast<int>(expected_rows.size()),
+                   L"Sorted rows");
+  Assert::AreEqual(0, num_runs, L"Sorted in memory");
+
+  // Four workers sort ranges of the rows in memory, which are merged.
+  g_num_worker_threads = 4;
+  Assert::IsTrue(expected_rows == sort_rows(&num_runs),
+                 L"Rows sorted by four workers");
+
+  // The buffer holds about 40000 rows, so each spill but the last one is
+  // split between two workers, and writes two runs.
+  g_sort_memory_size =
+      (get_sort_row_size(&plan) + 2 * sizeof(sort_entry)) * 40000;
+  Assert::IsTrue(expected_rows == sort_rows(&num_runs),
+                 L"Rows merged from the runs of several workers");
+  Assert::IsTrue(num_runs >= 5, L"Runs of several workers");
+}
+
+TEST_METHOD(GroupBySpillsPartitions) {
+  std::string statement = "INSERT INTO BOOK VALUES ";
+  int64_t total_copies = 0;
+  int num_null_copies = 0;
+  for (int i = 0; i < 2500; i++) {
+    char values[64];
+    if (i % 10 == 0) {
+      sprintf(values, "%s('t%d', 'x', NULL, %d)", (i > 0) ? ", " : "",
+              i % 37, i);
+      num_null_copies++;
+    } else {
+      sprintf(values, "%s('t%d', 'x', %d, %d)", (i > 0) ? ", " : "", i % 37,
+              i * 800000, i);
+      total_copies += static_cast<int64_t>(i) * 800000;
+    }
+    statement += values;
+  }
+  Assert::AreEqual(0, execute_statement((char *)statement.c_str(), 1));
+  Assert::AreEqual(
+      0,
+      execute_statement("SELECT title, COUNT(*), MAX(pages) FROM BOOK GROUP "
+                        "BY title HAVING SUM(copies) > 0 ORDER BY "
+                        "COUNT(*) DESC LIMIT 3",
+                        1),
+      L"Grouped SELECT");
+  Assert::AreEqual(
+      static_cast<int>(INVALID_COLUMN_NAME),
+      execute_statement("SELECT title, pages FROM BOOK GROUP BY title", 1),
+      L"Column which is not grouped");
+  Assert::AreEqual(
+      static_cast<int>(INVALID_AGGREGATE_COLUMN),
+      execute_statement("SELECT SUM(author) FROM BOOK GROUP BY title", 1),
+      L"SUM of a string");
+
+  // GROUP BY pages, with COUNT(*) and SUM(copies).
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  select_plan plan;
+  memset(&plan, '\0', sizeof(plan));
+  init_record_layout(cd_entries, tab_entry->num_columns, &plan.layout);
+  plan.num_project_cols = 2;
+  plan.project_col_ids[0] = 2;
+  plan.project_col_ids[1] = 3;
+  plan.num_group_by_cols = 1;
+  plan.group_by_col_ids[0] = 3;
+  plan.num_group_aggregates = 2;
+  plan.group_aggregates[0].function = F_COUNT;
+  plan.group_aggregates[0].col_id = -1;
+  plan.group_aggregates[1].function = F_SUM;
+  plan.group_aggregates[1].col_id = 2;
+  plan.num_grouped_cols = 3;
+  plan.grouped_cols[0].group_by_index = 0;
+  plan.grouped_cols[0].aggregate_index = -1;
+  for (int a = 0; a < 2; a++) {
+    plan.grouped_cols[a + 1].group_by_index = -1;
+    plan.grouped_cols[a + 1].aggregate_index = a;
+  }
+  select_plan group_plan;
+  memset(&group_plan, '\0', sizeof(group_plan));
+  init_group_plan(&plan, &group_plan);
+  plan.p_group_plan = &group_plan;
+  record_predicate predicate;
+  memset(&predicate, '\0', sizeof(predicate));
+  compile_predicate(&plan.layout, &predicate, &plan.where_filter);
+
+  // A few groups fit in memory, so they are spilled to partitions, which
+  // are partitioned again.
+  g_group_memory_size = 1024;
+  table_scan scan;
+  Assert::AreEqual(0, open_table_scan(tab_entry, &scan, true));
+  select_pipeline pipeline;
+  Assert::AreEqual(0, open_select_pipeline(&plan, &scan, &pipeline));
+  batch_operator *p_group = &pipeline.operators[pipeline.num_operators - 1];
+  row_batch *p_batch = NULL;
+  int num_groups = 0;
+  int num_null_sums = 0;
+  int64_t total_pages = 0;
+  int64_t total_sums = 0;
+  while ((p_group->next(p_group, &p_batch) == 0) && p_batch) {
+    for (int i = 0; i < p_batch->num_selected; i++) {
+      int row = p_batch->selected[i];
+      Assert::AreEqual(static_cast<int64_t>(1),
+                       p_batch->columns[1]->long_values[row], L"COUNT(*)");
+      total_pages += p_batch->columns[0]->long_values[row];
+      if (p_batch->columns[2]->is_null[row]) {
+        num_null_sums++;
+      } else {
+        total_sums += p_batch->columns[2]->long_values[row];
+      }
+      num_groups++;
+    }
+  }
+  Assert::AreEqual(2500, num_groups, L"Groups");
+  Assert::AreEqual(static_cast<int64_t>(2500 * 2499 / 2), total_pages,
+                   L"Keys of the groups");
+  Assert::AreEqual(num_null_copies, num_null_sums, L"SUM of NULL");
+  Assert::AreEqual(total_copies, total_sums, L"SUM(copies)");
+  Assert::IsTrue(p_group->p_groups->depth >= 2, L"Spilled partitions");
+  close_select_pipeline(&pipeline);
+  close_table_scan(&scan);
+  finish_table_io();
+}
+
+TEST_METHOD(UngroupedAggregatesInOnePass) {
+  Assert::AreEqual(
+      0,
+      execute_statement("SELECT COUNT(*), MIN(title), MAX(pages) FROM BOOK",
+                        1),
+      L"Aggregates of an empty table");
+  std::string statement = "INSERT INTO BOOK VALUES ";
+  for (int i = 1; i <= 100; i++) {
+    char values[64];
+    char title[16] = "NULL";
+    char copies[16] = "NULL";
+    if (i % 7 != 0) {
+      sprintf(title, "'t%03d'", i);
+    }
+    if (i % 10 != 0) {
+      sprintf(copies, "%d", i);
+    }
+    sprintf(values, "%s(%s, 'x', %s, %d)", (i > 1) ? ", " : "", title, copies,
+            i);
+    statement += values;
+  }
+  Assert::AreEqual(0, execute_statement((char *)statement.c_str(), 1));
+  Assert::AreEqual(
+      0,
+      execute_statement("SELECT SUM(copies), AVG(copies), COUNT(title), "
+                        "MIN(title), MAX(title), MIN(pages) FROM BOOK WHERE "
+                        "pages > 50 HAVING COUNT(*) > 1",
+                        1),
+      L"Aggregates in one SELECT");
+  Assert::AreEqual(
+      static_cast<int>(INVALID_COLUMN_NAME),
+      execute_statement("SELECT title, COUNT(*) FROM BOOK", 1),
+      L"Column without GROUP BY");
+  Assert::AreEqual(
+      static_cast<int>(INVALID_AGGREGATE_COLUMN),
+      execute_statement("SELECT COUNT(*), AVG(title) FROM BOOK", 1),
+      L"AVG of a string");
+
+  // COUNT(*), SUM(copies), AVG(copies), MIN(title) and MAX(pages) make one
+  // group without GROUP BY.
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  select_plan plan;
+  memset(&plan, '\0', sizeof(plan));
+  init_record_layout(cd_entries, tab_entry->num_columns, &plan.layout);
+  plan.num_project_cols = 3;
+  plan.project_col_ids[0] = 0;
+  plan.project_col_ids[1] = 2;
+  plan.project_col_ids[2] = 3;
+  int functions[] = {F_COUNT, F_SUM, F_AVG, F_MIN, F_MAX};
+  int col_ids[] = {-1, 2, 2, 0, 3};
+  plan.num_group_aggregates = 5;
+  plan.num_grouped_cols = 5;
+  for (int a = 0; a < 5; a++) {
+    plan.group_aggregates[a].function = functions[a];
+    plan.group_aggregates[a].col_id = col_ids[a];
+    plan.grouped_cols[a].group_by_index = -1;
+    plan.grouped_cols[a].aggregate_index = a;
+  }
+  select_plan group_plan;
+  memset(&group_plan, '\0', sizeof(group_plan));
+  init_group_plan(&plan, &group_plan);
+  plan.p_group_plan = &group_plan;
+  record_predicate predicate;
+  memset(&predicate, '\0', sizeof(predicate));
+  compile_predicate(&plan.layout, &predicate, &plan.where_filter);
+
+  table_scan scan;
+  Assert::AreEqual(0, open_table_scan(tab_entry, &scan, true));
+  select_pipeline pipeline;
+  Assert::AreEqual(0, open_select_pipeline(&plan, &scan, &pipeline));
+  batch_operator *p_group = &pipeline.operators[pipeline.num_operators - 1];
+  row_batch *p_batch = NULL;
+  Assert::AreEqual(0, p_group->next(p_group, &p_batch));
+  Assert::IsNotNull(p_batch, L"One row");
+  Assert::AreEqual(1, p_batch->num_selected, L"One row");
+  int row = p_batch->selected[0];
+  Assert::AreEqual(static_cast<int64_t>(100),
+                   p_batch->columns[0]->long_values[row], L"COUNT(*)");
+  Assert::AreEqual(static_cast<int64_t>(5050 - 550),
+                   p_batch->columns[1]->long_values[row], L"SUM(copies)");
+  Assert::AreEqual(static_cast<int64_t>(4500 / 90),
+                   p_batch->columns[2]->long_values[row], L"AVG(copies)");
+  Assert::AreEqual("t001", p_batch->columns[3]->string_values +
+                               row * p_batch->columns[3]->value_size,
+                   L"MIN(title)");
+  Assert::AreEqual(static_cast<int64_t>(100),
+                   p_batch->columns[4]->long_values[row], L"MAX(pages)");
+  Assert::AreEqual(0, p_group->next(p_group, &p_batch));
+  Assert::IsNull(p_batch, L"No other row");
+  close_select_pipeline(&pipeline);
+  close_table_scan(&scan);
+  finish_table_io();
+}
+
+TEST_METHOD(TakeMorsels) {
+  scan_pool *p_pool = new scan_pool();
+  p_pool->num_workers = 3;
+  p_pool->num_morsels = 8;
+  for (int i = 0; i < p_pool->num_workers; i++) {
+    p_pool->queue_heads[i] = 0;
+  }
+
+  // Worker 1 takes its own morsels, then those left in the queue of worker
+  // 2, then of worker 0.
+  int expected[] = {1, 4, 7, 2, 5, 0, 3, 6, -1};
+  for (int i = 0; i < 9; i++) {
+    Assert::AreEqual(expected[i], take_morsel(p_pool, 1), L"Morsel");
+  }
+  Assert::AreEqual(-1, take_morsel(p_pool, 0), L"No morsel left");
+  delete p_pool;
+}
+
+TEST_METHOD(ParallelScanMatchesOneWorker) {
+  FILE *f_data = fopen("BOOK.csv", "w");
+  Assert::IsNotNull(f_data);
+  for (int i = 0; i < 100000; i++) {
+    if (i % 13 == 0) {
+      fprintf(f_data, "NULL,x,NULL,%d\n", i);
+    } else {
+      fprintf(f_data, "t%d,x,%d,%d\n", i % 37, i % 7, i);
+    }
+  }
+  fclose(f_data);
+  Assert::AreEqual(0, execute_statement("LOAD DATA 'BOOK.csv' INTO BOOK", 1));
+  remove("BOOK.csv");
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+
+  // WHERE copies > 2, projecting title, copies and pages.
+  select_plan plan;
+  memset(&plan, '\0', sizeof(plan));
+  init_record_layout(cd_entries, tab_entry->num_columns, &plan.layout);
+  plan.num_project_cols = 3;
+  plan.project_col_ids[0] = 0;
+  plan.project_col_ids[1] = 2;
+  plan.project_col_ids[2] = 3;
+  record_predicate predicate;
+  memset(&predicate, '\0', sizeof(predicate));
+  predicate.num_conditions = 1;
+  predicate.conditions[0].col_id = 2;
+  predicate.conditions[0].op_type = S_GREATER;
+  predicate.conditions[0].value_type = FIELD_VALUE_TYPE_INT;
+  predicate.conditions[0].int_data_value = 2;
+  predicate.root = add_predicate_node(&predicate, 0, 0);
+  compile_predicate(&plan.layout, &predicate, &plan.where_filter);
+
+  // COUNT(*), SUM(copies), AVG(copies), MIN(title) and MAX(pages) of the
+  // same rows.
+  select_plan aggregate_plan = plan;
+  int functions[] = {F_COUNT, F_SUM, F_AVG, F_MIN, F_MAX};
+  int col_ids[] = {-1, 2, 2, 0, 3};
+  aggregate_plan.num_group_aggregates = 5;
+  aggregate_plan.num_grouped_cols = 5;
+  for (int a = 0; a < 5; a++) {
+    aggregate_plan.group_aggregates[a].function = functions[a];
+    aggregate_plan.group_aggregates[a].col_id = col_ids[a];
+    aggregate_plan.grouped_cols[a].group_by_index = -1;
+    aggregate_plan.grouped_cols[a].aggregate_index = a;
+  }
+  select_plan group_plan;
+  memset(&group_plan, '\0', sizeof(group_plan));
+  init_group_plan(&aggregate_plan, &group_plan);
+  aggregate_plan.p_group_plan = &group_plan;
+
+  // Each run returns its rows as text, and its number of operators.
+  auto run_plan = [&](select_plan *p_plan, std::vector<int> columns,
+                      int *p_num_operators) {
+    std::vector<std::string> rows;
+    table_scan scan;
+    Assert::AreEqual(0, open_table_scan(tab_entry, &scan, true));
+    select_pipeline pipeline;
+    Assert::AreEqual(0, open_select_pipeline(p_plan, &scan, &pipeline));
+    *p_num_operators = pipeline.num_operators;
+    batch_operator *p_last = &pipeline.operators[pipeline.num_operators - 1];
+    row_batch *p_batch = NULL;
+    while ((p_last->next(p_last, &p_batch) == 0) && p_batch) {
+      for (int i = 0; i < p_batch->num_selected; i++) {
+        int row = p_batch->selected[i];
+        std::string text;
+        for (int c : columns) {
+          column_vector *p_column = p_batch->columns[c];
+          char value[MAX_STRING_LEN + 16];
+          if (p_column->is_null[row]) {
+            strcpy(value, "NULL");
+          } else if (p_column->col_type == T_CHAR) {
+            strcpy(value, p_column->string_values + row * p_column->value_size);
+          } else if (p_column->long_values) {
+            sprintf(value, "%lld", (long long)p_column->long_values[row]);
+          } else {
+            sprintf(value, "%d", p_column->int_values[row]);
+          }
+          text += value;
+          text += "|";
+        }
+        rows.push_back(text);
+      }
+    }
+    close_select_pipeline(&pipeline);
+    close_table_scan(&scan);
+    finish_table_io();
+    return rows;
+  };
+
+  // One worker scans, filters and projects on its own operators. Four
+  // workers share the morsels of the one parallel scan operator.
+  int num_operators = 0;
+  g_num_worker_threads = 1;
+  std::vector<int> row_columns = {0, 2, 3};
+  std::vector<int> aggregate_columns = {0, 1, 2, 3, 4};
+  std::vector<std::string> expected_rows =
+      run_plan(&plan, row_columns, &num_operators);
+  Assert::AreEqual(3, num_operators, L"Operators of one worker");
+  std::vector<std::string> expected_aggregates =
+      run_plan(&aggregate_plan, aggregate_columns, &num_operators);
+  g_num_worker_threads = 4;
+  std::vector<std::string> rows =
+      run_plan(&plan, row_columns, &num_operators);
+  Assert::AreEqual(1, num_operators, L"Operators of the parallel scan");
+  Assert::IsTrue(rows.size() > 50000, L"Selected rows");
+  Assert::IsTrue(expected_rows == rows, L"Rows of four workers");
+  std::vector<std::string> aggregates =
+      run_plan(&aggregate_plan, aggregate_columns, &num_operators);
+  Assert::AreEqual(1, static_cast<int>(aggregates.size()), L"One row");
+  Assert::AreEqual(expected_aggregates[0], aggregates[0],
+                   L"Aggregates of four workers");
+}
+
+#ifndef _WIN32
+// The text a statement writes to stdout.
+std::string statement_output(const char *statement) {
+  FILE *fhandle = tmpfile();
+  Assert::IsNotNull(fhandle);
+  fflush(stdout);
+  int saved_stdout = dup(fileno(stdout));
+  dup2(fileno(fhandle), fileno(stdout));
+  int rc = execute_statement((char *)statement, 1);
+  fflush(stdout);
+  dup2(saved_stdout, fileno(stdout));
+  close(saved_stdout);
+  Assert::AreEqual(0, rc, L"Return code");
+  rewind(fhandle);
+  std::string text;
+  int c;
+  while ((c = fgetc(fhandle)) != EOF) {
+    text += (char)c;
+  }
+  fclose(fhandle);
+  // Only the table, from its first border on, is kept.
+  size_t start = text.find("\n+");
+  return (start == std::string::npos) ? "" : text.substr(start + 1);
+}
+
+TEST_METHOD(AggregateDroppedByLimitShowsTitles) {
+  Assert::AreEqual(0, execute_statement(
+                          "INSERT INTO BOOK VALUES('a', 'x', 1, 1), "
+                          "('b', 'x', 2, 2)",
+                          1));
+  Assert::AreEqual(std::string("+----------+\n"
+                               "| COUNT(*) |\n"
+                               "+----------+\n"
+                               "| 2        |\n"
+                               "+----------+\n"),
+                   statement_output("SELECT COUNT(*) FROM BOOK"));
+  // Like SELECT * with LIMIT 0, the titles are shown without any row.
+  Assert::AreEqual(std::string("+----------+\n"
+                               "| COUNT(*) |\n"
+                               "+----------+\n"
+                               "+----------+\n"),
+                   statement_output("SELECT COUNT(*) FROM BOOK LIMIT 0"),
+                   L"LIMIT 0");
+  Assert::AreEqual(std::string("+----------+-------------+\n"
+                               "| COUNT(*) | SUM(copies) |\n"
+                               "+----------+-------------+\n"
+                               "+----------+-------------+\n"),
+                   statement_output("SELECT COUNT(*), SUM(copies) FROM BOOK "
+                                    "LIMIT 1 OFFSET 1"),
+                   L"OFFSET");
+  Assert::AreEqual(std::string("+----------+\n"
+                               "| COUNT(*) |\n"
+                               "+----------+\n"
+                               "+----------+\n"),
+                   statement_output(
+                       "SELECT COUNT(*) FROM BOOK HAVING COUNT(*) > 2"),
+                   L"HAVING");
+}
+
+TEST_METHOD(GroupedAggregatesAreAsWideAsValues) {
+  Assert::AreEqual(0, execute_statement(
+                          "INSERT INTO BOOK VALUES('a', 'x', 1, 1), "
+                          "('a', 'y', 123456789, 2), ('b', 'x', NULL, 3)",
+                          1));
+  // As without GROUP BY, an aggregate column fits its title or its widest
+  // value, and the grouping columns keep the width of the table.
+  Assert::AreEqual(std::string("+------------+----------+-------------+"
+                               "-------------+\n"
+                               "| title      | COUNT(*) | SUM(copies) |"
+                               " MAX(author) |\n"
+                               "+------------+----------+-------------+"
+                               "-------------+\n"
+                               "| a          |        2 |   123456790 |"
+                               " y           |\n"
+                               "| b          |        1 |           - |"
+                               " x           |\n"
+                               "+------------+----------+-------------+"
+                               "-------------+\n"),
+                   statement_output("SELECT title, COUNT(*), SUM(copies), "
+                                    "MAX(author) FROM BOOK GROUP BY title "
+                                    "ORDER BY title"));
+  Assert::AreEqual(std::string("+------------+----------+\n"
+                               "| title      | COUNT(*) |\n"
+                               "+------------+----------+\n"
+                               "+------------+----------+\n"),
+                   statement_output("SELECT title, COUNT(*) FROM BOOK "
+                                    "GROUP BY title LIMIT 0"),
+                   L"LIMIT 0");
+}
+#endif
+
+TEST_METHOD(LimitAndOffset) {
+  Assert::AreEqual(0, execute_statement(
+                          "INSERT INTO BOOK VALUES('c', 'x', 1, 1), "
+                          "('a', 'x', NULL, 2), ('b', 'x', 1, 3), "
+                          "('d', 'x', NULL, 4), ('e', 'x', 2, 5)",
+                          1));
+  Assert::AreEqual(
+      0,
+      execute_statement(
+          "SELECT * FROM BOOK ORDER BY title DESC LIMIT 2 OFFSET 1", 1),
+      L"LIMIT with ORDER BY");
+  Assert::AreEqual(
+      static_cast<int>(INVALID_VALUE),
+      execute_statement("SELECT * FROM BOOK LIMIT 'a'", 1),
+      L"LIMIT of a string");
+  tpd_entry *tab_entry = get_tpd_from_list("BOOK");
+  cd_entry *cd_entries = NULL;
+  get_cd_entries(tab_entry, &cd_entries);
+  select_plan plan;
+  memset(&plan, '\0', sizeof(plan));
+  init_record_layout(cd_entries, tab_entry->num_columns, &plan.layout);
+  plan.num_project_cols = 2;
+  plan.project_col_ids[0] = 0;
+  plan.project_col_ids[1] = 2;
+  plan.has_limit = true;
+  plan.limit = 2;
+  plan.offset = 1;
+
+  // The top rows of copies DESC, title are kept in a heap, and without
+  // ORDER BY the limit returns rows in scan order.
+  const char *expected_titles[2] = {"bc", "ab"};
+  for (int k = 0; k < 2; k++) {
+    plan.num_order_by_cols = (k == 0) ? 2 : 0;
+    plan.order_by_col_ids[0] = 2;
+    plan.order_by_desc[0] = true;
+    plan.order_by_col_ids[1] = 0;
+    record_predicate predicate;
+    memset(&predicate, '\0', sizeof(predicate));
+    compile_predicate(&plan.layout, &predicate, &plan.where_filter);
+    table_scan scan;
+    Assert::AreEqual(0, open_table_scan(tab_entry, &scan, true));
+    select_pipeline pipeline;
+    Assert::AreEqual(0, open_select_pipeline(&plan, &scan, &pipeline));
+    Assert::AreEqual(4, pipeline.num_operators, L"Number of operators");
+    batch_operator *p_last = &pipeline.operators[pipeline.num_operators - 1];
+    row_batch *p_batch = NULL;
+    Assert::AreEqual(0, p_last->next(p_last, &p_batch));
+    Assert::AreEqual(2, p_batch->num_selected, L"Limited rows");
+    std::string titles;
+    column_vector *p_titles = p_batch->columns[0];
+    for (int i = 0; i < 2; i++) {
+      titles += p_titles->string_values +
+                p_batch->selected[i] * p_titles->value_size;
+    }
+    Assert::AreEqual(std::string(expected_titles[k]), titles, L"Titles");
+    Assert::AreEqual(0, p_last->next(p_last, &p_batch));
+    Assert::IsTrue(p_batch == NULL, L"End of the rows");
+    close_select_pipeline(&pipeline);
+    close_table_scan(&scan);
+  }
+  finish_table_io();
+}
+}
+;
+
 TEST_CLASS(LogTest) {public : BEGIN_TEST_CLASS_ATTRIBUTE() TEST_CLASS_ATTRIBUTE(
     L"Descrioption",
     L"Tests to log original DDL/DML statement within double quotes.")
@@ -420,4 +2434,252 @@ TEST_METHOD(BackupStatement) {
 }
 }
 ;
+
+TEST_CLASS(ScriptTest) {
+  public : BEGIN_TEST_CLASS_ATTRIBUTE()
+  TEST_CLASS_ATTRIBUTE(L"Descrioption", L"Tests to run scripts.")
+  END_TEST_CLASS_ATTRIBUTE()
+  TEST_METHOD_INITIALIZE(MethodInitialize) {remove(kDbFile);
+remove("BOOK.tab");
+remove(kDbLogFile);
+remove("backup_img");
+}
+
+// A failed Assert must not leave the modes of a script to the next tests.
+TEST_METHOD_CLEANUP(MethodFinalize) {
+  discard_pending_log();
+  free_buffer_pool();
+  invalidate_resident_tpd_list();
+  g_deferred_writes = false;
+  g_resident_mode = false;
+}
+
+int run_script_text(const char *text) {
+  FILE *fhandle = tmpfile();
+  Assert::IsNotNull(fhandle);
+  fputs(text, fhandle);
+  rewind(fhandle);
+  int rc = run_script(fhandle);
+  fclose(fhandle);
+  return rc;
+}
+
+table_file_header read_table_header(const char *filename) {
+  table_file_header tab_header;
+  memset(&tab_header, '\0', sizeof(tab_header));
+  FILE *f_table = fopen(filename, "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  fclose(f_table);
+  return tab_header;
+}
+
+int count_log_lines() {
+  std::ifstream input(kDbLogFile);
+  std::string line;
+  int num_lines = 0;
+  while (std::getline(input, line)) {
+    num_lines++;
+  }
+  return num_lines;
+}
+
+TEST_METHOD(StatementsSpanLinesAndTabs) {
+  Assert::AreEqual(0, run_script_text(
+                          "CREATE TABLE BOOK(title char(20) NOT NULL,\n"
+                          "\tcopies int);\n"
+                          "INSERT INTO BOOK\r\n  VALUES('A;\tB', 1);"
+                          "INSERT\tINTO BOOK VALUES('C', 2)\n\n"),
+                   L"Return code");
+  Assert::AreEqual(2, static_cast<int>(read_table_header("BOOK.tab")
+                                           .num_records),
+                   L"Number of records");
+  Assert::AreEqual(3, count_log_lines(), L"Log lines count");
+
+  // The ';' and the tab of the string literal are kept.
+  std::ifstream input(kDbLogFile);
+  std::string line;
+  std::getline(input, line);
+  std::getline(input, line);
+  Assert::AreEqual(std::string("INSERT INTO BOOK    VALUES('A;\tB', 1)"),
+                   line.substr(16, line.size() - 17), L"Logged statement");
+}
+
+TEST_METHOD(SyncWritesDeferredChanges) {
+  Assert::AreEqual(
+      0, execute_statement("CREATE TABLE BOOK(title char(20), copies int)", 1),
+      L"Return code");
+  g_resident_mode = true;
+  g_deferred_writes = true;
+  Assert::AreEqual(
+      0, execute_statement("INSERT INTO BOOK VALUES('A', 1), ('B', 2)", 1),
+      L"Return code");
+
+  // Neither the rows nor their log record are written before SYNC.
+  Assert::AreEqual(0, static_cast<int>(read_table_header("BOOK.tab")
+                                           .num_records),
+                   L"Number of records before SYNC");
+  Assert::AreEqual(1, count_log_lines(), L"Log lines before SYNC");
+  Assert::AreEqual(0, execute_statement("SYNC", 1), L"Return code");
+  Assert::AreEqual(2, static_cast<int>(read_table_header("BOOK.tab")
+                                           .num_records),
+                   L"Number of records after SYNC");
+  Assert::AreEqual(2, count_log_lines(), L"Log lines after SYNC");
+}
+
+TEST_METHOD(BackupSeesDeferredRows) {
+  // The image is taken after the rows are inserted and before they are
+  // deleted, so restoring it brings them back.
+  Assert::AreEqual(0, run_script_text(
+                          "CREATE TABLE BOOK(title char(20), copies int);\n"
+                          "INSERT INTO BOOK VALUES('A', 1);\n"
+                          "INSERT INTO BOOK VALUES('B', 2);\n"
+                          "BACKUP TO backup_img;\n"
+                          "DELETE FROM BOOK;\n"
+                          "RESTORE FROM backup_img WITHOUT RF;\n"),
+                   L"Return code");
+  Assert::AreEqual(2, static_cast<int>(read_table_header("BOOK.tab")
+                                           .num_records),
+                   L"Number of records");
+}
+}
+;
+
+TEST_CLASS(ServerTest) {
+  public : BEGIN_TEST_CLASS_ATTRIBUTE()
+  TEST_CLASS_ATTRIBUTE(L"Descrioption", L"Tests of the resident server.")
+  END_TEST_CLASS_ATTRIBUTE()
+  TEST_METHOD_INITIALIZE(MethodInitialize) {remove(kDbFile);
+remove("BOOK.tab");
+remove(kDbLogFile);
+Assert::AreEqual(
+    0, execute_statement("CREATE TABLE BOOK(title char(20), copies int)", 1),
+    L"Return code.");
+}
+
+TEST_METHOD_CLEANUP(MethodFinalize) {
+  free_buffer_pool();
+  invalidate_resident_tpd_list();
+  g_resident_mode = false;
+}
+
+TEST_METHOD(ResidentPagesReloadAfterFileChange) {
+  Assert::AreEqual(
+      0, execute_statement("INSERT INTO BOOK VALUES('A', 1)", 1),
+      L"Return code");
+  std::ifstream input("BOOK.tab", std::ios::binary);
+  std::string one_record((std::istreambuf_iterator<char>(input)),
+                         std::istreambuf_iterator<char>());
+  input.close();
+  Assert::AreEqual(
+      0, execute_statement("INSERT INTO BOOK VALUES('B', 2)", 1),
+      L"Return code");
+
+  // The pages read by a resident statement are kept for the next one.
+  g_resident_mode = true;
+  Assert::AreEqual(0, execute_statement("SELECT * FROM BOOK", 1),
+                   L"Return code");
+  table_file *file = find_table_file("BOOK");
+  Assert::IsNotNull(file, L"Resident table file");
+  Assert::AreEqual(2, static_cast<int>(file->header.num_records),
+                   L"Resident number of records");
+
+  // Another process replaces the file with its one record version.
+  std::ofstream output("BOOK.tab.new", std::ios::binary);
+  output.write(one_record.data(), one_record.size());
+  output.close();
+  remove("BOOK.tab");
+  Assert::AreEqual(0, rename("BOOK.tab.new", "BOOK.tab"), L"Rename");
+
+  Assert::AreEqual(0, refresh_resident_tpd_list(), L"Return code");
+  Assert::AreEqual(0, open_table_file(get_tpd_from_list("BOOK"), &file),
+                   L"Return code");
+  Assert::AreEqual(1, static_cast<int>(file->header.num_records),
+                   L"Number of records after the change");
+  Assert::AreEqual(0, finish_table_io(), L"Return code");
+}
+
+#ifndef _WIN32
+// Reads what the server sent on fd without waiting.
+std::string read_response(int fd) {
+  std::string response;
+  char buffer[4096];
+  ssize_t num_bytes = 0;
+  while ((num_bytes = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+    response.append(buffer, num_bytes);
+  }
+  return response;
+}
+
+TEST_METHOD(ReadClientStatementsSplitsLines) {
+  int fds[2];
+  Assert::AreEqual(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  server_client client;
+  memset(&client, '\0', sizeof(client));
+  client.fd = fds[0];
+
+  // A statement split over two reads runs once its line-feed arrives, and
+  // a CR LF ends a line like a line-feed.
+  const char *first = "INSERT INTO BOOK VALUES('A', 1)\r\nINSERT INTO BO";
+  const char *second = "OK VALUES('B', 2)\n\nSELECT * FROM BOOK\n";
+  Assert::IsTrue(write(fds[1], first, strlen(first)) > 0);
+  Assert::AreEqual(0, read_client_statements(&client), L"Return code");
+  std::string response = read_response(fds[1]);
+  Assert::AreEqual(1, static_cast<int>(std::count(response.begin(),
+                                                  response.end(), '\0')),
+                   L"Responses to the first read");
+  Assert::AreEqual(std::string("INSERT INTO BO"), std::string(client.buffer),
+                   L"Incomplete line");
+
+  Assert::IsTrue(write(fds[1], second, strlen(second)) > 0);
+  Assert::AreEqual(0, read_client_statements(&client), L"Return code");
+  response = read_response(fds[1]);
+  Assert::AreEqual(2, static_cast<int>(std::count(response.begin(),
+                                                  response.end(), '\0')),
+                   L"Responses to the second read");
+  Assert::IsTrue(response.find("| B ") != std::string::npos, L"Row B");
+  Assert::AreEqual(0, client.length, L"Nothing left");
+
+  table_file_header tab_header;
+  FILE *f_table = fopen("BOOK.tab", "rb");
+  Assert::IsNotNull(f_table);
+  fread(&tab_header, sizeof(table_file_header), 1, f_table);
+  fclose(f_table);
+  Assert::AreEqual(2, static_cast<int>(tab_header.num_records),
+                   L"Number of records");
+  close(fds[0]);
+  close(fds[1]);
+  free(client.buffer);
+}
+
+TEST_METHOD(ReadClientStatementsCapsLineLength) {
+  int fds[2];
+  Assert::AreEqual(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  server_client client;
+  memset(&client, '\0', sizeof(client));
+  client.fd = fds[0];
+
+  // A line which never ends is refused once it passes the limit.
+  std::string chunk(4096, 'x');
+  int rc = 0;
+  int num_bytes = 0;
+  while (!rc && (num_bytes < 8 * 1024 * 1024)) {
+    Assert::AreEqual(static_cast<int>(chunk.size()),
+                     static_cast<int>(write(fds[1], chunk.data(),
+                                            chunk.size())));
+    num_bytes += (int)chunk.size();
+    rc = read_client_statements(&client);
+  }
+  Assert::AreEqual(static_cast<int>(STATEMENT_TOO_LONG), rc, L"Return code");
+  Assert::IsTrue(num_bytes <= 4 * 1024 * 1024 + 4096, L"Bytes read");
+  std::string response = read_response(fds[1]);
+  Assert::IsTrue(response.find("Error") == 0, L"Error message");
+  Assert::AreEqual('\0', response[response.size() - 1], L"Terminator");
+  close(fds[0]);
+  close(fds[1]);
+  free(client.buffer);
+}
+#endif
+}
+;
 }